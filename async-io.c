@@ -0,0 +1,381 @@
+/****************************************************************************
+ *
+ * async-io.c -- Sequential file I/O overlapped with computation
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/* O_DIRECT is not part of POSIX */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "async-io.h"
+
+/* Minimum size and number of the chunks of the ring; the size is a
+   multiple of the alignment required by O_DIRECT */
+#define ASYNC_CHUNK (1 << 20)
+#define ASYNC_NCHUNKS 4
+#define ASYNC_ALIGN 4096
+
+struct async_file {
+    int fd;
+    int write;          /* nonzero if the file is open for writing */
+    int threaded;       /* nonzero if there is an I/O thread */
+    int direct;         /* nonzero if the file has been opened with O_DIRECT */
+    char *buf;          /* ASYNC_NCHUNKS chunks of `chunk` bytes */
+    size_t chunk;       /* size of each chunk */
+    size_t len[ASYNC_NCHUNKS]; /* bytes in each chunk */
+    int full[ASYNC_NCHUNKS];   /* nonzero if the chunk is ready for the
+                                  caller (reading) or the I/O thread
+                                  (writing) */
+    int head;           /* chunk used by the caller */
+    size_t pos;         /* position of the caller within chunk `head` */
+    int tail;           /* chunk used by the I/O thread */
+    int stop;           /* the I/O thread must terminate */
+    int error;          /* errno of the first failed read() or write() */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    async_stats_t stats;
+};
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Read up to `n` bytes, stopping only at the end of the file or on
+   error; return the number of bytes read, or -1 on error */
+static ssize_t read_fully( int fd, char *buf, size_t n )
+{
+    size_t done = 0;
+    while (done < n) {
+        const ssize_t r = read(fd, buf + done, n - done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return -1;
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+/* Write `n` bytes; return 0 on success, -1 on error */
+static int write_fully( int fd, const char *buf, size_t n )
+{
+    size_t done = 0;
+    while (done < n) {
+        const ssize_t r = write(fd, buf + done, n - done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return -1;
+        done += r;
+    }
+    return 0;
+}
+
+/* Return the size of the chunks of a ring that holds `ahead` bytes
+   besides the chunk used by the caller */
+static size_t chunk_size( size_t ahead )
+{
+    const size_t per_chunk = (ahead + ASYNC_NCHUNKS - 2) / (ASYNC_NCHUNKS - 1);
+    const size_t aligned = (per_chunk + ASYNC_ALIGN - 1) / ASYNC_ALIGN * ASYNC_ALIGN;
+    return (aligned > ASYNC_CHUNK ? aligned : ASYNC_CHUNK);
+}
+
+size_t async_ring_size( size_t ahead )
+{
+    return ASYNC_NCHUNKS * chunk_size(ahead);
+}
+
+static char *chunk( async_file_t *f, int i )
+{
+    return f->buf + (size_t)i * f->chunk;
+}
+
+/* Body of the I/O thread of a file open for reading: fill the free
+   chunks in order, until the end of the file */
+static void *reader( void *arg )
+{
+    async_file_t *f = (async_file_t*)arg;
+    int eof = 0;
+    while (!eof) {
+        pthread_mutex_lock(&f->lock);
+        while (f->full[f->tail] && !f->stop)
+            pthread_cond_wait(&f->cond, &f->lock);
+        const int stop = f->stop;
+        pthread_mutex_unlock(&f->lock);
+        if (stop)
+            break;
+
+        const double t0 = now();
+        const ssize_t n = read_fully(f->fd, chunk(f, f->tail), f->chunk);
+        const int err = errno;
+        f->stats.busy += now() - t0;
+
+        pthread_mutex_lock(&f->lock);
+        if (n < 0 && f->error == 0)
+            f->error = err;
+        /* a chunk that is not full is the last one */
+        f->len[f->tail] = (n > 0 ? n : 0);
+        f->full[f->tail] = 1;
+        eof = (f->len[f->tail] < f->chunk);
+        f->tail = (f->tail + 1) % ASYNC_NCHUNKS;
+        pthread_cond_broadcast(&f->cond);
+        pthread_mutex_unlock(&f->lock);
+    }
+    return NULL;
+}
+
+/* Write chunk `i`; the last chunk of a file open with O_DIRECT may not
+   have the required size, and is written through the page cache */
+static int write_chunk( async_file_t *f, int i )
+{
+    if (f->direct && f->len[i] % ASYNC_ALIGN != 0) {
+        fcntl(f->fd, F_SETFL, fcntl(f->fd, F_GETFL) & ~O_DIRECT);
+        f->direct = 0;
+    }
+    return write_fully(f->fd, chunk(f, i), f->len[i]);
+}
+
+/* Body of the I/O thread of a file open for writing: write the full
+   chunks in order, until the file is closed */
+static void *writer( void *arg )
+{
+    async_file_t *f = (async_file_t*)arg;
+    for (;;) {
+        pthread_mutex_lock(&f->lock);
+        while (!f->full[f->tail] && !f->stop)
+            pthread_cond_wait(&f->cond, &f->lock);
+        const int done = !f->full[f->tail];
+        const int failed = (f->error != 0);
+        pthread_mutex_unlock(&f->lock);
+        if (done)
+            break;
+
+        /* after an error, the chunks are discarded, so that the
+           caller is never blocked */
+        if (!failed) {
+            const double t0 = now();
+            const int status = write_chunk(f, f->tail);
+            const int err = errno;
+            f->stats.busy += now() - t0;
+            if (status != 0) {
+                pthread_mutex_lock(&f->lock);
+                f->error = err;
+                pthread_mutex_unlock(&f->lock);
+            }
+        }
+
+        pthread_mutex_lock(&f->lock);
+        f->full[f->tail] = 0;
+        f->tail = (f->tail + 1) % ASYNC_NCHUNKS;
+        pthread_cond_broadcast(&f->cond);
+        pthread_mutex_unlock(&f->lock);
+    }
+    return NULL;
+}
+
+async_file_t *async_open( const char *fname, int write, int flags, size_t ahead )
+{
+    async_file_t *f = (async_file_t*)calloc(1, sizeof(*f));
+    if (f == NULL)
+        return NULL;
+    f->write = write;
+    f->threaded = (flags & (ASYNC_THREAD | ASYNC_DIRECT)) != 0;
+    f->chunk = chunk_size(ahead);
+
+    if (strcmp(fname, "-") == 0) {
+        f->fd = (write ? STDOUT_FILENO : STDIN_FILENO);
+    } else {
+        const int mode = (write ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY);
+        f->fd = -1;
+        if (flags & ASYNC_DIRECT) {
+            f->fd = open(fname, mode | O_DIRECT, 0666);
+            f->direct = (f->fd >= 0);
+        }
+        /* O_DIRECT is not supported by all file systems */
+        if (f->fd < 0)
+            f->fd = open(fname, mode, 0666);
+        if (f->fd < 0) {
+            free(f);
+            return NULL;
+        }
+    }
+
+    if (f->threaded) {
+        void *buf;
+        int err = posix_memalign(&buf, ASYNC_ALIGN, async_ring_size(ahead));
+        if (err == 0) {
+            f->buf = (char*)buf;
+            pthread_mutex_init(&f->lock, NULL);
+            pthread_cond_init(&f->cond, NULL);
+            err = pthread_create(&f->thread, NULL, write ? writer : reader, f);
+        }
+        if (err != 0) {
+            free(f->buf);
+            if (f->fd > STDERR_FILENO)
+                close(f->fd);
+            free(f);
+            errno = err;
+            return NULL;
+        }
+    }
+    return f;
+}
+
+int async_is_direct( const async_file_t *f )
+{
+    return f->direct;
+}
+
+size_t async_read( async_file_t *f, void *buf, size_t n )
+{
+    char *dst = (char*)buf;
+    size_t done = 0;
+
+    if (!f->threaded) {
+        const double t0 = now();
+        const ssize_t r = read_fully(f->fd, dst, n);
+        if (r < 0 && f->error == 0)
+            f->error = errno;
+        const double elapsed = now() - t0;
+        f->stats.busy += elapsed;
+        f->stats.wait += elapsed;
+        return (r > 0 ? r : 0);
+    }
+
+    while (done < n) {
+        pthread_mutex_lock(&f->lock);
+        if (!f->full[f->head]) {
+            const double t0 = now();
+            while (!f->full[f->head])
+                pthread_cond_wait(&f->cond, &f->lock);
+            f->stats.wait += now() - t0;
+        }
+        const size_t len = f->len[f->head];
+        pthread_mutex_unlock(&f->lock);
+
+        if (f->pos == len && len < f->chunk)
+            break; /* end of file */
+        const size_t k = (len - f->pos < n - done ? len - f->pos : n - done);
+        memcpy(dst + done, chunk(f, f->head) + f->pos, k);
+        done += k;
+        f->pos += k;
+        if (f->pos == f->chunk) {
+            pthread_mutex_lock(&f->lock);
+            f->full[f->head] = 0;
+            f->head = (f->head + 1) % ASYNC_NCHUNKS;
+            f->pos = 0;
+            pthread_cond_broadcast(&f->cond);
+            pthread_mutex_unlock(&f->lock);
+        }
+    }
+    return done;
+}
+
+/* Hand chunk `head`, holding `pos` bytes, to the I/O thread */
+static void flush_chunk( async_file_t *f )
+{
+    pthread_mutex_lock(&f->lock);
+    f->len[f->head] = f->pos;
+    f->full[f->head] = 1;
+    f->head = (f->head + 1) % ASYNC_NCHUNKS;
+    f->pos = 0;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+}
+
+void async_write( async_file_t *f, const void *buf, size_t n )
+{
+    const char *src = (const char*)buf;
+    size_t done = 0;
+
+    if (!f->threaded) {
+        const double t0 = now();
+        if (write_fully(f->fd, src, n) != 0 && f->error == 0)
+            f->error = errno;
+        const double elapsed = now() - t0;
+        f->stats.busy += elapsed;
+        f->stats.wait += elapsed;
+        return;
+    }
+
+    while (done < n) {
+        if (f->pos == 0) {
+            /* wait until the I/O thread has written the chunk */
+            pthread_mutex_lock(&f->lock);
+            if (f->full[f->head]) {
+                const double t0 = now();
+                while (f->full[f->head])
+                    pthread_cond_wait(&f->cond, &f->lock);
+                f->stats.wait += now() - t0;
+            }
+            pthread_mutex_unlock(&f->lock);
+        }
+        const size_t k = (f->chunk - f->pos < n - done ? f->chunk - f->pos : n - done);
+        memcpy(chunk(f, f->head) + f->pos, src + done, k);
+        done += k;
+        f->pos += k;
+        if (f->pos == f->chunk)
+            flush_chunk(f);
+    }
+}
+
+int async_close( async_file_t *f, async_stats_t *stats )
+{
+    if (f->threaded) {
+        /* async_write() has made sure that chunk `head` is free */
+        if (f->write && f->pos > 0)
+            flush_chunk(f);
+        pthread_mutex_lock(&f->lock);
+        f->stop = 1;
+        pthread_cond_broadcast(&f->cond);
+        pthread_mutex_unlock(&f->lock);
+        /* the writer terminates after the last full chunk */
+        const double t0 = now();
+        pthread_join(f->thread, NULL);
+        if (f->write)
+            f->stats.wait += now() - t0;
+        pthread_mutex_destroy(&f->lock);
+        pthread_cond_destroy(&f->cond);
+        free(f->buf);
+    }
+    if (f->fd > STDERR_FILENO)
+        close(f->fd);
+    if (stats != NULL) {
+        stats->busy += f->stats.busy;
+        stats->wait += f->stats.wait;
+    }
+    const int err = f->error;
+    free(f);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/****************************************************************************
+ *
+ * async-io.h -- Sequential file I/O overlapped with computation
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Images are read and written sequentially. With ASYNC_THREAD, a
+ * dedicated I/O thread moves the data between the file and a ring of
+ * ASYNC_NCHUNKS chunks: when reading, the thread fills the chunks ahead
+ * of the caller, so that the next rows are already in memory when they
+ * are needed; when writing, the caller copies the data into a chunk and
+ * returns immediately, while the thread writes the chunks that are
+ * full. The I/O thread therefore works while the OpenMP threads compute
+ * the median of the previous (or next) band of rows, provided that the
+ * ring is large enough to hold a whole band: its size is chosen when
+ * the file is opened.
+ *
+ * With ASYNC_DIRECT, the file is opened with O_DIRECT, bypassing the
+ * page cache; this avoids evicting useful pages when huge images are
+ * read and written once. The chunks are aligned as O_DIRECT requires.
+ * If the file system does not support O_DIRECT, the page cache is
+ * used.
+ *
+ * Without flags, reads and writes are performed synchronously, directly
+ * from and to the caller's buffer.
+ */
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stddef.h>
+
+enum {
+    ASYNC_THREAD = 1,   /* overlap I/O with the caller, see above */
+    ASYNC_DIRECT = 2    /* bypass the page cache (implies ASYNC_THREAD) */
+};
+
+/* Time spent in I/O: `busy` is the time spent in read() and write(),
+   `wait` the part of it during which the caller was blocked; the
+   difference has been hidden behind the computation */
+typedef struct {
+    double busy;
+    double wait;
+} async_stats_t;
+
+typedef struct async_file async_file_t;
+
+/* Open file `fname` for reading (`write` == 0) or writing; "-" is the
+   standard input or output. `flags` is a combination of the ASYNC_xxx
+   constants; with an I/O thread, the ring holds at least `ahead` bytes
+   besides the chunk used by the caller, that the thread reads before
+   they are requested, or writes after async_write() has returned (0
+   selects the smallest ring). Return NULL on failure, with errno set
+   to the cause. */
+async_file_t *async_open( const char *fname, int write, int flags, size_t ahead );
+
+/* Return the memory taken by the ring of a file opened with an I/O
+   thread and `ahead` bytes, see async_open() */
+size_t async_ring_size( size_t ahead );
+
+/* Return nonzero if `f` bypasses the page cache */
+int async_is_direct( const async_file_t *f );
+
+/* Read the next `n` bytes of `f` into `buf`; return the number of
+   bytes read, that is less than `n` at the end of the file or on
+   error */
+size_t async_read( async_file_t *f, void *buf, size_t n );
+
+/* Append `n` bytes from `buf` to `f` */
+void async_write( async_file_t *f, const void *buf, size_t n );
+
+/* Wait for the pending writes, if any, and close `f`; the time spent in
+   I/O is added to `*stats`, if not NULL. Return 0 on success, -1 if
+   a read or write failed, with errno set to the cause. */
+int async_close( async_file_t *f, async_stats_t *stats );
+
+#endif
@@ -0,0 +1,433 @@
+/****************************************************************************
+ *
+ * autotune.c -- Choose the fastest algorithm for a job from measurements
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#if _XOPEN_SOURCE < 600
+#define _XOPEN_SOURCE 600
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <omp.h>
+#include "common.h"
+#include "keys.h"
+#include "median-plan.h"
+#include "autotune.h"
+
+/* The brute-force algorithm is only a candidate for small windows */
+#define TUNE_SMALL_RADIUS 2
+
+/* The configurations are measured on the first TUNE_ROWS rows of the
+   image (or more, if the window is taller), and the time is scaled to
+   the whole image */
+#define TUNE_ROWS 256
+
+/* Each configuration is executed up to TUNE_REPS times, unless an
+   execution takes more than TUNE_MAX_SECONDS, and the best time is
+   kept */
+#define TUNE_REPS 3
+#define TUNE_MAX_SECONDS 1.0
+
+const char *wisdom_default_path( void )
+{
+    static char path[4096];
+    const char *env = getenv("MEDIAN_FILTER_WISDOM");
+    const char *home = getenv("HOME");
+    if (env != NULL && env[0] != '\0')
+        return env;
+    if (home == NULL || home[0] == '\0')
+        return ".median-filter-wisdom";
+    snprintf(path, sizeof(path), "%s/.median-filter-wisdom", home);
+    return path;
+}
+
+static int wisdom_append( wisdom_t *w, const wisdom_entry_t *e )
+{
+    if (w->n == w->capacity) {
+        const size_t capacity = (w->capacity > 0 ? 2 * w->capacity : 64);
+        wisdom_entry_t *entries = (wisdom_entry_t*)realloc(w->entries, capacity * sizeof(*entries));
+        if (entries == NULL)
+            return -1;
+        w->entries = entries;
+        w->capacity = capacity;
+    }
+    w->entries[w->n++] = *e;
+    return 0;
+}
+
+int wisdom_load( wisdom_t *w, const char *path, char *err, size_t errlen )
+{
+    char line[256];
+    int lineno = 0;
+
+    w->entries = NULL;
+    w->n = w->capacity = 0;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        snprintf(err, errlen, "%s", strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        wisdom_entry_t e;
+        char extra;
+        lineno++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#')
+            continue;
+        if (sscanf(line, "%d %d %d %d %d %d %d %d %d %31s %d %lf %c",
+                   &e.shape.width, &e.shape.height, &e.shape.channels, &e.shape.bpp, &e.shape.bits,
+                   &e.shape.radius, &e.shape.dilation, &e.shape.stride, &e.shape.postop,
+                   e.algo, &e.threads, &e.seconds, &extra) != 12 ||
+            e.shape.width < 1 || e.shape.height < 1 || e.shape.channels < 1 ||
+            e.shape.bits < 1 || e.shape.bits > e.shape.bpp ||
+            e.shape.radius < 0 || e.shape.dilation < 1 || e.shape.stride < 1 ||
+            e.shape.postop < POSTOP_NONE || e.shape.postop > POSTOP_MASK ||
+            e.threads < 1 || !(e.seconds > 0.0)) {
+            snprintf(err, errlen, "line %d is not valid", lineno);
+            fclose(f);
+            wisdom_free(w);
+            return -1;
+        }
+        if (wisdom_append(w, &e) != 0) {
+            snprintf(err, errlen, "%s", strerror(ENOMEM));
+            fclose(f);
+            wisdom_free(w);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+int wisdom_save( const wisdom_t *w, const char *path, char *err, size_t errlen )
+{
+    /* The new wisdom replaces the file atomically, so that concurrent
+       readers see either version */
+    char tmp[4096 + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) {
+        snprintf(err, errlen, "%s", strerror(errno));
+        return -1;
+    }
+    fprintf(f, "# median-filter wisdom: width height channels bpp bits radius dilation stride postop algorithm threads seconds\n");
+    for (size_t i=0; i<w->n; i++) {
+        const wisdom_entry_t *e = &w->entries[i];
+        fprintf(f, "%d %d %d %d %d %d %d %d %d %s %d %.6g\n",
+                e->shape.width, e->shape.height, e->shape.channels, e->shape.bpp, e->shape.bits,
+                e->shape.radius, e->shape.dilation, e->shape.stride, e->shape.postop,
+                e->algo, e->threads, e->seconds);
+    }
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        snprintf(err, errlen, "%s", strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void wisdom_free( wisdom_t *w )
+{
+    free(w->entries);
+    w->entries = NULL;
+    w->n = w->capacity = 0;
+}
+
+/* Return nonzero if the times measured on `a` can predict those on
+   `b`, i.e., they differ at most in the geometry and radius */
+static int same_work( const tune_shape_t *a, const tune_shape_t *b )
+{
+    return (a->bpp == b->bpp && a->bits == b->bits && a->dilation == b->dilation &&
+            a->stride == b->stride && a->postop == b->postop);
+}
+
+static int same_shape( const tune_shape_t *a, const tune_shape_t *b )
+{
+    return (a->width == b->width && a->height == b->height && a->channels == b->channels &&
+            a->radius == b->radius && same_work(a, b));
+}
+
+/* Return nonzero if algorithm `a` can be chosen for `shape` and
+   `opts`; only exact algorithms that compute the median of each
+   channel are candidates */
+static int candidate( const median_filter_algo_info_t *a, const tune_shape_t *shape,
+                      const median_filter_opts_t *opts )
+{
+    char err[256], type[8];
+    snprintf(type, sizeof(type), "u%d", shape->bpp);
+    const value_type_t *t = value_type_find(type);
+
+    if (a->bound.u8 != NULL ||
+        a->fun.u8 == median_filter_2D_vector_l1_u8 ||
+        a->fun.u8 == median_filter_2D_vector_l2_u8 ||
+        a->fun.u8 == median_filter_2D_vector_reference_l1_u8 ||
+        a->fun.u8 == median_filter_2D_vector_reference_l2_u8)
+        return 0;
+    if (a->fun.u8 == median_filter_2D_reference_u8 && shape->radius > TUNE_SMALL_RADIUS)
+        return 0;
+    if (a->fun.u8 == cuda_median_2D_hist_generic_u8 && !cuda_median_available_u8())
+        return 0;
+    return (t != NULL && median_filter_check(&a->fun, t, opts, err, sizeof(err)) == 0);
+}
+
+/* Return the time to filter an image of shape `shape` with algorithm
+   `a` and `threads` threads, measured on its first `rows` rows `in`;
+   return -1 if the algorithm can not be executed */
+static double measure( const median_filter_algo_info_t *a, int threads, const tune_shape_t *shape,
+                       int rows, const median_filter_opts_t *opts, const void *in, void *out )
+{
+    char err[256], type[8];
+    snprintf(type, sizeof(type), "u%d", shape->bpp);
+
+    /* the plan runs with the threads of its creation */
+    const int saved = omp_get_max_threads();
+    omp_set_num_threads(threads);
+    median_filter_plan_t *plan = median_filter_plan_create(a->name, type, shape->width, rows, shape->radius,
+                                                           opts, err, sizeof(err));
+    omp_set_num_threads(saved);
+    if (plan == NULL)
+        return -1.0;
+    double best = -1.0;
+    for (int i=0; i<TUNE_REPS; i++) {
+        const double tstart = omp_get_wtime();
+        if (median_filter_execute(plan, in, out) != 0)
+            break;
+        const double elapsed = omp_get_wtime() - tstart;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+        if (elapsed > TUNE_MAX_SECONDS)
+            break;
+    }
+    median_filter_plan_destroy(plan);
+    return (best < 0 ? -1.0 : best * shape->height / rows);
+}
+
+int autotune( wisdom_t *w, const tune_shape_t *shape, const median_filter_opts_t *opts, FILE *log )
+{
+    median_filter_opts_t o = *opts;
+    o.dilation = shape->dilation;
+    o.stride = shape->stride;
+    o.postop = shape->postop;
+    o.bits = (shape->bits < shape->bpp ? shape->bits : 0);
+    o.stats = NULL;
+    o.in_pitch = o.out_pitch = 0;
+    o.workspace = NULL;
+
+    int rows = (TUNE_ROWS > 2*shape->radius + 1 ? TUNE_ROWS : 2*shape->radius + 1);
+    if (rows > shape->height)
+        rows = shape->height;
+    const size_t size = shape->bpp / 8;
+    const size_t n_in = (size_t)shape->width * rows * shape->channels;
+    const size_t n_out = (size_t)((shape->width + o.stride - 1) / o.stride) *
+        ((rows + o.stride - 1) / o.stride) * shape->channels;
+    void *in = malloc(n_in * size);
+    void *out = malloc(n_out * size);
+    if (in == NULL || out == NULL) {
+        free(in);
+        free(out);
+        return 0;
+    }
+
+    /* uniform values of the significant bits */
+    const int bits = shape->bits;
+    const uint32_t mask = (bits >= 32 ? 0xffffffffu : (1u << bits) - 1);
+    uint32_t x = 2463534242u;
+    for (size_t i=0; i<n_in; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        switch (size) {
+        case 1:
+            ((uint8_t*)in)[i] = (uint8_t)(x & mask);
+            break;
+        case 2:
+            ((uint16_t*)in)[i] = (uint16_t)(x & mask);
+            break;
+        default:
+            ((uint32_t*)in)[i] = x & mask;
+        }
+    }
+
+    /* the new measurements replace those of the same shape */
+    size_t kept = 0;
+    for (size_t i=0; i<w->n; i++) {
+        if (!same_shape(&w->entries[i].shape, shape))
+            w->entries[kept++] = w->entries[i];
+    }
+    w->n = kept;
+
+    const int max_threads = omp_get_max_threads();
+    int nmeasured = 0;
+    for (int i=0; median_filter_algos[i].name; i++) {
+        const median_filter_algo_info_t *a = &median_filter_algos[i];
+        if (!candidate(a, shape, &o))
+            continue;
+        const int is_cuda = (a->fun.u8 == cuda_median_2D_hist_generic_u8);
+        for (int threads = (is_cuda ? max_threads : 1); ; threads *= 2) {
+            if (threads > max_threads)
+                threads = max_threads;
+            wisdom_entry_t e;
+            e.shape = *shape;
+            snprintf(e.algo, sizeof(e.algo), "%s", a->name);
+            e.threads = threads;
+            e.seconds = measure(a, threads, shape, rows, &o, in, out);
+            if (e.seconds > 0.0 && wisdom_append(w, &e) == 0) {
+                nmeasured++;
+                if (log != NULL)
+                    fprintf(log, "%-24s %3d threads %12.6f s\n", a->name, threads, e.seconds);
+            }
+            if (threads == max_threads)
+                break;
+        }
+    }
+    free(in);
+    free(out);
+    return nmeasured;
+}
+
+/* Predict the time of algorithm `algo` with `threads` threads on
+   `shape`, from the measurements in `w`; return -1 if there are none */
+static double predict( const wisdom_t *w, const char *algo, int threads, const tune_shape_t *shape )
+{
+    const double pixels = (double)shape->width * shape->height;
+    /* for each measured radius, the time per value measured on the
+       image whose size is closest to that of `shape` */
+    int lo = -1, lo2 = -1, hi = -1, hi2 = -1;   /* nearest radii below and above */
+    double c_lo = 0, c_lo2 = 0, c_hi = 0, c_hi2 = 0;
+    for (size_t i=0; i<w->n; i++) {
+        const wisdom_entry_t *e = &w->entries[i];
+        if (!same_work(&e->shape, shape) || e->threads != threads || strcmp(e->algo, algo))
+            continue;
+        const int r = e->shape.radius;
+        double c = 0.0, best = -1.0;
+        /* the entry of radius r that is most similar to `shape` */
+        for (size_t j=0; j<w->n; j++) {
+            const wisdom_entry_t *f = &w->entries[j];
+            if (!same_work(&f->shape, shape) || f->threads != threads || f->shape.radius != r ||
+                strcmp(f->algo, algo))
+                continue;
+            const double d = fabs(log((double)f->shape.width * f->shape.height / pixels));
+            if (best < 0 || d < best) {
+                best = d;
+                c = f->seconds / ((double)f->shape.width * f->shape.height * f->shape.channels);
+            }
+        }
+        if (r <= shape->radius) {
+            if (r > lo) {
+                if (lo >= 0) {
+                    lo2 = lo;
+                    c_lo2 = c_lo;
+                }
+                lo = r;
+                c_lo = c;
+            } else if (r < lo && r > lo2) {
+                lo2 = r;
+                c_lo2 = c;
+            }
+        } else {
+            if (hi < 0 || r < hi) {
+                if (hi >= 0) {
+                    hi2 = hi;
+                    c_hi2 = c_hi;
+                }
+                hi = r;
+                c_hi = c;
+            } else if (r > hi && (hi2 < 0 || r < hi2)) {
+                hi2 = r;
+                c_hi2 = c;
+            }
+        }
+    }
+
+    /* the two points of the power law: the nearest radius on each side
+       of shape->radius, or the two nearest on one side */
+    int r1, r2;
+    double c1, c2;
+    if (lo >= 0 && hi >= 0) {
+        r1 = lo; c1 = c_lo; r2 = hi; c2 = c_hi;
+    } else if (lo >= 0) {
+        r1 = lo; c1 = c_lo; r2 = lo2; c2 = c_lo2;
+    } else if (hi >= 0) {
+        r1 = hi; c1 = c_hi; r2 = hi2; c2 = c_hi2;
+    } else {
+        return -1.0;
+    }
+    const double n = pixels * shape->channels;
+    if (r1 == shape->radius)
+        return c1 * n;
+    /* with a single radius, the time is assumed proportional to the
+       side of the window */
+    double k = 1.0;
+    if (r2 >= 0) {
+        k = log(c2 / c1) / log((2.0*r2 + 1) / (2.0*r1 + 1));
+        k = (k < 0.0 ? 0.0 : (k > 2.0 ? 2.0 : k));
+    }
+    return c1 * pow((2.0*shape->radius + 1) / (2.0*r1 + 1), k) * n;
+}
+
+tune_source_t wisdom_choose( const wisdom_t *w, const tune_shape_t *shape, const median_filter_opts_t *opts,
+                             const median_filter_algo_info_t **algo, int *threads, double *seconds )
+{
+    const int max_threads = omp_get_max_threads();
+    tune_source_t source = TUNE_NONE;
+
+    for (size_t i=0; i<w->n; i++) {
+        const wisdom_entry_t *e = &w->entries[i];
+        const median_filter_algo_info_t *a = median_filter_algo_find(e->algo);
+        if (!same_shape(&e->shape, shape) || a == NULL || e->threads > max_threads ||
+            !candidate(a, shape, opts))
+            continue;
+        if (source == TUNE_NONE || e->seconds < *seconds) {
+            source = TUNE_MEASURED;
+            *algo = a;
+            *threads = e->threads;
+            *seconds = e->seconds;
+        }
+    }
+    if (source != TUNE_NONE)
+        return source;
+
+    for (size_t i=0; i<w->n; i++) {
+        const wisdom_entry_t *e = &w->entries[i];
+        const median_filter_algo_info_t *a = median_filter_algo_find(e->algo);
+        if (!same_work(&e->shape, shape) || a == NULL || e->threads > max_threads ||
+            !candidate(a, shape, opts))
+            continue;
+        /* each configuration is predicted once, at its first entry */
+        size_t j = 0;
+        while (j < i && (!same_work(&w->entries[j].shape, shape) || w->entries[j].threads != e->threads ||
+                         strcmp(w->entries[j].algo, e->algo)))
+            j++;
+        if (j < i)
+            continue;
+        const double predicted = predict(w, e->algo, e->threads, shape);
+        if (predicted > 0.0 && (source == TUNE_NONE || predicted < *seconds)) {
+            source = TUNE_MODEL;
+            *algo = a;
+            *threads = e->threads;
+            *seconds = predicted;
+        }
+    }
+    return source;
+}
@@ -0,0 +1,105 @@
+/****************************************************************************
+ *
+ * autotune.h -- Choose the fastest algorithm for a job from measurements
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * The fastest exact algorithm, and the best number of threads, depend
+ * on the size of the image, on the radius, on the data type and on the
+ * machine. autotune() measures the candidate configurations on a
+ * synthetic image of the given shape, and records the times in the
+ * wisdom, which is kept in a text file with one measurement per line:
+ *
+ *      width height channels bpp bits radius dilation stride postop algorithm threads seconds
+ *
+ * where bits is the number of significant bits of the values (see
+ * `bits` in median_filter_opts_t), and postop is one of the POSTOP_xxx
+ * constants.
+ *
+ * wisdom_choose() returns the configuration that was fastest on the
+ * same shape. For shapes that were never measured, the time of each
+ * configuration is predicted from the measurements with the same data
+ * type, significant bits, dilation, stride and post operation, that
+ * change the work per value: the time per value at the two nearest measured radii is
+ * interpolated (or extrapolated) as a power of the window side 2r+1,
+ * using for each radius the measurement of the most similar image size.
+ */
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdio.h>
+#include "median-plan.h"
+
+typedef struct {
+    int width, height;  /* of the input image */
+    int channels;
+    int bpp;            /* bits per value: 8, 16 or 32 */
+    int bits;           /* significant bits, at most bpp */
+    int radius;
+    int dilation, stride, postop; /* as in median_filter_opts_t */
+} tune_shape_t;
+
+typedef struct {
+    tune_shape_t shape;
+    char algo[32];
+    int threads;
+    double seconds;     /* time to filter the whole image */
+} wisdom_entry_t;
+
+typedef struct {
+    wisdom_entry_t *entries;
+    size_t n, capacity;
+} wisdom_t;
+
+typedef enum {
+    TUNE_NONE,          /* no measurement is usable */
+    TUNE_MEASURED,      /* the shape has been measured */
+    TUNE_MODEL          /* the time has been predicted */
+} tune_source_t;
+
+/* Return the wisdom file given by the environment variable
+   MEDIAN_FILTER_WISDOM, or ~/.median-filter-wisdom */
+const char *wisdom_default_path( void );
+
+/* Read the wisdom from `path` into `w`; a missing file is empty wisdom.
+   Return 0 on success, -1 on error with the reason in `err` */
+int wisdom_load( wisdom_t *w, const char *path, char *err, size_t errlen );
+
+/* Replace the file `path` with the wisdom `w`; return 0 on success, -1
+   on error with the reason in `err` */
+int wisdom_save( const wisdom_t *w, const char *path, char *err, size_t errlen );
+
+void wisdom_free( wisdom_t *w );
+
+/* Measure the exact algorithms that accept `opts`, with different
+   numbers of threads, on a synthetic image of shape `shape` (whose
+   dilation, stride and post operation replace those of `opts`), and
+   replace the measurements of that shape in `w`. The times are printed
+   to `log` if it is not NULL. Return the number of configurations
+   measured. */
+int autotune( wisdom_t *w, const tune_shape_t *shape, const median_filter_opts_t *opts, FILE *log );
+
+/* Choose the configuration for `shape` and `opts` with the lowest
+   measured or predicted time, considering only the configurations
+   that use at most omp_get_max_threads() threads; store the algorithm,
+   threads and time into `*algo`, `*threads` and `*seconds`. */
+tune_source_t wisdom_choose( const wisdom_t *w, const tune_shape_t *shape, const median_filter_opts_t *opts,
+                             const median_filter_algo_info_t **algo, int *threads, double *seconds );
+
+#endif
@@ -0,0 +1,751 @@
+#!/bin/bash
+
+## Differential test of the median filter algorithms. Each algorithm
+## is executed on random images with random shapes, radiuses (also
+## larger than the image), dilation factors, strides, channels, value
+## distributions, no-data values, post operations and rank filter
+## pipelines, for all data types, with and without memory-mapped
+## files, streaming in bands of rows, asynchronous I/O and chunk
+## stores, batches, regions of interest, and padded or unpadded rows;
+## its output must be bit-for-bit identical to that of the brute-force
+## `omp-reference` algorithm, or of `omp-vector-reference-l1` and `-l2`
+## for the vector medians.
+##
+## Usage: ./check.sh [algo ...]
+##
+## By default, all algorithms listed by `median-filter -h` are
+## checked. Algorithms that can not be executed at all (e.g., the CUDA
+## ones on a machine without a GPU) are skipped, and so are the
+## combinations of options that an algorithm rejects. Approximate
+## algorithms are executed with error bound 0, and are checked only
+## when they report that this makes them exact.
+## The environment variables NCASES and SEED set the number of random
+## test cases and the seed of the random generator; a failing case
+## prints the command line that reproduces it. The vector medians of
+## floating point values, the readers and writers of PNM, TIFF and
+## FITS images, packed values, and the daemon, are checked afterwards
+## against the same values stored as integers, raw files, unpacked
+## values, and the program itself, respectively.
+
+## Written on 2025-06-16 by Moreno Marzolla
+
+NCASES=${NCASES:-100}
+SEED=${SEED:-$$}
+EXE=${EXE:-./median-filter}
+GEN=${GEN:-./random-image}
+TEST_DAEMON=${TEST_DAEMON:-./test-daemon}
+TMP=$( mktemp -d ) || exit 1
+trap "rm -rf $TMP" EXIT
+## -a auto is checked with an empty wisdom file, i.e., it runs the
+## default algorithm, whatever the wisdom of the user
+export MEDIAN_FILTER_WISDOM=$TMP/wisdom
+
+if [ $# -gt 0 ]; then
+    ALGOS="$*"
+else
+    ALGOS=$( $EXE -h 2>&1 | sed '1,/^Valid algorithm names:/d' | awk 'NF > 0 && $1 !~ /reference/ { print $1 }' )
+fi
+
+## Check which algorithms can be executed on a 1x1 image, of 16-bit
+## values so that the default error bound of the approximate
+## algorithms is valid
+$GEN -b 16 -X 1 -Y 1 $TMP/in.raw || exit 1
+CHECKED=""
+for A in $ALGOS ; do
+    if $EXE -a $A -b 16 -X 1 -Y 1 -r 1 -o $TMP/out.raw $TMP/in.raw > /dev/null 2>&1 ; then
+        CHECKED="$CHECKED $A"
+    else
+        echo "SKIP $A: can not be executed"
+    fi
+done
+
+## Return success if algorithm $1 computes the same result as the
+## reference with the options of the current test case
+applicable() {
+    case $1 in
+        omp-vector-median-*)
+            ## the brute-force vector median takes O(R^4) time per
+            ## pixel
+            [ $(( R / D )) -le 5 ] ;;
+        *)
+            true ;;
+    esac
+}
+
+## Print the reductions computed with --stats, if any
+stats() {
+    grep -E '^(Outliers|Sum \|residual\|)' $1
+}
+
+## Prepare the resumption of algorithm $1 on $IN: leave in out.raw its
+## output, in which only some bands of rows are complete, and in
+## out.raw.ckpt the checkpoint that records them, and set RESUMED to
+## the line of the log that reports them. The key of the job is found
+## in the log of --cache, that names the cached outputs with it.
+resume_setup() {
+    rm -rf $TMP/keys $TMP/out.raw $TMP/out.raw.ckpt
+    $EXE -a $1 -e 0 $OPTS --cache $TMP/keys --checkpoint 0 -o $TMP/out.raw $IN 2> $TMP/ckpt.log || return
+    local KEY=$( sed -n 's/^Cache\.* miss //p' $TMP/ckpt.log )
+    local NB=$( sed -n 's/^Checkpoint\.* .* (0 of \([0-9]*\) bands.*/\1/p' $TMP/ckpt.log )
+    local ROWS=$( sed -n 's/^Checkpoint\.* .* bands of \([0-9]*\) rows.*/\1/p' $TMP/ckpt.log )
+    local H=$( sed -n 's/^Output size\.* [0-9]* x //p' $TMP/ckpt.log )
+    [ -n "$KEY" -a -n "$NB" -a -n "$ROWS" ] || return
+    local ROW_BYTES=$(( $( wc -c < $TMP/out.raw ) / H ))
+    local FLAGS="" NDONE=0
+    for b in `seq 0 $(( NB - 1 ))`; do
+        if [ $(( RANDOM % 2 )) -eq 0 ]; then
+            FLAGS="${FLAGS}1"
+            NDONE=$(( NDONE + 1 ))
+        else
+            ## the bands that are not complete hold garbage
+            FLAGS="${FLAGS}0"
+            local LEN=$(( ROWS < H - b * ROWS ? ROWS : H - b * ROWS ))
+            head -c $(( LEN * ROW_BYTES )) /dev/zero | tr '\0' '\245' |
+                dd of=$TMP/out.raw bs=1 seek=$(( b * ROWS * ROW_BYTES )) conv=notrunc 2> /dev/null
+        fi
+    done
+    printf "median-filter-checkpoint %s %d\n%s" $KEY $NB $FLAGS > $TMP/out.raw.ckpt
+    RESUMED="($NDONE of $NB bands"
+}
+
+## Print the unsigned words of the file read from stdin, one per line;
+## the arguments are those of od
+words() {
+    od -An -v "$@" | awk '{ for (i=1; i<=NF; i++) print $i }'
+}
+
+RANDOM=$SEED
+POSTOPS=(median residual absresidual mask)
+VALUES=(uniform few extreme constant)
+TYPES=(u8 u16 u32 i8 i16 i32 f16 f32)
+STAGES=(min max median p10 p25 p75 p90)
+NFAIL=0
+declare -A NPASS NSKIP
+echo "Checking${CHECKED} (seed $SEED)"
+for CASE in `seq $NCASES`; do
+    T=${TYPES[$(( RANDOM % 8 ))]}
+    B=${T:1}
+    X=$(( 1 + RANDOM % 40 ))
+    Y=$(( 1 + RANDOM % 40 ))
+    C=1 ; [ $(( RANDOM % 3 )) -eq 0 ] && C=$(( 2 + RANDOM % 3 ))
+    ## rows of 512 bytes are padded in memory
+    [ $C -ne 3 -a $(( RANDOM % 5 )) -eq 0 ] && X=$(( 512 * 8 / (B * C) ))
+    if [ $(( RANDOM % 4 )) -eq 0 ]; then
+        R=$(( (X > Y ? X : Y) + RANDOM % 4 ))
+    else
+        R=$(( RANDOM % 7 ))
+    fi
+    D=1 ; [ $(( RANDOM % 3 )) -eq 0 ] && D=$(( 2 + RANDOM % 2 ))
+    S=1 ; [ $(( RANDOM % 3 )) -eq 0 ] && S=$(( 2 + RANDOM % 3 ))
+    V=${VALUES[$(( RANDOM % 4 ))]}
+    SIGBITS=$B
+    if [ ${T:0:1} = u -a $(( RANDOM % 3 )) -eq 0 ]; then
+        SIGBITS=$(( 1 + RANDOM % B ))
+    fi
+    NODATA="" ; [ $(( RANDOM % 4 )) -eq 0 ] && NODATA="-n $(( RANDOM % 2 ))"
+    OPTS="--type $T --bits $SIGBITS -X $X -Y $Y -C $C -r $R -d $D -s $S -p ${POSTOPS[$(( RANDOM % 4 ))]} -t $(( RANDOM % 4 )) $NODATA"
+    [ $(( RANDOM % 4 )) -eq 0 ] && OPTS="$OPTS --clamp $(( RANDOM % 2 )):$(( 2 + RANDOM % 200 ))"
+    [ $(( RANDOM % 3 )) -eq 0 ] && OPTS="$OPTS --stats"
+    if [ $(( RANDOM % 5 )) -eq 0 ]; then
+        RX=$(( RANDOM % X )) ; RY=$(( RANDOM % Y ))
+        OPTS="$OPTS --roi $RX:$RY:$(( 1 + RANDOM % (X - RX) )):$(( 1 + RANDOM % (Y - RY) ))"
+    fi
+    ## REACH is the distance of the input rows that affect an output row
+    REACH=$R
+    if [ $D -eq 1 -a $S -eq 1 -a $(( RANDOM % 4 )) -eq 0 ]; then
+        REACH=$(( RANDOM % 4 ))
+        PIPELINE="${STAGES[$(( RANDOM % 7 ))]}:$REACH"
+        for s in `seq $(( RANDOM % 3 ))`; do
+            SR=$(( RANDOM % 4 ))
+            REACH=$(( REACH + SR ))
+            PIPELINE="$PIPELINE,${STAGES[$(( RANDOM % 7 ))]}:$SR"
+        done
+        OPTS="$OPTS --pipeline $PIPELINE"
+    fi
+    export OMP_NUM_THREADS=$(( 1 + RANDOM % 4 ))
+
+    IMG_SEED=$RANDOM
+    $GEN -b $B -B $SIGBITS -X $(( X * C )) -Y $Y -v $V -s $IMG_SEED $TMP/in.raw || exit 1
+    $EXE -a omp-reference $OPTS -o $TMP/ref.raw $TMP/in.raw 2> $TMP/ref.log
+    STATUS=$?
+    if [ $STATUS -eq 1 ] && grep -q FATAL $TMP/ref.log ; then
+        ## invalid combination of options, e.g., residuals of floats
+        continue
+    elif [ $STATUS -ne 0 ]; then
+        echo "FATAL: the reference algorithm failed on $OPTS"
+        cat $TMP/ref.log
+        exit 1
+    fi
+    rm -f $TMP/vref-*
+    for A in $CHECKED ; do
+        if ! applicable $A ; then
+            NSKIP[$A]=$(( ${NSKIP[$A]:-0} + 1 ))
+            continue
+        fi
+        REF=ref
+        case $A in
+            omp-vector-median-*)
+                REF=vref-${A##*-}
+                [ -f $TMP/$REF.log ] ||
+                    $EXE -a omp-vector-reference-${A##*-} $OPTS -o $TMP/$REF.raw $TMP/in.raw 2> $TMP/$REF.log ;;
+        esac
+        ## I/O mode: whole image, mapped files, bands of a few rows,
+        ## with or without an I/O thread, chunks of a chunk store, a
+        ## batch of one image, a copy from the result cache, or bands
+        ## of rows recorded in a checkpoint, either from scratch or
+        ## resumed from a checkpoint of some of them
+        IN=$TMP/in.raw
+        RESUMED=""
+        case $(( RANDOM % 7 )) in
+            0) IO="" ;;
+            1) IO="--mmap" ;;
+            2) IO="--stream --mem-budget $(( 2 * X * C * B / 8 * (2 * (REACH + S) + 1 + S * (RANDOM % 6)) ))" ;;
+            3) IO="--chunk-size $(( 1 + RANDOM % X ))x$(( 1 + RANDOM % Y ))"
+               rm -rf $TMP/in.chunks
+               $EXE -a omp-reference -r 0 --type $T -X $X -Y $Y -C $C $IO -o $TMP/in.chunks $IN > /dev/null 2>&1
+               IN=$TMP/in.chunks
+               IO="--in-flight $(( 1 + RANDOM % 4 ))" ;;
+            4) echo "$TMP/in.raw $TMP/out.raw" > $TMP/batch.txt
+               IO="--batch $TMP/batch.txt" ;;
+            5) IO="--cache $TMP/cache --cache-size 1M"
+               ## the first run stores the result, the second copies it
+               $EXE -a $A -e 0 $OPTS $IO -o $TMP/out.raw $IN > /dev/null 2>&1 ;;
+            6) IO="--checkpoint 0"
+               if [ $(( RANDOM % 2 )) -eq 0 ]; then
+                   IO="--resume"
+                   resume_setup $A
+               fi ;;
+        esac
+        case $(( RANDOM % 4 )) in
+            0) [ "$IO" = "" -o "${IO:0:8}" = "--stream" ] && IO="$IO --async-io" ;;
+            1) [ "$IO" = "" -o "${IO:0:8}" = "--stream" ] && IO="$IO --direct-io" ;;
+        esac
+        [ $(( RANDOM % 4 )) -eq 0 ] && IO="$IO --no-padding"
+        [ -z "$RESUMED" ] && rm -f $TMP/out.raw
+        if [ "${IO:0:7}" = "--batch" ]; then
+            $EXE -a $A -e 0 $OPTS $IO 2> $TMP/out.log
+        else
+            $EXE -a $A -e 0 $OPTS $IO -o $TMP/out.raw $IN 2> $TMP/out.log
+        fi
+        STATUS=$?
+        if [ $STATUS -eq 1 ] && grep -q FATAL $TMP/out.log ; then
+            ## the options are rejected by this algorithm
+            NSKIP[$A]=$(( ${NSKIP[$A]:-0} + 1 ))
+        elif grep -q '^Error bound' $TMP/out.log && ! grep -q '^Error bound\.* exact$' $TMP/out.log ; then
+            ## the result is approximate
+            NSKIP[$A]=$(( ${NSKIP[$A]:-0} + 1 ))
+        elif [ $STATUS -ne 0 ] || ! cmp -s $TMP/$REF.raw $TMP/out.raw || \
+             [ "$( stats $TMP/$REF.log )" != "$( stats $TMP/out.log )" ] || \
+             ! grep -q -F "$RESUMED" $TMP/out.log ; then
+            echo "FAIL $A: OMP_NUM_THREADS=$OMP_NUM_THREADS $EXE -a $A -e 0 $OPTS $IO $( basename $IN )"
+            echo "     where in.raw is created by $GEN -b $B -B $SIGBITS -X $(( X * C )) -Y $Y -v $V -s $IMG_SEED in.raw"
+            NFAIL=$(( NFAIL + 1 ))
+        else
+            NPASS[$A]=$(( ${NPASS[$A]:-0} + 1 ))
+        fi
+    done
+done
+
+## Print the number of pixels of the output $2 whose rank, within the
+## window of radius $R of the single-channel input $1 (of $X x $Y
+## unsigned values of $B bits), is not within ranks $3 .. $4, counted
+## from 1; a value that occurs several times in the window has all the
+## ranks of its copies
+rank_misses() {
+    { od -An -v -tu$(( B / 8 )) $1 ; echo ; od -An -v -tu$(( B / 8 )) $2 ; } |
+        awk -v X=$X -v Y=$Y -v R=$R -v lo=$3 -v hi=$4 '
+            NF == 0 { out = 1 ; next }
+            { for (i=1; i<=NF; i++) { if (out) o[m++] = $i + 0 ; else v[n++] = $i + 0 } }
+            END {
+                for (p=0; p<m; p++) {
+                    i = int(p / X) ; j = p % X ; lt = 0 ; le = 0
+                    for (di=-R; di<=R; di++) {
+                        ii = i + di ; ii = (ii < 0 ? 0 : (ii >= Y ? Y - 1 : ii))
+                        for (dj=-R; dj<=R; dj++) {
+                            jj = j + dj ; jj = (jj < 0 ? 0 : (jj >= X ? X - 1 : jj))
+                            w = v[ii * X + jj] ; lt += (w < o[p]) ; le += (w <= o[p])
+                        }
+                    }
+                    if (le < lo || lt + 1 > hi) miss++
+                }
+                print miss + 0
+            }'
+}
+
+## The approximate algorithms must be within the error bound that they
+## report: the coarse median within the given number of grey levels
+## of the median, the median of row medians within the given ranks, and
+## the median of random samples within the given rank error of the
+## median, for almost all pixels, since the bound holds with high
+## probability only. However the image is split, in bands of rows or
+## in chunks, the result must be the same, also for the algorithms that
+## draw random samples.
+for CASE in `seq $(( (NCASES + 9) / 10 ))`; do
+    T=${TYPES[$(( RANDOM % 3 ))]}
+    B=${T:1}
+    X=$(( 20 + RANDOM % 40 ))
+    Y=$(( 20 + RANDOM % 40 ))
+    R=$(( 2 + RANDOM % 7 ))
+    N=$(( (2 * R + 1) * (2 * R + 1) ))
+    SIGBITS=$B ; [ $B -eq 32 ] && SIGBITS=$(( 17 + RANDOM % 8 ))
+    V=${VALUES[$(( RANDOM % 2 ))]}
+    OPTS="--type $T --bits $SIGBITS -X $X -Y $Y -r $R"
+    IMG_SEED=$RANDOM
+    CMD="$GEN -b $B -B $SIGBITS -X $X -Y $Y -v $V -s $IMG_SEED in.raw"
+    $GEN -b $B -B $SIGBITS -X $X -Y $Y -v $V -s $IMG_SEED $TMP/in.raw || exit 1
+    $EXE -a omp-reference $OPTS -o $TMP/ref.raw $TMP/in.raw > /dev/null 2>&1 || exit 1
+    for A in $CHECKED ; do
+        case $A in
+            omp-approx-coarse) E=$(( 1 << (RANDOM % 8) )) ; [ $SIGBITS -gt 16 ] && E=$(( E << (SIGBITS - 16) )) ;;
+            omp-approx-sample) E=$(( 10 + RANDOM % 30 )) ;;
+            *) E=$(( RANDOM % 8 )) ;;
+        esac
+        rm -f $TMP/out.raw $TMP/split.raw
+        if ! $EXE -a $A -e $E $OPTS -o $TMP/out.raw $TMP/in.raw > $TMP/out.log 2>&1 ; then
+            NSKIP[$A]=$(( ${NSKIP[$A]:-0} + 1 ))
+            continue
+        fi
+        BOUND=$( sed -n 's/^Error bound\.* //p' $TMP/out.log )
+        case "$BOUND" in
+            ""|exact) cmp -s $TMP/ref.raw $TMP/out.raw ; MISSES=$? ;;
+            "+/- "*) K=${BOUND#+/- } ; K=${K%% *}
+                     MISSES=$( paste <( words -tu$(( B / 8 )) $TMP/ref.raw ) <( words -tu$(( B / 8 )) $TMP/out.raw ) |
+                                   awk -v k=$K '{ d = $1 - $2 } d > k || d < -k { miss++ } END { print miss + 0 }' ) ;;
+            "rank in ["*) LO=${BOUND#rank in [} ; HI=${LO#*, } ; LO=${LO%%,*} ; HI=${HI%%]*}
+                          MISSES=$( rank_misses $TMP/in.raw $TMP/out.raw $LO $HI ) ;;
+            "rank +/- "*) P=${BOUND#rank +/- } ; EPS=$(( N * ${P%%\%*} / 100 ))
+                          MISSES=$( rank_misses $TMP/in.raw $TMP/out.raw $(( N / 2 + 1 - EPS )) $(( N / 2 + 1 + EPS )) )
+                          [ $MISSES -le $(( X * Y / 100 )) ] && MISSES=0 ;;
+            *) echo "FATAL: unknown error bound \"$BOUND\" of $A" ; exit 1 ;;
+        esac
+        ## the same, in bands of a few rows, or in chunks
+        if [ $(( RANDOM % 2 )) -eq 0 ]; then
+            SPLIT="--stream --mem-budget $(( 2 * X * B / 8 * (2 * R + 2 + RANDOM % 6) ))"
+            $EXE -a $A -e $E $OPTS $SPLIT -o $TMP/split.raw $TMP/in.raw > /dev/null 2>&1
+        else
+            SPLIT="--chunk-size $(( 1 + RANDOM % X ))x$(( 1 + RANDOM % Y ))"
+            rm -rf $TMP/in.chunks
+            $EXE -a omp-reference -r 0 --type $T -X $X -Y $Y $SPLIT -o $TMP/in.chunks $TMP/in.raw > /dev/null 2>&1
+            $EXE -a $A -e $E -r $R --bits $SIGBITS -o $TMP/split.raw $TMP/in.chunks > /dev/null 2>&1
+        fi
+        if [ $MISSES -ne 0 ]; then
+            echo "FAIL $A: $EXE -a $A -e $E $OPTS in.raw is not within \"$BOUND\" at $MISSES pixels"
+            echo "     where in.raw is created by $CMD"
+            NFAIL=$(( NFAIL + 1 ))
+        elif ! cmp -s $TMP/out.raw $TMP/split.raw ; then
+            echo "FAIL $A: $EXE -a $A -e $E $OPTS $SPLIT in.raw differs from the whole image"
+            echo "     where in.raw is created by $CMD"
+            NFAIL=$(( NFAIL + 1 ))
+        else
+            NPASS[$A]=$(( ${NPASS[$A]:-0} + 1 ))
+        fi
+    done
+done
+
+## The vector medians compute with the values, rather than compare
+## them: on integers stored as floating point numbers (shifted by
+## -2^(SIGBITS-1) by $GEN -F), the result must be that on the same
+## integers stored as u32, shifted likewise
+for A in $CHECKED ; do
+    case $A in
+        omp-vector-median-*) ;;
+        *) continue ;;
+    esac
+    for CASE in `seq $(( (NCASES + 9) / 10 ))`; do
+        X=$(( 1 + RANDOM % 20 ))
+        Y=$(( 1 + RANDOM % 20 ))
+        C=$(( 2 + RANDOM % 3 ))
+        SIGBITS=$(( 1 + RANDOM % 24 ))
+        OPTS="-X $X -Y $Y -C $C -r $(( RANDOM % 5 )) -d $(( 1 + RANDOM % 2 )) -s $(( 1 + RANDOM % 2 ))"
+        IMG_SEED=$RANDOM
+        $GEN -b 32 -B $SIGBITS -X $(( X * C )) -Y $Y -s $IMG_SEED $TMP/in.raw || exit 1
+        $GEN -b 32 -B $SIGBITS -X $(( X * C )) -Y $Y -s $IMG_SEED -F $TMP/in-f32.raw || exit 1
+        if ! $EXE -a $A --type u32 $OPTS -o $TMP/ref.raw $TMP/in.raw > /dev/null 2>&1 ||
+           ! $EXE -a $A --type f32 $OPTS -o $TMP/out.raw $TMP/in-f32.raw > /dev/null 2>&1 ||
+           [ "$( od -An -v -tu4 $TMP/ref.raw | awk -v o=$(( 1 << (SIGBITS - 1) )) '{ for (i=1; i<=NF; i++) print $i - o }' )" != \
+             "$( od -An -v -tf4 $TMP/out.raw | awk '{ for (i=1; i<=NF; i++) print $i + 0 }' )" ]; then
+            echo "FAIL $A: $EXE -a $A --type f32 $OPTS in-f32.raw"
+            echo "     where in-f32.raw is created by $GEN -b 32 -B $SIGBITS -X $(( X * C )) -Y $Y -s $IMG_SEED -F in-f32.raw"
+            NFAIL=$(( NFAIL + 1 ))
+        else
+            NPASS[$A]=$(( ${NPASS[$A]:-0} + 1 ))
+        fi
+    done
+done
+
+## File formats. The images written as PNM, TIFF or FITS must contain
+## the header and the values, in the byte order of the format, of the
+## raw output; read back, and filtered, they must give the same
+## results as the raw files. Images that this program does not write
+## (big-endian TIFF, strips out of order, tiles, PNM comments, FITS
+## headers of several blocks) are made here.
+
+## Copy the words of $1 bytes from stdin to stdout, converted from the
+## byte order of the host to big-endian (and from little-endian to
+## big-endian); if $2 is nonzero, their sign bit is flipped
+big_endian() {
+    printf "$( od -An -v -tu1 | awk -v s=$1 -v flip=$2 -v le=$HOST_LE '
+        { for (i=1; i<=NF; i++) {
+              b[n++] = $i
+              if (n == s) {
+                  for (k=0; k<s; k++) {
+                      v = b[le ? s-1-k : k]
+                      if (k == 0 && flip) v = (v + 128) % 256
+                      printf "\\x%02x", v
+                  }
+                  n = 0
+              }
+          } }' )"
+}
+
+## Print the 16 or 32-bit word $1 as $2 bytes, big-endian
+be() {
+    local k
+    for k in `seq $(( $2 - 1 )) -1 0`; do
+        printf "\\x$( printf %02x $(( ($1 >> (8 * k)) & 255 )) )"
+    done
+}
+
+## Print a big-endian TIFF directory entry: tag $1, type $2 (3 =
+## SHORT, 4 = LONG), count $3, value $4
+tiff_entry() {
+    be $1 2 ; be $2 2 ; be $3 4
+    if [ $2 -eq 3 ]; then be $4 2 ; be 0 2 ; else be $4 4 ; fi
+}
+
+## Write the big-endian values of $TMP/in.be, of type $T, $X x $Y x $C,
+## to the big-endian TIFF file $1 in tiles of $2 x $3 pixels; if $2 is
+## 0, strips of $3 rows are written instead. If $4 is nonzero, the
+## segments are stored in the file in reverse order.
+make_tiff() {
+    local PX=$(( C * B / 8 ))
+    local TW=$2 TH=$3
+    [ $TW -eq 0 ] && TW=$X
+    local ACROSS=$(( (X + TW - 1) / TW )) DOWN=$(( (Y + TH - 1) / TH ))
+    local N=$(( ACROSS * DOWN )) FMT=1 NENTRIES=11
+    [ ${T:0:1} = i ] && FMT=2
+    [ ${T:0:1} = f ] && FMT=3
+    [ $2 -gt 0 ] && NENTRIES=12
+    local ARRAYS=$(( 8 + 2 + 12 * NENTRIES + 4 ))
+    local DATA=$(( ARRAYS + 8 * N ))
+    local k r x0 y0 w ROWS SEGBYTES OFFSETS="" COUNTS="" ORDER
+    rm -f $TMP/seg.*
+    for k in `seq 0 $(( N - 1 ))`; do
+        x0=$(( (k % ACROSS) * TW )) ; y0=$(( (k / ACROSS) * TH ))
+        w=$(( X - x0 < TW ? X - x0 : TW ))
+        ROWS=$(( Y - y0 < TH ? Y - y0 : TH ))
+        ## tiles are padded to the full size, strips are not
+        [ $2 -gt 0 ] && ROWS=$TH
+        for r in `seq 0 $(( ROWS - 1 ))`; do
+            if [ $(( y0 + r )) -lt $Y ]; then
+                tail -c +$(( ((y0 + r) * X + x0) * PX + 1 )) $TMP/in.be | head -c $(( w * PX ))
+                head -c $(( (TW - w) * PX )) /dev/zero
+            else
+                head -c $(( TW * PX )) /dev/zero
+            fi
+        done > $TMP/seg.$k
+    done
+    ORDER=$( seq 0 $(( N - 1 )) ) ; [ $4 -ne 0 ] && ORDER=$( seq $(( N - 1 )) -1 0 )
+    local POS=$DATA
+    declare -A AT
+    for k in $ORDER; do
+        AT[$k]=$POS
+        POS=$(( POS + $( stat -c %s $TMP/seg.$k ) ))
+    done
+    {
+        printf "MM\\x00\\x2a" ; be 8 4
+        be $NENTRIES 2
+        tiff_entry 256 4 1 $X
+        tiff_entry 257 4 1 $Y
+        tiff_entry 258 3 1 $B
+        tiff_entry 259 3 1 1
+        tiff_entry 262 3 1 1
+        if [ $2 -eq 0 ]; then
+            tiff_entry 273 4 $N $( [ $N -eq 1 ] && echo $DATA || echo $ARRAYS )
+            tiff_entry 277 3 1 $C
+            tiff_entry 278 4 1 $TH
+            tiff_entry 279 4 $N $( [ $N -eq 1 ] && stat -c %s $TMP/seg.0 || echo $(( ARRAYS + 4 * N )) )
+            tiff_entry 284 3 1 1
+        else
+            tiff_entry 277 3 1 $C
+            tiff_entry 284 3 1 1
+            tiff_entry 322 3 1 $TW
+            tiff_entry 323 3 1 $TH
+            tiff_entry 324 4 $N $( [ $N -eq 1 ] && echo $DATA || echo $ARRAYS )
+            tiff_entry 325 4 $N $( [ $N -eq 1 ] && stat -c %s $TMP/seg.0 || echo $(( ARRAYS + 4 * N )) )
+        fi
+        tiff_entry 339 3 1 $FMT
+        be 0 4
+        for k in `seq 0 $(( N - 1 ))`; do be ${AT[$k]} 4 ; done
+        for k in `seq 0 $(( N - 1 ))`; do be $( stat -c %s $TMP/seg.$k ) 4 ; done
+        for k in $ORDER; do cat $TMP/seg.$k ; done
+    } > $1
+}
+
+## Print a FITS card with keyword $1 and value $2
+fits_card() {
+    printf "%-80s" "$( printf "%-8s= %20s" $1 $2 )"
+}
+
+HOST_LE=$( printf '\1\0' | od -An -tu2 | awk '{ print ($1 == 1) }' )
+FORMATS=(pgm ppm tif fits)
+NPASS_IO=0
+for CASE in `seq $(( (NCASES + 4) / 5 ))`; do
+    ## the values written by the program
+    FMT=${FORMATS[$(( RANDOM % 4 ))]}
+    case $FMT in
+        pgm) C=1 ; TYPES_OK=(u8 u16) ;;
+        ppm) C=3 ; TYPES_OK=(u8 u16) ;;
+        tif) C=$(( 1 + RANDOM % 4 )) ; TYPES_OK=(u8 u16 u32 i8 i16 i32 f16 f32) ;;
+        fits) C=1 ; TYPES_OK=(u8 u16 u32 i8 i16 i32 f32) ;;
+    esac
+    T=${TYPES_OK[$(( RANDOM % ${#TYPES_OK[@]} ))]}
+    B=${T:1} ; S=$(( B / 8 ))
+    X=$(( 1 + RANDOM % 30 ))
+    Y=$(( 1 + RANDOM % 30 ))
+    SIGBITS=$B
+    [ $B -le 16 -a ${T:0:1} = u -a $(( RANDOM % 2 )) -eq 0 ] && SIGBITS=$(( 1 + RANDOM % B ))
+    ## the maxval of a PNM header gives the size of the values, so
+    ## that 16-bit values with at most 8 significant bits are rejected
+    REJECT=0 ; [ $FMT != tif -a $FMT != fits -a $B -eq 16 -a $SIGBITS -le 8 ] && REJECT=1
+    ## the floating point values are finite, so that they are read
+    ## back as they are
+    GENBITS=$SIGBITS ; [ ${T:0:1} = f ] && GENBITS=$(( B - 2 ))
+    OPTS="--type $T --bits $SIGBITS -X $X -Y $Y -C $C -r $(( RANDOM % 4 ))"
+    IMG_SEED=$RANDOM
+    CMD="$GEN -b $B -B $GENBITS -X $(( X * C )) -Y $Y -s $IMG_SEED in.raw"
+    $GEN -b $B -B $GENBITS -X $(( X * C )) -Y $Y -s $IMG_SEED $TMP/in.raw || exit 1
+    N=$(( X * Y * C ))
+    rm -f $TMP/ref.raw $TMP/out.$FMT $TMP/back.raw
+    $EXE $OPTS -o $TMP/ref.raw $TMP/in.raw > /dev/null 2>&1 &&
+        $EXE $OPTS -o $TMP/out.$FMT $TMP/in.raw > /dev/null 2>&1
+    STATUS=$?
+    WRITTEN=$STATUS
+    case $FMT in
+        pgm|ppm)
+            HEADER="P$( [ $C -eq 3 ] && echo 6 || echo 5 ) $X $Y $(( (1 << SIGBITS) - 1 ))"
+            HLEN=$( printf "P5\n$X $Y\n$(( (1 << SIGBITS) - 1 ))\n" | wc -c )
+            [ "$( head -c $HLEN $TMP/out.$FMT 2> /dev/null | tr '\n' ' ' )" = "$HEADER " ] || STATUS=1
+            ENDIAN=big ; FLIP=0 ; SIZE=$(( HLEN + N * S )) ;;
+        tif)
+            HLEN=$( od -An -tu4 -j 78 -N 4 --endian=little $TMP/out.$FMT | tr -d ' ' )
+            ENDIAN=little ; FLIP=0 ; SIZE=$(( HLEN + N * S )) ;;
+        fits)
+            HLEN=2880
+            BITPIX=$B ; [ ${T:0:1} = f ] && BITPIX=-$B
+            head -c 2880 $TMP/out.$FMT | fold -w 80 | grep -q "^BITPIX  = *$BITPIX *\$" || STATUS=1
+            ENDIAN=big ; FLIP=0 ; [ $T = u16 -o $T = u32 -o $T = i8 ] && FLIP=1
+            SIZE=$(( HLEN + (N * S + 2879) / 2880 * 2880 )) ;;
+    esac
+    if [ $REJECT -ne 0 ]; then
+        if [ $WRITTEN -eq 0 ]; then
+            echo "FAIL writing $FMT: $EXE $OPTS -o out.$FMT in.raw is not rejected"
+            echo "     where in.raw is created by $CMD"
+            NFAIL=$(( NFAIL + 1 ))
+        else
+            NPASS_IO=$(( NPASS_IO + 1 ))
+        fi
+    elif [ $STATUS -ne 0 ] || [ "$( stat -c %s $TMP/out.$FMT )" != "$SIZE" ] ||
+       [ "$( tail -c +$(( HLEN + 1 )) $TMP/out.$FMT | head -c $(( N * S )) | words --endian=$ENDIAN -tu$S )" != \
+         "$( words -tu$S $TMP/ref.raw | awk -v flip=$FLIP -v m=$(( 1 << (B - 1) )) '{ printf "%.0f\n", (flip ? ($1 + m) % (2 * m) : $1) }' )" ]; then
+        echo "FAIL writing $FMT: $EXE $OPTS -o out.$FMT in.raw"
+        echo "     where in.raw is created by $CMD"
+        NFAIL=$(( NFAIL + 1 ))
+    elif ! $EXE -r 0 -o $TMP/back.raw $TMP/out.$FMT > /dev/null 2>&1 || ! cmp -s $TMP/ref.raw $TMP/back.raw ; then
+        echo "FAIL reading $FMT: $EXE -r 0 -o back.raw out.$FMT"
+        echo "     where out.$FMT is created by $EXE $OPTS -o out.$FMT in.raw, and in.raw by $CMD"
+        NFAIL=$(( NFAIL + 1 ))
+    else
+        NPASS_IO=$(( NPASS_IO + 1 ))
+    fi
+
+    ## the values read from files made here
+    case $(( RANDOM % 3 )) in
+        0) FMT=tif ; C=$(( 1 + RANDOM % 4 )) ; TYPES_OK=(u8 u16 u32 i16 i32 f32) ;;
+        1) FMT=pgm ; C=1 ; TYPES_OK=(u16) ;;
+        2) FMT=fits ; C=1 ; TYPES_OK=(u16 i32 f32) ;;
+    esac
+    T=${TYPES_OK[$(( RANDOM % ${#TYPES_OK[@]} ))]}
+    B=${T:1} ; S=$(( B / 8 ))
+    X=$(( 1 + RANDOM % 30 ))
+    Y=$(( 1 + RANDOM % 30 ))
+    GENBITS=$B ; [ ${T:0:1} = f ] && GENBITS=$(( B - 2 ))
+    [ $FMT = pgm ] && GENBITS=12
+    OPTS="-r $(( RANDOM % 4 ))"
+    IMG_SEED=$RANDOM
+    CMD="$GEN -b $B -B $GENBITS -X $(( X * C )) -Y $Y -s $IMG_SEED in.raw"
+    $GEN -b $B -B $GENBITS -X $(( X * C )) -Y $Y -s $IMG_SEED $TMP/in.raw || exit 1
+    big_endian $S 0 < $TMP/in.raw > $TMP/in.be
+    case $FMT in
+        tif)
+            TW=0 ; [ $(( RANDOM % 2 )) -eq 0 ] && TW=$(( 1 + RANDOM % 16 ))
+            TH=$(( 1 + RANDOM % 16 ))
+            REVERSE=$(( RANDOM % 2 ))
+            HOW="tiles of $TW x $TH" ; [ $TW -eq 0 ] && HOW="strips of $TH rows"
+            [ $REVERSE -ne 0 ] && HOW="$HOW in reverse order"
+            make_tiff $TMP/in.$FMT $TW $TH $REVERSE ;;
+        pgm)
+            HOW="a comment and 12 bits"
+            { printf "P5\n# made by check.sh\n$X $Y\n4095\n" ; cat $TMP/in.be ; } > $TMP/in.$FMT ;;
+        fits)
+            HOW="a header of two blocks"
+            BZERO=0 ; [ $T = u16 ] && BZERO=1
+            {
+                fits_card SIMPLE T
+                fits_card BITPIX $( [ $T = f32 ] && echo -32 || echo $B )
+                fits_card NAXIS 3
+                fits_card NAXIS1 $X
+                fits_card NAXIS2 $Y
+                fits_card NAXIS3 1
+                [ $BZERO -ne 0 ] && fits_card BZERO 32768
+                for k in `seq 40`; do printf "%-80s" "COMMENT $k" ; done
+                printf "%-80s" END
+                head -c $(( 2 * 2880 - 80 * (47 + BZERO) )) /dev/zero | tr '\0' ' '
+                big_endian $S $BZERO < $TMP/in.raw
+            } > $TMP/in.$FMT ;;
+    esac
+    rm -f $TMP/ref.raw $TMP/out.raw
+    if ! $EXE --type $T -X $X -Y $Y -C $C $OPTS -o $TMP/ref.raw $TMP/in.raw > /dev/null 2>&1 ||
+       ! $EXE $OPTS -o $TMP/out.raw $TMP/in.$FMT > $TMP/out.log 2>&1 || ! cmp -s $TMP/ref.raw $TMP/out.raw ||
+       ! grep -q "^Data type\.* $T\$" $TMP/out.log ; then
+        echo "FAIL reading $FMT with $HOW: $EXE $OPTS -o out.raw in.$FMT"
+        echo "     where in.$FMT holds $T values, $X x $Y x $C, created by $CMD"
+        NFAIL=$(( NFAIL + 1 ))
+    else
+        NPASS_IO=$(( NPASS_IO + 1 ))
+    fi
+done
+
+## Packed values of 10, 12 or 14 bits, read whole or in bands of rows,
+## must give the same results as the same values stored as u16
+NPASS_PACKED=0
+for CASE in `seq $(( (NCASES + 4) / 5 ))`; do
+    LAYOUTS=(mipi10 mipi12 mipi14 lsb10 lsb12 lsb14)
+    L=${LAYOUTS[$(( RANDOM % 6 ))]}
+    BITS=${L: -2}
+    ## the rows are made of whole groups of values, as --stream requires
+    X=$(( 4 * (1 + RANDOM % 12) ))
+    Y=$(( 1 + RANDOM % 40 ))
+    R=$(( RANDOM % 5 ))
+    S=$(( 1 + RANDOM % 2 ))
+    OPTS="-r $R -s $S"
+    IMG_SEED=$RANDOM
+    $GEN -b 16 -P $L -X $X -Y $Y -s $IMG_SEED $TMP/in.packed || exit 1
+    $GEN -b 16 -B $BITS -X $X -Y $Y -s $IMG_SEED $TMP/in.raw || exit 1
+    rm -f $TMP/ref.raw
+    $EXE --type u16 --bits $BITS -X $X -Y $Y $OPTS -o $TMP/ref.raw $TMP/in.raw > /dev/null 2>&1
+    for HOW in "" "--stream --mem-budget $(( 2 * X * 2 * (2 * (R + S) + 1 + S * (RANDOM % 6)) ))"; do
+        rm -f $TMP/out.raw
+        if ! $EXE --packed $L -X $X -Y $Y $OPTS $HOW -o $TMP/out.raw $TMP/in.packed > /dev/null 2>&1 ||
+           ! cmp -s $TMP/ref.raw $TMP/out.raw ; then
+            echo "FAIL packed: $EXE --packed $L -X $X -Y $Y $OPTS $HOW -o out.raw in.packed"
+            echo "     where in.packed is created by $GEN -b 16 -P $L -X $X -Y $Y -s $IMG_SEED in.packed,"
+            echo "     and compared with the output of --type u16 --bits $BITS on $GEN -b 16 -B $BITS -X $X -Y $Y -s $IMG_SEED in.raw"
+            NFAIL=$(( NFAIL + 1 ))
+        else
+            NPASS_PACKED=$(( NPASS_PACKED + 1 ))
+        fi
+    done
+done
+
+## The images submitted with --submit to a daemon must be filtered
+## as by the program itself
+NPASS_DAEMON=0
+for CASE in `seq $(( (NCASES + 9) / 10 ))`; do
+    T=${TYPES[$(( RANDOM % 8 ))]}
+    B=${T:1}
+    X=$(( 1 + RANDOM % 40 ))
+    Y=$(( 1 + RANDOM % 40 ))
+    C=$(( 1 + RANDOM % 3 ))
+    GEOMETRY="--type $T -X $X -Y $Y -C $C"
+    OPTS="-r $(( RANDOM % 5 )) -s $(( 1 + RANDOM % 2 ))"
+    rm -f $TMP/daemon.sock
+    $EXE $GEOMETRY $OPTS --daemon $TMP/daemon.sock > $TMP/daemon.log 2>&1 &
+    DAEMON=$!
+    for k in `seq 50`; do
+        [ -S $TMP/daemon.sock ] && break
+        sleep 0.1
+    done
+    ## jobs whose images do not lie within the shared memory are
+    ## rejected, and the daemon keeps serving the next ones
+    if ! $TEST_DAEMON $TMP/daemon.sock $(( C * B / 8 )) ; then
+        echo "FAIL daemon: $TEST_DAEMON daemon.sock $(( C * B / 8 )), with $EXE $GEOMETRY $OPTS --daemon daemon.sock"
+        NFAIL=$(( NFAIL + 1 ))
+    fi
+    ## a few jobs in a row, with the same daemon
+    for JOB in 1 2; do
+        IMG_SEED=$RANDOM
+        $GEN -b $B -X $(( X * C )) -Y $Y -s $IMG_SEED $TMP/in.raw || exit 1
+        rm -f $TMP/ref.raw $TMP/out.raw
+        $EXE $GEOMETRY $OPTS -o $TMP/ref.raw $TMP/in.raw > /dev/null 2>&1
+        if ! $EXE $GEOMETRY --submit $TMP/daemon.sock -o $TMP/out.raw $TMP/in.raw > $TMP/out.log 2>&1 ||
+           ! cmp -s $TMP/ref.raw $TMP/out.raw ; then
+            echo "FAIL daemon: $EXE $GEOMETRY --submit daemon.sock in.raw, with $EXE $GEOMETRY $OPTS --daemon daemon.sock"
+            echo "     where in.raw is created by $GEN -b $B -X $(( X * C )) -Y $Y -s $IMG_SEED in.raw"
+            NFAIL=$(( NFAIL + 1 ))
+        else
+            NPASS_DAEMON=$(( NPASS_DAEMON + 1 ))
+        fi
+    done
+    kill $DAEMON
+    wait $DAEMON
+done
+
+## --autotune records the times of the configurations for the shape
+## of the image, with its significant bits, dilation, stride and post
+## operation; -a auto then chooses one of the measured configurations
+## for that shape, predicts one for another radius, and has no wisdom
+## for another stride or number of significant bits. The result is the
+## exact median.
+NPASS_TUNE=0
+for CASE in `seq $(( (NCASES + 49) / 50 ))`; do
+    T=${TYPES[$(( RANDOM % 3 ))]}
+    B=${T:1}
+    X=$(( 8 + RANDOM % 40 ))
+    Y=$(( 8 + RANDOM % 40 ))
+    R=$(( RANDOM % 3 ))
+    D=$(( 1 + RANDOM % 2 ))
+    S=$(( 1 + RANDOM % 2 ))
+    P=${POSTOPS[$(( RANDOM % 4 ))]}
+    ## the values have fewer significant bits than both shapes
+    NB=$(( B - 1 - RANDOM % 4 ))
+    OPTS="--type $T -X $X -Y $Y -d $D -p $P"
+    IMG_SEED=$RANDOM
+    $GEN -b $B -B $(( NB - 1 )) -X $X -Y $Y -s $IMG_SEED $TMP/in.raw || exit 1
+    rm -f $TMP/tune.wisdom
+    FAILED=""
+    if ! $EXE --wisdom $TMP/tune.wisdom --autotune $OPTS --bits $NB -r $R -s $S > /dev/null 2>&1 ||
+       ! grep -q "^$X $Y 1 $B $NB $R $D $S [0-9] omp-" $TMP/tune.wisdom ; then
+        FAILED="--autotune"
+    fi
+    for HOW in "measured $R $S $NB" "predicted $(( R + 2 )) $S $NB" "no-wisdom $R $(( S + 1 )) $NB" \
+               "no-wisdom $R $S $(( NB - 1 ))"; do
+        set -- $HOW
+        rm -f $TMP/ref.raw $TMP/out.raw
+        $EXE -a omp-reference $OPTS -r $2 -s $3 -o $TMP/ref.raw $TMP/in.raw > /dev/null 2>&1
+        if ! $EXE --wisdom $TMP/tune.wisdom -a auto $OPTS --bits $4 -r $2 -s $3 -o $TMP/out.raw $TMP/in.raw > $TMP/out.log 2>&1 ||
+           ! grep -q "^Autotune\.* ${1/-/ }" $TMP/out.log || ! cmp -s $TMP/ref.raw $TMP/out.raw ; then
+            FAILED="-a auto --bits $4 -r $2 -s $3, that should use the $1 configuration"
+        fi
+    done
+    if [ -n "$FAILED" ]; then
+        echo "FAIL autotune: $EXE --wisdom tune.wisdom $OPTS $FAILED, after --autotune --bits $NB -r $R -s $S"
+        echo "     where in.raw is created by $GEN -b $B -B $(( NB - 1 )) -X $X -Y $Y -s $IMG_SEED in.raw"
+        NFAIL=$(( NFAIL + 1 ))
+    else
+        NPASS_TUNE=$(( NPASS_TUNE + 1 ))
+    fi
+done
+
+for A in $CHECKED ; do
+    printf "%-24s %4d passed %4d skipped\n" $A ${NPASS[$A]:-0} ${NSKIP[$A]:-0}
+done
+printf "%-24s %4d passed\n" "file formats" $NPASS_IO
+printf "%-24s %4d passed\n" "packed values" $NPASS_PACKED
+printf "%-24s %4d passed\n" "daemon" $NPASS_DAEMON
+printf "%-24s %4d passed\n" "autotune" $NPASS_TUNE
+if [ $NFAIL -gt 0 ]; then
+    echo "$NFAIL FAILURES"
+    exit 1
+fi
+echo "All tests passed"
@@ -0,0 +1,174 @@
+/****************************************************************************
+ *
+ * checkpoint.c -- Record the progress of long jobs, so that they can be resumed
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/* fdatasync() and pwrite() are part of POSIX.1-2008 */
+#if _XOPEN_SOURCE < 700
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "checkpoint.h"
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Write `n` bytes of `buf` at offset `offset` of `fd`; return 0 on
+   success, -1 on error */
+static int write_at( int fd, const char *buf, size_t n, off_t offset )
+{
+    while (n > 0) {
+        const ssize_t k = pwrite(fd, buf, n, offset);
+        if (k < 0)
+            return -1;
+        buf += k;
+        n -= k;
+        offset += k;
+    }
+    return 0;
+}
+
+/* Read the flags of the checkpoint `path` of the job described by
+   `header` into `c->done`; a missing checkpoint has no complete bands.
+   Return the number of complete bands, or -1 on error */
+static int read_flags( checkpoint_t *c, const char *path, const char *header, char *err, size_t errlen )
+{
+    char line[128];
+    int ndone = 0;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        snprintf(err, errlen, "%s", strerror(errno));
+        return -1;
+    }
+    if (fgets(line, sizeof(line), f) == NULL || strcmp(line, header) != 0) {
+        snprintf(err, errlen, "the checkpoint belongs to a different job");
+        fclose(f);
+        return -1;
+    }
+    const size_t nread = fread(c->done, 1, c->nbands, f);
+    fclose(f);
+    for (int b=0; b<c->nbands; b++) {
+        if ((size_t)b >= nread || (c->done[b] != '0' && c->done[b] != '1')) {
+            snprintf(err, errlen, "the checkpoint is damaged");
+            return -1;
+        }
+        ndone += (c->done[b] == '1');
+    }
+    return ndone;
+}
+
+int checkpoint_open( checkpoint_t *c, const char *path, const char *key, int nbands,
+                     double interval, int resume, char *err, size_t errlen )
+{
+    char header[128], tmp[4096];
+    const int hlen = snprintf(header, sizeof(header), "median-filter-checkpoint %s %d\n", key, nbands);
+    int ndone = 0;
+
+    c->path = strdup(path);
+    c->fd = -1;
+    c->nbands = nbands;
+    c->done = (char*)malloc(nbands > 0 ? nbands : 1);
+    c->offset = hlen;
+    c->out = NULL;
+    c->size = 0;
+    c->interval = interval;
+    if (c->path == NULL || c->done == NULL) {
+        snprintf(err, errlen, "%s", strerror(ENOMEM));
+        goto fail;
+    }
+    memset(c->done, '0', nbands);
+    if (resume && (ndone = read_flags(c, path, header, err, errlen)) < 0)
+        goto fail;
+
+    /* The checkpoint is replaced as a whole, so that an interruption
+       never leaves a partial one */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    c->fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (c->fd < 0 ||
+        write_at(c->fd, header, hlen, 0) != 0 ||
+        write_at(c->fd, c->done, nbands, c->offset) != 0 ||
+        fdatasync(c->fd) != 0 ||
+        rename(tmp, path) != 0) {
+        snprintf(err, errlen, "%s", strerror(errno));
+        if (c->fd >= 0)
+            unlink(tmp);
+        goto fail;
+    }
+    c->saved = now();
+    return ndone;
+ fail:
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c->path);
+    free(c->done);
+    c->path = c->done = NULL;
+    c->fd = -1;
+    return -1;
+}
+
+int checkpoint_is_done( const checkpoint_t *c, int band )
+{
+    return (c->done[band] == '1');
+}
+
+int checkpoint_save( checkpoint_t *c )
+{
+    /* only the pages that have been modified are written */
+    if (c->size > 0 && msync(c->out, c->size, MS_SYNC) != 0)
+        return -1;
+    if (write_at(c->fd, c->done, c->nbands, c->offset) != 0 || fdatasync(c->fd) != 0)
+        return -1;
+    c->saved = now();
+    return 0;
+}
+
+int checkpoint_done( checkpoint_t *c, int band )
+{
+    c->done[band] = '1';
+    if (now() - c->saved >= c->interval)
+        return checkpoint_save(c);
+    return 0;
+}
+
+void checkpoint_close( checkpoint_t *c, int job_done )
+{
+    if (c->fd >= 0)
+        close(c->fd);
+    /* without the checkpoint, a crash must not lose the output */
+    if (job_done && c->path != NULL &&
+        (c->size == 0 || msync(c->out, c->size, MS_SYNC) == 0))
+        unlink(c->path);
+    free(c->path);
+    free(c->done);
+    c->path = c->done = NULL;
+    c->fd = -1;
+}
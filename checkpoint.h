@@ -0,0 +1,85 @@
+/****************************************************************************
+ *
+ * checkpoint.h -- Record the progress of long jobs, so that they can be resumed
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * A job with a large radius can take hours; to survive an
+ * interruption, the output image is mapped from its file (see
+ * mmap-io.h) and computed in bands of rows, and the bands that are
+ * complete are recorded in a checkpoint file. A job that is started
+ * again with the same checkpoint skips them. The checkpoint file is a
+ * line of text with the key of the job (see result_cache_key()) and
+ * the number of bands, followed by one character per band: '1' if the
+ * band is complete, '0' otherwise.
+ *
+ * Saving the checkpoint writes the modified pages of the output to
+ * the file first, and the flags of the bands afterwards, so that a band
+ * that is recorded as complete is in the output file even after a
+ * crash of the system. To keep the cost low, the checkpoint is saved
+ * at most once every `interval` seconds; the bands that are completed
+ * in the meantime are recorded by the next save, and are computed again
+ * if the job is interrupted before it.
+ */
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct {
+    char *path;
+    int fd;
+    int nbands;
+    char *done;         /* flags of the bands, as in the file */
+    off_t offset;       /* of the flags in the file */
+    void *out;          /* the output mapping, and its size in bytes;
+                           set by the caller once the output is mapped */
+    size_t size;
+    double interval;    /* minimum time between saves, in seconds */
+    double saved;       /* time of the last save */
+} checkpoint_t;
+
+/* Open the checkpoint file `path` of the job `key`, whose output is
+   computed in `nbands` bands. If `resume` is nonzero, the bands
+   recorded as complete by an existing checkpoint of the same job are
+   complete; otherwise, or if there is no checkpoint, no band is.
+   Return the number of complete bands, or -1 on error with the reason
+   in `err`, e.g., if the checkpoint belongs to a different job. */
+int checkpoint_open( checkpoint_t *c, const char *path, const char *key, int nbands,
+                     double interval, int resume, char *err, size_t errlen );
+
+/* Return nonzero if band `band` is complete */
+int checkpoint_is_done( const checkpoint_t *c, int band );
+
+/* Record that band `band` is complete, and save the checkpoint if the
+   last save is at least `interval` seconds old; return 0 on success,
+   -1 on error with errno set */
+int checkpoint_done( checkpoint_t *c, int band );
+
+/* Save the checkpoint now; return 0 on success, -1 on error with errno
+   set */
+int checkpoint_save( checkpoint_t *c );
+
+/* Close the checkpoint; if `job_done` is nonzero, the job is complete:
+   the output is written to the file, and the checkpoint file is
+   removed */
+void checkpoint_close( checkpoint_t *c, int job_done );
+
+#endif
@@ -0,0 +1,222 @@
+/****************************************************************************
+ *
+ * chunk-store.c -- Images stored as directories of chunk files
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/* pread() and pwrite() are not part of C99 */
+#if _XOPEN_SOURCE < 600
+#define _XOPEN_SOURCE 600
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "chunk-store.h"
+
+#define SUFFIX ".chunks"
+
+int chunk_store_is( const char *fname )
+{
+    size_t len = strlen(fname);
+    /* "dir.chunks/" is the same as "dir.chunks" */
+    while (len > 1 && fname[len-1] == '/')
+        len--;
+    return (len >= strlen(SUFFIX) && strncmp(fname + len - strlen(SUFFIX), SUFFIX, strlen(SUFFIX)) == 0);
+}
+
+/* Return the name of file `name` within the store; the result must be
+   freed by the caller */
+static char *store_file( const chunk_store_t *s, const char *name )
+{
+    const size_t len = strlen(s->path) + strlen(name) + 2;
+    char *result = (char*)malloc(len);
+    if (result != NULL)
+        snprintf(result, len, "%s/%s", s->path, name);
+    return result;
+}
+
+/* Return the name of the file of chunk (cx, cy) */
+static char *chunk_file( const chunk_store_t *s, int cx, int cy )
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%d.%d", cy, cx);
+    return store_file(s, name);
+}
+
+int chunk_store_open( chunk_store_t *s, const char *path, char *err, size_t errlen )
+{
+    memset(s, 0, sizeof(*s));
+    s->path = strdup(path);
+    char *meta = store_file(s, "meta");
+    FILE *f = (meta != NULL ? fopen(meta, "r") : NULL);
+    free(meta);
+    if (f == NULL) {
+        snprintf(err, errlen, "not a chunk store (can not open %s/meta)", path);
+        chunk_store_close(s);
+        return -1;
+    }
+    char line[128], key[32], value[64];
+    s->width = s->height = -1;
+    s->channels = 1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%31s %63[^\n]", key, value) < 2)
+            continue;
+        if (strcmp(key, "width") == 0) {
+            s->width = atoi(value);
+        } else if (strcmp(key, "height") == 0) {
+            s->height = atoi(value);
+        } else if (strcmp(key, "channels") == 0) {
+            s->channels = atoi(value);
+        } else if (strcmp(key, "bits") == 0) {
+            s->bits = atoi(value);
+        } else if (strcmp(key, "type") == 0) {
+            s->type = value_type_find(value);
+        } else if (strcmp(key, "chunk") == 0) {
+            if (sscanf(value, "%d %d", &s->chunk_width, &s->chunk_height) != 2)
+                s->chunk_width = 0;
+        }
+    }
+    fclose(f);
+    if (s->width < 0 || s->height < 0 || s->channels < 1 || s->type == NULL ||
+        s->chunk_width < 1 || s->chunk_height < 1 || s->bits < 0 || s->bits > s->type->bits) {
+        snprintf(err, errlen, "invalid metadata in %s/meta", path);
+        chunk_store_close(s);
+        return -1;
+    }
+    return 0;
+}
+
+int chunk_store_create( chunk_store_t *s, const char *path )
+{
+    free(s->path);
+    s->path = strdup(path);
+    if (s->path == NULL)
+        return -1;
+    if (mkdir(path, 0777) != 0 && errno != EEXIST)
+        return -1;
+    char *meta = store_file(s, "meta");
+    FILE *f = (meta != NULL ? fopen(meta, "w") : NULL);
+    free(meta);
+    if (f == NULL)
+        return -1;
+    fprintf(f, "width %d\nheight %d\nchannels %d\ntype %s\n",
+            s->width, s->height, s->channels, s->type->name);
+    if (s->bits > 0)
+        fprintf(f, "bits %d\n", s->bits);
+    fprintf(f, "chunk %d %d\n", s->chunk_width, s->chunk_height);
+    return (fclose(f) == 0 ? 0 : -1);
+}
+
+void chunk_store_close( chunk_store_t *s )
+{
+    free(s->path);
+    s->path = NULL;
+}
+
+int chunk_store_grid( const chunk_store_t *s, int dim )
+{
+    return (dim == 0 ?
+            (s->width + s->chunk_width - 1) / s->chunk_width :
+            (s->height + s->chunk_height - 1) / s->chunk_height);
+}
+
+/* Read or write exactly `n` bytes at position `pos` of `fd` */
+static int transfer( int fd, char *buf, size_t n, off_t pos, int write )
+{
+    while (n > 0) {
+        const ssize_t r = (write ? pwrite(fd, buf, n, pos) : pread(fd, buf, n, pos));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            if (r == 0)
+                errno = 0;
+            return -1;
+        }
+        buf += r;
+        pos += r;
+        n -= r;
+    }
+    return 0;
+}
+
+int chunk_store_read( const chunk_store_t *s, int x0, int y0, int w, int h,
+                      void *buf, size_t pitch )
+{
+    const size_t px = (size_t)s->channels * (s->type->bits / 8);
+    const size_t size = s->type->bits / 8;
+    const int cw = s->chunk_width, ch = s->chunk_height;
+
+    for (int cy = y0 / ch; cy * ch < y0 + h; cy++) {
+        for (int cx = x0 / cw; cx * cw < x0 + w; cx++) {
+            /* the part of the chunk that is inside the image, and the
+               part of the rectangle that is inside the chunk */
+            const int width = (s->width - cx*cw < cw ? s->width - cx*cw : cw);
+            const int xa = (x0 > cx*cw ? x0 : cx*cw);
+            const int xb = (x0 + w < cx*cw + width ? x0 + w : cx*cw + width);
+            const int ya = (y0 > cy*ch ? y0 : cy*ch);
+            const int yb = (y0 + h < (cy+1)*ch ? y0 + h : (cy+1)*ch);
+            char *fname = chunk_file(s, cx, cy);
+            const int fd = (fname != NULL ? open(fname, O_RDONLY) : -1);
+            free(fname);
+            if (fd < 0)
+                return -1;
+            int status = 0;
+            for (int y=ya; y<yb && status == 0; y++) {
+                char *dst = (char*)buf + (size_t)(y - y0) * pitch * size + (size_t)(xa - x0) * px;
+                const off_t pos = ((off_t)(y - cy*ch) * width + (xa - cx*cw)) * px;
+                status = transfer(fd, dst, (size_t)(xb - xa) * px, pos, 0);
+            }
+            const int err = errno;
+            close(fd);
+            if (status != 0) {
+                errno = err;
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int chunk_store_write( const chunk_store_t *s, int cx, int cy,
+                       const void *buf, size_t pitch )
+{
+    const size_t px = (size_t)s->channels * (s->type->bits / 8);
+    const size_t size = s->type->bits / 8;
+    const int cw = s->chunk_width, ch = s->chunk_height;
+    const int width = (s->width - cx*cw < cw ? s->width - cx*cw : cw);
+    const int height = (s->height - cy*ch < ch ? s->height - cy*ch : ch);
+    char *fname = chunk_file(s, cx, cy);
+    const int fd = (fname != NULL ? open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666) : -1);
+    free(fname);
+    if (fd < 0)
+        return -1;
+    int status = 0;
+    for (int y=0; y<height && status == 0; y++) {
+        status = transfer(fd, (char*)buf + (size_t)y * pitch * size, (size_t)width * px,
+                          (off_t)y * width * px, 1);
+    }
+    const int err = errno;
+    if (close(fd) != 0 && status == 0)
+        return -1;
+    errno = err;
+    return status;
+}
@@ -0,0 +1,86 @@
+/****************************************************************************
+ *
+ * chunk-store.h -- Images stored as directories of chunk files
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * A chunk store is a directory, whose name ends with ".chunks", that
+ * holds a 2D image split into chunks of chunk_width x chunk_height
+ * pixels. The directory contains:
+ *
+ * - a text file called "meta", made of lines of the form "key value",
+ *   with keys width, height, channels, type, bits (optional) and
+ *   chunk (two values: width and height);
+ *
+ * - a file for each chunk, called "i.j" for the chunk in row i and
+ *   column j of the grid of chunks (both starting at 0), that holds
+ *   the values of the pixels of the chunk that are inside the image,
+ *   row by row, as a raw file (i.e., in the byte order of the host).
+ *
+ * Any rectangle of the image can be read without reading the whole
+ * chunks that it overlaps, so that a chunk can be processed by
+ * fetching only the borders of its neighbors.
+ */
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <stddef.h>
+#include "keys.h"
+
+typedef struct {
+    char *path;
+    int width, height, channels;
+    const value_type_t *type;
+    int bits;           /* if > 0, the values have `bits` significant bits */
+    int chunk_width, chunk_height;
+} chunk_store_t;
+
+/* Return nonzero if `fname` is the name of a chunk store */
+int chunk_store_is( const char *fname );
+
+/* Open the chunk store `path`. Return 0 on success, -1 on error, with
+   a description of the error in `err`. */
+int chunk_store_open( chunk_store_t *s, const char *path, char *err, size_t errlen );
+
+/* Create the chunk store `path` (or replace the metadata of an
+   existing one) with the geometry given in `s`, whose `path` is
+   ignored. Return 0 on success, -1 on error with errno set. */
+int chunk_store_create( chunk_store_t *s, const char *path );
+
+/* Release the memory used by `s` */
+void chunk_store_close( chunk_store_t *s );
+
+/* Return the number of columns (`dim` == 0) or rows of the grid of
+   chunks of `s` */
+int chunk_store_grid( const chunk_store_t *s, int dim );
+
+/* Read the rectangle of w x h pixels at (x0, y0), that must be inside
+   the image, into `buf`, whose rows are `pitch` values apart. Return
+   0 on success, -1 on error with errno set (or 0 if a chunk is too
+   short). */
+int chunk_store_read( const chunk_store_t *s, int x0, int y0, int w, int h,
+                      void *buf, size_t pitch );
+
+/* Write the part of the chunk in row `cy` and column `cx` of the grid
+   that is inside the image from `buf`, whose rows are `pitch` values
+   apart. Return 0 on success, -1 on error with errno set. */
+int chunk_store_write( const chunk_store_t *s, int cx, int cy,
+                       const void *buf, size_t pitch );
+
+#endif
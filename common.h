@@ -22,27 +22,267 @@
 #define COMMON_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
 
+/* The algorithms are compiled once for each supported data type, with
+   -DBPP=8, 16 or 32, and the suffix _u8, _u16 or _u32 is appended to
+   the names of their external symbols, so that all instantiations can
+   be linked into the same program; see TYPED() below. Type-independent
+   code, such as the command-line interface, is compiled without BPP
+   and chooses the instantiation at run time. */
+#ifdef BPP
 #if BPP == 8
 typedef uint8_t data_t;
+#define DATA_SUFFIX u8
 #elif BPP == 16
 typedef uint16_t data_t;
-#else
+#define DATA_SUFFIX u16
+#elif BPP == 32
 typedef uint32_t data_t;
+#define DATA_SUFFIX u32
+#else
+#error "BPP must be 8, 16 or 32"
 #endif
 #define DATA_SIZE (sizeof(data_t))
+#define TYPED_PASTE(name, suffix) name ## _ ## suffix
+#define TYPED_EXPAND(name, suffix) TYPED_PASTE(name, suffix)
+/* Name of the instantiation of `name` for type data_t */
+#define TYPED(name) TYPED_EXPAND(name, DATA_SUFFIX)
+#endif
 #define DX 0
 #define DY 1
 #define DZ 2
 
-void median_filter_2D_sparse_byrow( const data_t *in, data_t *out, const int *dims, int ndims, int radius );
+/* Per-pixel operations that are applied to the median as soon as each
+   output row is computed; see postop.h */
+enum {
+    POSTOP_NONE = 0,        /* output the median */
+    POSTOP_RESIDUAL,        /* max(input - median, 0) */
+    POSTOP_ABS_RESIDUAL,    /* |input - median| */
+    POSTOP_MASK             /* 1 if |input - median| > threshold, 0 otherwise */
+};
+
+/* Global reductions computed together with the median */
+typedef struct {
+    uint64_t outliers;      /* number of samples with |input - median| > threshold */
+    double abs_residual;    /* sum of |input - median| */
+} median_filter_stats_t;
+
+/* A stage of a rank filter pipeline: the output of the stage is the
+   `percentile`-th percentile of the values within distance `radius`
+   from each pixel; see omp-rank-pipeline-2D.c */
+#define RANK_MEDIAN -1
+typedef struct {
+    int percentile; /* 0 (minimum) to 100 (maximum), or RANK_MEDIAN */
+    int radius;
+} rank_stage_t;
+
+/* Additional parameters of the median filter, shared by all
+   algorithms. Use `median_filter_opts_init()` to fill the structure
+   with default values. Pixel values are stored as uint32_t, so that the
+   same structure can be used with all data types; they must fit in
+   data_t. */
+typedef struct {
+    int channels;   /* number of interleaved channels per pixel (>= 1) */
+    int bits;       /* if > 0, all values are less than 2^bits; dense
+                       histograms are sized accordingly */
+    int dilation;   /* the window samples every `dilation`-th row and column (>= 1) */
+    int stride;     /* compute every `stride`-th output row and column (>= 1) */
+    int max_error;  /* error bound of the approximate algorithms; the unit
+                       depends on the algorithm */
+    int float_keys; /* nonzero if the values are the keys of floating
+                       point values (see keys.h); the algorithms that
+                       compute with the values, rather than compare
+                       them, decode the keys first */
+    int has_nodata; /* nonzero if values equal to `nodata` are missing samples */
+    uint32_t nodata; /* missing samples are excluded from the windows; windows
+                       without valid samples produce `nodata` */
+    int postop;     /* one of the POSTOP_xxx constants */
+    uint32_t threshold; /* threshold of POSTOP_MASK and of the outlier count */
+    int has_clamp;  /* nonzero if the output is clamped to [clamp_lo, clamp_hi] */
+    uint32_t clamp_lo, clamp_hi;
+    median_filter_stats_t *stats; /* if not NULL, global reductions are
+                                     accumulated here */
+    int stats_first, stats_last; /* only output rows stats_first ..
+                                    stats_last-1 are included in `stats`,
+                                    e.g., when the image is a band of a
+                                    larger one (default: all rows) */
+    int rows_first, rows_last; /* only output rows rows_first ..
+                                  rows_last-1 are computed, and the
+                                  other rows of the output are left
+                                  untouched, e.g., when the image is
+                                  filtered in bands (default: all
+                                  rows) */
+    int64_t row_origin, col_origin; /* position, in the whole image, of
+                                       the first input row and column,
+                                       e.g., when the image is a band or
+                                       a chunk of a larger one; the
+                                       randomized algorithms depend on
+                                       it (default: 0) */
+    const rank_stage_t *stages; /* stages of the rank filter pipeline */
+    int nstages;
+    size_t in_pitch, out_pitch; /* distance, in values, between the
+                                   first values of two consecutive rows
+                                   of the input and output images; 0
+                                   means that the rows are contiguous.
+                                   A larger pitch allows padded rows,
+                                   or a sub-rectangle of a larger image */
+    struct median_filter_workspace *workspace; /* if not NULL, temporary
+                                                  memory is taken from
+                                                  here; see workspace.h */
+} median_filter_opts_t;
+
+static inline void median_filter_opts_init( median_filter_opts_t *opts )
+{
+    opts->channels = 1;
+    opts->bits = 0;
+    opts->dilation = 1;
+    opts->stride = 1;
+    opts->max_error = 4;
+    opts->float_keys = 0;
+    opts->has_nodata = 0;
+    opts->nodata = 0;
+    opts->postop = POSTOP_NONE;
+    opts->threshold = 0;
+    opts->has_clamp = 0;
+    opts->clamp_lo = opts->clamp_hi = 0;
+    opts->stats = NULL;
+    opts->stats_first = 0;
+    opts->stats_last = INT_MAX;
+    opts->rows_first = 0;
+    opts->rows_last = INT_MAX;
+    opts->row_origin = opts->col_origin = 0;
+    opts->stages = NULL;
+    opts->nstages = 0;
+    opts->in_pitch = opts->out_pitch = 0;
+    opts->workspace = NULL;
+}
+
+/* Allocate and release the temporary memory of the algorithms, from
+   `opts->workspace` or with malloc() and free(); see workspace.h */
+#ifdef __cplusplus
+extern "C" {
+#endif
+void *median_filter_alloc( const median_filter_opts_t *opts, size_t size );
+void *median_filter_calloc( const median_filter_opts_t *opts, size_t n, size_t size );
+void median_filter_free( const median_filter_opts_t *opts, void *p );
+#ifdef __cplusplus
+}
+#endif
+
+/* Return the distance, in values, between consecutive rows of the
+   input image with dimensions `dims` */
+static inline size_t median_filter_in_pitch( const int *dims, const median_filter_opts_t *opts )
+{
+    return (opts->in_pitch > 0 ? opts->in_pitch : (size_t)dims[DX] * opts->channels);
+}
+
+/* Return the distance, in values, between consecutive rows of the
+   output image computed from an input with dimensions `dims` */
+static inline size_t median_filter_out_pitch( const int *dims, const median_filter_opts_t *opts )
+{
+    const int out_width = (dims[DX] + opts->stride - 1) / opts->stride;
+    return (opts->out_pitch > 0 ? opts->out_pitch : (size_t)out_width * opts->channels);
+}
+
+/* Return the pitch, in values, of buffers whose rows hold `n` values
+   of `size` bytes. When a row is a multiple of 512 bytes, the same
+   column of consecutive rows would be mapped to a few sets of the
+   caches, and the vertical neighbors of a pixel would evict each
+   other; in that case the rows are padded with one cache line, so
+   that their size is an odd number of cache lines. */
+#define MEDIAN_FILTER_CACHE_LINE 64
+static inline size_t median_filter_padded_pitch( size_t n, size_t size )
+{
+    return ((n * size) % 512 == 0 && n > 0 ? n + MEDIAN_FILTER_CACHE_LINE / size : n);
+}
+
+/* Store into `*first` and `*last` the output rows first .. last-1,
+   out of `out_height`, that are computed with options `opts` */
+static inline void median_filter_rows( const median_filter_opts_t *opts, int out_height, int *first, int *last )
+{
+    *first = (opts->rows_first > 0 ? opts->rows_first : 0);
+    *last = (opts->rows_last < out_height ? opts->rows_last : out_height);
+}
+
+#ifdef BPP
+/* Return the number of significant bits of the values */
+static inline int median_filter_bits( const median_filter_opts_t *opts )
+{
+    return (opts->bits > 0 ? opts->bits : 8*(int)DATA_SIZE);
+}
+
+/* Return a pointer to the no-data value converted to data_t, which is
+   stored in `*buf`, or NULL if there are no missing samples */
+static inline const data_t *median_filter_nodata( const median_filter_opts_t *opts, data_t *buf )
+{
+    *buf = (data_t)opts->nodata;
+    return (opts->has_nodata ? buf : NULL);
+}
+#endif
+
+/* Base-2 logarithm of the maximum number of bins of the coarse
+   histograms of the approximate algorithms; with more significant
+   bits, the bins are wider, and the error bound must be large
+   enough (see median_filter_check()) */
+#define COARSE_MAX_BITS 16
+
+/* Declare the instantiations of the algorithms for values of type `T`;
+   `S` is the suffix of their names */
+#define DECLARE_MEDIAN_FILTERS(T, S)                                    \
+    void median_filter_2D_sparse_byrow_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    void median_filter_2D_vector_l1_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    void median_filter_2D_vector_l2_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    void median_filter_2D_rank_pipeline_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    void median_filter_2D_reference_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    void median_filter_2D_vector_reference_l1_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    void median_filter_2D_vector_reference_l2_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    void median_filter_2D_approx_coarse_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    void median_filter_2D_approx_sample_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    void median_filter_2D_approx_separable_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    /* Describe the error bound guaranteed by the approximate algorithms */ \
+    void median_filter_2D_approx_coarse_bound_ ## S( int radius, const median_filter_opts_t *opts, char *buf, size_t len ); \
+    void median_filter_2D_approx_sample_bound_ ## S( int radius, const median_filter_opts_t *opts, char *buf, size_t len ); \
+    void median_filter_2D_approx_separable_bound_ ## S( int radius, const median_filter_opts_t *opts, char *buf, size_t len );
+
+#define DECLARE_CUDA_MEDIAN_FILTERS(T, S)                               \
+    void cuda_median_2D_hist_generic_ ## S( const T *in, T *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts ); \
+    /* Return nonzero if a CUDA device can be used */                  \
+    int cuda_median_available_ ## S( void );
+
+DECLARE_MEDIAN_FILTERS(uint8_t, u8)
+DECLARE_MEDIAN_FILTERS(uint16_t, u16)
+DECLARE_MEDIAN_FILTERS(uint32_t, u32)
 
 #ifdef __cplusplus
 extern "C" {
 #endif
-    void cuda_median_2D_hist_generic( const data_t *in, data_t *out, const int *dims, int ndims, int radius );
+    DECLARE_CUDA_MEDIAN_FILTERS(uint8_t, u8)
+    DECLARE_CUDA_MEDIAN_FILTERS(uint16_t, u16)
+    DECLARE_CUDA_MEDIAN_FILTERS(uint32_t, u32)
 #ifdef __cplusplus
 }
 #endif
 
+/* Within the instantiation for data_t, the algorithms are referred to
+   by their plain names */
+#ifdef BPP
+#define median_filter_2D_sparse_byrow TYPED(median_filter_2D_sparse_byrow)
+#define median_filter_2D_vector_l1 TYPED(median_filter_2D_vector_l1)
+#define median_filter_2D_vector_l2 TYPED(median_filter_2D_vector_l2)
+#define median_filter_2D_rank_pipeline TYPED(median_filter_2D_rank_pipeline)
+#define median_filter_2D_reference TYPED(median_filter_2D_reference)
+#define median_filter_2D_vector_reference_l1 TYPED(median_filter_2D_vector_reference_l1)
+#define median_filter_2D_vector_reference_l2 TYPED(median_filter_2D_vector_reference_l2)
+#define median_filter_2D_approx_coarse TYPED(median_filter_2D_approx_coarse)
+#define median_filter_2D_approx_sample TYPED(median_filter_2D_approx_sample)
+#define median_filter_2D_approx_separable TYPED(median_filter_2D_approx_separable)
+#define median_filter_2D_approx_coarse_bound TYPED(median_filter_2D_approx_coarse_bound)
+#define median_filter_2D_approx_sample_bound TYPED(median_filter_2D_approx_sample_bound)
+#define median_filter_2D_approx_separable_bound TYPED(median_filter_2D_approx_separable_bound)
+#define cuda_median_2D_hist_generic TYPED(cuda_median_2D_hist_generic)
+#define cuda_median_available TYPED(cuda_median_available)
+#endif
+
 #endif
@@ -25,8 +25,10 @@
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <limits.h>
 
 #include "common.h"
+#include "postop.h"
 
 // threads per CUDA block
 #define BLKDIM 1024
@@ -39,6 +41,9 @@
 
 #define HIST_SIZE 256
 
+// maximum size of the second dimension of a CUDA grid
+#define MAX_GRID_Y 65535
+
 /* The following kernel assumes that threads are organized into a 2D
    grid, and that there are as many threads as pixels in the extended
    image, i.e., image with ghost area.
@@ -48,10 +53,11 @@
    Image `out` must have size (width + 2*radius) * (height + 2*radius)
 
    `width` and `height` represent the size of the input image, and
-   must not include the ghost area.
+   must not include the ghost area. Each pixel is made of `channels`
+   interleaved values.
 */
 static __global__
-void init_ghost_area( const data_t *in, data_t *out, int width, int height, int radius )
+void init_ghost_area( const data_t *in, data_t *out, int width, int height, int radius, int channels )
 {
     // These coordinates refer to the output image (with ghost area)
     const int DST_X = threadIdx.x + blockIdx.x * blockDim.x;
@@ -75,7 +81,12 @@ void init_ghost_area( const data_t *in, data_t *out, int width, int height, int
     else if (SRC_Y >= height)
         SRC_Y = height-1;
 
-    out[DST_X + DST_Y*ext_width] = in[SRC_X + SRC_Y*width];
+    // Images may have more than 2^31 values
+    const size_t dst = ((size_t)DST_Y*ext_width + DST_X)*channels;
+    const size_t src = ((size_t)SRC_Y*width + SRC_X)*channels;
+    for (int c=0; c<channels; c++) {
+        out[dst + c] = in[src + c];
+    }
 }
 
 /**
@@ -96,8 +107,17 @@ void median_filter_kernel_generic( const data_t* in,
                                    data_t* out,
                                    const int WIDTH,
                                    const int HEIGHT,
-                                   const int radius )
+                                   const int radius,
+                                   const int ROW0,
+                                   const median_filter_opts_t OPTS,
+                                   median_filter_stats_t *stats )
 {
+    const int DILATION = OPTS.dilation;
+    const int STRIDE = OPTS.stride;
+    const int CHANNELS = OPTS.channels;
+    const int HAS_NODATA = OPTS.has_nodata;
+    const data_t NODATA = (data_t)OPTS.nodata;
+
     // ID of the current warp
     const int WARP_ID = threadIdx.x / WARP_SIZE;
     // ID of the thread within the warp (0 <= LAND_ID < WARP_SIZE)
@@ -109,29 +129,44 @@ void median_filter_kernel_generic( const data_t* in,
     // the histogram handled by the current warp
     int *warp_hist = &sh_hist[WARP_ID][0];
 
-    const int NPASSES = DATA_SIZE;
+    // One pass for each byte of the significant bits
+    const int NPASSES = ((OPTS.bits > 0 ? OPTS.bits : 8*(int)DATA_SIZE) + 7) / 8;
 
     __shared__ data_t mask[NUM_WARPS];
     __shared__ data_t key[NUM_WARPS];
     __shared__ int median_pos[NUM_WARPS];
+    __shared__ int nvalid[NUM_WARPS];
     __shared__ int shift_amount[NUM_WARPS];
 
-    // Pixel coordinates
+    // Pixel coordinates (in the output image); the grid covers the
+    // output rows starting from ROW0
     const int pixelX = threadIdx.x / WARP_SIZE + blockIdx.x * NUM_WARPS;
-    const int pixelY = threadIdx.y + blockIdx.y * blockDim.y;
-
-    if (pixelY >= HEIGHT || pixelX >= WIDTH)
+    const int pixelY = ROW0 + threadIdx.y + blockIdx.y * blockDim.y;
+    // Each channel is handled by a different layer of the grid
+    const int CHAN = blockIdx.z;
+    // Only every STRIDE-th row and column of the input is computed
+    const int OUT_WIDTH = (WIDTH + STRIDE - 1) / STRIDE;
+    const int OUT_HEIGHT = (HEIGHT + STRIDE - 1) / STRIDE;
+
+    if (pixelY >= OUT_HEIGHT || pixelX >= OUT_WIDTH)
         return;
 
-    const int WINDOW_L = (2 * radius) + 1;
+    // The window samples every DILATION-th row and column
+    const int NSAMP = radius / DILATION;
+    const int WINDOW_L = (2 * NSAMP) + 1;
     const int WINDOW_SIZE = WINDOW_L * WINDOW_L;
     const int EXT_WIDTH = (2 * radius) + WIDTH;
+    // The window of this pixel starts at `win`; offsets within the
+    // window fit in 32 bits (see the host code), and are cheaper to
+    // compute than 64-bit ones
+    const data_t *win = in + ((size_t)pixelY*STRIDE*EXT_WIDTH + (size_t)pixelX*STRIDE)*CHANNELS + CHAN;
 
     if (0 == LANE_ID) {
         shift_amount[WARP_ID] = 8*(NPASSES - 1);
         mask[WARP_ID] = 0;
         key[WARP_ID] = 0;
         median_pos[WARP_ID] = WINDOW_SIZE / 2;
+        nvalid[WARP_ID] = WINDOW_SIZE;
     }
     __syncwarp();
 
@@ -143,14 +178,16 @@ void median_filter_kernel_generic( const data_t* in,
 
         // Fill histogram; all threads in this warp contribute to
         // filling the histogram of the filter region centered at
-        // (pixelX, pixelY)
+        // (pixelX*STRIDE, pixelY*STRIDE)
         for (int i=LANE_ID; i<WINDOW_SIZE; i+=WARP_SIZE) {
-            // window pixel coords
-            const int win_pX = (i % WINDOW_L) + pixelX;
-            const int win_pY = (i / WINDOW_L) + pixelY;
-
-            const data_t val = in[win_pX + (win_pY * EXT_WIDTH)];
-            if ((val & mask[WARP_ID]) == key[WARP_ID]) {
+            // window pixel coords, relative to the top left corner
+            // of the window
+            const int win_pX = ((i % WINDOW_L) - NSAMP) * DILATION + radius;
+            const int win_pY = ((i / WINDOW_L) - NSAMP) * DILATION + radius;
+
+            const data_t val = win[(win_pX + (win_pY * EXT_WIDTH))*CHANNELS];
+            // No-data samples are never counted
+            if ((val & mask[WARP_ID]) == key[WARP_ID] && !(HAS_NODATA && val == NODATA)) {
                 const int idx = (val >> shift_amount[WARP_ID]) & 0xff;
                 atomicAdd(&warp_hist[idx], 1);
             }
@@ -160,6 +197,15 @@ void median_filter_kernel_generic( const data_t* in,
         // Search median from histogram (only the master of each warp)
         if (LANE_ID == 0) {
             int k=0;
+            if (HAS_NODATA && pass == 0) {
+                // The first pass counts all valid samples; the
+                // median is computed over them only
+                int total = 0;
+                for (k=0; k<HIST_SIZE; k++)
+                    total += warp_hist[k];
+                nvalid[WARP_ID] = total;
+                median_pos[WARP_ID] = total / 2;
+            }
             for (k=0; (k<HIST_SIZE-1) && (median_pos[WARP_ID] >= warp_hist[k]); k++)
                 median_pos[WARP_ID] -= warp_hist[k];
             key[WARP_ID] |= k << shift_amount[WARP_ID];
@@ -170,43 +216,102 @@ void median_filter_kernel_generic( const data_t* in,
     }
 
     if (0 == LANE_ID) {
-        out[pixelX + (pixelY * WIDTH)] = key[WARP_ID];
+        data_t result = (nvalid[WARP_ID] > 0 ? key[WARP_ID] : NODATA);
+        // Apply the post-operations, if any, to the median
+        const data_t center = win[(radius + radius * EXT_WIDTH)*CHANNELS];
+        if (!(HAS_NODATA && (center == NODATA || result == NODATA))) {
+            if (stats != NULL && pixelY >= OPTS.stats_first && pixelY < OPTS.stats_last) {
+                const data_t r = postop_abs_diff(center, result);
+                if (r > OPTS.threshold)
+                    atomicAdd((unsigned long long*)&(stats->outliers), 1ull);
+                atomicAdd(&(stats->abs_residual), (double)r);
+            }
+            result = postop_apply(&OPTS, center, result);
+        }
+        out[((size_t)pixelY * OUT_WIDTH + pixelX)*CHANNELS + CHAN] = result;
     }
 }
 
 extern "C"
 void cuda_median_2D_hist_generic( const data_t *in, data_t *out,
-                                  const int *dims, int ndims, int radius )
+                                  const int *dims, int ndims, int radius,
+                                  const median_filter_opts_t *opts )
 {
     data_t *d_in, *d_out;
+    median_filter_stats_t *d_stats = NULL;
 
     assert(ndims == 2);
     const int width = dims[DX];
     const int height = dims[DY];
+    const int channels = opts->channels;
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const int out_height = (height + stride - 1) / stride;
+    int row_first, row_last;
+    median_filter_rows(opts, out_height, &row_first, &row_last);
 
     const int EXT_WIDTH = (2 * radius) + width;
     const int EXT_HEIGHT = (2 * radius) + height;
 
-    const size_t SIZE = width * height * DATA_SIZE;
-    const size_t EXT_SIZE = EXT_WIDTH * EXT_HEIGHT * DATA_SIZE;
+    const size_t SIZE = (size_t)width * height * channels * DATA_SIZE;
+    const size_t EXT_SIZE = (size_t)EXT_WIDTH * EXT_HEIGHT * channels * DATA_SIZE;
+
+    // The kernel uses 32-bit offsets within each window
+    if ((size_t)(2*radius + 1) * EXT_WIDTH * channels > INT_MAX) {
+        fprintf(stderr, "FATAL: the image is too wide for radius %d\n", radius);
+        exit(EXIT_FAILURE);
+    }
 
     cudaSafeCall( cudaMalloc((void**)&d_in, EXT_SIZE) );
+    // `d_out` is also used to transfer the input image
     cudaSafeCall( cudaMalloc((void**)&d_out, SIZE) );
 
-    // Initialize the ghost area
-    cudaSafeCall( cudaMemcpy(d_out, in, SIZE, cudaMemcpyHostToDevice) );
+    // Initialize the ghost area; the rows of the host images may be
+    // padded (see opts->in_pitch), those on the device are contiguous
+    const size_t ROW_SIZE = (size_t)width * channels * DATA_SIZE;
+    const size_t OUT_ROW_SIZE = (size_t)out_width * channels * DATA_SIZE;
+    cudaSafeCall( cudaMemcpy2D(d_out, ROW_SIZE, in, median_filter_in_pitch(dims, opts) * DATA_SIZE,
+                               ROW_SIZE, height, cudaMemcpyHostToDevice) );
     const dim3 INIT_BLOCK(BLKDIM_2D, BLKDIM_2D);
     const dim3 INIT_GRID((EXT_WIDTH + BLKDIM_2D - 1) / BLKDIM_2D,
                          (EXT_HEIGHT + BLKDIM_2D - 1) / BLKDIM_2D);
-    init_ghost_area<<< INIT_GRID, INIT_BLOCK >>>(d_out, d_in, width, height, radius);
+    init_ghost_area<<< INIT_GRID, INIT_BLOCK >>>(d_out, d_in, width, height, radius, channels);
     cudaCheckError();
 
-    // Start computation
-    const dim3 GRID((width + NUM_WARPS - 1) / NUM_WARPS, height);
-    median_filter_kernel_generic<<< GRID, BLKDIM >>>(d_in, d_out, width, height, radius);
-    cudaCheckError();
-    cudaSafeCall( cudaMemcpy(out, d_out, SIZE, cudaMemcpyDeviceToHost) );
+    if (opts->stats != NULL) {
+        cudaSafeCall( cudaMalloc((void**)&d_stats, sizeof(*d_stats)) );
+        cudaSafeCall( cudaMemset(d_stats, 0, sizeof(*d_stats)) );
+    }
+
+    // Start computation; the second dimension of the grid can not
+    // exceed MAX_GRID_Y, so tall images are processed in bands
+    for (int row0 = row_first; row0 < row_last; row0 += MAX_GRID_Y) {
+        const int nrows = (row_last - row0 < MAX_GRID_Y ? row_last - row0 : MAX_GRID_Y);
+        const dim3 GRID((out_width + NUM_WARPS - 1) / NUM_WARPS, nrows, channels);
+        median_filter_kernel_generic<<< GRID, BLKDIM >>>(d_in, d_out, width, height, radius, row0, *opts, d_stats);
+        cudaCheckError();
+    }
+    if (row_last > row_first) {
+        const size_t out_pitch = median_filter_out_pitch(dims, opts);
+        cudaSafeCall( cudaMemcpy2D(out + (size_t)row_first * out_pitch, out_pitch * DATA_SIZE,
+                                   (char*)d_out + (size_t)row_first * OUT_ROW_SIZE, OUT_ROW_SIZE,
+                                   OUT_ROW_SIZE, row_last - row_first, cudaMemcpyDeviceToHost) );
+    }
+    if (d_stats != NULL) {
+        median_filter_stats_t stats;
+        cudaSafeCall( cudaMemcpy(&stats, d_stats, sizeof(stats), cudaMemcpyDeviceToHost) );
+        opts->stats->outliers += stats.outliers;
+        opts->stats->abs_residual += stats.abs_residual;
+        cudaFree(d_stats);
+    }
 
     cudaFree(d_in);
     cudaFree(d_out);
 }
+
+extern "C"
+int cuda_median_available( void )
+{
+    int n = 0;
+    return (cudaGetDeviceCount(&n) == cudaSuccess && n > 0);
+}
@@ -0,0 +1,443 @@
+/****************************************************************************
+ *
+ * daemon.c -- Filter images submitted through a Unix socket
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/* memfd_create() and the seals of shared memory are specific to
+   Linux */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemon.h"
+
+#define MAX_CLIENTS 64
+
+/* A job that has been admitted, with its shared memory mapped */
+typedef struct job {
+    daemon_job_t req;
+    int client;
+    char *mem;
+    size_t len;         /* bytes mapped */
+    size_t cost;        /* bytes counted against the budget */
+    struct job *next;
+} job_t;
+
+/* A connected client; its request is `pending` if it has been
+   received, but does not fit in the budget yet */
+typedef struct {
+    int sock;           /* -1 if the slot is free */
+    int pending;
+    daemon_job_t req;
+    int fd;             /* shared memory of the pending request */
+} client_t;
+
+typedef struct {
+    const daemon_config_t *config;
+    client_t clients[MAX_CLIENTS];
+    job_t *head, *tail; /* queue of the admitted jobs */
+    size_t used;        /* total cost of the queued jobs */
+    daemon_stats_t *stats;
+} server_t;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal( int sig )
+{
+    (void)sig;
+    stop = 1;
+}
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void drop_client( server_t *srv, int c );
+
+/* Send a reply to client `c`. The daemon serves all the clients, so
+   it never waits for one of them: a client whose replies do not fit
+   in its socket, because it does not read them, is dropped, together
+   with its jobs. */
+static void reply( server_t *srv, int c, uint32_t id, int status, const int *out_dims, double elapsed )
+{
+    daemon_reply_t r;
+    memset(&r, 0, sizeof(r));
+    r.magic = DAEMON_MAGIC;
+    r.id = id;
+    r.status = status;
+    r.out_width = (out_dims != NULL ? out_dims[0] : 0);
+    r.out_height = (out_dims != NULL ? out_dims[1] : 0);
+    r.elapsed = elapsed;
+    if (send(srv->clients[c].sock, &r, sizeof(r), MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)sizeof(r))
+        drop_client(srv, c);
+}
+
+/* Bytes of the input and output images of `req`; return -1 if they
+   overflow */
+static int job_sizes( const server_t *srv, const daemon_job_t *req, size_t *in_bytes, size_t *out_bytes )
+{
+    const size_t s = srv->config->stride, pixel_size = srv->config->pixel_size;
+    size_t n, out_n, total;
+    if (req->width < 1 || req->height < 1 ||
+        __builtin_mul_overflow((size_t)req->width, (size_t)req->height, &n) ||
+        __builtin_mul_overflow(n, pixel_size, in_bytes))
+        return -1;
+    out_n = ((size_t)(req->width - 1) / s + 1) * ((size_t)(req->height - 1) / s + 1);
+    return (__builtin_mul_overflow(out_n, pixel_size, out_bytes) ||
+            __builtin_add_overflow(*in_bytes, *out_bytes, &total) ? -1 : 0);
+}
+
+/* Try to admit the pending request of client `c`: the request is
+   either queued, rejected, or left pending if it does not fit in the
+   budget yet */
+static void admit( server_t *srv, int c )
+{
+    client_t *cl = &srv->clients[c];
+    const daemon_job_t *req = &cl->req;
+    const size_t align = srv->config->pixel_size;
+    size_t in_bytes = 0, out_bytes = 0, len = 0;
+    struct stat st;
+    int status = 0;
+
+    /* memory that the client could shrink while it is mapped would
+       kill the daemon with SIGBUS */
+    const int seals = fcntl(cl->fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+        status = EPERM;
+    } else if (job_sizes(srv, req, &in_bytes, &out_bytes) != 0 ||
+               req->in_offset % align != 0 || req->out_offset % align != 0 ||
+               fstat(cl->fd, &st) != 0 ||
+               /* the images must lie within the memory, which is
+                  checked without computing sums that could wrap */
+               req->in_offset > (uint64_t)st.st_size || in_bytes > (uint64_t)st.st_size - req->in_offset ||
+               req->out_offset > (uint64_t)st.st_size || out_bytes > (uint64_t)st.st_size - req->out_offset ||
+               (req->in_offset < req->out_offset + out_bytes && req->out_offset < req->in_offset + in_bytes)) {
+        status = EINVAL;
+    } else if (in_bytes + out_bytes > srv->config->budget) {
+        status = E2BIG;
+    } else if (srv->used + in_bytes + out_bytes > srv->config->budget) {
+        return;
+    }
+    const size_t cost = in_bytes + out_bytes;
+    job_t *job = NULL;
+    if (status == 0) {
+        const uint64_t in_end = req->in_offset + in_bytes, out_end = req->out_offset + out_bytes;
+        len = (in_end > out_end ? in_end : out_end);
+        char *mem = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, cl->fd, 0);
+        job = (mem != MAP_FAILED ? (job_t*)malloc(sizeof(*job)) : NULL);
+        if (job == NULL) {
+            status = errno;
+            if (mem != MAP_FAILED)
+                munmap(mem, len);
+        } else {
+            job->req = *req;
+            job->client = c;
+            job->mem = mem;
+            job->len = len;
+            job->cost = cost;
+            job->next = NULL;
+        }
+    }
+    close(cl->fd);
+    cl->pending = 0;
+    if (job == NULL) {
+        srv->stats->rejected++;
+        reply(srv, c, req->id, status, NULL, 0.0);
+        return;
+    }
+    if (srv->tail != NULL)
+        srv->tail->next = job;
+    else
+        srv->head = job;
+    srv->tail = job;
+    srv->used += cost;
+}
+
+static void job_free( server_t *srv, job_t *job )
+{
+    munmap(job->mem, job->len);
+    srv->used -= job->cost;
+    free(job);
+}
+
+/* Close client `c`, and discard its jobs */
+static void drop_client( server_t *srv, int c )
+{
+    client_t *cl = &srv->clients[c];
+    job_t **p = &srv->head;
+    srv->tail = NULL;
+    while (*p != NULL) {
+        if ((*p)->client == c) {
+            job_t *job = *p;
+            *p = job->next;
+            job_free(srv, job);
+        } else {
+            srv->tail = *p;
+            p = &(*p)->next;
+        }
+    }
+    if (cl->pending)
+        close(cl->fd);
+    close(cl->sock);
+    cl->sock = -1;
+    cl->pending = 0;
+}
+
+/* Receive a request from client `c`; return -1 if the client has
+   closed the connection */
+static int receive( server_t *srv, int c )
+{
+    client_t *cl = &srv->clients[c];
+    daemon_job_t req;
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    const ssize_t n = recvmsg(cl->sock, &msg, 0);
+    if (n <= 0)
+        return (n < 0 && errno == EINTR ? 0 : -1);
+    int fd = -1;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cm), sizeof(fd));
+    }
+    if (n != sizeof(req) || req.magic != DAEMON_MAGIC || fd < 0 || (msg.msg_flags & MSG_CTRUNC)) {
+        if (fd >= 0)
+            close(fd);
+        srv->stats->rejected++;
+        reply(srv, c, (n >= 8 ? req.id : 0), EINVAL, NULL, 0.0);
+        return 0;
+    }
+    cl->req = req;
+    cl->fd = fd;
+    cl->pending = 1;
+    admit(srv, c);
+    return 0;
+}
+
+/* Execute the first job of the queue */
+static void execute( server_t *srv )
+{
+    job_t *job = srv->head;
+    srv->head = job->next;
+    if (srv->head == NULL)
+        srv->tail = NULL;
+    const int dims[2] = {job->req.width, job->req.height};
+    const int s = srv->config->stride;
+    const int out_dims[2] = {(dims[0] - 1) / s + 1, (dims[1] - 1) / s + 1};
+    const int job_client = job->client;
+    const uint32_t job_id = job->req.id;
+    const double tstart = now();
+    const int status = srv->config->filter(srv->config->ctx, job->mem + job->req.in_offset,
+                                           job->mem + job->req.out_offset, dims);
+    const double elapsed = now() - tstart;
+    srv->stats->busy += elapsed;
+    srv->stats->jobs++;
+    job_free(srv, job);
+    reply(srv, job_client, job_id, status, out_dims, elapsed);
+}
+
+int daemon_serve( const char *path, const daemon_config_t *config, daemon_stats_t *stats )
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    /* the socket is bound to a temporary name, and renamed to `path`
+       once it is listening, so that the clients that find `path` can
+       connect to it */
+    char tmp_path[sizeof(addr.sun_path)];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, tmp_path);
+    const int lsock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (lsock < 0)
+        return -1;
+    unlink(tmp_path);
+    if (bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lsock, MAX_CLIENTS) != 0 ||
+        rename(tmp_path, path) != 0) {
+        const int err = errno;
+        close(lsock);
+        unlink(tmp_path);
+        errno = err;
+        return -1;
+    }
+
+    /* poll() is interrupted by the signals that stop the daemon */
+    struct sigaction sa, old_int, old_term;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+
+    server_t srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.config = config;
+    srv.stats = stats;
+    memset(stats, 0, sizeof(*stats));
+    for (int c=0; c<MAX_CLIENTS; c++) {
+        srv.clients[c].sock = -1;
+    }
+    struct pollfd fds[MAX_CLIENTS + 1];
+    int slot[MAX_CLIENTS + 1];
+    while (!stop) {
+        int nfds = 0, nclients = 0;
+        for (int c=0; c<MAX_CLIENTS; c++) {
+            if (srv.clients[c].sock >= 0) {
+                fds[nfds].fd = srv.clients[c].sock;
+                fds[nfds].events = (srv.clients[c].pending ? 0 : POLLIN);
+                slot[nfds++] = c;
+                nclients++;
+            }
+        }
+        if (nclients < MAX_CLIENTS) {
+            fds[nfds].fd = lsock;
+            fds[nfds].events = POLLIN;
+            slot[nfds++] = -1;
+        }
+        /* the queued jobs are executed between two polls */
+        if (poll(fds, nfds, (srv.head != NULL ? 0 : -1)) < 0 && errno != EINTR)
+            break;
+        for (int i=0; i<nfds && !stop; i++) {
+            const int c = slot[i];
+            if (c < 0 && (fds[i].revents & POLLIN)) {
+                const int sock = accept(lsock, NULL, NULL);
+                int free_slot = 0;
+                while (sock >= 0 && srv.clients[free_slot].sock >= 0)
+                    free_slot++;
+                if (sock >= 0)
+                    srv.clients[free_slot].sock = sock;
+            } else if (c >= 0 && (fds[i].revents & POLLIN)) {
+                if (receive(&srv, c) != 0)
+                    drop_client(&srv, c);
+            } else if (c >= 0 && (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL))) {
+                drop_client(&srv, c);
+            }
+        }
+        if (srv.head != NULL && !stop) {
+            execute(&srv);
+            /* the memory that has been released may admit the pending
+               requests */
+            for (int c=0; c<MAX_CLIENTS; c++) {
+                if (srv.clients[c].sock >= 0 && srv.clients[c].pending)
+                    admit(&srv, c);
+            }
+        }
+    }
+
+    for (int c=0; c<MAX_CLIENTS; c++) {
+        if (srv.clients[c].sock >= 0)
+            drop_client(&srv, c);
+    }
+    close(lsock);
+    unlink(path);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    stop = 0;
+    return 0;
+}
+
+int daemon_memory( size_t size )
+{
+    const int fd = memfd_create("median-filter-job", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd >= 0 && (ftruncate(fd, (off_t)size) != 0 ||
+                    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+int daemon_connect( const char *path )
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    const int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        const int err = errno;
+        close(sock);
+        errno = err;
+        return -1;
+    }
+    return sock;
+}
+
+int daemon_submit( int sock, const daemon_job_t *job, int fd )
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {(void*)job, sizeof(*job)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(fd));
+    return (sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(*job) ? 0 : -1);
+}
+
+int daemon_wait( int sock, daemon_reply_t *reply )
+{
+    ssize_t n;
+    do {
+        n = recv(sock, reply, sizeof(*reply), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)sizeof(*reply)) {
+        if (n >= 0)
+            errno = 0;
+        return -1;
+    }
+    return 0;
+}
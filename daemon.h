@@ -0,0 +1,112 @@
+/****************************************************************************
+ *
+ * daemon.h -- Filter images submitted through a Unix socket
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * In daemon mode, the program listens on a Unix socket of type
+ * SOCK_SEQPACKET. A client submits a job by sending a daemon_job_t,
+ * together with a file descriptor of shared memory (e.g., created with
+ * daemon_memory()) passed as SCM_RIGHTS ancillary data. The memory
+ * must be a memfd sealed with F_SEAL_SHRINK, so that the client can
+ * not truncate it while the daemon accesses it; jobs in other memory
+ * are rejected with status EPERM.
+ * The shared memory holds the input image at `in_offset`, and receives
+ * the output image at `out_offset`; both are raw images of the data
+ * type and channels of the daemon, and must not overlap. The daemon
+ * maps the memory, filters the image without copying it, and sends back
+ * a daemon_reply_t with the same `id`. A client may submit several jobs
+ * without waiting for the replies; the jobs of all clients are executed
+ * one at a time, in the order they arrive, by all the threads.
+ * The daemon never waits for a client to read its replies: a client
+ * whose replies no longer fit in its socket is disconnected, and its
+ * queued jobs are discarded.
+ *
+ * Memory admission is bounded: a job costs the bytes of its input and
+ * output, and jobs are admitted only while the total cost of the jobs
+ * in the queue does not exceed the budget. The requests of a client
+ * whose job does not fit are not read until enough jobs complete, so
+ * that the client is blocked by the socket; a job that is larger than
+ * the whole budget is rejected with status E2BIG.
+ */
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DAEMON_MAGIC 0x4d464a31 /* "MFJ1" */
+
+typedef struct {
+    uint32_t magic;         /* DAEMON_MAGIC */
+    uint32_t id;            /* chosen by the client, returned in the reply */
+    int32_t width, height;  /* geometry of the input image */
+    uint64_t in_offset;     /* position of the input in the shared memory */
+    uint64_t out_offset;    /* position of the output in the shared memory */
+} daemon_job_t;
+
+typedef struct {
+    uint32_t magic;         /* DAEMON_MAGIC */
+    uint32_t id;            /* that of the job */
+    int32_t status;         /* 0 on success, otherwise an errno value */
+    int32_t out_width, out_height;
+    double elapsed;         /* time spent filtering, in seconds */
+} daemon_reply_t;
+
+/* Filter the `dims[0]` x `dims[1]` image `in` into `out`; return 0 on
+   success, otherwise an errno value */
+typedef int (*daemon_filter_t)( void *ctx, void *in, void *out, const int *dims );
+
+typedef struct {
+    size_t pixel_size;      /* bytes per pixel, i.e., of all channels */
+    int stride;             /* stride of the output */
+    size_t budget;          /* maximum bytes of the queued jobs */
+    daemon_filter_t filter;
+    void *ctx;              /* first argument of `filter` */
+} daemon_config_t;
+
+typedef struct {
+    unsigned long jobs;     /* jobs completed */
+    unsigned long rejected; /* invalid requests */
+    double busy;            /* time spent filtering */
+} daemon_stats_t;
+
+/* Serve the jobs submitted to the socket `path` until SIGINT or
+   SIGTERM is received; the socket is then removed. Return 0 on
+   success, -1 if the socket can not be created, with errno set. */
+int daemon_serve( const char *path, const daemon_config_t *config, daemon_stats_t *stats );
+
+/* Create shared memory of `size` bytes for the jobs of the daemon,
+   sealed so that its size can not change; return its file descriptor,
+   or -1 with errno set */
+int daemon_memory( size_t size );
+
+/* Connect to the daemon listening on `path`; return the socket, or -1
+   with errno set */
+int daemon_connect( const char *path );
+
+/* Submit `job` to the daemon connected to `sock`, with the shared
+   memory `fd`; return 0 on success, -1 with errno set */
+int daemon_submit( int sock, const daemon_job_t *job, int fd );
+
+/* Wait for the next reply from the daemon connected to `sock`; return
+   0 on success, -1 with errno set (or 0 if the daemon has exited) */
+int daemon_wait( int sock, daemon_reply_t *reply );
+
+#endif
@@ -51,6 +51,10 @@ typedef struct HistNode {
 
 struct Hist {
     HistNode *root;
+    /* nodes that have been removed from the tree are kept in a list,
+       linked by `right`, and reused by later insertions */
+    HistNode *free_nodes;
+    const median_filter_opts_t *opts; /* the memory is allocated with these options */
 };
 
 #ifndef NDEBUG
@@ -115,11 +119,15 @@ static void update_counts_to_root( HistNode *n )
 }
 
 
-static HistNode *hist_new_node( data_t k, int count,
+static HistNode *hist_new_node( Hist *H, data_t k, int count,
                                 HistNode *parent,
                                 HistNode *left, HistNode *right)
 {
-    HistNode *n = (HistNode*)malloc(sizeof(*n));
+    HistNode *n = H->free_nodes;
+    if (n != NULL)
+        H->free_nodes = n->right;
+    else
+        n = (HistNode*)median_filter_alloc(H->opts, sizeof(*n));
     assert(n != NULL);
     n->key = k;
     n->count = count;
@@ -130,21 +138,30 @@ static HistNode *hist_new_node( data_t k, int count,
     return n;
 }
 
-Hist *hist_create( void )
+/* Put node `n` in the list of free nodes of `H` */
+static void hist_free_node( Hist *H, HistNode *n )
 {
-    Hist *H = (Hist*)malloc(sizeof(*H));
+    n->right = H->free_nodes;
+    H->free_nodes = n;
+}
+
+Hist *hist_create( const median_filter_opts_t *opts )
+{
+    Hist *H = (Hist*)median_filter_alloc(opts, sizeof(*H));
     assert(H != NULL);
 
     H->root = NULL;
+    H->free_nodes = NULL;
+    H->opts = opts;
     return H;
 }
 
-static void hist_clear_rec(HistNode *n)
+static void hist_clear_rec(Hist *H, HistNode *n)
 {
     if (n != NULL) {
-        hist_clear_rec(n->left);
-        hist_clear_rec(n->right);
-        free(n);
+        hist_clear_rec(H, n->left);
+        hist_clear_rec(H, n->right);
+        hist_free_node(H, n);
     }
 }
 
@@ -152,7 +169,7 @@ void hist_clear(Hist *H)
 {
     assert(H != NULL);
 
-    hist_clear_rec(H->root);
+    hist_clear_rec(H, H->root);
     H->root = NULL;
     hist_check(H);
 }
@@ -160,21 +177,26 @@ void hist_clear(Hist *H)
 void hist_destroy(Hist *H)
 {
     hist_clear(H);
-    free(H);
+    while (H->free_nodes != NULL) {
+        HistNode *n = H->free_nodes;
+        H->free_nodes = n->right;
+        median_filter_free(H->opts, n);
+    }
+    median_filter_free(H->opts, H);
 }
 
 
 /* Insert c>=0 additional instances of key `k` in the subtree rooted at
    `n`. */
-static HistNode *hist_insert_rec(HistNode *n, HistNode *p, data_t k, int c)
+static HistNode *hist_insert_rec(Hist *H, HistNode *n, HistNode *p, data_t k, int c)
 {
     if (n == NULL) {
-        n = hist_new_node(k, c, p, NULL, NULL);
+        n = hist_new_node(H, k, c, p, NULL, NULL);
     } else {
         if (k < n->key) {
-            n->left = hist_insert_rec(n->left, n, k, c);
+            n->left = hist_insert_rec(H, n->left, n, k, c);
         } else if (k > n->key) {
-            n->right = hist_insert_rec(n->right, n, k, c);
+            n->right = hist_insert_rec(H, n->right, n, k, c);
         } else {
             n->count += c;
         }
@@ -192,7 +214,7 @@ void hist_insert(Hist *H, data_t k, int c)
     assert(c>=0);
 
     if (c > 0) {
-        H->root = hist_insert_rec(H->root, NULL, k, c);
+        H->root = hist_insert_rec(H, H->root, NULL, k, c);
         /* hist_pretty_print(H); */
         hist_check(H);
     }
@@ -284,7 +306,7 @@ void hist_delete(Hist *H, data_t v, int c)
             min_of_right->left = n->left;
             min_of_right->left->parent = min_of_right;
         }
-        free(n);
+        hist_free_node(H, n);
         update_counts_to_root(update_from);
     }
     hist_check(H);
@@ -332,7 +354,7 @@ int hist_is_empty(const Hist *H)
     return ( (H->root == NULL) || (H->root->counts == 0) );
 }
 
-void hist_add_rec( Hist *H, const HistNode *n)
+static void hist_add_rec( Hist *H, const HistNode *n)
 {
     if (n != NULL) {
         hist_insert(H, n->key, n->count);
@@ -347,7 +369,7 @@ void hist_add(Hist *H1, const Hist *H2)
 }
 
 
-void hist_sub_rec( Hist *H, const HistNode *n)
+static void hist_sub_rec( Hist *H, const HistNode *n)
 {
     if (n != NULL) {
         hist_delete(H, n->key, n->count);
@@ -361,14 +383,27 @@ void hist_sub(Hist *H1, const Hist *H2)
     hist_sub_rec(H1, H2->root);
 }
 
+int hist_count(const Hist *H)
+{
+    assert(H != NULL);
+
+    return (H->root == NULL ? 0 : H->root->counts);
+}
+
 data_t hist_median(const Hist *H)
 {
-    int target;
+    assert(H->root != NULL); /* can not find median of empty set */
+
+    return hist_nth(H, H->root->counts / 2);
+}
+
+data_t hist_nth(const Hist *H, int target)
+{
     const HistNode *n = H->root;
 
-    assert(n != NULL); /* can not find median of empty set */
+    assert(n != NULL); /* can not select from empty set */
+    assert(0 <= target && target < n->counts);
 
-    target = H->root->counts / 2;
     while (1) {
         int counts_left = 0;
         assert(n != NULL);
@@ -27,8 +27,26 @@
 
 typedef struct Hist Hist;
 
-/* Restituisce un nuovo istogramma inizialmente vuoto */
-Hist *hist_create( void );
+/* The histogram is compiled once for each data type (see common.h) */
+#define hist_create TYPED(hist_create)
+#define hist_clear TYPED(hist_clear)
+#define hist_destroy TYPED(hist_destroy)
+#define hist_insert TYPED(hist_insert)
+#define hist_get TYPED(hist_get)
+#define hist_delete TYPED(hist_delete)
+#define hist_is_empty TYPED(hist_is_empty)
+#define hist_print TYPED(hist_print)
+#define hist_pretty_print TYPED(hist_pretty_print)
+#define hist_add TYPED(hist_add)
+#define hist_sub TYPED(hist_sub)
+#define hist_median TYPED(hist_median)
+#define hist_nth TYPED(hist_nth)
+#define hist_count TYPED(hist_count)
+
+/* Restituisce un nuovo istogramma inizialmente vuoto. La memoria
+   viene allocata con median_filter_alloc(opts, ...), quindi `opts`
+   deve restare valido finché l'istogramma non viene distrutto. */
+Hist *hist_create( const median_filter_opts_t *opts );
 
 /* Svuota l'istogramma. */
 void hist_clear(Hist *H);
@@ -71,4 +89,12 @@ void hist_sub(Hist *H1, const Hist *H2);
    deve essere vuoto. */
 data_t hist_median(const Hist *H);
 
+/* Return the `k`-th smallest value in `H` (0 <= k < hist_count(H));
+   the histogram must not be empty. The median is the element with
+   k = hist_count(H)/2. */
+data_t hist_nth(const Hist *H, int k);
+
+/* Return the total number of occurrences of all values in `H`. */
+int hist_count(const Hist *H);
+
 #endif
@@ -0,0 +1,715 @@
+/****************************************************************************
+ *
+ * image-io.c -- Headers of PNM, TIFF and FITS images
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/* fseeko() and pread() are not part of C99 */
+#if _XOPEN_SOURCE < 600
+#define _XOPEN_SOURCE 600
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "image-io.h"
+
+static const struct {
+    const char *ext;
+    image_format_t format;
+} extensions[] = { {".pgm", IMAGE_PNM}, {".ppm", IMAGE_PNM}, {".pnm", IMAGE_PNM},
+                   {".tif", IMAGE_TIFF}, {".tiff", IMAGE_TIFF},
+                   {".fits", IMAGE_FITS}, {".fit", IMAGE_FITS}, {".fts", IMAGE_FITS},
+                   {NULL, IMAGE_RAW} };
+
+image_format_t image_format_of( const char *fname )
+{
+    const char *dot = strrchr(fname, '.');
+    if (dot != NULL) {
+        for (int i=0; extensions[i].ext; i++) {
+            if (strcasecmp(dot, extensions[i].ext) == 0)
+                return extensions[i].format;
+        }
+    }
+    return IMAGE_RAW;
+}
+
+const char *image_format_name( image_format_t f )
+{
+    static const char *names[] = {"raw", "PNM", "TIFF", "FITS"};
+    return names[f];
+}
+
+static int host_big_endian( void )
+{
+    const uint16_t one = 1;
+    return *(const uint8_t*)&one == 0;
+}
+
+/* Return the data type with `bits` bits of the given kind */
+static const value_type_t *find_type( value_kind_t kind, int bits )
+{
+    char name[16];
+    snprintf(name, sizeof(name), "%c%d", (kind == VALUE_UNSIGNED ? 'u' : (kind == VALUE_SIGNED ? 'i' : 'f')), bits);
+    return value_type_find(name);
+}
+
+static void init_info( image_info_t *info, image_format_t format )
+{
+    memset(info, 0, sizeof(*info));
+    info->format = format;
+    info->channels = 1;
+    info->contiguous = 1;
+}
+
+/****************************************************************************
+ * PNM
+ ****************************************************************************/
+
+/* Read the next decimal number of a PNM header, skipping blanks and
+   comments; return -1 on error */
+static long pnm_number( FILE *f )
+{
+    int c = fgetc(f);
+    while (c == '#' || isspace(c)) {
+        if (c == '#') {
+            while (c != '\n' && c != EOF)
+                c = fgetc(f);
+        }
+        c = fgetc(f);
+    }
+    if (!isdigit(c))
+        return -1;
+    long v = 0;
+    while (isdigit(c) && v < 1000000000L) {
+        v = v * 10 + (c - '0');
+        c = fgetc(f);
+    }
+    /* a single blank follows the header */
+    return (isspace(c) ? v : -1);
+}
+
+static int pnm_read_header( FILE *f, image_info_t *info, char *err, size_t errlen )
+{
+    char magic[2];
+    if (fread(magic, 1, 2, f) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6')) {
+        snprintf(err, errlen, "not a binary PGM (P5) or PPM (P6) file");
+        return -1;
+    }
+    const long width = pnm_number(f);
+    const long height = pnm_number(f);
+    const long maxval = pnm_number(f);
+    if (width < 0 || height < 0 || maxval < 1 || maxval > 65535) {
+        snprintf(err, errlen, "invalid PNM header");
+        return -1;
+    }
+    info->width = width;
+    info->height = height;
+    info->channels = (magic[1] == '6' ? 3 : 1);
+    info->type = find_type(VALUE_UNSIGNED, maxval < 256 ? 8 : 16);
+    info->big_endian = (maxval >= 256);
+    /* e.g., 12-bit images have maxval 4095 */
+    info->bits = 0;
+    while (info->bits < 16 && (1L << info->bits) <= maxval)
+        info->bits++;
+    info->offset = ftello(f);
+    return 0;
+}
+
+/****************************************************************************
+ * TIFF
+ ****************************************************************************/
+
+enum {
+    TIFF_SHORT = 3,
+    TIFF_LONG = 4,
+    TIFF_IMAGE_WIDTH = 256,
+    TIFF_IMAGE_LENGTH = 257,
+    TIFF_BITS_PER_SAMPLE = 258,
+    TIFF_COMPRESSION = 259,
+    TIFF_PHOTOMETRIC = 262,
+    TIFF_STRIP_OFFSETS = 273,
+    TIFF_SAMPLES_PER_PIXEL = 277,
+    TIFF_ROWS_PER_STRIP = 278,
+    TIFF_STRIP_BYTE_COUNTS = 279,
+    TIFF_PLANAR_CONFIG = 284,
+    TIFF_TILE_WIDTH = 322,
+    TIFF_TILE_LENGTH = 323,
+    TIFF_TILE_OFFSETS = 324,
+    TIFF_TILE_BYTE_COUNTS = 325,
+    TIFF_EXTRA_SAMPLES = 338,
+    TIFF_SAMPLE_FORMAT = 339
+};
+
+typedef struct {
+    FILE *f;
+    int big_endian;
+    uint64_t size;      /* size of the file, in bytes */
+} tiff_reader_t;
+
+static uint32_t tiff_get( const tiff_reader_t *r, const uint8_t *p, int size )
+{
+    uint32_t v = 0;
+    for (int i=0; i<size; i++) {
+        v |= (uint32_t)p[r->big_endian ? size-1-i : i] << (8*i);
+    }
+    return v;
+}
+
+/* Read the `count` values of an IFD entry of type SHORT or LONG, whose
+   value (or offset) field is `field`, into `v`; return 0 on success, -1
+   if the values do not fit in the field, nor in the file */
+static int tiff_values( const tiff_reader_t *r, int type, uint32_t count,
+                        const uint8_t *field, uint64_t *v )
+{
+    const int size = (type == TIFF_SHORT ? 2 : 4);
+    if (type != TIFF_SHORT && type != TIFF_LONG)
+        return -1;
+    const uint64_t nbytes = (uint64_t)count * size;
+    if (nbytes <= 4) {
+        for (uint32_t i=0; i<count; i++) {
+            v[i] = tiff_get(r, field + i*size, size);
+        }
+        return 0;
+    }
+    uint8_t buf[4];
+    const uint64_t offset = tiff_get(r, field, 4);
+    if (offset > r->size || nbytes > r->size - offset || fseeko(r->f, offset, SEEK_SET) != 0)
+        return -1;
+    for (uint32_t i=0; i<count; i++) {
+        if (fread(buf, size, 1, r->f) != 1)
+            return -1;
+        v[i] = tiff_get(r, buf, size);
+    }
+    return 0;
+}
+
+static int tiff_read_header( FILE *f, image_info_t *info, char *err, size_t errlen )
+{
+    tiff_reader_t r = {f, 0, 0};
+    uint8_t hdr[8];
+    if (fread(hdr, 1, 8, f) != 8 || !((hdr[0] == 'I' && hdr[1] == 'I') || (hdr[0] == 'M' && hdr[1] == 'M'))) {
+        snprintf(err, errlen, "not a TIFF file");
+        return -1;
+    }
+    r.big_endian = (hdr[0] == 'M');
+    if (tiff_get(&r, hdr + 2, 2) != 42) {
+        snprintf(err, errlen, "not a TIFF file (BigTIFF is not supported)");
+        return -1;
+    }
+    uint8_t nbuf[2];
+    const off_t size = (fseeko(f, 0, SEEK_END) == 0 ? ftello(f) : -1);
+    r.size = (size > 0 ? (uint64_t)size : 0);
+    if (fseeko(f, tiff_get(&r, hdr + 4, 4), SEEK_SET) != 0 || fread(nbuf, 1, 2, f) != 2) {
+        snprintf(err, errlen, "truncated TIFF file");
+        return -1;
+    }
+    const int nentries = tiff_get(&r, nbuf, 2);
+    uint8_t *ifd = (uint8_t*)malloc((size_t)nentries * 12);
+    if (ifd == NULL || fread(ifd, 12, nentries, f) != (size_t)nentries) {
+        free(ifd);
+        snprintf(err, errlen, "truncated TIFF file");
+        return -1;
+    }
+
+    uint64_t width = 0, height = 0, bps = 1, spp = 1, compression = 1, planar = 1;
+    uint64_t rows_per_strip = UINT32_MAX, tile_width = 0, tile_height = 0, format = 1;
+    /* the offsets and sizes of the strips or tiles are read once their
+       number is known */
+    const uint8_t *offsets_entry = NULL, *counts_entry = NULL;
+    int status = 0;
+    for (int i=0; i<nentries && status == 0; i++) {
+        const uint8_t *e = ifd + 12*i;
+        const int tag = tiff_get(&r, e, 2);
+        const int type = tiff_get(&r, e + 2, 2);
+        const uint32_t count = tiff_get(&r, e + 4, 4);
+        uint64_t *dst = NULL;
+        switch (tag) {
+        case TIFF_IMAGE_WIDTH: dst = &width; break;
+        case TIFF_IMAGE_LENGTH: dst = &height; break;
+        case TIFF_COMPRESSION: dst = &compression; break;
+        case TIFF_SAMPLES_PER_PIXEL: dst = &spp; break;
+        case TIFF_ROWS_PER_STRIP: dst = &rows_per_strip; break;
+        case TIFF_PLANAR_CONFIG: dst = &planar; break;
+        case TIFF_TILE_WIDTH: dst = &tile_width; break;
+        case TIFF_TILE_LENGTH: dst = &tile_height; break;
+        case TIFF_BITS_PER_SAMPLE:
+        case TIFF_SAMPLE_FORMAT: {
+            /* all samples must have the same size and format */
+            uint64_t v[16];
+            if (count < 1 || count > 16 || tiff_values(&r, type, count, e + 8, v) != 0) {
+                status = -1;
+                break;
+            }
+            for (uint32_t k=1; k<count; k++) {
+                if (v[k] != v[0])
+                    status = -1;
+            }
+            *(tag == TIFF_BITS_PER_SAMPLE ? &bps : &format) = v[0];
+            break;
+        }
+        case TIFF_STRIP_OFFSETS:
+        case TIFF_TILE_OFFSETS:
+            offsets_entry = e;
+            break;
+        case TIFF_STRIP_BYTE_COUNTS:
+        case TIFF_TILE_BYTE_COUNTS:
+            counts_entry = e;
+            break;
+        default:
+            break;
+        }
+        if (dst != NULL && (count != 1 || tiff_values(&r, type, 1, e + 8, dst) != 0))
+            status = -1;
+    }
+
+    const value_kind_t kind = (format == 2 ? VALUE_SIGNED : (format == 3 ? VALUE_FLOAT : VALUE_UNSIGNED));
+    if (status != 0) {
+        snprintf(err, errlen, "invalid TIFF directory");
+    } else if (compression != 1) {
+        snprintf(err, errlen, "compressed TIFF images are not supported");
+        status = -1;
+    } else if (spp > 1 && planar != 1) {
+        snprintf(err, errlen, "planar TIFF images are not supported");
+        status = -1;
+    } else if (format < 1 || format > 3 || (info->type = find_type(kind, (int)bps)) == NULL) {
+        snprintf(err, errlen, "unsupported TIFF sample format (%d bits, format %d)", (int)bps, (int)format);
+        status = -1;
+    } else if (width < 1 || height < 1 || width > INT32_MAX || height > INT32_MAX || spp > 255 ||
+               (tile_width > 0 && tile_height > 0 ? tile_width > INT32_MAX || tile_height > INT32_MAX : rows_per_strip < 1) ||
+               offsets_entry == NULL || counts_entry == NULL) {
+        snprintf(err, errlen, "invalid TIFF image geometry");
+        status = -1;
+    }
+    if (status != 0) {
+        free(ifd);
+        return -1;
+    }
+
+    info->width = width;
+    info->height = height;
+    info->channels = spp;
+    info->big_endian = r.big_endian;
+    if (tile_width > 0 && tile_height > 0) {
+        info->tile_width = tile_width;
+        info->tile_height = tile_height;
+    } else {
+        info->tile_width = width;
+        info->tile_height = (rows_per_strip < height ? rows_per_strip : height);
+    }
+    /* there is one offset and one size for each strip or tile, and the
+       data of each one must be in the file */
+    const uint64_t across = (width + info->tile_width - 1) / info->tile_width;
+    const uint64_t down = (height + info->tile_height - 1) / info->tile_height;
+    const uint64_t nsegs = across * down;
+    uint64_t *offsets = NULL, *counts = NULL;
+    if (nsegs <= INT32_MAX && nsegs <= r.size &&
+        tiff_get(&r, offsets_entry + 4, 4) == nsegs && tiff_get(&r, counts_entry + 4, 4) == nsegs) {
+        offsets = (uint64_t*)malloc(nsegs * sizeof(*offsets));
+        counts = (uint64_t*)malloc(nsegs * sizeof(*counts));
+    }
+    status = (offsets != NULL && counts != NULL &&
+              tiff_values(&r, tiff_get(&r, offsets_entry + 2, 2), nsegs, offsets_entry + 8, offsets) == 0 &&
+              tiff_values(&r, tiff_get(&r, counts_entry + 2, 2), nsegs, counts_entry + 8, counts) == 0 ? 0 : -1);
+    for (uint64_t k=0; k<nsegs && status == 0; k++) {
+        if (offsets[k] > r.size || counts[k] > r.size - offsets[k])
+            status = -1;
+    }
+    free(ifd);
+    if (status != 0) {
+        snprintf(err, errlen, "invalid TIFF strips or tiles");
+        free(offsets);
+        free(counts);
+        return -1;
+    }
+    info->nsegs = nsegs;
+    info->seg_offset = offsets;
+    info->seg_bytes = counts;
+    info->offset = offsets[0];
+
+    /* Strips that follow each other can be read at once */
+    const uint64_t row_bytes = width * spp * (bps / 8);
+    info->contiguous = (info->tile_width == info->width);
+    for (int k=0; k<info->nsegs && info->contiguous; k++) {
+        const uint64_t rows = (k < info->nsegs - 1 ? (uint64_t)info->tile_height : height - (uint64_t)k * info->tile_height);
+        info->contiguous = (offsets[k] == offsets[0] + (uint64_t)k * info->tile_height * row_bytes &&
+                            counts[k] >= rows * row_bytes);
+    }
+    return 0;
+}
+
+int image_read_segments( const char *fname, const image_info_t *info, void *buf )
+{
+    const size_t px = (size_t)info->channels * (info->type->bits / 8);
+    const size_t tile_row = (size_t)info->tile_width * px;
+    const int across = (info->width + info->tile_width - 1) / info->tile_width;
+    char *tile = (char*)malloc(tile_row * info->tile_height);
+    const int fd = open(fname, O_RDONLY);
+    int status = (tile != NULL && fd >= 0 ? 0 : -1);
+
+    for (int k=0; k<info->nsegs && status == 0; k++) {
+        const int x0 = (k % across) * info->tile_width;
+        const int y0 = (k / across) * info->tile_height;
+        const int w = (x0 + info->tile_width < info->width ? info->tile_width : info->width - x0);
+        const int h = (y0 + info->tile_height < info->height ? info->tile_height : info->height - y0);
+        /* tiles are padded to the full size, strips are not */
+        const size_t nbytes = (info->tile_width == info->width ? (size_t)h * tile_row : tile_row * info->tile_height);
+        if (info->seg_bytes[k] < nbytes ||
+            pread(fd, tile, nbytes, (off_t)info->seg_offset[k]) != (ssize_t)nbytes) {
+            status = -1;
+            break;
+        }
+        for (int y=0; y<h; y++) {
+            memcpy((char*)buf + ((size_t)(y0 + y) * info->width + x0) * px,
+                   tile + (size_t)y * tile_row, (size_t)w * px);
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    free(tile);
+    return status;
+}
+
+/****************************************************************************
+ * FITS
+ ****************************************************************************/
+
+#define FITS_BLOCK 2880
+#define FITS_CARD 80
+
+static int fits_read_header( FILE *f, image_info_t *info, char *err, size_t errlen )
+{
+    char card[FITS_CARD + 1];
+    long bitpix = 0, naxis = -1, naxis1 = -1, naxis2 = -1, naxis3 = 1;
+    double bzero = 0.0, bscale = 1.0;
+    int simple = 0, end = 0;
+    long ncards = 0;
+
+    while (!end) {
+        if (fread(card, 1, FITS_CARD, f) != FITS_CARD) {
+            snprintf(err, errlen, "truncated FITS header");
+            return -1;
+        }
+        card[FITS_CARD] = '\0';
+        if (ncards++ == 0) {
+            simple = (strncmp(card, "SIMPLE  =", 9) == 0 && strchr(card + 9, 'T') != NULL);
+            if (!simple) {
+                snprintf(err, errlen, "not a FITS file");
+                return -1;
+            }
+        }
+        if (strncmp(card, "END", 3) == 0 && card[3] == ' ') {
+            end = 1;
+        } else if (card[8] == '=') {
+            const char *value = card + 10;
+            if (strncmp(card, "BITPIX  ", 8) == 0) bitpix = strtol(value, NULL, 10);
+            else if (strncmp(card, "NAXIS   ", 8) == 0) naxis = strtol(value, NULL, 10);
+            else if (strncmp(card, "NAXIS1  ", 8) == 0) naxis1 = strtol(value, NULL, 10);
+            else if (strncmp(card, "NAXIS2  ", 8) == 0) naxis2 = strtol(value, NULL, 10);
+            else if (strncmp(card, "NAXIS3  ", 8) == 0) naxis3 = strtol(value, NULL, 10);
+            else if (strncmp(card, "BZERO   ", 8) == 0) bzero = strtod(value, NULL);
+            else if (strncmp(card, "BSCALE  ", 8) == 0) bscale = strtod(value, NULL);
+        }
+    }
+
+    if (!(naxis == 2 || (naxis == 3 && naxis3 == 1)) || naxis1 < 0 || naxis2 < 0 ||
+        naxis1 > INT32_MAX || naxis2 > INT32_MAX) {
+        snprintf(err, errlen, "only 2D FITS images are supported");
+        return -1;
+    }
+    /* BZERO = 2^(bits-1) (or -2^(bits-1) for 8-bit values) turns
+       signed values into unsigned ones, and vice versa */
+    const int bits = (bitpix < 0 ? -bitpix : bitpix);
+    info->flip_sign = (bitpix > 0 && bzero != 0.0);
+    if (bscale != 1.0 ||
+        (info->flip_sign && bzero != (bitpix == 8 ? -128.0 : (double)((uint32_t)1 << (bits - 1))))) {
+        snprintf(err, errlen, "FITS images with BSCALE or BZERO are not supported, except for unsigned values");
+        return -1;
+    }
+    value_kind_t kind;
+    if (bitpix == 8)
+        kind = (info->flip_sign ? VALUE_SIGNED : VALUE_UNSIGNED);
+    else if (bitpix > 0)
+        kind = (info->flip_sign ? VALUE_UNSIGNED : VALUE_SIGNED);
+    else
+        kind = VALUE_FLOAT;
+    info->type = (bitpix == 64 || bitpix == -64 || bitpix == -16 ? NULL : find_type(kind, bits));
+    if (info->type == NULL) {
+        snprintf(err, errlen, "unsupported FITS BITPIX %ld", bitpix);
+        return -1;
+    }
+    info->width = naxis1;
+    info->height = naxis2;
+    info->big_endian = 1;
+    info->offset = (uint64_t)(ncards * FITS_CARD + FITS_BLOCK - 1) / FITS_BLOCK * FITS_BLOCK;
+    return 0;
+}
+
+/****************************************************************************
+ * Common functions
+ ****************************************************************************/
+
+int image_read_header( const char *fname, image_info_t *info, char *err, size_t errlen )
+{
+    const image_format_t format = image_format_of(fname);
+    init_info(info, format);
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) {
+        snprintf(err, errlen, "can not open input file \"%s\"", fname);
+        return -1;
+    }
+    int status;
+    switch (format) {
+    case IMAGE_PNM: status = pnm_read_header(f, info, err, errlen); break;
+    case IMAGE_TIFF: status = tiff_read_header(f, info, err, errlen); break;
+    case IMAGE_FITS: status = fits_read_header(f, info, err, errlen); break;
+    default:
+        snprintf(err, errlen, "raw files have no header");
+        status = -1;
+    }
+    fclose(f);
+    return status;
+}
+
+void image_info_init( image_info_t *info, image_format_t format,
+                      int width, int height, int channels,
+                      const value_type_t *t, int bits )
+{
+    init_info(info, format);
+    info->width = width;
+    info->height = height;
+    info->channels = channels;
+    info->type = t;
+    info->bits = bits;
+    /* TIFF files are written little-endian; FITS files store unsigned
+       values (and signed 8-bit values) with the BZERO offset */
+    info->big_endian = (format == IMAGE_PNM || format == IMAGE_FITS);
+    info->flip_sign = (format == IMAGE_FITS && t->kind != VALUE_FLOAT &&
+                       (t->bits == 8) == (t->kind == VALUE_SIGNED));
+}
+
+void image_info_free( image_info_t *info )
+{
+    free(info->seg_offset);
+    free(info->seg_bytes);
+    info->seg_offset = info->seg_bytes = NULL;
+    info->nsegs = 0;
+}
+
+int image_check_writable( const image_info_t *info, char *err, size_t errlen )
+{
+    const value_type_t *t = info->type;
+    switch (info->format) {
+    case IMAGE_PNM:
+        if (t->kind != VALUE_UNSIGNED || t->bits > 16 || (info->channels != 1 && info->channels != 3)) {
+            snprintf(err, errlen, "PNM images are made of 1 or 3 channels of 8 or 16 bit unsigned values");
+            return -1;
+        }
+        /* the maxval of the header, that is derived from the
+           significant bits, gives the size of the values: 1 byte if
+           it is less than 256, 2 bytes otherwise */
+        if (info->bits > 0 && (info->bits > t->bits || (t->bits == 16 && info->bits <= 8))) {
+            snprintf(err, errlen, "PNM images of %d-bit values can not have %d significant bits", t->bits, info->bits);
+            return -1;
+        }
+        break;
+    case IMAGE_TIFF:
+        if ((uint64_t)info->width * info->height * info->channels * (t->bits / 8) > UINT32_MAX - IMAGE_MAX_HEADER ||
+            info->channels > 255) {
+            snprintf(err, errlen, "the image is too large for TIFF");
+            return -1;
+        }
+        break;
+    case IMAGE_FITS:
+        if (info->channels != 1 || (t->kind == VALUE_FLOAT && t->bits == 16)) {
+            snprintf(err, errlen, "FITS images are made of a single channel, and can not store f16 values");
+            return -1;
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+/* Append a 12-byte little-endian TIFF directory entry to `p` */
+static uint8_t *tiff_entry( uint8_t *p, int tag, int type, uint32_t count, uint32_t value )
+{
+    const uint32_t v[4] = {(uint32_t)tag, (uint32_t)type, count, value};
+    const int size[4] = {2, 2, 4, 4};
+    for (int k=0; k<4; k++) {
+        for (int i=0; i<size[k]; i++) {
+            *p++ = (uint8_t)(v[k] >> (8*i));
+        }
+    }
+    return p;
+}
+
+/* Write a FITS card */
+static char *fits_card( char *p, const char *key, const char *value )
+{
+    char card[FITS_CARD + 1];
+    snprintf(card, sizeof(card), "%-8s= %20s", key, value);
+    memset(p, ' ', FITS_CARD);
+    memcpy(p, card, strlen(card));
+    return p + FITS_CARD;
+}
+
+size_t image_header( const image_info_t *info, char *buf )
+{
+    const value_type_t *t = info->type;
+    switch (info->format) {
+    case IMAGE_PNM: {
+        const unsigned maxval = (info->bits > 0 ? (1u << info->bits) - 1 : (1u << t->bits) - 1);
+        return sprintf(buf, "P%c\n%d %d\n%u\n", (info->channels == 3 ? '6' : '5'),
+                       info->width, info->height, maxval);
+    }
+    case IMAGE_TIFF: {
+        /* little-endian header, followed by the directory, the arrays
+           that do not fit in the entries, and the values */
+        const int spp = info->channels;
+        const int nentries = 11 + (spp != 1 && spp != 3);
+        const uint32_t ifd_size = 2 + 12 * nentries + 4;
+        uint32_t extra = 8 + ifd_size; /* position of the next array */
+        const uint32_t bps_at = (spp > 2 ? extra : 0);
+        extra += (spp > 2 ? 2 * spp : 0);
+        const uint32_t fmt_at = (spp > 2 ? extra : 0);
+        extra += (spp > 2 ? 2 * spp : 0);
+        const uint32_t es_at = (spp - 1 > 2 ? extra : 0);
+        extra += (spp - 1 > 2 ? 2 * (spp - 1) : 0);
+        const uint32_t data_at = (extra + 15) / 16 * 16;
+        const uint32_t nbytes = (uint32_t)info->width * info->height * spp * (t->bits / 8);
+        const int format = (t->kind == VALUE_UNSIGNED ? 1 : (t->kind == VALUE_SIGNED ? 2 : 3));
+        /* inline arrays of 1 or 2 SHORTs */
+        const uint32_t bps = (spp > 2 ? bps_at : (spp == 2 ? (uint32_t)t->bits * 0x10001 : (uint32_t)t->bits));
+        const uint32_t fmt = (spp > 2 ? fmt_at : (spp == 2 ? (uint32_t)format * 0x10001 : (uint32_t)format));
+        uint8_t *p = (uint8_t*)buf;
+        memset(buf, 0, data_at);
+        memcpy(p, "II*\0", 4);
+        p[4] = 8;
+        p += 8;
+        *p++ = nentries;
+        *p++ = 0;
+        p = tiff_entry(p, TIFF_IMAGE_WIDTH, TIFF_LONG, 1, info->width);
+        p = tiff_entry(p, TIFF_IMAGE_LENGTH, TIFF_LONG, 1, info->height);
+        p = tiff_entry(p, TIFF_BITS_PER_SAMPLE, TIFF_SHORT, spp, bps);
+        p = tiff_entry(p, TIFF_COMPRESSION, TIFF_SHORT, 1, 1);
+        p = tiff_entry(p, TIFF_PHOTOMETRIC, TIFF_SHORT, 1, (spp == 3 ? 2 : 1));
+        p = tiff_entry(p, TIFF_STRIP_OFFSETS, TIFF_LONG, 1, data_at);
+        p = tiff_entry(p, TIFF_SAMPLES_PER_PIXEL, TIFF_SHORT, 1, spp);
+        p = tiff_entry(p, TIFF_ROWS_PER_STRIP, TIFF_LONG, 1, info->height);
+        p = tiff_entry(p, TIFF_STRIP_BYTE_COUNTS, TIFF_LONG, 1, nbytes);
+        p = tiff_entry(p, TIFF_PLANAR_CONFIG, TIFF_SHORT, 1, 1);
+        if (spp != 1 && spp != 3) {
+            /* the channels other than the first are unspecified */
+            p = tiff_entry(p, TIFF_EXTRA_SAMPLES, TIFF_SHORT, spp - 1, es_at);
+        }
+        p = tiff_entry(p, TIFF_SAMPLE_FORMAT, TIFF_SHORT, spp, fmt);
+        /* no next directory */
+        p += 4;
+        for (int i=0; spp > 2 && i<spp; i++) {
+            buf[bps_at + 2*i] = t->bits;
+            buf[fmt_at + 2*i] = format;
+        }
+        return data_at;
+    }
+    case IMAGE_FITS: {
+        char value[32];
+        char *p = buf;
+        const int bitpix = (t->kind == VALUE_FLOAT ? -t->bits : t->bits);
+        p = fits_card(p, "SIMPLE", "T");
+        snprintf(value, sizeof(value), "%d", bitpix);
+        p = fits_card(p, "BITPIX", value);
+        p = fits_card(p, "NAXIS", "2");
+        snprintf(value, sizeof(value), "%d", info->width);
+        p = fits_card(p, "NAXIS1", value);
+        snprintf(value, sizeof(value), "%d", info->height);
+        p = fits_card(p, "NAXIS2", value);
+        if (info->flip_sign) {
+            snprintf(value, sizeof(value), "%.0f", (t->bits == 8 ? -128.0 : (double)((uint32_t)1 << (t->bits - 1))));
+            p = fits_card(p, "BZERO", value);
+            p = fits_card(p, "BSCALE", "1");
+        }
+        memset(p, ' ', buf + FITS_BLOCK - p);
+        memcpy(p, "END", 3);
+        return FITS_BLOCK;
+    }
+    default:
+        return 0;
+    }
+}
+
+size_t image_trailer( const image_info_t *info, char *buf )
+{
+    if (info->format != IMAGE_FITS)
+        return 0;
+    /* the data are padded with zeros to a multiple of the block size */
+    const uint64_t nbytes = (uint64_t)info->width * info->height * (info->type->bits / 8);
+    const size_t pad = (FITS_BLOCK - nbytes % FITS_BLOCK) % FITS_BLOCK;
+    memset(buf, 0, pad);
+    return pad;
+}
+
+/* Swap the bytes of the `n` words of `size` bytes in `buf`, and/or
+   flip their sign bit (in the byte order of the host) */
+static void convert( void *buf, size_t n, int size, int swap, int flip )
+{
+    if (size == 2) {
+        uint16_t *v = (uint16_t*)buf;
+        const uint16_t mask = (flip ? 0x8000 : 0);
+#pragma omp simd
+        for (size_t i=0; i<n; i++) {
+            const uint16_t x = (swap ? (uint16_t)((v[i] >> 8) | (v[i] << 8)) : v[i]);
+            v[i] = x ^ mask;
+        }
+    } else if (size == 4) {
+        uint32_t *v = (uint32_t*)buf;
+        const uint32_t mask = (flip ? 0x80000000u : 0);
+#pragma omp simd
+        for (size_t i=0; i<n; i++) {
+            const uint32_t x = v[i];
+            v[i] = (swap ? ((x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24)) : x) ^ mask;
+        }
+    } else if (flip) {
+        uint8_t *v = (uint8_t*)buf;
+#pragma omp simd
+        for (size_t i=0; i<n; i++) {
+            v[i] ^= 0x80;
+        }
+    }
+}
+
+void image_to_host( const image_info_t *info, void *buf, size_t n )
+{
+    const int swap = (info->big_endian != host_big_endian());
+    if (swap || info->flip_sign)
+        convert(buf, n, info->type->bits / 8, swap, info->flip_sign);
+}
+
+void image_from_host( const image_info_t *info, void *buf, size_t n )
+{
+    const int size = info->type->bits / 8;
+    const int swap = (info->big_endian != host_big_endian());
+    if (info->flip_sign)
+        convert(buf, n, size, 0, 1);
+    if (swap)
+        convert(buf, n, size, 1, 0);
+}
@@ -0,0 +1,132 @@
+/****************************************************************************
+ *
+ * image-io.h -- Headers of PNM, TIFF and FITS images
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Besides raw files, images can be stored in the following formats,
+ * that are recognized by the extension of the file name:
+ *
+ * - PNM (.pgm, .ppm, .pnm): binary graymaps (P5) and pixmaps (P6,
+ *   three channels) of 8 or 16 bits; 16-bit values are big-endian,
+ *   and have more than 8 significant bits, since the size of the
+ *   values is given by the maximum value of the header.
+ *
+ * - TIFF (.tif, .tiff): uncompressed images of 8, 16 or 32 bit
+ *   unsigned, signed or floating point values, with any number of
+ *   interleaved channels, stored in strips or tiles, in either byte
+ *   order. Only the first image of the file is read.
+ *
+ * - FITS (.fits, .fit, .fts): 2D primary arrays with BITPIX 8, 16, 32
+ *   or -32; the values are big-endian. Unsigned 16 and 32-bit values
+ *   (and signed 8-bit values) are stored with the usual BZERO offset,
+ *   i.e., with the sign bit flipped.
+ *
+ * The geometry and the data type of the image are taken from the
+ * header. The values are then read as they are, usually with a single
+ * read into the buffer of the image, and converted in place to the
+ * byte order of the host; this is fused with the conversion to keys
+ * (see keys.h), one block at a time. Only tiles, and strips that are
+ * not stored in order, are read piecewise with image_read_segments().
+ *
+ * Images are written with a header produced by image_header(), the
+ * values converted by image_from_host(), and the padding produced by
+ * image_trailer(), in this order, so that they can be written
+ * sequentially, even to a pipe.
+ */
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "keys.h"
+
+typedef enum {
+    IMAGE_RAW = 0,
+    IMAGE_PNM,
+    IMAGE_TIFF,
+    IMAGE_FITS
+} image_format_t;
+
+typedef struct {
+    image_format_t format;
+    int width, height, channels;
+    const value_type_t *type;
+    int bits;           /* if > 0, the values have `bits` significant bits */
+    int big_endian;     /* nonzero if the values are stored big-endian */
+    int flip_sign;      /* nonzero if the values are stored with the sign bit flipped */
+    uint64_t offset;    /* position of the first value in the file */
+    int contiguous;     /* nonzero if the values are stored row by row from `offset` */
+    /* if !contiguous, the image is made of segments (tiles, or strips
+       of tile_width == width) of tile_width x tile_height pixels, in
+       row-major order */
+    int nsegs;
+    uint64_t *seg_offset, *seg_bytes;
+    int tile_width, tile_height;
+} image_info_t;
+
+/* Return the format of file `fname`, given its extension */
+image_format_t image_format_of( const char *fname );
+
+/* Return the name of format `f` */
+const char *image_format_name( image_format_t f );
+
+/* Read the header of file `fname`, whose format is not IMAGE_RAW, into
+   `info`. Return 0 on success, -1 on error, with a description of the
+   error in `err`. */
+int image_read_header( const char *fname, image_info_t *info, char *err, size_t errlen );
+
+/* Read the values of a non contiguous image, described by `info`, from
+   file `fname` into `buf`, without converting them; return 0 on
+   success, -1 on error */
+int image_read_segments( const char *fname, const image_info_t *info, void *buf );
+
+/* Describe in `info` an image of format `format`, with the given
+   geometry and data type, as it is written by this module */
+void image_info_init( image_info_t *info, image_format_t format,
+                      int width, int height, int channels,
+                      const value_type_t *t, int bits );
+
+/* Release the memory used by `info` */
+void image_info_free( image_info_t *info );
+
+/* Return 0 if an image described by `info` can be written in format
+   `info->format`, -1 otherwise, with a description of the problem in
+   `err` */
+int image_check_writable( const image_info_t *info, char *err, size_t errlen );
+
+/* Write into `buf` the header of the image described by `info`; return
+   its length, that is at most IMAGE_MAX_HEADER bytes */
+#define IMAGE_MAX_HEADER 2880
+size_t image_header( const image_info_t *info, char *buf );
+
+/* Write into `buf` the bytes that follow the values of the image
+   described by `info`; return their number, that is less than
+   IMAGE_MAX_HEADER */
+size_t image_trailer( const image_info_t *info, char *buf );
+
+/* Convert `n` values stored as described by `info` to the byte order
+   of the host, in place */
+void image_to_host( const image_info_t *info, void *buf, size_t n );
+
+/* Convert `n` values from the byte order of the host to that
+   described by `info`, in place */
+void image_from_host( const image_info_t *info, void *buf, size_t n );
+
+#endif
@@ -0,0 +1,240 @@
+/****************************************************************************
+ *
+ * keys.c -- Order-preserving mapping of pixel values to unsigned keys
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "keys.h"
+
+static const value_type_t value_types[] = { {"u8", 8, VALUE_UNSIGNED},
+                                            {"u16", 16, VALUE_UNSIGNED},
+                                            {"u32", 32, VALUE_UNSIGNED},
+                                            {"i8", 8, VALUE_SIGNED},
+                                            {"i16", 16, VALUE_SIGNED},
+                                            {"i32", 32, VALUE_SIGNED},
+                                            {"f16", 16, VALUE_FLOAT},
+                                            {"f32", 32, VALUE_FLOAT},
+                                            {NULL, 0, VALUE_UNSIGNED} };
+
+const value_type_t *value_type_find( const char *name )
+{
+    for (int i=0; value_types[i].name; i++) {
+        if (strcmp(name, value_types[i].name) == 0)
+            return &value_types[i];
+    }
+    return NULL;
+}
+
+void value_type_list( FILE *f )
+{
+    for (int i=0; value_types[i].name; i++) {
+        fprintf(f, "%s%s", (i > 0 ? ", " : ""), value_types[i].name);
+    }
+}
+
+/* Mask of the sign bit of a word of `bits` bits */
+static uint32_t sign_bit( int bits )
+{
+    return (uint32_t)1 << (bits - 1);
+}
+
+/* Mask of the exponent of a floating point value of `bits` bits; a
+   value whose magnitude is larger than the mask is a NaN */
+static uint32_t exp_mask( int bits )
+{
+    return (bits == 16 ? 0x7c00 : 0x7f800000);
+}
+
+/* Key of the floating point value `v` of `bits` bits */
+static uint32_t float_key( uint32_t v, int bits )
+{
+    const uint32_t sign = sign_bit(bits);
+    const uint32_t mask = sign | (sign - 1);
+    return ((v & sign) ? ~v : v | sign) & mask;
+}
+
+/* Flip the sign bit of the `n` words of type T in `buf` */
+#define FLIP_SIGN(T, buf, n)                                    \
+    do {                                                        \
+        T *v = (T*)(buf);                                       \
+        const T sign = (T)sign_bit(8*sizeof(T));                \
+        for (size_t i=0; i<(n); i++) {                          \
+            v[i] ^= sign;                                       \
+        }                                                       \
+    } while (0)
+
+/* Map the `n` floating point values of type T in `buf` to keys */
+#define FLOAT_TO_KEYS(T, buf, n, nan_key, nnan)                 \
+    do {                                                        \
+        T *v = (T*)(buf);                                       \
+        const T sign = (T)sign_bit(8*sizeof(T));                \
+        const T nan = (T)exp_mask(8*sizeof(T));                 \
+        for (size_t i=0; i<(n); i++) {                          \
+            const T x = v[i];                                   \
+            if ((T)(x & ~sign) > nan) {                         \
+                v[i] = (T)(nan_key);                            \
+                (nnan)++;                                       \
+            } else {                                            \
+                v[i] = (T)((x & sign) ? ~x : x | sign);         \
+            }                                                   \
+        }                                                       \
+    } while (0)
+
+/* Map the `n` keys of type T in `buf` to floating point values */
+#define KEYS_TO_FLOAT(T, buf, n)                                \
+    do {                                                        \
+        T *v = (T*)(buf);                                       \
+        const T sign = (T)sign_bit(8*sizeof(T));                \
+        for (size_t i=0; i<(n); i++) {                          \
+            const T k = v[i];                                   \
+            v[i] = (T)((k & sign) ? k & ~sign : ~k);            \
+        }                                                       \
+    } while (0)
+
+size_t values_to_keys( void *buf, size_t n, const value_type_t *t, uint32_t nan_key )
+{
+    size_t nnan = 0;
+
+    if (t->kind == VALUE_SIGNED) {
+        switch (t->bits) {
+        case 8: FLIP_SIGN(uint8_t, buf, n); break;
+        case 16: FLIP_SIGN(uint16_t, buf, n); break;
+        default: FLIP_SIGN(uint32_t, buf, n);
+        }
+    } else if (t->kind == VALUE_FLOAT) {
+        if (t->bits == 16)
+            FLOAT_TO_KEYS(uint16_t, buf, n, nan_key, nnan);
+        else
+            FLOAT_TO_KEYS(uint32_t, buf, n, nan_key, nnan);
+    }
+    return nnan;
+}
+
+void keys_to_values( void *buf, size_t n, const value_type_t *t )
+{
+    if (t->kind == VALUE_SIGNED) {
+        /* flipping the sign bit is an involution */
+        values_to_keys(buf, n, t, 0);
+    } else if (t->kind == VALUE_FLOAT) {
+        if (t->bits == 16)
+            KEYS_TO_FLOAT(uint16_t, buf, n);
+        else
+            KEYS_TO_FLOAT(uint32_t, buf, n);
+    }
+}
+
+/* Return the bitwise OR of the `n` words of type T in `buf` */
+#define OR_ALL(T, buf, n, result)                               \
+    do {                                                        \
+        const T *v = (const T*)(buf);                           \
+        T acc = 0;                                              \
+        for (size_t i=0; i<(n); i++) {                          \
+            acc |= v[i];                                        \
+        }                                                       \
+        (result) = acc;                                         \
+    } while (0)
+
+int keys_fit( const void *buf, size_t n, int width, int bits )
+{
+    uint32_t all;
+    switch (width) {
+    case 8: OR_ALL(uint8_t, buf, n, all); break;
+    case 16: OR_ALL(uint16_t, buf, n, all); break;
+    default: OR_ALL(uint32_t, buf, n, all);
+    }
+    return (bits >= 32 || (all >> bits) == 0);
+}
+
+/* Convert `f` to IEEE 754 half precision, rounding to nearest even */
+static uint16_t float_to_half( float f )
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const int exp = (x >> 23) & 0xff;
+    uint32_t mant = x & 0x7fffff;
+    const int e = exp - 127 + 15;   /* biased exponent of the result */
+    int shift;
+
+    if (exp == 0xff)                /* infinity or NaN */
+        return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0));
+    if (e >= 31)                    /* overflow */
+        return (uint16_t)(sign | 0x7c00);
+    if (e <= 0) {                   /* subnormal result */
+        if (e < -10)
+            return (uint16_t)sign;
+        mant |= 0x800000;
+        shift = 14 - e;
+    } else {
+        mant |= (uint32_t)e << 23;
+        shift = 13;
+    }
+    uint32_t h = mant >> shift;
+    const uint32_t rem = mant & ((1u << shift) - 1);
+    const uint32_t half = 1u << (shift - 1);
+    /* a carry out of the mantissa correctly increments the exponent */
+    if (rem > half || (rem == half && (h & 1)))
+        h++;
+    return (uint16_t)(sign | h);
+}
+
+int value_parse( const char *s, const value_type_t *t, uint32_t *key )
+{
+    char *end;
+    const uint32_t sign = sign_bit(t->bits);
+    const uint32_t mask = sign | (sign - 1);
+
+    errno = 0;
+    if (t->kind == VALUE_UNSIGNED) {
+        const unsigned long long v = strtoull(s, &end, 0);
+        if (*s == '-' || v > mask)
+            return -1;
+        *key = (uint32_t)v;
+    } else if (t->kind == VALUE_SIGNED) {
+        const long long v = strtoll(s, &end, 0);
+        if (v < -(long long)sign || v > (long long)(sign - 1))
+            return -1;
+        *key = ((uint32_t)v & mask) ^ sign;
+    } else {
+        const float f = strtof(s, &end);
+        uint32_t bits;
+        if (isnan(f)) {
+            *key = value_nan_key(t);
+        } else {
+            if (t->bits == 16) {
+                bits = float_to_half(f);
+            } else {
+                memcpy(&bits, &f, sizeof(bits));
+            }
+            *key = float_key(bits, t->bits);
+        }
+    }
+    return (end == s || *end != '\0' || errno != 0 ? -1 : 0);
+}
+
+uint32_t value_nan_key( const value_type_t *t )
+{
+    /* quiet NaN with a zero payload */
+    const uint32_t nan = (t->bits == 16 ? 0x7e00 : 0x7fc00000);
+    return float_key(nan, t->bits);
+}
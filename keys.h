@@ -0,0 +1,81 @@
+/****************************************************************************
+ *
+ * keys.h -- Order-preserving mapping of pixel values to unsigned keys
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * The algorithms only handle unsigned integers. Images of signed
+ * integers and of floating point values (IEEE 754 single and half
+ * precision) are processed by mapping each value to an unsigned key
+ * of the same width, such that a < b if and only if key(a) < key(b);
+ * the median of the keys is then the key of the median. Signed
+ * integers are mapped by flipping the sign bit; floating point values
+ * by flipping the sign bit of positive values and all the bits of
+ * negative values. The transform is applied while the image is read,
+ * and inverted while the result is written, one block at a time, so
+ * that it does not require additional passes over the image.
+ *
+ * NaNs have no place in the order, and are mapped to the key of the
+ * no-data value, i.e., they are treated as missing samples.
+ */
+#ifndef KEYS_H
+#define KEYS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    VALUE_UNSIGNED,
+    VALUE_SIGNED,
+    VALUE_FLOAT
+} value_kind_t;
+
+typedef struct {
+    const char *name;   /* e.g., "u16", "i16", "f32" */
+    int bits;           /* 8, 16 or 32 */
+    value_kind_t kind;
+} value_type_t;
+
+/* Return the data type called `name`, or NULL if there is none */
+const value_type_t *value_type_find( const char *name );
+
+/* Print the names of the data types to `f` */
+void value_type_list( FILE *f );
+
+/* Map the `n` values of type `t` in `buf` to keys, in place; NaNs are
+   replaced with `nan_key`. Return the number of NaNs. */
+size_t values_to_keys( void *buf, size_t n, const value_type_t *t, uint32_t nan_key );
+
+/* Map the `n` keys in `buf` back to values of type `t`, in place */
+void keys_to_values( void *buf, size_t n, const value_type_t *t );
+
+/* Return nonzero if all the `n` unsigned integers of `width` bits in
+   `buf` are less than 2^bits */
+int keys_fit( const void *buf, size_t n, int width, int bits );
+
+/* Parse the string `s` as a value of type `t`, and store its key into
+   `*key`; return 0 on success, -1 if `s` is not a valid value */
+int value_parse( const char *s, const value_type_t *t, uint32_t *key );
+
+/* Return the key of the canonical NaN of type `t`, which must be a
+   floating point type */
+uint32_t value_nan_key( const value_type_t *t );
+
+#endif
@@ -26,11 +26,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <assert.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <omp.h>
 #include "common.h"
+#include "keys.h"
+#include "packed.h"
+#include "mmap-io.h"
+#include "async-io.h"
+#include "image-io.h"
+#include "chunk-store.h"
+#include "daemon.h"
+#include "median-plan.h"
+#include "workspace.h"
+#include "autotune.h"
+#include "result-cache.h"
+#include "checkpoint.h"
 
 double hpc_gettime( void )
 {
@@ -39,69 +56,1186 @@ double hpc_gettime( void )
     return ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
-typedef void (*median_filter_algo_t)( const data_t *in,
-                                      data_t *out,
-                                      const int *dims, /* array of 2 or 3 elements */
-                                      int ndims, /* either 2 or 3 */
-                                      int radius );
+/* The preview computed with --preview is PREVIEW_STRIDE times smaller
+   than the final result in each direction */
+#define PREVIEW_STRIDE 8
 
-struct {
-    const char *name;
-    const char *description;
-    median_filter_algo_t fun;
-} median_filter_algos[] = { {"omp-hist-sparse-byrow", "Optimized sparse histogram-based median (OpenMP)", median_filter_2D_sparse_byrow},
-                            {"cuda-hist-generic", "Histogram-based median, works with any data type  (CUDA)", cuda_median_2D_hist_generic},
-                            {NULL, NULL, NULL}
-};
+/* Maximum number of stages of a rank filter pipeline */
+#define MAX_STAGES 16
+
+/* With --checkpoint, the output is computed in at most
+   CHECKPOINT_BANDS bands of at least CHECKPOINT_ROWS rows; the bands
+   do not depend on the number of threads, so that a job can be
+   resumed on a different machine */
+#define CHECKPOINT_BANDS 64
+#define CHECKPOINT_ROWS 16
+
+/* Default seconds between the saves of the checkpoint with --resume */
+#define CHECKPOINT_INTERVAL 60.0
 
 void print_usage( const char *exe_name )
 {
     fprintf(stderr,
-            "Usage: %s [-h] [-a algo] [-X dimx] [-Y dimy] [-Z dimz] [-r radius] [-o outfile] infile\n\n"
+            "Usage: %s [-h] [-a algo] [-X dimx] [-Y dimy] [-Z dimz] [-C channels] [-b bits] [--type type] [--bits n] [--packed layout] [-r radius] [-d dilation] [-s stride] [-e error] [-n nodata] [-p postop] [-t threshold] [--clamp lo:hi] [--stats] [--no-output] [--pipeline stages] [--preview file] [--mmap] [--stream] [--mem-budget bytes] [--async-io] [--direct-io] [--roi x:y:w:h] [--no-padding] [--chunk-size WxH] [--in-flight n] [--batch manifest] [--daemon socket] [--submit socket] [--autotune] [--wisdom file] [--cache dir] [--cache-size bytes] [--checkpoint seconds] [--resume] [-o outfile] infile\n\n"
             "-h\t\tprint help\n"
             "-a algo\t\tset algorithm (see below)\n"
             "-X dimx\tX dimension (width)\n"
             "-Y dimy\tY dimension (height)\n"
             "-Z dimz\tZ dimension (depth)\n"
+            "-C channels\tnumber of interleaved channels per pixel (default 1)\n"
+            "-b bits\t\tbits per value of unsigned images: 8, 16 or 32 (default 32)\n"
+            "--type type\tdata type of the values (see below)\n"
+            "--bits n\tthe values of unsigned images have at most n significant bits\n"
+            "--packed layout\tthe input is made of packed 10, 12 or 14 bit values, that\n"
+            "\t\tare unpacked into 16 bits: mipi10, mipi12, mipi14 (MIPI CSI-2),\n"
+            "\t\tlsb10, lsb12, lsb14 (little-endian bit stream)\n"
             "-r radius\tfilter radius\n"
-            "-o outfile\toutput file name\n"
-            "infile\t\tinput file name\n\n"
-            "Valid algorithm names:\n\n", exe_name);
+            "-d dilation\tsample every dilation-th row and column of the window (default 1)\n"
+            "-s stride\tcompute every stride-th row and column of the output (default 1)\n"
+            "-e error\terror bound of approximate algorithms (default 4)\n"
+            "-n nodata\tvalue of missing samples, excluded from the windows; NaNs\n"
+            "\t\tare always missing samples\n"
+            "-p postop\toperation applied to the median: median (default), residual,\n"
+            "\t\tabsresidual, mask (see below)\n"
+            "-t threshold\tthreshold of the mask and of the outlier count (default 0)\n"
+            "--clamp lo:hi\tclamp the output to [lo, hi]\n"
+            "--stats\t\tcount the outliers and sum the absolute residuals\n"
+            "--no-output\tdo not write the output image\n"
+            "--pipeline stages\tcomma-separated list of rank filters, each of the form\n"
+            "\t\tname:radius, where name is min, max, median or pN for the\n"
+            "\t\tN-th percentile (requires -a omp-rank-pipeline or omp-reference)\n"
+            "--preview file\twrite a coarse result to file before computing the final one\n"
+            "--mmap\t\tmap the input and output files into memory instead of\n"
+            "\t\tcopying them (packed input is always copied)\n"
+            "--stream\tprocess 2D images in bands of rows, reading the input and\n"
+            "\t\twriting the output as the computation proceeds\n"
+            "--mem-budget bytes\tmemory for the buffers of --stream and the jobs of\n"
+            "\t\t--daemon, with optional suffix K, M or G (default 256M)\n"
+            "--async-io\tread and write the files in a separate thread, overlapped\n"
+            "\t\twith the computation; 2D images are processed in bands of\n"
+            "\t\trows, as with --stream\n"
+            "--direct-io\tlike --async-io, bypassing the page cache (O_DIRECT)\n"
+            "--roi x:y:w:h\tfilter the w x h rectangle at (x, y) only, as if it were\n"
+            "\t\tthe whole image, without copying it\n"
+            "--no-padding\tdo not pad the rows of the image in memory; by default,\n"
+            "\t\trows of a multiple of 512 bytes are padded, so that vertical\n"
+            "\t\tneighbors do not map to the same cache sets\n"
+            "--chunk-size WxH\tsize of the chunks of an output chunk store (default:\n"
+            "\t\tthat of the input store, or 512x512)\n"
+            "--in-flight n\tnumber of chunks of an input chunk store that are\n"
+            "\t\tprocessed at the same time (default 4)\n", exe_name);
+    fprintf(stderr,
+            "--batch manifest\tfilter the images listed in the manifest, one per line\n"
+            "\t\tof the form \"infile outfile [WxH]\" (WxH is the geometry of\n"
+            "\t\traw files, by default -X x -Y), in a single process\n"
+            "--daemon socket\tfilter the images submitted through the Unix socket\n"
+            "\t\t(see daemon.h), queueing up to --mem-budget bytes of images\n"
+            "--submit socket\tsubmit the raw 2D input to the daemon listening on the\n"
+            "\t\tsocket, that filters it with its own options, and write its\n"
+            "\t\toutput; the data type and channels must be those of the daemon\n"
+            "--autotune\tmeasure the exact algorithms with different numbers of\n"
+            "\t\tthreads on a synthetic image of the size of the input, store\n"
+            "\t\tthe times in the wisdom file, then filter the input, if any,\n"
+            "\t\twith -a auto\n"
+            "--wisdom file\twisdom file of --autotune and -a auto (default:\n"
+            "\t\t$MEDIAN_FILTER_WISDOM or ~/.median-filter-wisdom)\n"
+            "--cache dir\tcopy the output from the result cache dir if the same\n"
+            "\t\tinput has been filtered with the same options, otherwise\n"
+            "\t\tstore it there (see result-cache.h)\n"
+            "--cache-size bytes\tmaximum size of the result cache, with optional\n"
+            "\t\tsuffix K, M or G (default 1G)\n"
+            "--checkpoint seconds\tcompute the output in bands of rows, and record\n"
+            "\t\tthe bands that are complete in outfile.ckpt at most every\n"
+            "\t\tseconds seconds (see checkpoint.h); implies --mmap\n"
+            "--resume\tskip the bands recorded as complete by the checkpoint\n"
+            "\t\tof an interrupted run of the same job; implies --checkpoint %g\n"
+            "-o outfile\toutput file name, or - for the standard output\n"
+            "infile\t\tinput file name, or - for the standard input\n\n", CHECKPOINT_INTERVAL);
+    fprintf(stderr,
+            "Files whose name ends with .pgm, .ppm or .pnm (binary PNM), .tif or\n"
+            ".tiff (uncompressed TIFF), .fits, .fit or .fts (FITS) have a header;\n"
+            "the dimensions, channels and data type of the input are taken from it.\n"
+            "Directories whose name ends with .chunks are chunk stores (see\n"
+            "chunk-store.h); an input chunk store is processed one chunk at a time.\n"
+            "Other files are raw sequences of values.\n\n"
+            "Post operations:\n\n"
+            "median\t\tthe median m\n"
+            "residual\tmax(x - m, 0), where x is the input value\n"
+            "absresidual\t|x - m|\n"
+            "mask\t\t1 if |x - m| > threshold, 0 otherwise\n\n"
+            "The residuals and the mask are unsigned integers of the same size as\n"
+            "the data type; they are not supported with floating point types.\n\n"
+            "Valid data types: ");
+    value_type_list(stderr);
+    fprintf(stderr, "\n\n"
+            "Valid algorithm names:\n\n");
     for (int i=0; median_filter_algos[i].name; i++) {
         fprintf(stderr, "%-20s\t%s%s\n",
                 median_filter_algos[i].name,
                 median_filter_algos[i].description,
                 i == 0 ? " (default)" : "");
     }
-    fprintf(stderr, "\n");
+    fprintf(stderr, "%-20s\t%s\n\n", "auto",
+            "Fastest exact algorithm and number of threads according to the wisdom file");
+}
+
+/* Parse a pipeline specification such as "min:3,max:3,median:5,p25:2"
+   into `stages`; return the number of stages, or -1 on error. */
+static int parse_pipeline( const char *spec, rank_stage_t *stages, int max_stages )
+{
+    int n = 0;
+    while (*spec) {
+        char name[16];
+        int radius, len;
+        if (n >= max_stages ||
+            sscanf(spec, "%15[^:,]:%d%n", name, &radius, &len) != 2 ||
+            radius < 0) {
+            return -1;
+        }
+        if (strcmp(name, "min") == 0) {
+            stages[n].percentile = 0;
+        } else if (strcmp(name, "max") == 0) {
+            stages[n].percentile = 100;
+        } else if (strcmp(name, "median") == 0) {
+            stages[n].percentile = RANK_MEDIAN;
+        } else if (name[0] == 'p' && sscanf(name+1, "%d", &stages[n].percentile) == 1 &&
+                   stages[n].percentile >= 0 && stages[n].percentile <= 100) {
+            /* nothing to do */
+        } else {
+            return -1;
+        }
+        stages[n].radius = radius;
+        n++;
+        spec += len;
+        if (*spec == ',')
+            spec++;
+        else if (*spec != '\0')
+            return -1;
+    }
+    return n;
+}
+
+/* Images are read and written in blocks of IO_BLOCK values, that are
+   converted from values to keys (and back) while they are in cache */
+#define IO_BLOCK 16384
+
+/* Convert the `len` values of type `t` in `block`, read from file
+   `fname`, to keys; NaNs are replaced with `nan_key`. All values must
+   have at most `bits` significant bits. Return the number of NaNs. */
+static size_t block_to_keys( const char *fname, void *block, size_t len,
+                             const value_type_t *t, uint32_t nan_key, int bits )
+{
+    const size_t nnan = values_to_keys(block, len, t, nan_key);
+    if (bits < t->bits && !keys_fit(block, len, t->bits, bits)) {
+        fprintf(stderr, "\nFATAL: input file \"%s\" contains values with more than %d bits\n", fname, bits);
+        exit(EXIT_FAILURE);
+    }
+    return nnan;
+}
+
+/* Image files are opened with these ASYNC_xxx flags, and the time
+   spent in I/O is accumulated in `io_stats` (see async-io.h) */
+static int io_flags = 0;
+static async_stats_t io_stats = {0.0, 0.0};
+
+/* With I/O threads, 2D images are processed in at least ASYNC_BANDS
+   bands of rows, so that the I/O of each band overlaps with the
+   computation of another one (see stream_plan_t) */
+#define ASYNC_BANDS 8
+
+/* Open file `fname` for reading (`write` == 0) or writing; "-" is
+   the standard input or output. The I/O thread, if any, reads or
+   writes up to `ahead` bytes while the caller computes. */
+static async_file_t *open_image( const char *fname, int write, size_t ahead )
+{
+    async_file_t *f = async_open(fname, write, io_flags, ahead);
+    if (f == NULL) {
+        if (write)
+            fprintf(stderr, "FATAL: can not create output file \"%s\"\n", fname);
+        else
+            fprintf(stderr, "\nFATAL: can not open input file \"%s\"\n", fname);
+        exit(EXIT_FAILURE);
+    }
+    return f;
+}
+
+/* Close `f`, that has been opened from file `fname` for reading
+   (`write` == 0) or writing */
+static void close_image( async_file_t *f, const char *fname, int write )
+{
+    /* in batch mode, files are closed by two threads */
+    static pthread_mutex_t io_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&io_stats_mutex);
+    const int status = async_close(f, &io_stats);
+    pthread_mutex_unlock(&io_stats_mutex);
+    if (status != 0) {
+        if (write)
+            fprintf(stderr, "FATAL: can not write output file \"%s\": %s\n", fname, strerror(errno));
+        else
+            fprintf(stderr, "\nFATAL: can not read input file \"%s\": %s\n", fname, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Print the time spent in I/O; the I/O is hidden when the computation
+   proceeds while the I/O thread reads or writes the files */
+static void print_io_stats( void )
+{
+    const double hidden = (io_stats.busy > io_stats.wait ? io_stats.busy - io_stats.wait : 0.0);
+    fprintf(stderr,
+            "I/O time........ %f\n"
+            "I/O hidden...... %f (%.0f%%)\n",
+            io_stats.busy, hidden,
+            (io_stats.busy > 0 ? 100.0 * hidden / io_stats.busy : 0.0));
+}
+
+/* Skip the `n` bytes that precede the values of the image in
+   `filein`, that has been opened from file `fname` (which may be a
+   pipe) */
+static void skip_header( async_file_t *filein, const char *fname, uint64_t n )
+{
+    char buf[IMAGE_MAX_HEADER];
+    while (n > 0) {
+        const size_t len = (n < sizeof(buf) ? n : sizeof(buf));
+        if (async_read(filein, buf, len) != len) {
+            fprintf(stderr, "\nFATAL: input file \"%s\" is too short\n", fname);
+            exit(EXIT_FAILURE);
+        }
+        n -= len;
+    }
+}
+
+/* Read the next `n` values of type `t` from `filein`, that has been
+   opened from file `fname`, into `buf`, and convert them to keys; NaNs
+   are replaced with `nan_key`. If `packed` is not NULL, the file
+   contains values packed with that layout; if `info` is not NULL, the
+   values are stored as described there (see image-io.h). All values
+   must have at most `bits` significant bits. Return the number of
+   NaNs. */
+static size_t read_values( async_file_t *filein, const char *fname, void *buf, size_t n,
+                           const value_type_t *t, uint32_t nan_key,
+                           const packed_layout_t *packed, const image_info_t *info, int bits )
+{
+    const size_t size = t->bits / 8;
+    uint8_t packed_block[2 * IO_BLOCK];
+    size_t nnan = 0;
+
+    for (size_t i=0; i<n; i+=IO_BLOCK) {
+        char *block = (char*)buf + i * size;
+        const size_t len = (n - i < IO_BLOCK ? n - i : IO_BLOCK);
+        if (packed != NULL) {
+            const size_t nbytes = len / packed->group_values * packed->group_bytes;
+            if (async_read(filein, packed_block, nbytes) != nbytes) {
+                fprintf(stderr, "\nFATAL: input file \"%s\" is too short\n", fname);
+                exit(EXIT_FAILURE);
+            }
+            packed_unpack(packed, packed_block, (uint16_t*)block, len);
+        } else {
+            if (async_read(filein, block, len * size) != len * size) {
+                fprintf(stderr, "\nFATAL: input file \"%s\" is too short\n", fname);
+                exit(EXIT_FAILURE);
+            }
+            if (info != NULL)
+                image_to_host(info, block, len);
+        }
+        nnan += block_to_keys(fname, block, len, t, nan_key, bits);
+    }
+    return nnan;
+}
+
+/* Read `nrows` rows of `row_values` values with read_values(), and
+   store them `pitch` values apart in `buf`; return the number of NaNs */
+static size_t read_rows( async_file_t *filein, const char *fname, void *buf,
+                         size_t nrows, size_t row_values, size_t pitch,
+                         const value_type_t *t, uint32_t nan_key,
+                         const packed_layout_t *packed, const image_info_t *info, int bits )
+{
+    if (pitch == row_values)
+        return read_values(filein, fname, buf, nrows * row_values, t, nan_key, packed, info, bits);
+    size_t nnan = 0;
+    for (size_t r=0; r<nrows; r++) {
+        nnan += read_values(filein, fname, (char*)buf + r * pitch * (t->bits / 8), row_values,
+                            t, nan_key, packed, info, bits);
+    }
+    return nnan;
+}
+
+/* Read `nrows` rows of `row_values` values of type `t` from file
+   `fname` into `buf`, `pitch` values apart, with read_rows(); return
+   the number of NaNs. The tiles, or strips, of a non contiguous image
+   are read at their positions in `buf`, converted in place, and then
+   moved apart. */
+static size_t read_image( const char *fname, void *buf, size_t nrows, size_t row_values, size_t pitch,
+                          const value_type_t *t, uint32_t nan_key,
+                          const packed_layout_t *packed, const image_info_t *info, int bits )
+{
+    const size_t n = nrows * row_values;
+    size_t nnan = 0;
+    if (info != NULL && !info->contiguous) {
+        if (image_read_segments(fname, info, buf) != 0) {
+            fprintf(stderr, "\nFATAL: can not read the %s image \"%s\"\n", image_format_name(info->format), fname);
+            exit(EXIT_FAILURE);
+        }
+        const size_t size = t->bits / 8;
+        for (size_t i=0; i<n; i+=IO_BLOCK) {
+            const size_t len = (n - i < IO_BLOCK ? n - i : IO_BLOCK);
+            image_to_host(info, (char*)buf + i * size, len);
+            nnan += block_to_keys(fname, (char*)buf + i * size, len, t, nan_key, bits);
+        }
+        for (size_t r=nrows; r-- > 1 && pitch != row_values; ) {
+            memmove((char*)buf + r * pitch * size, (char*)buf + r * row_values * size, row_values * size);
+        }
+        return nnan;
+    }
+    async_file_t *filein = open_image(fname, 0, 0);
+    if (info != NULL)
+        skip_header(filein, fname, info->offset);
+    nnan = read_rows(filein, fname, buf, nrows, row_values, pitch, t, nan_key, packed, info, bits);
+    close_image(filein, fname, 0);
+    return nnan;
+}
+
+/* Map `n` values of type `t` from file `fname` into memory, and convert
+   them to keys in place, as read_image() does; the pages of unsigned
+   images are never modified, and are not copied. Store the number of
+   NaNs in `*nnan`. */
+static void *map_image( const char *fname, size_t n, const value_type_t *t,
+                        uint32_t nan_key, int bits, size_t *nnan )
+{
+    const size_t size = t->bits / 8;
+    char *buf = (char*)mmap_input(fname, n * size);
+    if (buf == NULL && n > 0) {
+        if (errno == 0)
+            fprintf(stderr, "\nFATAL: input file \"%s\" is too short\n", fname);
+        else
+            fprintf(stderr, "\nFATAL: can not map input file \"%s\": %s\n", fname, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    *nnan = 0;
+    if (t->kind != VALUE_UNSIGNED || bits < t->bits) {
+        for (size_t i=0; i<n; i+=IO_BLOCK) {
+            const size_t len = (n - i < IO_BLOCK ? n - i : IO_BLOCK);
+            *nnan += block_to_keys(fname, buf + i * size, len, t, nan_key, bits);
+        }
+    }
+    return buf;
+}
+
+/* Write `n` keys from `buf` to `fileout`, converting them to values
+   of type `t`; if `raw` is nonzero, the keys are written as unsigned
+   integers. If `info` is not NULL, the values are stored as described
+   there. */
+static void write_values( async_file_t *fileout, const void *buf, size_t n,
+                          const value_type_t *t, int raw, const image_info_t *info )
+{
+    const size_t size = t->bits / 8;
+    char block[IO_BLOCK * sizeof(uint32_t)];
+
+    for (size_t i=0; i<n; i+=IO_BLOCK) {
+        const char *src = (const char*)buf + i * size;
+        const size_t len = (n - i < IO_BLOCK ? n - i : IO_BLOCK);
+        if ((!raw && t->kind != VALUE_UNSIGNED) || info != NULL) {
+            memcpy(block, src, len * size);
+            if (!raw && t->kind != VALUE_UNSIGNED)
+                keys_to_values(block, len, t);
+            if (info != NULL)
+                image_from_host(info, block, len);
+            src = block;
+        }
+        async_write(fileout, src, len * size);
+    }
+}
+
+/* Write the header (`trailer` == 0) or the trailer of the image
+   described by `info`, if any, to `fileout` */
+static void write_header( async_file_t *fileout, const image_info_t *info, int trailer )
+{
+    char buf[IMAGE_MAX_HEADER];
+    if (info != NULL) {
+        const size_t len = (trailer ? image_trailer(info, buf) : image_header(info, buf));
+        async_write(fileout, buf, len);
+    }
+}
+
+/* Write `n` keys from `buf` to file `fname` with write_values(),
+   preceded and followed by the header and trailer of `info` */
+static void write_image( const char *fname, const void *buf, size_t n,
+                         const value_type_t *t, int raw, const image_info_t *info )
+{
+    async_file_t *fileout = open_image(fname, 1, 0);
+    write_header(fileout, info, 0);
+    write_values(fileout, buf, n, t, raw, info);
+    write_header(fileout, info, 1);
+    close_image(fileout, fname, 1);
+}
+
+/* Parse a size in bytes with an optional suffix K, M or G (powers of
+   1024); return 0 on error */
+static size_t parse_size( const char *s )
+{
+    char *end;
+    const unsigned long long v = strtoull(s, &end, 10);
+    switch (*end) {
+    case 'K': case 'k': end++; return (*end ? 0 : (size_t)v << 10);
+    case 'M': case 'm': end++; return (*end ? 0 : (size_t)v << 20);
+    case 'G': case 'g': end++; return (*end ? 0 : (size_t)v << 30);
+    case '\0': return (size_t)v;
+    default: return 0;
+    }
+}
+
+/* In streaming mode, the output is computed in bands of `band` rows.
+   The input rows that a band depends on (the rows of the band, plus
+   `halo` rows above and below) are kept in a buffer, and the
+   algorithm is applied to them as if they were the whole image; the
+   rows that are shared with the next band are moved to the top of
+   the buffer, and the rows below them are read from the input. The
+   halo is a multiple of the stride, so that the output rows of each
+   band are aligned with those of the whole image, and is not smaller
+   than the radius, so that the windows of the rows of the band are the
+   same as in the whole image. Only the output rows of the band are
+   computed (see `rows_first` and `rows_last` in median_filter_opts_t),
+   and the randomized algorithms are told where the band is in the
+   whole image. With --async-io, the I/O threads read the input rows of
+   the next band, and write the output rows of the previous one, while
+   a band is computed: the rings of the files hold a whole band, and
+   their memory is part of the budget. */
+typedef struct {
+    int band;           /* output rows per band */
+    int halo;           /* input rows above and below each band */
+    size_t in_rows;     /* capacity of the input buffer, in rows */
+    size_t out_rows;    /* capacity of the output buffer, in rows */
+    size_t in_ahead;    /* bytes of the input and output files that */
+    size_t out_ahead;   /* the I/O threads hold (0 without I/O threads) */
+} stream_plan_t;
+
+/* Return the memory required by the buffers of `plan`, whose input
+   rows are padded as those of the whole image */
+static size_t stream_memory( const stream_plan_t *plan, size_t row_bytes, size_t out_row_bytes )
+{
+    size_t mem = plan->in_rows * row_bytes + plan->out_rows * out_row_bytes;
+    if (plan->in_ahead > 0)
+        mem += async_ring_size(plan->in_ahead) + async_ring_size(plan->out_ahead);
+    return mem;
+}
+
+/* Size the buffers of `plan` for bands of `band` output rows; see
+   stream_plan() for the other parameters */
+static void stream_band( stream_plan_t *plan, int band, int stride,
+                         size_t file_row_bytes, size_t out_row_bytes )
+{
+    plan->band = band;
+    plan->in_rows = (size_t)band * stride + 2 * (size_t)plan->halo;
+    plan->out_rows = (size_t)band + 2 * (size_t)plan->halo / stride;
+    plan->in_ahead = (io_flags != 0 ? (size_t)band * stride * file_row_bytes : 0);
+    plan->out_ahead = (io_flags != 0 ? (size_t)band * out_row_bytes : 0);
+}
+
+/* Plan the streaming computation of an image with dimensions `dims`
+   in bands of at most `max_band` output rows, so that the buffers take
+   at most `budget` bytes; `reach` is the maximum distance of the input
+   rows that affect an output row. Return 0 on success, -1 if the
+   budget is too small; in that case, `plan` describes bands of a
+   single row, which require the least memory. */
+static int stream_plan( stream_plan_t *plan, const int *dims, int reach,
+                        const median_filter_opts_t *opts, size_t size, size_t budget, int max_band )
+{
+    const int stride = opts->stride;
+    const int out_width = (dims[DX] + stride - 1) / stride;
+    const int out_height = (dims[DY] + stride - 1) / stride;
+    const size_t row_bytes = (opts->in_pitch > 0 ? opts->in_pitch : (size_t)dims[DX] * opts->channels) * size;
+    const size_t file_row_bytes = (size_t)dims[DX] * opts->channels * size;
+    const size_t out_row_bytes = (size_t)out_width * opts->channels * size;
+
+    plan->halo = (reach + stride - 1) / stride * stride;
+    /* the buffers hold band*stride + 2*halo input rows, and the
+       corresponding band + 2*halo/stride output rows; the memory grows
+       with the band, and the largest band within the budget is found
+       by bisection */
+    int lo = 1, hi = (max_band < out_height ? max_band : out_height);
+    while (lo <= hi) {
+        const int band = lo + (hi - lo) / 2;
+        stream_band(plan, band, stride, file_row_bytes, out_row_bytes);
+        if (stream_memory(plan, row_bytes, out_row_bytes) <= budget)
+            lo = band + 1;
+        else
+            hi = band - 1;
+    }
+    stream_band(plan, (hi > 1 ? hi : 1), stride, file_row_bytes, out_row_bytes);
+    return (stream_memory(plan, row_bytes, out_row_bytes) <= budget ? 0 : -1);
+}
+
+/* Apply algorithm `fun` to the 2D image read from `filein` (opened from
+   file `fname`) in bands, as planned by `plan`, and write the result to
+   `fileout`, if not NULL, as soon as each band is complete; see
+   read_values() and write_values() for the other parameters. Return
+   the time spent in the algorithm. */
+static double filter_stream( const median_filter_algo_t *fun, int bpp,
+                             async_file_t *filein, const char *fname, async_file_t *fileout,
+                             const int *dims, int radius,
+                             const median_filter_opts_t *opts,
+                             const stream_plan_t *plan,
+                             const value_type_t *t, uint32_t nan_key,
+                             const packed_layout_t *packed, const image_info_t *in_info,
+                             int bits, int raw, const image_info_t *out_info )
+{
+    const size_t size = bpp / 8;
+    const int width = dims[DX];
+    const int height = dims[DY];
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const int out_height = (height + stride - 1) / stride;
+    const size_t row_values = (size_t)width * opts->channels;
+    const size_t pitch = median_filter_in_pitch(dims, opts);
+    const size_t out_row_values = (size_t)out_width * opts->channels;
+    char *in = (char*)malloc(plan->in_rows * pitch * size);
+    char *out = (char*)malloc(plan->out_rows * out_row_values * size);
+    assert(in != NULL);
+    assert(out != NULL);
+    int first = 0, last = 0; /* input rows first .. last-1 are in `in` */
+
+    double tcompute = 0.0;
+    for (int y0=0; y0<out_height; y0+=plan->band) {
+        const int y1 = (y0 + plan->band < out_height ? y0 + plan->band : out_height);
+        /* input rows needed by output rows y0 .. y1-1 */
+        const int lo = (y0*stride - plan->halo > 0 ? y0*stride - plan->halo : 0);
+        const int hi = ((y1-1)*stride + 1 + plan->halo < height ? (y1-1)*stride + 1 + plan->halo : height);
+        if (lo < last) {
+            memmove(in, in + (size_t)(lo - first) * pitch * size,
+                    (size_t)(last - lo) * pitch * size);
+        } else {
+            /* with a large stride, some rows are not needed at all */
+            for (int y=last; y<lo; y++) {
+                read_values(filein, fname, in, row_values, t, nan_key, packed, in_info, bits);
+            }
+            last = lo;
+        }
+        first = lo;
+        read_rows(filein, fname, in + (size_t)(last - first) * pitch * size,
+                  hi - last, row_values, pitch, t, nan_key, packed, in_info, bits);
+        last = hi;
+
+        /* output row y0 is row `skip` of the band */
+        const int skip = (y0*stride - lo) / stride;
+        const int band_dims[2] = {width, hi - lo};
+        median_filter_opts_t band_opts = *opts;
+        band_opts.stats_first = band_opts.rows_first = skip;
+        band_opts.stats_last = band_opts.rows_last = skip + (y1 - y0);
+        band_opts.row_origin = opts->row_origin + lo;
+        const double t0 = hpc_gettime();
+        median_filter_run(fun, bpp, in, out, band_dims, 2, radius, &band_opts);
+        tcompute += hpc_gettime() - t0;
+
+        /* with ASYNC_THREAD, the band is written while the next one is
+           computed */
+        if (fileout != NULL) {
+            write_values(fileout, out + (size_t)skip * out_row_values * size,
+                         (size_t)(y1 - y0) * out_row_values, t, raw, out_info);
+        }
+    }
+    free(in);
+    free(out);
+    return tcompute;
+}
+
+/* Apply algorithm `fun` to the 2D image `in`, whose output `out` is
+   mapped from file `fname`, in bands of `band` output rows; the bands
+   that are complete in checkpoint `c` are skipped, the others are
+   recorded there as soon as their keys have been converted to values
+   (unless `raw` is nonzero). Each band is computed from the whole
+   input, so that no rows are computed twice. Return the time spent in
+   the algorithm. */
+static double filter_bands( const median_filter_algo_t *fun, int bpp,
+                            const void *in, void *out, const char *fname,
+                            const int *dims, int radius,
+                            const median_filter_opts_t *opts, int band,
+                            checkpoint_t *c, const value_type_t *t, int raw )
+{
+    const size_t size = bpp / 8;
+    const int out_height = (dims[DY] + opts->stride - 1) / opts->stride;
+    const size_t out_row_values = median_filter_out_pitch(dims, opts);
+
+    double tcompute = 0.0;
+    for (int b=0; b<c->nbands; b++) {
+        if (checkpoint_is_done(c, b))
+            continue;
+        median_filter_opts_t band_opts = *opts;
+        band_opts.rows_first = b * band;
+        band_opts.rows_last = (band_opts.rows_first + band < out_height ? band_opts.rows_first + band : out_height);
+        const double t0 = hpc_gettime();
+        median_filter_run(fun, bpp, in, out, dims, 2, radius, &band_opts);
+        tcompute += hpc_gettime() - t0;
+        if (!raw) {
+            keys_to_values((char*)out + (size_t)band_opts.rows_first * out_row_values * size,
+                           (size_t)(band_opts.rows_last - band_opts.rows_first) * out_row_values, t);
+        }
+        if (checkpoint_done(c, b) != 0) {
+            fprintf(stderr, "\nFATAL: can not save the checkpoint of \"%s\": %s\n\n", fname, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    return tcompute;
+}
+
+/* Create the chunk store `path` with the geometry of `s`, or exit */
+static void create_store( chunk_store_t *s, const char *path )
+{
+    if (chunk_store_create(s, path) != 0) {
+        fprintf(stderr, "\nFATAL: can not create \"%s\": %s\n\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* In chunked mode, the output is computed one chunk at a time, and
+   up to `in_flight` chunks are computed in parallel, each by a team of
+   threads. The input pixels that a chunk depends on (the pixels of the
+   chunk, plus a halo around them, that is a multiple of the stride and
+   not smaller than the reach, as in streaming mode) are read from the
+   chunks of the input store that they overlap, and the algorithm is
+   applied to them as if they were the whole image, except that the
+   output rows of the halo are not computed; the output columns of the
+   halo are discarded. Only the chunks of the input that overlap the
+   region of interest `roi` are read.
+
+   The output has the geometry of `out`, and is written to the chunk
+   store `out`, if its path is not NULL, or to the raw file open as
+   `fdout`, if not negative. Keys are converted to values of type `t`,
+   unless `raw` is nonzero; see read_values() for the other parameters.
+   Return the elapsed time. */
+static double filter_chunks( const median_filter_algo_t *fun, int bpp,
+                             const chunk_store_t *in, const int *roi,
+                             int radius, int reach, const median_filter_opts_t *opts,
+                             int in_flight, const chunk_store_t *out, int fdout,
+                             const value_type_t *t, uint32_t nan_key, int bits, int raw )
+{
+    const size_t size = bpp / 8;
+    const int nchan = opts->channels;
+    const int stride = opts->stride;
+    const int halo = (reach + stride - 1) / stride * stride;
+    const int ncx = chunk_store_grid(out, 0);
+    const int nchunks = ncx * chunk_store_grid(out, 1);
+    const int nthreads = omp_get_max_threads();
+    const int inner = (nthreads / in_flight > 1 ? nthreads / in_flight : 1);
+    const double tstart = hpc_gettime();
+
+    omp_set_max_active_levels(2);
+#pragma omp parallel for schedule(dynamic) num_threads(in_flight)
+    for (int k=0; k<nchunks; k++) {
+        omp_set_num_threads(inner);
+        const int cx = k % ncx, cy = k / ncx;
+        const int ox0 = cx * out->chunk_width, oy0 = cy * out->chunk_height;
+        const int ox1 = (ox0 + out->chunk_width < out->width ? ox0 + out->chunk_width : out->width);
+        const int oy1 = (oy0 + out->chunk_height < out->height ? oy0 + out->chunk_height : out->height);
+        /* input pixels needed by the chunk, relative to the region of
+           interest */
+        const int x_lo = (ox0*stride - halo > 0 ? ox0*stride - halo : 0);
+        const int x_hi = ((ox1-1)*stride + 1 + halo < roi[2] ? (ox1-1)*stride + 1 + halo : roi[2]);
+        const int y_lo = (oy0*stride - halo > 0 ? oy0*stride - halo : 0);
+        const int y_hi = ((oy1-1)*stride + 1 + halo < roi[3] ? (oy1-1)*stride + 1 + halo : roi[3]);
+        const int sub_dims[2] = {x_hi - x_lo, y_hi - y_lo};
+        const size_t row_values = (size_t)sub_dims[DX] * nchan;
+        const size_t pitch = median_filter_padded_pitch(row_values, size);
+        const int sub_out_width = (sub_dims[DX] + stride - 1) / stride;
+        const int sub_out_height = (sub_dims[DY] + stride - 1) / stride;
+        const size_t out_pitch = (size_t)sub_out_width * nchan;
+        char *buf = (char*)malloc((size_t)sub_dims[DY] * pitch * size);
+        char *result = (char*)malloc((size_t)sub_out_height * out_pitch * size);
+        assert(buf != NULL);
+        assert(result != NULL);
+
+        if (chunk_store_read(in, roi[0] + x_lo, roi[1] + y_lo, sub_dims[DX], sub_dims[DY], buf, pitch) != 0) {
+            fprintf(stderr, "\nFATAL: can not read chunk store \"%s\": %s\n", in->path,
+                    (errno == 0 ? "a chunk is too short" : strerror(errno)));
+            exit(EXIT_FAILURE);
+        }
+        for (int y=0; y<sub_dims[DY]; y++) {
+            block_to_keys(in->path, buf + (size_t)y * pitch * size, row_values, in->type, nan_key, bits);
+        }
+        /* output pixel (ox0, oy0) is pixel (sx, sy) of the result; the
+           rows computed from the halo alone are skipped */
+        const int sx = (ox0*stride - x_lo) / stride;
+        const int sy = (oy0*stride - y_lo) / stride;
+        median_filter_opts_t chunk_opts = *opts;
+        chunk_opts.in_pitch = pitch;
+        chunk_opts.out_pitch = out_pitch;
+        chunk_opts.rows_first = sy;
+        chunk_opts.rows_last = sy + (oy1 - oy0);
+        chunk_opts.row_origin = opts->row_origin + y_lo;
+        chunk_opts.col_origin = opts->col_origin + x_lo;
+        median_filter_run(fun, bpp, buf, result, sub_dims, 2, radius, &chunk_opts);
+
+        const size_t out_row_values = (size_t)(ox1 - ox0) * nchan;
+        char *first = result + ((size_t)sy * out_pitch + (size_t)sx * nchan) * size;
+        for (int y=0; y<oy1-oy0 && !raw && t->kind != VALUE_UNSIGNED; y++) {
+            keys_to_values(first + (size_t)y * out_pitch * size, out_row_values, t);
+        }
+        int status = 0;
+        if (out->path != NULL) {
+            status = chunk_store_write(out, cx, cy, first, out_pitch);
+        } else if (fdout >= 0) {
+            for (int y=0; y<oy1-oy0 && status == 0; y++) {
+                const off_t pos = ((off_t)(oy0 + y) * out->width + ox0) * nchan * size;
+                if (pwrite(fdout, first + (size_t)y * out_pitch * size, out_row_values * size, pos) !=
+                    (ssize_t)(out_row_values * size))
+                    status = -1;
+            }
+        }
+        if (status != 0) {
+            fprintf(stderr, "\nFATAL: can not write the output: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        free(buf);
+        free(result);
+    }
+    return hpc_gettime() - tstart;
+}
+
+/* An entry of the manifest of a batch: the input and output file
+   names, and the geometry of raw input files (-1 if not given) */
+typedef struct {
+    char *in, *out;
+    int width, height;
+} batch_entry_t;
+
+/* Read the manifest `fname`, made of lines "infile outfile [WxH]";
+   empty lines and lines starting with '#' are ignored. Store the
+   entries in `*entries` (to be freed with batch_free()) and return
+   their number. */
+static int batch_read( const char *fname, batch_entry_t **entries )
+{
+    FILE *f = fopen(fname, "r");
+    if (f == NULL) {
+        fprintf(stderr, "\nFATAL: can not open manifest \"%s\"\n\n", fname);
+        exit(EXIT_FAILURE);
+    }
+    char line[4096], in[2048], out[2048], geometry[64], extra;
+    int n = 0, capacity = 0, lineno = 0;
+    *entries = NULL;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        const int nfields = sscanf(line, "%2047s %2047s %63s %c", in, out, geometry, &extra);
+        if (nfields <= 0 || in[0] == '#')
+            continue;
+        batch_entry_t e = {NULL, NULL, -1, -1};
+        if (nfields == 1 || nfields > 3 ||
+            (nfields == 3 && (sscanf(geometry, "%dx%d%c", &e.width, &e.height, &extra) != 2 ||
+                              e.width < 0 || e.height < 0))) {
+            fprintf(stderr, "\nFATAL: %s:%d: expected \"infile outfile [WxH]\"\n\n", fname, lineno);
+            exit(EXIT_FAILURE);
+        }
+        if (n == capacity) {
+            capacity = (capacity > 0 ? 2 * capacity : 64);
+            *entries = (batch_entry_t*)realloc(*entries, capacity * sizeof(**entries));
+            assert(*entries != NULL);
+        }
+        e.in = strdup(in);
+        e.out = strdup(out);
+        assert(e.in != NULL && e.out != NULL);
+        (*entries)[n++] = e;
+    }
+    fclose(f);
+    if (n == 0) {
+        fprintf(stderr, "\nFATAL: manifest \"%s\" is empty\n\n", fname);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+static void batch_free( batch_entry_t *entries, int n )
+{
+    for (int i=0; i<n; i++) {
+        free(entries[i].in);
+        free(entries[i].out);
+    }
+    free(entries);
+}
+
+/* A buffer of the batch, that holds the keys of an input image */
+typedef struct {
+    void *img;
+    size_t capacity;    /* size of `img` in bytes */
+    int dims[2];
+    size_t pitch;
+} batch_slot_t;
+
+/* The state shared by the thread that loads the images of a batch and
+   the thread that filters them. Image k is loaded into slot k % 2,
+   once image k-2 has been filtered. */
+typedef struct {
+    const batch_entry_t *entries;
+    int n;
+    /* the images must have these channels and data type, and their
+       values at most `bits` significant bits; raw files without a
+       geometry in the manifest are default_dims[0] x default_dims[1] */
+    int channels;
+    const value_type_t *t;
+    uint32_t nan_key;
+    int bits;
+    int default_dims[2];
+    int no_padding;
+    batch_slot_t slots[2];
+    int loaded, filtered;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} batch_t;
+
+/* Read image `k` of batch `b` into its slot */
+static void batch_load( batch_t *b, int k )
+{
+    const batch_entry_t *e = &b->entries[k];
+    batch_slot_t *slot = &b->slots[k % 2];
+    image_info_t info;
+    const int has_header = (image_format_of(e->in) != IMAGE_RAW);
+    if (has_header) {
+        char err[256];
+        if (image_read_header(e->in, &info, err, sizeof(err)) != 0) {
+            fprintf(stderr, "\nFATAL: input file \"%s\": %s\n\n", e->in, err);
+            exit(EXIT_FAILURE);
+        }
+        if (info.channels != b->channels || info.type != b->t) {
+            fprintf(stderr, "\nFATAL: \"%s\" has %d channels of type %s, but the batch has %d channels of type %s\n\n",
+                    e->in, info.channels, info.type->name, b->channels, b->t->name);
+            exit(EXIT_FAILURE);
+        }
+        slot->dims[DX] = info.width;
+        slot->dims[DY] = info.height;
+    } else {
+        slot->dims[DX] = (e->width >= 0 ? e->width : b->default_dims[DX]);
+        slot->dims[DY] = (e->height >= 0 ? e->height : b->default_dims[DY]);
+        if (slot->dims[DX] < 0 || slot->dims[DY] < 0) {
+            fprintf(stderr, "\nFATAL: the geometry of raw file \"%s\" is not given\n\n", e->in);
+            exit(EXIT_FAILURE);
+        }
+    }
+    const size_t size = b->t->bits / 8;
+    const size_t row_values = (size_t)slot->dims[DX] * b->channels;
+    slot->pitch = (b->no_padding ? row_values : median_filter_padded_pitch(row_values, size));
+    const size_t img_size = (size_t)slot->dims[DY] * slot->pitch * size;
+    /* the buffers only grow, so that a batch of images of the same
+       size allocates them once */
+    if (img_size > slot->capacity) {
+        free(slot->img);
+        slot->img = malloc(img_size);
+        assert(slot->img != NULL);
+        slot->capacity = img_size;
+    }
+    read_image(e->in, slot->img, slot->dims[DY], row_values, slot->pitch, b->t, b->nan_key,
+               NULL, (has_header ? &info : NULL), b->bits);
+    if (has_header)
+        image_info_free(&info);
+}
+
+static void *batch_loader( void *arg )
+{
+    batch_t *b = (batch_t*)arg;
+    for (int k=0; k<b->n; k++) {
+        pthread_mutex_lock(&b->mutex);
+        while (b->filtered < k - 1)
+            pthread_cond_wait(&b->cond, &b->mutex);
+        pthread_mutex_unlock(&b->mutex);
+        batch_load(b, k);
+        pthread_mutex_lock(&b->mutex);
+        b->loaded = k + 1;
+        pthread_cond_signal(&b->cond);
+        pthread_mutex_unlock(&b->mutex);
+    }
+    return NULL;
+}
+
+/* In batch mode, the images listed in the `n` entries of the manifest
+   are filtered one after the other by the same process, so that the
+   threads of OpenMP (and the CUDA context) are created once, and the
+   buffers of the images and the temporary memory of the algorithm (see
+   workspace.h) are reused. A separate thread loads the next
+   image while the current one is filtered; the output is written by
+   the calling thread. The images are filtered with the options
+   `opts`; the other parameters are those of read_image() and
+   write_image(), and `out_type` is the type of the output
+   values. Return the time spent waiting for the images to be
+   loaded, and store the total computation time in `*tcompute`. */
+static double filter_batch( const median_filter_algo_t *fun, int bpp,
+                            const batch_entry_t *entries, int n, const int *default_dims,
+                            int radius, const median_filter_opts_t *opts, int no_padding,
+                            const value_type_t *t, uint32_t nan_key, int bits, int raw,
+                            const value_type_t *out_type, int no_output, double *tcompute )
+{
+    batch_t b;
+    memset(&b, 0, sizeof(b));
+    b.entries = entries;
+    b.n = n;
+    b.channels = opts->channels;
+    b.t = t;
+    b.nan_key = nan_key;
+    b.bits = bits;
+    b.default_dims[DX] = default_dims[DX];
+    b.default_dims[DY] = default_dims[DY];
+    b.no_padding = no_padding;
+    pthread_mutex_init(&b.mutex, NULL);
+    pthread_cond_init(&b.cond, NULL);
+    pthread_t loader;
+    if (pthread_create(&loader, NULL, batch_loader, &b) != 0) {
+        fprintf(stderr, "\nFATAL: can not create the loader thread\n\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const size_t size = bpp / 8;
+    void *out = NULL;
+    size_t out_capacity = 0;
+    /* the arenas grow to the needs of the largest image, so that the
+       following images allocate nothing */
+    median_filter_workspace_t *ws = workspace_create(omp_get_max_threads());
+    assert(ws != NULL);
+    double twait = 0.0;
+    *tcompute = 0.0;
+    for (int k=0; k<n; k++) {
+        const double t0 = hpc_gettime();
+        pthread_mutex_lock(&b.mutex);
+        while (b.loaded <= k)
+            pthread_cond_wait(&b.cond, &b.mutex);
+        pthread_mutex_unlock(&b.mutex);
+        twait += hpc_gettime() - t0;
+
+        const batch_slot_t *slot = &b.slots[k % 2];
+        const int out_dims[2] = {(slot->dims[DX] + opts->stride - 1) / opts->stride,
+                                 (slot->dims[DY] + opts->stride - 1) / opts->stride};
+        const size_t n_out = (size_t)out_dims[DX] * out_dims[DY] * opts->channels;
+        if (n_out * size > out_capacity) {
+            free(out);
+            out = malloc(n_out * size);
+            assert(out != NULL);
+            out_capacity = n_out * size;
+        }
+        median_filter_opts_t image_opts = *opts;
+        image_opts.in_pitch = slot->pitch;
+        image_opts.out_pitch = 0;
+        image_opts.workspace = ws;
+        const double tstart = hpc_gettime();
+        median_filter_run(fun, bpp, slot->img, out, slot->dims, 2, radius, &image_opts);
+        workspace_reset(ws);
+        *tcompute += hpc_gettime() - tstart;
+
+        pthread_mutex_lock(&b.mutex);
+        b.filtered = k + 1;
+        pthread_cond_signal(&b.cond);
+        pthread_mutex_unlock(&b.mutex);
+
+        if (!no_output) {
+            const char *outfile = entries[k].out;
+            image_info_t out_info;
+            image_info_init(&out_info, image_format_of(outfile), out_dims[DX], out_dims[DY],
+                            opts->channels, out_type, (raw ? 0 : opts->bits));
+            char err[256];
+            if (out_info.format != IMAGE_RAW && image_check_writable(&out_info, err, sizeof(err)) != 0) {
+                fprintf(stderr, "\nFATAL: can not write output file \"%s\": %s\n\n", outfile, err);
+                exit(EXIT_FAILURE);
+            }
+            write_image(outfile, out, n_out, t, raw, (out_info.format != IMAGE_RAW ? &out_info : NULL));
+        }
+    }
+    pthread_join(loader, NULL);
+    pthread_mutex_destroy(&b.mutex);
+    pthread_cond_destroy(&b.cond);
+    free(b.slots[0].img);
+    free(b.slots[1].img);
+    free(out);
+    workspace_destroy(ws);
+    return twait;
+}
+
+/* The parameters of the jobs of the daemon (see daemon.h), that are
+   those given on the command line */
+typedef struct {
+    const median_filter_algo_t *fun;
+    int bpp;
+    int radius;
+    median_filter_opts_t opts;
+    const value_type_t *t;
+    uint32_t nan_key;
+    int bits;
+    int raw;
+} daemon_ctx_t;
+
+/* Filter a job of the daemon. The input is converted to keys in place,
+   and back to values when the job is done, so that the client gets
+   back its input unchanged (except for the payload of NaNs). */
+static int filter_job( void *arg, void *in, void *out, const int *dims )
+{
+    const daemon_ctx_t *ctx = (const daemon_ctx_t*)arg;
+    const int stride = ctx->opts.stride;
+    const size_t n = (size_t)dims[DX] * dims[DY] * ctx->opts.channels;
+    const size_t n_out = (size_t)((dims[DX] + stride - 1) / stride) * ((dims[DY] + stride - 1) / stride) *
+        ctx->opts.channels;
+    int status = 0;
+    values_to_keys(in, n, ctx->t, ctx->nan_key);
+    if (ctx->bits < ctx->t->bits && !keys_fit(in, n, ctx->t->bits, ctx->bits)) {
+        status = ERANGE;
+    } else {
+        median_filter_run(ctx->fun, ctx->bpp, in, out, dims, 2, ctx->radius, &ctx->opts);
+        if (!ctx->raw)
+            keys_to_values(out, n_out, ctx->t);
+    }
+    keys_to_values(in, n, ctx->t);
+    return status;
+}
+
+/* Submit the raw 2D image `infile`, of `dims[0]` x `dims[1]` pixels of
+   `pixel_size` bytes, to the daemon listening on `path`, and write the
+   result to `outfile`; the image is filtered with the options of the
+   daemon, that must have the same data type and channels. Return the
+   exit status of the program. */
+static int submit_image( const char *path, const char *infile, const char *outfile,
+                         const int *dims, size_t pixel_size )
+{
+    const size_t in_bytes = (size_t)dims[DX] * dims[DY] * pixel_size;
+    /* the output follows the input, and is never larger */
+    const int fd = daemon_memory(2 * in_bytes);
+    char *buf = (char*)malloc(in_bytes > 0 ? in_bytes : 1);
+    assert(buf != NULL);
+    if (fd < 0) {
+        fprintf(stderr, "\nFATAL: can not create the shared memory: %s\n\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    FILE *filein = (strcmp(infile, "-") == 0 ? stdin : fopen(infile, "rb"));
+    if (filein == NULL || fread(buf, 1, in_bytes, filein) != in_bytes) {
+        fprintf(stderr, "\nFATAL: can not read %llu bytes from input file \"%s\"\n\n",
+                (unsigned long long)in_bytes, infile);
+        return EXIT_FAILURE;
+    }
+    if (filein != stdin)
+        fclose(filein);
+    if (pwrite(fd, buf, in_bytes, 0) != (ssize_t)in_bytes) {
+        fprintf(stderr, "\nFATAL: can not write the shared memory: %s\n\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    const int sock = daemon_connect(path);
+    if (sock < 0) {
+        fprintf(stderr, "\nFATAL: can not connect to \"%s\": %s\n\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    daemon_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.magic = DAEMON_MAGIC;
+    job.id = 1;
+    job.width = dims[DX];
+    job.height = dims[DY];
+    job.in_offset = 0;
+    job.out_offset = in_bytes;
+    daemon_reply_t reply;
+    if (daemon_submit(sock, &job, fd) != 0 || daemon_wait(sock, &reply) != 0) {
+        fprintf(stderr, "\nFATAL: the daemon did not reply: %s\n\n", (errno != 0 ? strerror(errno) : "connection closed"));
+        return EXIT_FAILURE;
+    }
+    close(sock);
+    if (reply.status != 0) {
+        fprintf(stderr, "\nFATAL: the daemon rejected the job: %s\n\n", strerror(reply.status));
+        return EXIT_FAILURE;
+    }
+
+    const size_t out_bytes = (size_t)reply.out_width * reply.out_height * pixel_size;
+    FILE *fileout = (strcmp(outfile, "-") == 0 ? stdout : fopen(outfile, "wb"));
+    if (fileout == NULL ||
+        pread(fd, buf, out_bytes, (off_t)in_bytes) != (ssize_t)out_bytes ||
+        fwrite(buf, 1, out_bytes, fileout) != out_bytes ||
+        (fileout != stdout && fclose(fileout) != 0)) {
+        fprintf(stderr, "\nFATAL: can not write output file \"%s\"\n\n", outfile);
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    free(buf);
+    fprintf(stderr,
+            "Submitted to.... %s\n"
+            "Output size..... %d x %d\n"
+            "Execution time.. %f\n\n",
+            path, reply.out_width, reply.out_height, reply.elapsed);
+    return EXIT_SUCCESS;
 }
 
 int main( int argc, char *argv[] )
 {
     int radius = 41;
-    const char *infile = NULL, *outfile = "out.raw";
+    const char *infile = NULL, *outfile = "out.raw", *previewfile = NULL, *pipeline = NULL;
     int i, opt;
     int dims[3] = {-1, -1, -1};
     int ndims;
+    median_filter_opts_t opts;
+    median_filter_stats_t stats = {0, 0.0};
+    rank_stage_t stages[MAX_STAGES];
+    int no_output = 0;
+    int use_mmap = 0;
+    int stream = 0;
+    int channels_given = 0, type_given = 0;
+    int no_padding = 0;
+    int chunk_size[2] = {0, 0};
+    int in_flight = 4;
+    const char *roi_arg = NULL;
+    const char *batch_file = NULL;
+    const char *daemon_socket = NULL, *submit_socket = NULL;
+    int autotune_flag = 0, auto_algo = 0;
+    const char *wisdom_file = NULL;
+    const char *cache_dir = NULL;
+    size_t cache_size = (size_t)1 << 30;
+    int checkpoint = 0, resume = 0;
+    double checkpoint_interval = CHECKPOINT_INTERVAL;
+    batch_entry_t *batch = NULL;
+    int nbatch = 0;
+    size_t mem_budget = (size_t)256 << 20;
+    const value_type_t *vtype = value_type_find("u32");
+    const char *nodata_arg = NULL, *clamp_arg = NULL;
+    const packed_layout_t *packed = NULL;
+    static const char *postop_names[] = {"median", "residual", "absresidual", "mask", NULL};
+    static const struct option long_opts[] = {
+        {"preview", required_argument, NULL, 'P'},
+        {"clamp", required_argument, NULL, 'L'},
+        {"stats", no_argument, NULL, 'S'},
+        {"no-output", no_argument, NULL, 'N'},
+        {"pipeline", required_argument, NULL, 'I'},
+        {"type", required_argument, NULL, 'T'},
+        {"bits", required_argument, NULL, 'B'},
+        {"packed", required_argument, NULL, 'K'},
+        {"mmap", no_argument, NULL, 'M'},
+        {"stream", no_argument, NULL, 'R'},
+        {"mem-budget", required_argument, NULL, 'G'},
+        {"async-io", no_argument, NULL, 'A'},
+        {"direct-io", no_argument, NULL, 'D'},
+        {"roi", required_argument, NULL, 'O'},
+        {"no-padding", no_argument, NULL, 'W'},
+        {"chunk-size", required_argument, NULL, 'Q'},
+        {"in-flight", required_argument, NULL, 'F'},
+        {"batch", required_argument, NULL, 'J'},
+        {"daemon", required_argument, NULL, 'U'},
+        {"submit", required_argument, NULL, 'j'},
+        {"autotune", no_argument, NULL, 'V'},
+        {"wisdom", required_argument, NULL, 'H'},
+        {"cache", required_argument, NULL, 'E'},
+        {"cache-size", required_argument, NULL, 'c'},
+        {"checkpoint", required_argument, NULL, 'k'},
+        {"resume", no_argument, NULL, 'u'},
+        {NULL, 0, NULL, 0}
+    };
+
+    median_filter_opts_init(&opts);
 
     const char *algo_name = median_filter_algos[0].name;
-    median_filter_algo_t algo_fun = median_filter_algos[0].fun;
+    const median_filter_algo_t *algo_fun = &median_filter_algos[0].fun;
+    const median_filter_bound_t *algo_bound = &median_filter_algos[0].bound;
 
-    while ((opt = getopt(argc, argv, "ha:X:Y:Z:r:o:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "ha:X:Y:Z:C:b:r:d:s:e:n:p:t:o:", long_opts, NULL)) != -1) {
         switch(opt) {
-        case 'a':
-            i = 0;
-            while (median_filter_algos[i].name && strcmp(optarg, median_filter_algos[i].name)) {
-                i++;
-            }
-            if (median_filter_algos[i].name) {
-                algo_name = median_filter_algos[i].name;
-                algo_fun = median_filter_algos[i].fun;
+        case 'a': {
+            const median_filter_algo_info_t *info = median_filter_algo_find(optarg);
+            if (strcmp(optarg, "auto") == 0) {
+                auto_algo = 1;
+            } else if (info != NULL) {
+                algo_name = info->name;
+                algo_fun = &info->fun;
+                algo_bound = &info->bound;
             } else {
                 fprintf(stderr, "\nFATAL: invalid algorithm %s\n", optarg);
                 exit(EXIT_FAILURE);
             }
             break;
+        }
         case 'X': /* width */
             dims[DX] = atoi(optarg);
             break;
@@ -111,9 +1245,160 @@ int main( int argc, char *argv[] )
         case 'Z': /* depth */
             dims[DZ] = atoi(optarg);
             break;
+        case 'C': /* channels */
+            opts.channels = atoi(optarg);
+            channels_given = 1;
+            break;
+        case 'b': { /* bits per value */
+            char name[16];
+            snprintf(name, sizeof(name), "u%d", atoi(optarg));
+            vtype = value_type_find(name);
+            if (vtype == NULL) {
+                fprintf(stderr, "\nFATAL: The number of bits per value must be 8, 16 or 32\n\n");
+                return EXIT_FAILURE;
+            }
+            type_given = 1;
+            break;
+        }
+        case 'T':
+            vtype = value_type_find(optarg);
+            if (vtype == NULL) {
+                fprintf(stderr, "\nFATAL: invalid data type %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            type_given = 1;
+            break;
+        case 'B':
+            opts.bits = atoi(optarg);
+            break;
+        case 'K':
+            packed = packed_layout_find(optarg);
+            if (packed == NULL) {
+                fprintf(stderr, "\nFATAL: invalid packed layout %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'r':
             radius = atoi(optarg);
             break;
+        case 'd':
+            opts.dilation = atoi(optarg);
+            break;
+        case 's':
+            opts.stride = atoi(optarg);
+            break;
+        case 'e':
+            opts.max_error = atoi(optarg);
+            break;
+        case 'n':
+            nodata_arg = optarg;
+            break;
+        case 'p':
+            i = 0;
+            while (postop_names[i] && strcmp(optarg, postop_names[i])) {
+                i++;
+            }
+            if (postop_names[i] == NULL) {
+                fprintf(stderr, "\nFATAL: invalid post operation %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            opts.postop = i; /* the names are in the same order as the POSTOP_xxx constants */
+            break;
+        case 't':
+            opts.threshold = (uint32_t)strtoull(optarg, NULL, 0);
+            break;
+        case 'L':
+            clamp_arg = optarg;
+            break;
+        case 'S':
+            opts.stats = &stats;
+            break;
+        case 'N':
+            no_output = 1;
+            break;
+        case 'M':
+            use_mmap = 1;
+            break;
+        case 'R':
+            stream = 1;
+            break;
+        case 'A':
+            io_flags |= ASYNC_THREAD;
+            break;
+        case 'D':
+            io_flags |= ASYNC_THREAD | ASYNC_DIRECT;
+            break;
+        case 'O':
+            roi_arg = optarg;
+            break;
+        case 'W':
+            no_padding = 1;
+            break;
+        case 'Q':
+            if (sscanf(optarg, "%dx%d", &chunk_size[0], &chunk_size[1]) != 2 ||
+                chunk_size[0] < 1 || chunk_size[1] < 1) {
+                fprintf(stderr, "\nFATAL: invalid chunk size %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'F':
+            in_flight = atoi(optarg);
+            if (in_flight < 1) {
+                fprintf(stderr, "\nFATAL: invalid number of chunks in flight %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'J':
+            batch_file = optarg;
+            break;
+        case 'U':
+            daemon_socket = optarg;
+            break;
+        case 'j':
+            submit_socket = optarg;
+            break;
+        case 'V':
+            autotune_flag = auto_algo = 1;
+            break;
+        case 'H':
+            wisdom_file = optarg;
+            break;
+        case 'E':
+            cache_dir = optarg;
+            break;
+        case 'c':
+            cache_size = parse_size(optarg);
+            break;
+        case 'k':
+            checkpoint = 1;
+            checkpoint_interval = atof(optarg);
+            if (checkpoint_interval < 0) {
+                fprintf(stderr, "\nFATAL: invalid checkpoint interval %s\n\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'u':
+            checkpoint = resume = 1;
+            break;
+        case 'G':
+            mem_budget = parse_size(optarg);
+            if (mem_budget == 0) {
+                fprintf(stderr, "\nFATAL: invalid memory budget %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'I':
+            pipeline = optarg;
+            opts.stages = stages;
+            opts.nstages = parse_pipeline(optarg, stages, MAX_STAGES);
+            if (opts.nstages < 0) {
+                fprintf(stderr, "\nFATAL: invalid pipeline %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'P':
+            previewfile = optarg;
+            break;
         case 'o':
             outfile = optarg;
             break;
@@ -127,77 +1412,764 @@ int main( int argc, char *argv[] )
         }
     }
 
+    /* The input and output files of a batch are listed in the
+       manifest; the first image sets the geometry that is checked
+       and printed below */
+    const int default_dims[2] = {dims[DX], dims[DY]};
+    if (batch_file != NULL) {
+        if (optind < argc) {
+            fprintf(stderr, "\nFATAL: The input files of --batch are listed in the manifest\n\n");
+            return EXIT_FAILURE;
+        }
+        nbatch = batch_read(batch_file, &batch);
+        for (i=0; i<nbatch; i++) {
+            if (chunk_store_is(batch[i].in) || chunk_store_is(batch[i].out)) {
+                fprintf(stderr, "\nFATAL: --batch does not support chunk stores\n\n");
+                return EXIT_FAILURE;
+            }
+        }
+        infile = batch[0].in;
+        outfile = batch[0].out;
+        if (image_format_of(infile) != IMAGE_RAW) {
+            dims[DX] = dims[DY] = -1;
+        } else if (batch[0].width >= 0) {
+            dims[DX] = batch[0].width;
+            dims[DY] = batch[0].height;
+        }
+    } else if (daemon_socket != NULL) {
+        /* the geometry of the images is given by each job */
+        if (optind < argc || batch_file != NULL) {
+            fprintf(stderr, "\nFATAL: The images of --daemon are submitted through the socket\n\n");
+            return EXIT_FAILURE;
+        }
+        infile = daemon_socket;
+        no_output = 1;
+        if (dims[DX] < 0 || dims[DY] < 0)
+            dims[DX] = dims[DY] = 0;
+    } else if (optind >= argc && autotune_flag) {
+        /* only the wisdom is updated, for the geometry of -X and -Y */
+    } else if (optind >= argc) {
+        fprintf(stderr, "\nFATAL: No input file given\n\n");
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    } else {
+        infile = argv[optind];
+    }
+
+    /* The geometry and the data type of images with a header, and of
+       chunk stores, are those of the header or metadata */
+    image_info_t in_info;
+    chunk_store_t in_store;
+    const int in_chunked = (infile != NULL && chunk_store_is(infile));
+    const int has_header = (infile != NULL && !in_chunked && image_format_of(infile) != IMAGE_RAW);
+    if (in_chunked || has_header) {
+        char err[256];
+        if (in_chunked) {
+            if (chunk_store_open(&in_store, infile, err, sizeof(err)) != 0) {
+                fprintf(stderr, "\nFATAL: input file \"%s\": %s\n\n", infile, err);
+                return EXIT_FAILURE;
+            }
+            image_info_init(&in_info, IMAGE_RAW, in_store.width, in_store.height, in_store.channels,
+                            in_store.type, in_store.bits);
+        } else if (image_read_header(infile, &in_info, err, sizeof(err)) != 0) {
+            fprintf(stderr, "\nFATAL: input file \"%s\": %s\n\n", infile, err);
+            return EXIT_FAILURE;
+        }
+        if ((dims[DX] >= 0 && dims[DX] != in_info.width) ||
+            (dims[DY] >= 0 && dims[DY] != in_info.height) ||
+            dims[DZ] >= 0 ||
+            (channels_given && opts.channels != in_info.channels) ||
+            (type_given && vtype != in_info.type) ||
+            packed != NULL) {
+            fprintf(stderr, "\nFATAL: \"%s\" describes a 2D image of %d x %d pixels, %d channels, type %s\n\n",
+                    infile,
+                    in_info.width, in_info.height, in_info.channels, in_info.type->name);
+            return EXIT_FAILURE;
+        }
+        dims[DX] = in_info.width;
+        dims[DY] = in_info.height;
+        opts.channels = in_info.channels;
+        vtype = in_info.type;
+        /* the images of a batch may have different significant bits */
+        if (opts.bits == 0 && batch == NULL && in_info.bits > 0 && in_info.bits < vtype->bits)
+            opts.bits = in_info.bits;
+    }
+
     if (dims[0] < 0 || dims[1] < 0) {
         fprintf(stderr, "\nFATAL: You must specify width and height\n\n");
         print_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
+    if (packed != NULL) {
+        vtype = value_type_find("u16");
+        if (opts.bits == 0)
+            opts.bits = packed->bits;
+    }
+
+    const int bpp = vtype->bits;
+    opts.float_keys = (vtype->kind == VALUE_FLOAT);
+
+    if (submit_socket != NULL) {
+        if (has_header || in_chunked || packed != NULL || dims[DZ] >= 0 ||
+            batch != NULL || daemon_socket != NULL) {
+            fprintf(stderr, "\nFATAL: --submit requires a raw 2D input file, and can not be combined with --packed, --batch or --daemon\n\n");
+            return EXIT_FAILURE;
+        }
+        return submit_image(submit_socket, infile, outfile, dims, (size_t)opts.channels * (bpp / 8));
+    }
+
+    /* With -a auto, the algorithm and the number of threads are those
+       that were the fastest on images of the same shape, measured now
+       with --autotune or in a previous run */
+    tune_source_t tune_source = TUNE_NONE;
+    int tune_threads = 0;
+    double tune_seconds = 0.0;
+    if (auto_algo) {
+        const char *path = (wisdom_file != NULL ? wisdom_file : wisdom_default_path());
+        const tune_shape_t shape = {dims[DX], dims[DY], opts.channels, bpp, (opts.bits > 0 ? opts.bits : bpp),
+                                    radius, opts.dilation, opts.stride, opts.postop};
+        const median_filter_algo_info_t *info = NULL;
+        wisdom_t wisdom;
+        char err[256];
+        if (wisdom_load(&wisdom, path, err, sizeof(err)) != 0) {
+            fprintf(stderr, "\nFATAL: wisdom file \"%s\": %s\n\n", path, err);
+            return EXIT_FAILURE;
+        }
+        if (autotune_flag) {
+            if (dims[DZ] >= 0 || dims[DX] < 1 || dims[DY] < 1) {
+                fprintf(stderr, "\nFATAL: --autotune requires the geometry of a 2D image\n\n");
+                return EXIT_FAILURE;
+            }
+            fprintf(stderr, "Autotuning %d x %d pixels, %d channels, %d bits (%d significant), radius %d, dilation %d, stride %d, %s\n\n",
+                    dims[DX], dims[DY], opts.channels, bpp, shape.bits, radius, opts.dilation, opts.stride,
+                    postop_names[opts.postop]);
+            if (autotune(&wisdom, &shape, &opts, stderr) == 0) {
+                fprintf(stderr, "\nFATAL: No algorithm can be measured with these options\n\n");
+                return EXIT_FAILURE;
+            }
+            if (wisdom_save(&wisdom, path, err, sizeof(err)) != 0) {
+                fprintf(stderr, "\nFATAL: can not write wisdom file \"%s\": %s\n\n", path, err);
+                return EXIT_FAILURE;
+            }
+            fprintf(stderr, "\nWisdom.......... %s\n", path);
+        }
+        /* the wisdom covers 2D images only */
+        if (dims[DZ] < 0)
+            tune_source = wisdom_choose(&wisdom, &shape, &opts, &info, &tune_threads, &tune_seconds);
+        if (tune_source != TUNE_NONE) {
+            algo_name = info->name;
+            algo_fun = &info->fun;
+            algo_bound = &info->bound;
+            omp_set_num_threads(tune_threads);
+        }
+        wisdom_free(&wisdom);
+        if (infile == NULL) {
+            fprintf(stderr, "Fastest......... %s, %d threads, %f s\n\n", algo_name, tune_threads, tune_seconds);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    {
+        char err[256];
+        if (median_filter_check(algo_fun, vtype, &opts, err, sizeof(err)) != 0) {
+            fprintf(stderr, "\nFATAL: %s\n\n", err);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (nodata_arg != NULL) {
+        opts.has_nodata = 1;
+        if (value_parse(nodata_arg, vtype, &opts.nodata) != 0) {
+            fprintf(stderr, "\nFATAL: invalid no-data value %s for type %s\n\n", nodata_arg, vtype->name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (clamp_arg != NULL) {
+        /* The clamp interval refers to the output, which is made of
+           unsigned integers unless it is the median */
+        char name[16];
+        snprintf(name, sizeof(name), "u%d", bpp);
+        const value_type_t *ctype = (opts.postop == POSTOP_NONE ? vtype : value_type_find(name));
+        char lo[64], hi[64];
+        opts.has_clamp = 1;
+        if (sscanf(clamp_arg, "%63[^:]:%63s", lo, hi) != 2 ||
+            value_parse(lo, ctype, &opts.clamp_lo) != 0 ||
+            value_parse(hi, ctype, &opts.clamp_hi) != 0 ||
+            opts.clamp_lo > opts.clamp_hi) {
+            fprintf(stderr, "\nFATAL: invalid clamp interval %s for type %s\n", clamp_arg, ctype->name);
+            return EXIT_FAILURE;
+        }
+    }
+
     ndims = (dims[2] < 0 ? 2 : 3);
 
-    if (optind >= argc) {
-        fprintf(stderr, "\nFATAL: No input file given\n\n");
-        print_usage(argv[0]);
+    /* The algorithms are applied to the rectangle roi[2] x roi[3] at
+       (roi[0], roi[1]), whose rows are those of the whole image */
+    int roi[4] = {0, 0, dims[DX], dims[DY]};
+    if (roi_arg != NULL) {
+        char extra;
+        if (sscanf(roi_arg, "%d:%d:%d:%d%c", &roi[0], &roi[1], &roi[2], &roi[3], &extra) != 4 ||
+            roi[0] < 0 || roi[1] < 0 || roi[2] < 1 || roi[3] < 1 ||
+            roi[2] > dims[DX] - roi[0] || roi[3] > dims[DY] - roi[1]) {
+            fprintf(stderr, "\nFATAL: invalid region of interest %s for a %d x %d image\n\n", roi_arg, dims[DX], dims[DY]);
+            return EXIT_FAILURE;
+        }
+        if (ndims != 2 || stream) {
+            fprintf(stderr, "\nFATAL: --roi requires a 2D image, and can not be combined with --stream\n\n");
+            return EXIT_FAILURE;
+        }
+    }
+    const int filter_dims[3] = {roi[2], roi[3], dims[DZ]};
+
+    const size_t N_PIXELS = (ndims == 2 ?
+                             (size_t)dims[0] * dims[1] :
+                             (size_t)dims[0] * dims[1] * dims[2]);
+    const size_t N_VALUES = N_PIXELS * opts.channels;
+    const size_t DATA_SIZE = bpp / 8;
+    const size_t N_ROWS = (ndims == 2 ? (size_t)dims[DY] : (size_t)dims[DY] * dims[DZ]);
+    const size_t ROW_VALUES = (size_t)dims[DX] * opts.channels;
+    const int out_dims[3] = {(filter_dims[DX] + opts.stride - 1) / opts.stride,
+                             (filter_dims[DY] + opts.stride - 1) / opts.stride,
+                             dims[DZ]};
+    const size_t N_OUT_VALUES = (size_t)out_dims[DX] * out_dims[DY] * (ndims == 2 ? 1 : out_dims[DZ]) * opts.channels;
+
+    /* NaNs become missing samples; if there is no no-data value, the
+       canonical NaN is used */
+    const uint32_t nan_key = (opts.has_nodata || vtype->kind != VALUE_FLOAT ? opts.nodata : value_nan_key(vtype));
+    if (packed != NULL && N_VALUES % packed->group_values != 0) {
+        fprintf(stderr, "\nFATAL: The number of values must be a multiple of %d with layout %s\n\n",
+                packed->group_values, packed->name);
         return EXIT_FAILURE;
     }
 
-    infile = argv[optind];
+    /* the output of the post operations is not made of keys */
+    const int raw_output = (opts.postop != POSTOP_NONE);
+    char out_type_name[16];
+    snprintf(out_type_name, sizeof(out_type_name), "u%d", bpp);
+    const value_type_t *out_type = (raw_output ? value_type_find(out_type_name) : vtype);
+    const image_format_t out_format = (no_output ? IMAGE_RAW : image_format_of(outfile));
+    image_info_t out_info;
+    image_info_init(&out_info, out_format, out_dims[DX], out_dims[DY], opts.channels,
+                    out_type, (raw_output ? 0 : opts.bits));
+    if (out_format != IMAGE_RAW) {
+        char err[256];
+        if (ndims != 2 || image_check_writable(&out_info, err, sizeof(err)) != 0) {
+            fprintf(stderr, "\nFATAL: can not write output file \"%s\": %s\n\n", outfile,
+                    (ndims != 2 ? "images with a header are 2D" : err));
+            return EXIT_FAILURE;
+        }
+    }
+    const image_info_t *in_image = (has_header ? &in_info : NULL);
+    const image_info_t *out_image = (out_format != IMAGE_RAW ? &out_info : NULL);
+
+    /* With --checkpoint, the output is mapped from its file, so that
+       the bands that are complete survive an interruption */
+    if (checkpoint) {
+        if (ndims != 2 || no_output || has_header || out_format != IMAGE_RAW ||
+            strcmp(infile, "-") == 0 || strcmp(outfile, "-") == 0 ||
+            in_chunked || chunk_store_is(outfile) || stream || batch_file != NULL || daemon_socket != NULL ||
+            previewfile != NULL || opts.stats != NULL) {
+            fprintf(stderr, "\nFATAL: --checkpoint and --resume require raw 2D input and output files, and can not be combined with chunk stores, --stream, --batch, --daemon, --preview, --stats or --no-output\n\n");
+            return EXIT_FAILURE;
+        }
+        use_mmap = 1;
+    }
 
-    FILE* filein = fopen(infile, "r");
-    if (filein == NULL) {
-        fprintf(stderr, "\nFATAL: can not open input file \"%s\"\n", infile);
+    if (use_mmap && (has_header || out_format != IMAGE_RAW)) {
+        fprintf(stderr, "\nFATAL: --mmap requires raw input and output files\n\n");
         return EXIT_FAILURE;
     }
 
-    const size_t N_PIXELS = (ndims == 2 ?
-                             dims[0] * dims[1] :
-                             dims[0] * dims[1] * dims[2]);
-    const size_t IMG_SIZE = N_PIXELS * DATA_SIZE;
+    const int out_chunked = (!no_output && chunk_store_is(outfile));
+    chunk_store_t out_store = {NULL, out_dims[DX], out_dims[DY], opts.channels, out_type,
+                               (raw_output ? 0 : opts.bits),
+                               (chunk_size[0] > 0 ? chunk_size[0] : (in_chunked ? in_store.chunk_width : 512)),
+                               (chunk_size[1] > 0 ? chunk_size[1] : (in_chunked ? in_store.chunk_height : 512))};
+    if ((in_chunked || out_chunked) && (ndims != 2 || use_mmap || stream || previewfile != NULL)) {
+        fprintf(stderr, "\nFATAL: Chunk stores are 2D, and can not be combined with --mmap, --stream or --preview\n\n");
+        return EXIT_FAILURE;
+    }
+    /* the output chunks are written as soon as they are complete, in
+       any order */
+    if (in_chunked && (opts.stats != NULL || out_format != IMAGE_RAW ||
+                       (!no_output && !out_chunked && strcmp(outfile, "-") == 0))) {
+        fprintf(stderr, "\nFATAL: An input chunk store requires an output chunk store or raw file, and can not be combined with --stats\n\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((batch != NULL || daemon_socket != NULL) &&
+        (ndims != 2 || use_mmap || stream || previewfile != NULL ||
+         roi_arg != NULL || opts.stats != NULL || packed != NULL)) {
+        fprintf(stderr, "\nFATAL: --batch and --daemon require 2D images, and can not be combined with --mmap, --stream, --preview, --roi, --stats or --packed\n\n");
+        return EXIT_FAILURE;
+    }
 
-    data_t *img = (data_t*)malloc(IMG_SIZE); assert(img != NULL);
-    data_t *out = (data_t*)malloc(IMG_SIZE); assert(out != NULL);
-    const size_t nread = fread(img, DATA_SIZE, N_PIXELS, filein);
-    (void)nread; // dummy access to suppress warning (unused variable `nread`)
-    assert(nread == N_PIXELS);
-    fclose(filein);
+    if (cache_dir != NULL &&
+        (batch != NULL || daemon_socket != NULL || in_chunked || out_chunked || no_output ||
+         previewfile != NULL || opts.stats != NULL || strcmp(infile, "-") == 0 || strcmp(outfile, "-") == 0)) {
+        fprintf(stderr, "\nFATAL: --cache requires input and output files, and can not be combined with chunk stores, --batch, --daemon, --preview, --stats or --no-output\n\n");
+        return EXIT_FAILURE;
+    }
+
+    /* The key of a job covers the input file and everything else that
+       affects the output file; it names the output in the cache of
+       --cache, and tells whether a checkpoint belongs to this job */
+    char job_key[RESULT_CACHE_KEY_LEN + 1];
+    const double tkey = hpc_gettime();
+    if (cache_dir != NULL || checkpoint) {
+        char params[1024];
+        int len = snprintf(params, sizeof(params),
+                           "median-filter-1 %s %s %d %d %d %d %d %d %d %d %d %d %lu %d %lu %d %lu %lu %d %d %d %d %s %s",
+                           algo_name, vtype->name, dims[DX], dims[DY], dims[DZ], opts.channels, radius,
+                           opts.bits, opts.dilation, opts.stride,
+                           (algo_bound->u8 != NULL ? opts.max_error : 0),
+                           opts.has_nodata, (unsigned long)opts.nodata,
+                           opts.postop, (unsigned long)opts.threshold,
+                           opts.has_clamp, (unsigned long)opts.clamp_lo, (unsigned long)opts.clamp_hi,
+                           roi[0], roi[1], roi[2], roi[3],
+                           (packed != NULL ? packed->name : "-"), image_format_name(out_format));
+        for (int s=0; s<opts.nstages && len < (int)sizeof(params); s++) {
+            len += snprintf(params + len, sizeof(params) - len, " %d:%d",
+                            opts.stages[s].percentile, opts.stages[s].radius);
+        }
+        if (result_cache_key(infile, params, job_key) != 0) {
+            fprintf(stderr, "\nFATAL: can not read input file \"%s\": %s\n\n", infile, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* With --cache, a job that has been done before is a copy of its
+       output file */
+    if (cache_dir != NULL) {
+        const int hit = result_cache_fetch(cache_dir, job_key, outfile);
+        if (hit < 0) {
+            fprintf(stderr, "\nFATAL: can not copy the cached result to \"%s\": %s\n\n", outfile, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (hit) {
+            char bound[128];
+            fprintf(stderr,
+                    "Algorithm....... %s\n"
+                    "Input........... %s\n"
+                    "Output.......... %s\n"
+                    "Cache........... hit %s\n",
+                    algo_name, infile, outfile, job_key);
+            if (median_filter_describe_bound(algo_bound, bpp, radius, &opts, bound, sizeof(bound))) {
+                fprintf(stderr, "Error bound..... %s\n", bound);
+            }
+            fprintf(stderr, "\nElapsed time.... %f\n\n", hpc_gettime() - tkey);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    /* maximum distance of the input rows that affect an output row */
+    int reach = radius;
+    if (opts.nstages > 0) {
+        reach = 0;
+        for (int s=0; s<opts.nstages; s++) {
+            reach += opts.stages[s].radius;
+        }
+    }
+
+    /* Packed values must be unpacked anyway, so they are always read */
+    const int map_input = (use_mmap && packed == NULL);
+    const int map_output = (use_mmap && !no_output);
+
+    /* Rows that are read into memory are padded, unless they are made
+       of packed groups that span two rows */
+    size_t in_pitch = ROW_VALUES;
+    if (!no_padding && ndims == 2 && !map_input &&
+        (packed == NULL || ROW_VALUES % packed->group_values == 0)) {
+        in_pitch = median_filter_padded_pitch(ROW_VALUES, DATA_SIZE);
+    }
+    opts.in_pitch = in_pitch;
+    const size_t IMG_SIZE = N_ROWS * in_pitch * DATA_SIZE;
+
+    stream_plan_t plan = {0, 0, 0, 0, 0, 0};
+    const int max_band = (io_flags != 0 ? (out_dims[DY] + ASYNC_BANDS - 1) / ASYNC_BANDS : out_dims[DY]);
+    /* With --async-io, the I/O of a whole image could only overlap with
+       the conversion of its values: the images that could be streamed
+       are streamed instead, with the memory that the whole image and
+       its output would take */
+    int async_bands = 0;
+    if (io_flags != 0 && !stream && ndims == 2 && previewfile == NULL && !use_mmap && roi_arg == NULL &&
+        !in_chunked && !out_chunked && batch == NULL && daemon_socket == NULL &&
+        (!has_header || in_info.contiguous) &&
+        (packed == NULL || ROW_VALUES % packed->group_values == 0)) {
+        async_bands = (stream_plan(&plan, dims, reach, &opts, DATA_SIZE,
+                                   IMG_SIZE + N_OUT_VALUES * DATA_SIZE, max_band) == 0 &&
+                       plan.band < out_dims[DY]);
+        stream = async_bands;
+    }
+    if (stream && !async_bands) {
+        if (ndims != 2 || previewfile != NULL || use_mmap || (has_header && !in_info.contiguous)) {
+            fprintf(stderr, "\nFATAL: --stream requires a 2D image stored row by row, and can not be combined with --preview or --mmap\n\n");
+            return EXIT_FAILURE;
+        }
+        /* packed rows are read one band at a time */
+        if (packed != NULL && ((size_t)dims[DX] * opts.channels) % packed->group_values != 0) {
+            fprintf(stderr, "\nFATAL: The number of values per row must be a multiple of %d with layout %s and --stream\n\n",
+                    packed->group_values, packed->name);
+            return EXIT_FAILURE;
+        }
+        if (stream_plan(&plan, dims, reach, &opts, DATA_SIZE, mem_budget, max_band) != 0) {
+            fprintf(stderr, "\nFATAL: --stream requires a memory budget of at least %llu bytes\n\n",
+                    (unsigned long long)stream_memory(&plan, in_pitch * DATA_SIZE,
+                                                      (size_t)out_dims[DX] * opts.channels * DATA_SIZE));
+            return EXIT_FAILURE;
+        }
+    }
+    /* When the image is processed in parts, NaNs are only found while
+       it is processed, so they are always treated as missing samples;
+       no other value has the key of a NaN, so the result does not
+       change */
+    if ((stream || in_chunked || batch != NULL || daemon_socket != NULL) &&
+        !opts.has_nodata && vtype->kind == VALUE_FLOAT) {
+        opts.has_nodata = 1;
+        opts.nodata = nan_key;
+        nodata_arg = "nan";
+    }
+
+    /* The checkpoint is checked before the output file is touched */
+    checkpoint_t ckpt;
+    int ckpt_band = 0, ckpt_done = 0;
+    char ckpt_path[4096];
+    if (checkpoint) {
+        char err[256];
+        struct stat st;
+        ckpt_band = (out_dims[DY] + CHECKPOINT_BANDS - 1) / CHECKPOINT_BANDS;
+        if (ckpt_band < CHECKPOINT_ROWS)
+            ckpt_band = CHECKPOINT_ROWS;
+        snprintf(ckpt_path, sizeof(ckpt_path), "%s.ckpt", outfile);
+        ckpt_done = checkpoint_open(&ckpt, ckpt_path, job_key, (out_dims[DY] + ckpt_band - 1) / ckpt_band,
+                                    checkpoint_interval, resume, err, sizeof(err));
+        if (ckpt_done < 0) {
+            fprintf(stderr, "\nFATAL: checkpoint \"%s\": %s\n\n", ckpt_path, err);
+            return EXIT_FAILURE;
+        }
+        if (ckpt_done > 0 && (stat(outfile, &st) != 0 || (size_t)st.st_size != N_OUT_VALUES * DATA_SIZE)) {
+            fprintf(stderr, "\nFATAL: output file \"%s\" does not match checkpoint \"%s\"\n\n", outfile, ckpt_path);
+            return EXIT_FAILURE;
+        }
+    }
 
+    void *img = NULL, *out = NULL;
+    size_t nnan = 0;
+    if (stream || in_chunked || batch != NULL || daemon_socket != NULL) {
+        /* the image is read by filter_stream(), filter_chunks() or
+           filter_batch(), or submitted to the daemon */
+    } else if (map_input) {
+        img = map_image(infile, N_VALUES, vtype, nan_key,
+                        (opts.bits > 0 ? opts.bits : bpp), &nnan);
+    } else {
+        img = malloc(IMG_SIZE); assert(img != NULL);
+        nnan = read_image(infile, img, N_ROWS, ROW_VALUES, in_pitch, vtype, nan_key, packed, in_image,
+                          (opts.bits > 0 ? opts.bits : bpp));
+    }
+    if (stream || in_chunked || batch != NULL || daemon_socket != NULL) {
+        /* the buffers are allocated by filter_stream(), filter_chunks()
+           or filter_batch(), or submitted to the daemon */
+    } else if (map_output) {
+        out = mmap_output(outfile, N_OUT_VALUES * DATA_SIZE, ckpt_done > 0);
+        if (out == NULL && N_OUT_VALUES > 0) {
+            fprintf(stderr, "\nFATAL: can not map output file \"%s\": %s\n", outfile, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (checkpoint) {
+            ckpt.out = out;
+            ckpt.size = N_OUT_VALUES * DATA_SIZE;
+        }
+    } else {
+        out = malloc(N_OUT_VALUES * DATA_SIZE); assert(out != NULL);
+    }
+    /* first value of the region of interest */
+    const void *roi_img = (img == NULL ? NULL :
+                           (const char*)img + ((size_t)roi[1] * in_pitch + (size_t)roi[0] * opts.channels) * DATA_SIZE);
+    if (nnan > 0 && !opts.has_nodata) {
+        opts.has_nodata = 1;
+        opts.nodata = nan_key;
+        nodata_arg = "nan";
+    }
     fprintf(stderr,
             "Algorithm....... %s\n"
             "Input........... %s\n"
             "X dim........... %d\n"
             "Y dim........... %d\n"
             "Z dim........... %d\n"
+            "Channels........ %d\n"
+            "Data type....... %s\n"
             "Data size (B)... %d\n"
+            "Bits............ %d\n"
             "Dimensions...... %d\n"
             "Radius.......... %d\n"
+            "Dilation........ %d\n"
+            "Stride.......... %d\n"
+            "Output size..... %d x %d\n"
+            "Post operation.. %s\n"
             "Output.......... %s\n",
             algo_name,
             infile,
             dims[DX],
             dims[DY],
             dims[DZ],
+            opts.channels,
+            vtype->name,
             (int)DATA_SIZE,
+            (opts.bits > 0 ? opts.bits : bpp),
             ndims,
             radius,
-            outfile);
-    const double tstart = hpc_gettime();
-    algo_fun(img, out, dims, ndims, radius);
-    const double elapsed = hpc_gettime() - tstart;
-    fprintf(stderr, "\nExecution time.. %f\n\n", elapsed);
+            opts.dilation,
+            opts.stride,
+            out_dims[DX], out_dims[DY],
+            postop_names[opts.postop],
+            (no_output ? "none" : outfile));
+    if (pipeline != NULL) {
+        fprintf(stderr, "Pipeline........ %s\n", pipeline);
+    }
+    if (cache_dir != NULL) {
+        fprintf(stderr, "Cache........... miss %s\n", job_key);
+    }
+    if (auto_algo) {
+        if (tune_source == TUNE_NONE) {
+            fprintf(stderr, "Autotune........ no wisdom, default algorithm\n");
+        } else {
+            fprintf(stderr, "Autotune........ %s, %d threads, %f s\n",
+                    (tune_source == TUNE_MEASURED ? "measured" : "predicted"), tune_threads, tune_seconds);
+        }
+    }
+    if (packed != NULL) {
+        fprintf(stderr, "Packed input.... %s\n", packed->name);
+    }
+    if (roi_arg != NULL) {
+        fprintf(stderr, "Region.......... %d x %d at (%d, %d)\n", roi[2], roi[3], roi[0], roi[1]);
+    }
+    if (in_pitch != ROW_VALUES) {
+        fprintf(stderr, "Row pitch....... %llu values (padded)\n", (unsigned long long)in_pitch);
+    }
+    if (has_header || out_format != IMAGE_RAW) {
+        fprintf(stderr, "File formats.... %s, %s\n",
+                image_format_name(has_header ? in_info.format : IMAGE_RAW),
+                image_format_name(out_format));
+    }
+    if (use_mmap) {
+        fprintf(stderr, "Mapped files.... %s\n",
+                (map_input ? (map_output ? "input, output" : "input") : (map_output ? "output" : "none")));
+    }
+    if (io_flags != 0) {
+        fprintf(stderr, "I/O mode........ %s\n",
+                (io_flags & ASYNC_DIRECT ? "async, O_DIRECT" : "async"));
+    }
+    if (in_chunked) {
+        fprintf(stderr, "Input chunks.... %d x %d (%d in flight)\n",
+                in_store.chunk_width, in_store.chunk_height, in_flight);
+    }
+    if (out_chunked) {
+        fprintf(stderr, "Output chunks... %d x %d\n", out_store.chunk_width, out_store.chunk_height);
+    }
+    if (stream) {
+        fprintf(stderr, "Stream bands.... %d rows + %d halo rows (%llu bytes)\n",
+                plan.band, plan.halo,
+                (unsigned long long)stream_memory(&plan, in_pitch * DATA_SIZE,
+                                                  (size_t)out_dims[DX] * opts.channels * DATA_SIZE));
+    }
+    if (batch != NULL) {
+        fprintf(stderr, "Batch........... %s (%d images)\n", batch_file, nbatch);
+    }
+    if (daemon_socket != NULL) {
+        fprintf(stderr, "Daemon socket... %s (memory budget %llu bytes)\n",
+                daemon_socket, (unsigned long long)mem_budget);
+    }
+    if (checkpoint) {
+        fprintf(stderr, "Checkpoint...... %s (%d of %d bands of %d rows done, saved every %g s)\n",
+                ckpt_path, ckpt_done, ckpt.nbands, ckpt_band, checkpoint_interval);
+    }
+    if (opts.has_nodata) {
+        fprintf(stderr, "No-data value... %s\n", nodata_arg);
+    }
 
-    FILE* fileout = fopen(outfile, "w");
-    if (fileout == NULL) {
-        fprintf(stderr, "FATAL: can not create output file \"%s\"\n", outfile);
-        return EXIT_FAILURE;
+    if (batch != NULL) {
+        double tcompute;
+        const double tstart = hpc_gettime();
+        const double twait =
+            filter_batch(algo_fun, bpp, batch, nbatch, default_dims, radius, &opts, no_padding,
+                         vtype, nan_key, (opts.bits > 0 ? opts.bits : bpp), raw_output, out_type,
+                         no_output, &tcompute);
+        const double elapsed = hpc_gettime() - tstart;
+        fprintf(stderr,
+                "\nExecution time.. %f\n"
+                "Elapsed time.... %f\n"
+                "Load wait....... %f\n"
+                "Images/second... %.1f\n",
+                tcompute, elapsed, twait, nbatch / elapsed);
+        char bound[128];
+        if (median_filter_describe_bound(algo_bound, bpp, radius, &opts, bound, sizeof(bound))) {
+            fprintf(stderr, "Error bound..... %s\n", bound);
+        }
+        fprintf(stderr, "\n");
+        batch_free(batch, nbatch);
+        if (has_header)
+            image_info_free(&in_info);
+        print_io_stats();
+        return EXIT_SUCCESS;
     }
 
-    const size_t nwritten = fwrite(out, DATA_SIZE, N_PIXELS, fileout);
-    (void)nwritten; // dummy write to suppress warning (unused variable `nwritten`)
-    assert(nwritten == N_PIXELS);
-    fclose(fileout);
+    if (daemon_socket != NULL) {
+        daemon_ctx_t ctx = {algo_fun, bpp, radius, opts, vtype, nan_key,
+                            (opts.bits > 0 ? opts.bits : bpp), raw_output};
+        ctx.opts.in_pitch = ctx.opts.out_pitch = 0;
+        const daemon_config_t config = {(size_t)opts.channels * DATA_SIZE, opts.stride, mem_budget,
+                                        filter_job, &ctx};
+        daemon_stats_t dstats;
+        if (daemon_serve(daemon_socket, &config, &dstats) != 0) {
+            fprintf(stderr, "\nFATAL: can not listen on \"%s\": %s\n\n", daemon_socket, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr,
+                "\nJobs............ %lu\n"
+                "Rejected jobs... %lu\n"
+                "Execution time.. %f\n\n",
+                dstats.jobs, dstats.rejected, dstats.busy);
+        if (has_header)
+            image_info_free(&in_info);
+        return EXIT_SUCCESS;
+    }
 
-    free(img);
-    free(out);
+    if (previewfile != NULL) {
+        /* The preview is computed at a coarser stride, and is small
+           enough to fit in the output buffer */
+        median_filter_opts_t preview_opts = opts;
+        preview_opts.stride = opts.stride * PREVIEW_STRIDE;
+        preview_opts.stats = NULL;
+        const int preview_width = (filter_dims[DX] + preview_opts.stride - 1) / preview_opts.stride;
+        const int preview_height = (filter_dims[DY] + preview_opts.stride - 1) / preview_opts.stride;
+        image_info_t preview_info;
+        image_info_init(&preview_info, image_format_of(previewfile), preview_width, preview_height,
+                        opts.channels, out_type, (raw_output ? 0 : opts.bits));
+        char err[256];
+        if (preview_info.format != IMAGE_RAW &&
+            (ndims != 2 || image_check_writable(&preview_info, err, sizeof(err)) != 0)) {
+            fprintf(stderr, "\nFATAL: can not write preview file \"%s\": %s\n\n", previewfile,
+                    (ndims != 2 ? "images with a header are 2D" : err));
+            return EXIT_FAILURE;
+        }
+        const double tpreview = hpc_gettime();
+        median_filter_run(algo_fun, bpp, roi_img, out, filter_dims, ndims, radius, &preview_opts);
+        write_image(previewfile, out, (size_t)preview_width * preview_height * opts.channels, vtype, raw_output,
+                    (preview_info.format != IMAGE_RAW ? &preview_info : NULL));
+        fprintf(stderr, "\nPreview......... %s (%d x %d, %f s)\n",
+                previewfile, preview_width, preview_height, hpc_gettime() - tpreview);
+    }
+
+    if (stream) {
+        async_file_t *filein = open_image(infile, 0, plan.in_ahead);
+        async_file_t *fileout = (no_output ? NULL : open_image(outfile, 1, plan.out_ahead));
+        if (has_header)
+            skip_header(filein, infile, in_info.offset);
+        if (fileout != NULL)
+            write_header(fileout, out_image, 0);
+        const double tcompute =
+            filter_stream(algo_fun, bpp, filein, infile, fileout, dims, radius, &opts, &plan,
+                          vtype, nan_key, packed, in_image, (opts.bits > 0 ? opts.bits : bpp),
+                          raw_output, out_image);
+        close_image(filein, infile, 0);
+        if (fileout != NULL) {
+            write_header(fileout, out_image, 1);
+            close_image(fileout, outfile, 1);
+        }
+        fprintf(stderr, "\nExecution time.. %f\n", tcompute);
+    } else if (in_chunked) {
+        int fdout = -1;
+        if (out_chunked) {
+            create_store(&out_store, outfile);
+        } else if (!no_output) {
+            fdout = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fdout < 0 || ftruncate(fdout, (off_t)(N_OUT_VALUES * DATA_SIZE)) != 0) {
+                fprintf(stderr, "\nFATAL: can not create \"%s\": %s\n\n", outfile, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+        const double tcompute =
+            filter_chunks(algo_fun, bpp, &in_store, roi, radius, reach, &opts, in_flight,
+                          &out_store, fdout, vtype, nan_key, (opts.bits > 0 ? opts.bits : bpp),
+                          raw_output);
+        if (fdout >= 0 && close(fdout) != 0) {
+            fprintf(stderr, "\nFATAL: can not write \"%s\": %s\n\n", outfile, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "\nExecution time.. %f\n", tcompute);
+    } else if (checkpoint) {
+        const double tcompute =
+            filter_bands(algo_fun, bpp, roi_img, out, outfile, filter_dims, radius, &opts, ckpt_band,
+                         &ckpt, vtype, raw_output);
+        fprintf(stderr, "\nExecution time.. %f\n", tcompute);
+    } else {
+        const double tstart = hpc_gettime();
+        median_filter_run(algo_fun, bpp, roi_img, out, filter_dims, ndims, radius, &opts);
+        const double elapsed = hpc_gettime() - tstart;
+        fprintf(stderr, "\nExecution time.. %f\n", elapsed);
+    }
+    char bound[128];
+    if (median_filter_describe_bound(algo_bound, bpp, radius, &opts, bound, sizeof(bound))) {
+        fprintf(stderr, "Error bound..... %s\n", bound);
+    }
+    if (opts.stats != NULL) {
+        fprintf(stderr,
+                "Outliers........ %llu\n"
+                "Sum |residual|.. %g\n",
+                (unsigned long long)stats.outliers,
+                stats.abs_residual);
+    }
+    fprintf(stderr, "\n");
+
+    if (map_output) {
+        /* the result is already in the file; with --checkpoint, the
+           values of each band have been converted as it was completed */
+        if (!raw_output && !checkpoint)
+            keys_to_values(out, N_OUT_VALUES, vtype);
+        if (checkpoint)
+            checkpoint_close(&ckpt, 1);
+        mmap_release(out, N_OUT_VALUES * DATA_SIZE);
+    } else if (out_chunked && !in_chunked) {
+        if (!raw_output)
+            keys_to_values(out, N_OUT_VALUES, vtype);
+        create_store(&out_store, outfile);
+        const int ncx = chunk_store_grid(&out_store, 0), ncy = chunk_store_grid(&out_store, 1);
+        const size_t out_row_values = (size_t)out_dims[DX] * opts.channels;
+        for (int cy=0; cy<ncy; cy++) {
+            for (int cx=0; cx<ncx; cx++) {
+                const size_t first = ((size_t)cy * out_store.chunk_height * out_dims[DX] +
+                                      (size_t)cx * out_store.chunk_width) * opts.channels;
+                if (chunk_store_write(&out_store, cx, cy, (char*)out + first * DATA_SIZE, out_row_values) != 0) {
+                    fprintf(stderr, "\nFATAL: can not write \"%s\": %s\n\n", outfile, strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        free(out);
+    } else if (!stream && !in_chunked) {
+        if (!no_output)
+            write_image(outfile, out, N_OUT_VALUES, vtype, raw_output, out_image);
+        free(out);
+    }
+
+    if (map_input)
+        mmap_release(img, IMG_SIZE);
+    else
+        free(img);
+    if (has_header)
+        image_info_free(&in_info);
+    if (in_chunked)
+        chunk_store_close(&in_store);
+    chunk_store_close(&out_store);
+
+    /* the cache is only an optimization; the job has succeeded anyway */
+    if (cache_dir != NULL && result_cache_store(cache_dir, job_key, outfile, cache_size) != 0) {
+        fprintf(stderr, "Can not store the result in cache \"%s\": %s\n\n", cache_dir, strerror(errno));
+    }
+
+    print_io_stats();
 
     return EXIT_SUCCESS;
 }
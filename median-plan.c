@@ -0,0 +1,391 @@
+/****************************************************************************
+ *
+ * median-plan.c -- Median filter library
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/* posix_memalign() is not part of C99 */
+#if _XOPEN_SOURCE < 600
+#define _XOPEN_SOURCE 600
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <omp.h>
+#include "common.h"
+#include "keys.h"
+#include "workspace.h"
+#include "median-plan.h"
+
+#define ALL_TYPES(fun) {fun ## _u8, fun ## _u16, fun ## _u32}
+#define EXACT {NULL, NULL, NULL}
+
+const median_filter_algo_info_t median_filter_algos[] = {
+    {"omp-hist-sparse-byrow", "Optimized sparse histogram-based median (OpenMP)", ALL_TYPES(median_filter_2D_sparse_byrow), EXACT},
+    {"omp-vector-median-l1", "Vector median of multi-channel pixels, L1 distance (OpenMP)", ALL_TYPES(median_filter_2D_vector_l1), EXACT},
+    {"omp-vector-median-l2", "Vector median of multi-channel pixels, L2 distance (OpenMP)", ALL_TYPES(median_filter_2D_vector_l2), EXACT},
+    {"omp-rank-pipeline", "Pipeline of rank filters with line buffers, see --pipeline (OpenMP)", ALL_TYPES(median_filter_2D_rank_pipeline), EXACT},
+    {"omp-approx-coarse", "Approximate median, error <= e grey levels, or e ulps of floating point values (OpenMP)", ALL_TYPES(median_filter_2D_approx_coarse), ALL_TYPES(median_filter_2D_approx_coarse_bound)},
+    {"omp-approx-sample", "Approximate median, rank error <= e% with high probability (OpenMP)", ALL_TYPES(median_filter_2D_approx_sample), ALL_TYPES(median_filter_2D_approx_sample_bound)},
+    {"omp-approx-separable", "Approximate median of row medians (OpenMP)", ALL_TYPES(median_filter_2D_approx_separable), ALL_TYPES(median_filter_2D_approx_separable_bound)},
+    {"cuda-hist-generic", "Histogram-based median, works with any data type  (CUDA)", ALL_TYPES(cuda_median_2D_hist_generic), EXACT},
+    {"omp-reference", "Brute-force median of each window, for testing (OpenMP)", ALL_TYPES(median_filter_2D_reference), EXACT},
+    {"omp-vector-reference-l1", "Brute-force vector median, L1 distance, for testing (OpenMP)", ALL_TYPES(median_filter_2D_vector_reference_l1), EXACT},
+    {"omp-vector-reference-l2", "Brute-force vector median, L2 distance, for testing (OpenMP)", ALL_TYPES(median_filter_2D_vector_reference_l2), EXACT},
+    {NULL, NULL, EXACT, EXACT}
+};
+
+const median_filter_algo_info_t *median_filter_algo_find( const char *name )
+{
+    for (int i=0; median_filter_algos[i].name; i++) {
+        if (strcmp(name, median_filter_algos[i].name) == 0)
+            return &median_filter_algos[i];
+    }
+    return NULL;
+}
+
+void median_filter_run( const median_filter_algo_t *fun, int bpp,
+                        const void *in, void *out,
+                        const int *dims, int ndims, int radius,
+                        const median_filter_opts_t *opts )
+{
+    switch (bpp) {
+    case 8:
+        fun->u8((const uint8_t*)in, (uint8_t*)out, dims, ndims, radius, opts);
+        break;
+    case 16:
+        fun->u16((const uint16_t*)in, (uint16_t*)out, dims, ndims, radius, opts);
+        break;
+    default:
+        fun->u32((const uint32_t*)in, (uint32_t*)out, dims, ndims, radius, opts);
+    }
+}
+
+int median_filter_describe_bound( const median_filter_bound_t *bound, int bpp, int radius,
+                                  const median_filter_opts_t *opts, char *buf, size_t len )
+{
+    if (bound->u8 == NULL)
+        return 0;
+    switch (bpp) {
+    case 8:
+        bound->u8(radius, opts, buf, len);
+        break;
+    case 16:
+        bound->u16(radius, opts, buf, len);
+        break;
+    default:
+        bound->u32(radius, opts, buf, len);
+    }
+    return 1;
+}
+
+int median_filter_check( const median_filter_algo_t *fun, const value_type_t *t,
+                         const median_filter_opts_t *opts, char *err, size_t errlen )
+{
+    const int bpp = t->bits;
+
+    /* Keys of signed and floating point values use all bits */
+    if (opts->bits != 0 && (opts->bits < 1 || opts->bits > bpp ||
+                            (t->kind != VALUE_UNSIGNED && opts->bits != bpp))) {
+        snprintf(err, errlen, "The number of significant bits must be between 1 and %d; signed and floating point types use all %d bits", bpp, bpp);
+        return -1;
+    }
+
+    /* The residuals are differences of keys, which are meaningful
+       for integer types only */
+    if (t->kind == VALUE_FLOAT && (opts->postop != POSTOP_NONE || opts->stats != NULL)) {
+        snprintf(err, errlen, "Post operations and --stats require an integer data type");
+        return -1;
+    }
+
+    if (opts->channels < 1) {
+        snprintf(err, errlen, "The number of channels must be at least 1");
+        return -1;
+    }
+
+    if (opts->dilation < 1) {
+        snprintf(err, errlen, "The dilation factor must be at least 1");
+        return -1;
+    }
+
+    if (opts->max_error < 0) {
+        snprintf(err, errlen, "The error bound must be nonnegative");
+        return -1;
+    }
+
+    if (opts->stride < 1) {
+        snprintf(err, errlen, "The output stride must be at least 1");
+        return -1;
+    }
+
+    /* The bins of the coarse histograms are at least 2^(bits -
+       COARSE_MAX_BITS) keys wide, and the error is half that */
+    if (fun->u8 == median_filter_2D_approx_coarse_u8) {
+        const int bits = (opts->bits > 0 ? opts->bits : bpp);
+        const long min_error = (bits > COARSE_MAX_BITS ? 1L << (bits - COARSE_MAX_BITS - 1) : 0);
+        if (opts->max_error < min_error) {
+            snprintf(err, errlen, "With %d significant bits, the error bound of omp-approx-coarse must be at least %ld", bits, min_error);
+            return -1;
+        }
+    }
+
+    if ((fun->u8 == median_filter_2D_rank_pipeline_u8 || opts->nstages > 0) &&
+        (opts->stride != 1 || opts->dilation != 1)) {
+        snprintf(err, errlen, "Rank filter pipelines do not support stride or dilation");
+        return -1;
+    }
+
+    if (opts->nstages > 0 &&
+        fun->u8 != median_filter_2D_rank_pipeline_u8 &&
+        fun->u8 != median_filter_2D_reference_u8) {
+        snprintf(err, errlen, "--pipeline requires -a omp-rank-pipeline or omp-reference");
+        return -1;
+    }
+    return 0;
+}
+
+struct median_filter_plan {
+    const median_filter_algo_info_t *algo;
+    const value_type_t *t;
+    int dims[2];
+    int out_dims[2];
+    int radius;
+    median_filter_opts_t opts;  /* the pitches are those of the algorithm */
+    rank_stage_t *stages;       /* copy of the stages of the caller */
+    size_t in_pitch, out_pitch; /* pitches of the images of the caller */
+    int nthreads;
+    median_filter_workspace_t *ws;
+    void *keys;                 /* padded copy of the input as keys, or NULL
+                                   if the input is passed as it is */
+    size_t keys_pitch;
+    size_t keys_bytes;
+};
+
+/* Fill the `n` values of `size` bytes in `buf` with pseudo-random keys
+   of `bits` bits. Distinct values are the worst case for the sparse
+   histograms, so the workspace is sized generously. */
+static void fill_random( void *buf, size_t n, size_t size, int bits )
+{
+    uint32_t x = 2463534242u;
+    const uint32_t mask = (bits >= 32 ? 0xffffffffu : (1u << bits) - 1);
+    for (size_t i=0; i<n; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        const uint32_t v = x & mask;
+        switch (size) {
+        case 1:
+            ((uint8_t*)buf)[i] = (uint8_t)v;
+            break;
+        case 2:
+            ((uint16_t*)buf)[i] = (uint16_t)v;
+            break;
+        default:
+            ((uint32_t*)buf)[i] = v;
+        }
+    }
+}
+
+median_filter_plan_t *median_filter_plan_create( const char *algo, const char *type,
+                                                 int width, int height, int radius,
+                                                 const median_filter_opts_t *opts,
+                                                 char *err, size_t errlen )
+{
+    const median_filter_algo_info_t *info = median_filter_algo_find(algo);
+    if (info == NULL) {
+        snprintf(err, errlen, "unknown algorithm %s", algo);
+        return NULL;
+    }
+    const value_type_t *t = value_type_find(type);
+    if (t == NULL) {
+        snprintf(err, errlen, "unknown data type %s", type);
+        return NULL;
+    }
+    if (width < 1 || height < 1 || radius < 0) {
+        snprintf(err, errlen, "invalid geometry %d x %d or radius %d", width, height, radius);
+        return NULL;
+    }
+    if (median_filter_check(&info->fun, t, opts, err, errlen) != 0)
+        return NULL;
+
+    const size_t size = t->bits / 8;
+    const size_t row_values = (size_t)width * opts->channels;
+    const int out_width = (width + opts->stride - 1) / opts->stride;
+    const int out_height = (height + opts->stride - 1) / opts->stride;
+    const size_t out_row_values = (size_t)out_width * opts->channels;
+    if ((opts->in_pitch > 0 && opts->in_pitch < row_values) ||
+        (opts->out_pitch > 0 && opts->out_pitch < out_row_values)) {
+        snprintf(err, errlen, "the row pitch is smaller than a row");
+        return NULL;
+    }
+
+    median_filter_plan_t *plan = (median_filter_plan_t*)calloc(1, sizeof(*plan));
+    if (plan == NULL) {
+        snprintf(err, errlen, "%s", strerror(ENOMEM));
+        return NULL;
+    }
+    plan->algo = info;
+    plan->t = t;
+    plan->dims[DX] = width;
+    plan->dims[DY] = height;
+    plan->out_dims[DX] = out_width;
+    plan->out_dims[DY] = out_height;
+    plan->radius = radius;
+    plan->opts = *opts;
+    plan->opts.float_keys = (t->kind == VALUE_FLOAT);
+    plan->in_pitch = (opts->in_pitch > 0 ? opts->in_pitch : row_values);
+    plan->out_pitch = (opts->out_pitch > 0 ? opts->out_pitch : out_row_values);
+    plan->opts.in_pitch = plan->in_pitch;
+    plan->opts.out_pitch = plan->out_pitch;
+    plan->nthreads = omp_get_max_threads();
+    plan->ws = workspace_create(plan->nthreads);
+    plan->opts.workspace = plan->ws;
+    if (plan->ws == NULL)
+        goto nomem;
+    if (opts->nstages > 0) {
+        plan->stages = (rank_stage_t*)malloc(opts->nstages * sizeof(*plan->stages));
+        if (plan->stages == NULL)
+            goto nomem;
+        memcpy(plan->stages, opts->stages, opts->nstages * sizeof(*plan->stages));
+        plan->opts.stages = plan->stages;
+    }
+
+    /* Signed and floating point values are converted to keys in a copy
+       of the input, which is also used to pad rows of a multiple of 512
+       bytes (see median_filter_padded_pitch()) */
+    if (t->kind != VALUE_UNSIGNED ||
+        median_filter_padded_pitch(plan->in_pitch, size) != plan->in_pitch) {
+        void *keys;
+        plan->keys_pitch = median_filter_padded_pitch(row_values, size);
+        plan->keys_bytes = plan->keys_pitch * height * size;
+        if (posix_memalign(&keys, MEDIAN_FILTER_CACHE_LINE, plan->keys_bytes) != 0)
+            goto nomem;
+        plan->keys = keys;
+        plan->opts.in_pitch = plan->keys_pitch;
+    }
+
+    /* Size the workspace by filtering a synthetic image of the same
+       geometry, then move all its memory into the arenas */
+    {
+        const int bits = (opts->bits > 0 ? opts->bits : t->bits);
+        const size_t in_bytes = plan->opts.in_pitch * height * size;
+        void *in = (plan->keys != NULL ? plan->keys : malloc(in_bytes));
+        void *out = malloc(plan->out_pitch * out_height * size);
+        if (in == NULL || out == NULL) {
+            if (in != plan->keys)
+                free(in);
+            free(out);
+            goto nomem;
+        }
+        fill_random(in, in_bytes / size, size, bits);
+        median_filter_opts_t warmup = plan->opts;
+        warmup.stats = NULL;
+        const int saved = omp_get_max_threads();
+        omp_set_num_threads(plan->nthreads);
+        median_filter_run(&info->fun, t->bits, in, out, plan->dims, 2, radius, &warmup);
+        omp_set_num_threads(saved);
+        workspace_reset(plan->ws);
+        if (in != plan->keys)
+            free(in);
+        free(out);
+    }
+    return plan;
+
+ nomem:
+    median_filter_plan_destroy(plan);
+    snprintf(err, errlen, "%s", strerror(ENOMEM));
+    return NULL;
+}
+
+int median_filter_execute( median_filter_plan_t *plan, const void *in, void *out )
+{
+    const value_type_t *t = plan->t;
+    const size_t size = t->bits / 8;
+    const int height = plan->dims[DY];
+    const size_t row_values = (size_t)plan->dims[DX] * plan->opts.channels;
+    const size_t out_row_values = (size_t)plan->out_dims[DX] * plan->opts.channels;
+    const int bits = (plan->opts.bits > 0 ? plan->opts.bits : t->bits);
+    median_filter_opts_t opts = plan->opts;
+    const void *keys = in;
+
+    if (plan->keys != NULL) {
+        /* NaNs become missing samples; if there is no no-data value,
+           the canonical NaN is used */
+        const uint32_t nan_key = (opts.has_nodata || t->kind != VALUE_FLOAT ? opts.nodata : value_nan_key(t));
+        size_t nnan = 0;
+        for (int y=0; y<height; y++) {
+            char *dst = (char*)plan->keys + y * plan->keys_pitch * size;
+            memcpy(dst, (const char*)in + y * plan->in_pitch * size, row_values * size);
+            nnan += values_to_keys(dst, row_values, t, nan_key);
+            if (bits < t->bits && !keys_fit(dst, row_values, t->bits, bits))
+                return ERANGE;
+        }
+        if (nnan > 0) {
+            opts.has_nodata = 1;
+            opts.nodata = nan_key;
+        }
+        keys = plan->keys;
+    } else if (bits < t->bits) {
+        for (int y=0; y<height; y++) {
+            if (!keys_fit((const char*)in + y * plan->in_pitch * size, row_values, t->bits, bits))
+                return ERANGE;
+        }
+    }
+
+    const int saved = omp_get_max_threads();
+    omp_set_num_threads(plan->nthreads);
+    median_filter_run(&plan->algo->fun, t->bits, keys, out, plan->dims, 2, plan->radius, &opts);
+    omp_set_num_threads(saved);
+    /* release the memory of this call, and enlarge the arenas if some
+       allocations did not fit */
+    workspace_reset(plan->ws);
+
+    /* the output of the post operations is not made of keys */
+    if (t->kind != VALUE_UNSIGNED && opts.postop == POSTOP_NONE) {
+        int first, last;
+        median_filter_rows(&opts, plan->out_dims[DY], &first, &last);
+        for (int y=first; y<last; y++) {
+            keys_to_values((char*)out + y * plan->out_pitch * size, out_row_values, t);
+        }
+    }
+    return 0;
+}
+
+void median_filter_plan_output( const median_filter_plan_t *plan, int *width, int *height )
+{
+    *width = plan->out_dims[DX];
+    *height = plan->out_dims[DY];
+}
+
+size_t median_filter_plan_bytes( const median_filter_plan_t *plan )
+{
+    return workspace_bytes(plan->ws) + plan->keys_bytes +
+        plan->opts.nstages * sizeof(*plan->stages);
+}
+
+void median_filter_plan_destroy( median_filter_plan_t *plan )
+{
+    if (plan == NULL)
+        return;
+    workspace_destroy(plan->ws);
+    free(plan->stages);
+    free(plan->keys);
+    free(plan);
+}
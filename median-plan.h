@@ -0,0 +1,143 @@
+/****************************************************************************
+ *
+ * median-plan.h -- Median filter library
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * The algorithms are available as a library (libmedianfilter.a and
+ * libmedianfilter.so) for programs that filter many images of the
+ * same geometry, e.g., the frames of a video:
+ *
+ *      median_filter_opts_t opts;
+ *      char err[256];
+ *      median_filter_opts_init(&opts);
+ *      opts.channels = 3;
+ *      median_filter_plan_t *plan =
+ *          median_filter_plan_create("omp-hist-sparse-byrow", "u8",
+ *                                    width, height, 5, &opts, err, sizeof(err));
+ *      for (each frame)
+ *          median_filter_execute(plan, in, out);
+ *      median_filter_plan_destroy(plan);
+ *
+ * The plan validates the parameters once, and owns the temporary memory
+ * of the algorithm (see workspace.h) and the buffers needed to convert
+ * signed and floating point values to keys (see keys.h). It is sized by
+ * filtering a synthetic image when the plan is created, so that, for
+ * images of similar content, median_filter_execute() does not allocate
+ * memory. The algorithm always runs with the number of OpenMP threads
+ * that was in effect when the plan was created.
+ *
+ * A plan must not be executed by two threads at the same time; distinct
+ * plans can, but not from within an OpenMP parallel region.
+ */
+#ifndef MEDIAN_PLAN_H
+#define MEDIAN_PLAN_H
+
+#include <stddef.h>
+#include "common.h"
+#include "keys.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Instantiations of an algorithm for each data type (see common.h) */
+typedef struct {
+    void (*u8)( const uint8_t *in, uint8_t *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts );
+    void (*u16)( const uint16_t *in, uint16_t *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts );
+    void (*u32)( const uint32_t *in, uint32_t *out, const int *dims, int ndims, int radius, const median_filter_opts_t *opts );
+} median_filter_algo_t;
+
+/* Approximate algorithms describe the error bound they guarantee */
+typedef struct {
+    void (*u8)( int radius, const median_filter_opts_t *opts, char *buf, size_t len );
+    void (*u16)( int radius, const median_filter_opts_t *opts, char *buf, size_t len );
+    void (*u32)( int radius, const median_filter_opts_t *opts, char *buf, size_t len );
+} median_filter_bound_t;
+
+typedef struct {
+    const char *name;
+    const char *description;
+    median_filter_algo_t fun;
+    median_filter_bound_t bound; /* all NULL for exact algorithms */
+} median_filter_algo_info_t;
+
+/* The available algorithms; the list ends with an element whose name
+   is NULL, and the first element is the default algorithm */
+extern const median_filter_algo_info_t median_filter_algos[];
+
+/* Return the algorithm called `name`, or NULL if there is none */
+const median_filter_algo_info_t *median_filter_algo_find( const char *name );
+
+/* Apply algorithm `fun` to an image whose values have `bpp` bits; the
+   data type is chosen here once, and the instantiation for that type
+   does not perform any further check */
+void median_filter_run( const median_filter_algo_t *fun, int bpp,
+                        const void *in, void *out,
+                        const int *dims, int ndims, int radius,
+                        const median_filter_opts_t *opts );
+
+/* Write the error bound of `bound` into `buf`; return 0 if the
+   algorithm is exact */
+int median_filter_describe_bound( const median_filter_bound_t *bound, int bpp, int radius,
+                                  const median_filter_opts_t *opts, char *buf, size_t len );
+
+/* Check that `opts` can be used with algorithm `fun` on values of type
+   `t`; return 0 if so, otherwise -1 with the reason in `err` */
+int median_filter_check( const median_filter_algo_t *fun, const value_type_t *t,
+                         const median_filter_opts_t *opts, char *err, size_t errlen );
+
+typedef struct median_filter_plan median_filter_plan_t;
+
+/* Create a plan that filters 2D images of `width` x `height` pixels of
+   type `type` (e.g., "u16", "f32", see value_type_find()) with the
+   algorithm called `algo`, radius `radius` and options `opts`. The
+   options are copied, except `opts->stats`, which must remain valid
+   until the plan is destroyed; `opts->workspace` is ignored, and
+   `opts->float_keys` is set according to `type`. For
+   floating point types without a no-data value, NaNs are the missing
+   samples. Return NULL if the parameters are not valid, or there is not
+   enough memory, with the reason in `err`. */
+median_filter_plan_t *median_filter_plan_create( const char *algo, const char *type,
+                                                 int width, int height, int radius,
+                                                 const median_filter_opts_t *opts,
+                                                 char *err, size_t errlen );
+
+/* Filter the image `in` into `out`; the rows of the images are
+   `opts->in_pitch` and `opts->out_pitch` values apart, as given when
+   the plan was created. The input is not modified. With a post
+   operation, the output is made of unsigned integers of the same width
+   as `type`. Only the output rows `opts->rows_first` ..
+   `opts->rows_last`-1 are written. Return 0 on success, or ERANGE if
+   an input value does not fit in `opts->bits` bits. */
+int median_filter_execute( median_filter_plan_t *plan, const void *in, void *out );
+
+/* Return the width and height of the images produced by `plan` */
+void median_filter_plan_output( const median_filter_plan_t *plan, int *width, int *height );
+
+/* Return the bytes of memory owned by `plan`, besides the plan itself */
+size_t median_filter_plan_bytes( const median_filter_plan_t *plan );
+
+void median_filter_plan_destroy( median_filter_plan_t *plan );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,110 @@
+/****************************************************************************
+ *
+ * mmap-io.c -- Memory-mapped input and output images
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/* madvise() and the MADV_HUGEPAGE hint are not part of C99/POSIX */
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mmap-io.h"
+
+/* Hints are only hints: failures are ignored */
+static void advise( void *addr, size_t size, int readahead )
+{
+#ifdef MADV_HUGEPAGE
+    madvise(addr, size, MADV_HUGEPAGE);
+#endif
+    if (readahead)
+        madvise(addr, size, MADV_WILLNEED);
+}
+
+void *mmap_input( const char *fname, size_t size )
+{
+    struct stat st;
+    void *addr = NULL;
+    const int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0)
+        goto out;
+    if (size == 0 || (size_t)st.st_size < size) {
+        errno = 0;
+        goto out;
+    }
+    /* Writable, so that the values can be converted in place; the
+       file is never modified */
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        addr = NULL;
+        goto out;
+    }
+    advise(addr, size, 1);
+ out:
+    {
+        const int saved_errno = errno;
+        close(fd); /* the mapping stays valid */
+        errno = saved_errno;
+    }
+    return addr;
+}
+
+void *mmap_output( const char *fname, size_t size, int keep )
+{
+    void *addr = NULL;
+    int err;
+    const int fd = open(fname, O_RDWR | O_CREAT | (keep ? 0 : O_TRUNC), 0666);
+    if (fd < 0)
+        return NULL;
+    if (size == 0) {
+        errno = 0;
+        goto out;
+    }
+    /* the first `size` bytes of a longer file are kept */
+    if (keep && ftruncate(fd, size) != 0)
+        goto out;
+    /* Allocate the blocks now: running out of space while the
+       algorithm writes to the mapping would raise SIGBUS */
+    if ((err = posix_fallocate(fd, 0, size)) != 0) {
+        errno = err;
+        goto out;
+    }
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        addr = NULL;
+        goto out;
+    }
+    advise(addr, size, 0);
+ out:
+    {
+        const int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    return addr;
+}
+
+void mmap_release( void *addr, size_t size )
+{
+    if (addr != NULL)
+        munmap(addr, size);
+}
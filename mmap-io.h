@@ -0,0 +1,55 @@
+/****************************************************************************
+ *
+ * mmap-io.h -- Memory-mapped input and output images
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Instead of being copied into (and out of) buffers allocated by the
+ * program, the images can be accessed directly in the page cache. The
+ * input file is mapped privately: the pages that are modified, e.g.,
+ * when signed or floating point values are converted to keys in place,
+ * are copied on write, all the others are shared with the page cache.
+ * The output file is created with its final size and mapped shared, so
+ * that the algorithms write the result directly into the file. In both
+ * cases, the kernel is asked to read ahead and to back the mapping
+ * with huge pages where possible.
+ */
+#ifndef MMAP_IO_H
+#define MMAP_IO_H
+
+#include <stddef.h>
+
+/* Map the first `size` bytes of file `fname`. Return NULL on failure,
+   with errno set to the cause, or to 0 if the file is shorter than
+   `size` bytes. If `size` is 0, nothing is mapped and NULL is
+   returned with errno set to 0. */
+void *mmap_input( const char *fname, size_t size );
+
+/* Create (or truncate) file `fname`, allocate `size` bytes to it and
+   map them; if `keep` is nonzero, the contents of an existing file are
+   not discarded, e.g., to complete a job that was interrupted. Return
+   NULL on failure, with errno set to the cause. */
+void *mmap_output( const char *fname, size_t size, int keep );
+
+/* Unmap `size` bytes at `addr`, returned by mmap_input() or
+   mmap_output(); the data written to an output mapping are in the
+   file afterwards */
+void mmap_release( void *addr, size_t size );
+
+#endif
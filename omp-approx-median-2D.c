@@ -0,0 +1,528 @@
+/****************************************************************************
+ *
+ * omp-approx-median-2D.c -- Approximate median filters with bounded error
+ *
+ * Copyright 2025 Moreno Marzolla, Michele Ravaioli
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * This file contains three approximate median filters that trade
+ * accuracy for speed, each with an explicit guarantee on the error:
+ *
+ * - coarse: the window histogram only counts the most significant
+ *   bits of each value, i.e., it has bins of width W = 2^k. The
+ *   histogram is dense and small enough to be updated in O(1) time,
+ *   and the result is the center of the bin containing the median;
+ *   the error is therefore at most W/2 grey levels. The histogram has
+ *   at most 2^COARSE_MAX_BITS bins, so that W can not be smaller than
+ *   2^(bits - COARSE_MAX_BITS); a smaller error bound is rejected by
+ *   median_filter_check(). The bins are those of the keys (see
+ *   keys.h): for signed types, these are the grey levels shifted by a
+ *   constant, but for floating point types the error is a number of
+ *   representable values (units in the last place) rather than a
+ *   distance.
+ *
+ * - sample: the median of M pixels drawn uniformly at random from the
+ *   window. By the Dvoretzky-Kiefer-Wolfowitz inequality, the rank of
+ *   the result differs from the rank of the median by at most eps*N
+ *   with probability at least 1 - 2*exp(-2*M*eps^2).
+ *
+ * - separable: the median of the medians of each row of the
+ *   window. At least (R+1) rows have a median <= the result, and each
+ *   of these rows contains at least (R+1) elements <= the result (and
+ *   symmetrically for >=); the rank of the result is therefore
+ *   guaranteed to be within [(R+1)^2, N-(R+1)^2+1].
+ *
+ * The error bounds are controlled by `opts->max_error`, whose meaning
+ * depends on the algorithm (grey levels for coarse, percentage of the
+ * window for sample); the separable filter has no parameter.
+ *
+ * Samples equal to the no-data value, if any, are ignored; the bounds
+ * then apply to the valid samples of each window (for the sample
+ * filter, missing samples reduce the effective sample size).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <stdint.h>
+#include <omp.h>
+#include "common.h"
+#include "quickselect.h"
+#include "postop.h"
+
+/* The sample filter guarantees its rank error with probability
+   1 - SAMPLE_FAILURE_PROB */
+#define SAMPLE_FAILURE_PROB 1e-3
+
+static int clamp(int x, int lo, int hi)
+{
+    return (x < lo ? lo : (x > hi ? hi : x));
+}
+
+/*
+ * Number of iterations of the sliding window. The window is centered
+ * at (i*stride, j*stride); consecutive centers that share the same
+ * histogram are `step` columns apart (the least common multiple of
+ * stride and dilation), so that `nphases` interleaved sequences of
+ * centers are required to cover a whole output row. See
+ * median_filter_2D_sparse_byrow().
+ */
+static void window_steps(int stride, int dil, int *step, int *nphases)
+{
+    *step = dil;
+    while (*step % stride != 0) {
+        *step += dil;
+    }
+    *nphases = *step / stride;
+}
+
+/****************************************************************************
+ * Coarse histograms
+ ****************************************************************************/
+
+/* Dense histogram with a pointer to the bin containing the median,
+   that is updated incrementally as in Huang's algorithm */
+typedef struct {
+    int *count;   /* count[b] is the number of values in bin b */
+    int med;      /* current position of the median pointer */
+    int below;    /* number of values in bins < med */
+    int total;    /* number of values in the histogram */
+} CoarseHist;
+
+/* Return the number of low-order bits that are dropped from values of
+   `bits` significant bits to get the coarse bin index, given the
+   requested maximum error `max_error`; the result must have at most
+   COARSE_MAX_BITS bits */
+static int coarse_shift(int bits, int max_error)
+{
+    const int BITS = bits;
+    int shift = 0;
+    while (shift < BITS-1 && ((int64_t)1 << shift) <= 2*(int64_t)max_error) {
+        shift++;
+    }
+    /* now 2^(shift-1) <= 2*max_error < 2^shift */
+    shift = (shift > 0 ? shift-1 : 0);
+    assert(BITS - shift <= COARSE_MAX_BITS);
+    return shift;
+}
+
+static void coarse_update(CoarseHist *h, int b, int c)
+{
+    h->count[b] += c;
+    h->total += c;
+    if (b < h->med)
+        h->below += c;
+}
+
+/* Move the median pointer so that it points to the bin that contains
+   the median; the histogram must not be empty */
+static int coarse_median(CoarseHist *h)
+{
+    const int target = h->total / 2;
+
+    while (h->below > target) {
+        h->med--;
+        h->below -= h->count[h->med];
+    }
+    while (h->below + h->count[h->med] <= target) {
+        h->below += h->count[h->med];
+        h->med++;
+    }
+    return h->med;
+}
+
+/* Add (c = 1) or remove (c = -1) the values of the window centered at
+   (i, j) to the histograms; the rows of `in` are `pitch` values apart.
+   Values equal to `*nodata` are skipped. */
+static void coarse_window(CoarseHist *h, const data_t *in,
+                          int i, int j, int nsamp, int dil, int shift,
+                          int width, int height, size_t pitch, int nchan, int c,
+                          const data_t *nodata)
+{
+    for (int di=-nsamp; di<=nsamp; di++) {
+        const data_t *row = in + (size_t)clamp(i + di*dil, 0, height-1) * pitch;
+        for (int dj=-nsamp; dj<=nsamp; dj++) {
+            const data_t *px = row + (size_t)clamp(j + dj*dil, 0, width-1) * nchan;
+            for (int ch=0; ch<nchan; ch++) {
+                if (nodata == NULL || px[ch] != *nodata)
+                    coarse_update(&h[ch], px[ch] >> shift, c);
+            }
+        }
+    }
+}
+
+/* Shift the window centered at (i, j) by `ncols` sampled columns to
+   the right */
+static void coarse_shift_window(CoarseHist *h, const data_t *in,
+                                int i, int j, int nsamp, int dil, int ncols, int shift,
+                                int width, int height, size_t pitch, int nchan,
+                                const data_t *nodata)
+{
+    for (int di=-nsamp; di<=nsamp; di++) {
+        const data_t *row = in + (size_t)clamp(i + di*dil, 0, height-1) * pitch;
+        for (int t=0; t<ncols; t++) {
+            const data_t *px_left = row + (size_t)clamp(j + (t-nsamp)*dil, 0, width-1) * nchan;
+            const data_t *px_right = row + (size_t)clamp(j + (nsamp+1+t)*dil, 0, width-1) * nchan;
+            for (int ch=0; ch<nchan; ch++) {
+                if (nodata == NULL || px_left[ch] != *nodata)
+                    coarse_update(&h[ch], px_left[ch] >> shift, -1);
+                if (nodata == NULL || px_right[ch] != *nodata)
+                    coarse_update(&h[ch], px_right[ch] >> shift, 1);
+            }
+        }
+    }
+}
+
+/**
+ ** Approximate median filter using coarse histograms with bins of
+ ** width W = 2^k; the result differs from the true median by at most
+ ** W/2. W is the largest power of two such that W/2 <= max_error,
+ ** but at least 2^(B-16) to keep the histograms small, where B is the
+ ** number of significant bits of the values (see opts->bits).
+ **
+ ** Execution time: O(width * height * C * R / P) plus the movements of
+ ** the median pointer.
+ **
+ ** Additional memory: O(P * C * 2^B/W)
+ **/
+void median_filter_2D_approx_coarse( const data_t * restrict in,
+                                     data_t * restrict out,
+                                     const int *dims, int ndims, int radius,
+                                     const median_filter_opts_t *opts )
+{
+    assert(ndims == 2);
+    const int width = dims[DX];
+    const int height = dims[DY];
+    const int nchan = opts->channels;
+    const int dil = opts->dilation;
+    const int nsamp = radius / dil;
+    const int wlen = 2*nsamp + 1;
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const int out_height = (height + stride - 1) / stride;
+    const int bits = median_filter_bits(opts);
+    const int shift = coarse_shift(bits, opts->max_error);
+    const size_t pitch = median_filter_in_pitch(dims, opts);
+    const size_t out_pitch = median_filter_out_pitch(dims, opts);
+    const int nbins = 1 << (bits - shift);
+    /* Each value is replaced by the center of its bin */
+    const data_t half_bin = (shift > 0 ? (data_t)1 << (shift-1) : 0);
+    int step, nphases;
+    window_steps(stride, dil, &step, &nphases);
+    const int ncols = step / dil;
+    int row_first, row_last;
+    median_filter_rows(opts, out_height, &row_first, &row_last);
+    data_t nodata_value;
+    const data_t *nodata = median_filter_nodata(opts, &nodata_value);
+
+#pragma omp parallel default(none) shared(width, height, pitch, out_pitch, in, out, nsamp, dil, wlen, stride, out_width, row_first, row_last, shift, nbins, half_bin, step, nphases, ncols, nchan, nodata, dims, opts)
+    {
+        CoarseHist *h = (CoarseHist*)median_filter_alloc(opts, nchan * sizeof(*h));
+        assert(h != NULL);
+        for (int ch=0; ch<nchan; ch++) {
+            h[ch].count = (int*)median_filter_calloc(opts, nbins, sizeof(int));
+            assert(h[ch].count != NULL);
+        }
+#pragma omp for
+        for (int oi=row_first; oi<row_last; oi++) {
+            const int i = oi * stride;
+            for (int phase=0; phase<nphases && phase<out_width; phase++) {
+                int oj = phase, j = phase * stride;
+                for (int ch=0; ch<nchan; ch++) {
+                    h[ch].med = h[ch].below = h[ch].total = 0;
+                }
+                coarse_window(h, in, i, j, nsamp, dil, shift, width, height, pitch, nchan, 1, nodata);
+                while (1) {
+                    data_t *px = out + (size_t)oi * out_pitch + (size_t)oj * nchan;
+                    for (int ch=0; ch<nchan; ch++) {
+                        if (h[ch].total == 0) {
+                            px[ch] = *nodata;
+                        } else {
+                            const data_t bin = coarse_median(&h[ch]);
+                            px[ch] = (data_t)(bin << shift) + half_bin;
+                        }
+                    }
+                    if (oj + nphases >= out_width)
+                        break;
+                    if (2*ncols <= wlen) {
+                        coarse_shift_window(h, in, i, j, nsamp, dil, ncols, shift, width, height, pitch, nchan, nodata);
+                    } else {
+                        coarse_window(h, in, i, j, nsamp, dil, shift, width, height, pitch, nchan, -1, nodata);
+                        coarse_window(h, in, i, j + step, nsamp, dil, shift, width, height, pitch, nchan, 1, nodata);
+                    }
+                    oj += nphases;
+                    j += step;
+                }
+                /* Empty the histograms, which is cheaper than clearing
+                   all bins */
+                coarse_window(h, in, i, j, nsamp, dil, shift, width, height, pitch, nchan, -1, nodata);
+            }
+            postop_row(in, out, dims, oi, 0, nchan, opts);
+        }
+        for (int ch=0; ch<nchan; ch++) {
+            median_filter_free(opts, h[ch].count);
+        }
+        median_filter_free(opts, h);
+    }
+}
+
+void median_filter_2D_approx_coarse_bound( int radius, const median_filter_opts_t *opts,
+                                           char *buf, size_t len )
+{
+    const int shift = coarse_shift(median_filter_bits(opts), opts->max_error);
+    (void)radius;
+    if (shift == 0) {
+        snprintf(buf, len, "exact");
+    } else {
+        snprintf(buf, len, "+/- %lu %s", (unsigned long)((uint64_t)1 << (shift-1)),
+                 (opts->float_keys ? "ulps" : "grey levels"));
+    }
+}
+
+/****************************************************************************
+ * Random sampling
+ ****************************************************************************/
+
+/* Return the number of samples required to guarantee a rank error of
+   at most `max_error` percent of the window size */
+static int sample_count(int max_error, int window_size)
+{
+    if (max_error <= 0)
+        return window_size;
+    const double eps = max_error / 100.0;
+    const double m = ceil(log(2.0 / SAMPLE_FAILURE_PROB) / (2.0 * eps * eps));
+    return (m < window_size ? (int)m : window_size);
+}
+
+/* Return the initial state of the generator of the samples of the
+   window centered at pixel (i, j) of the whole image; the samples thus
+   do not depend on how the image is split into bands or chunks */
+static uint32_t sample_seed(int64_t i, int64_t j)
+{
+    /* finalizer of splitmix64 */
+    uint64_t z = ((uint64_t)i << 32) ^ (uint64_t)j;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    /* xorshift32 requires a nonzero state */
+    return (uint32_t)(z >> 32) | 1u;
+}
+
+/* xorshift pseudo-random number generator */
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ ** Approximate median filter that computes the median of M pixels
+ ** drawn at random (with replacement) from each window; M depends on
+ ** the requested maximum rank error. If M is not smaller than the
+ ** window size, the exact median is computed.
+ **
+ ** Execution time: O(width * height * C * M / P)
+ **
+ ** Additional memory: O(P * M)
+ **/
+void median_filter_2D_approx_sample( const data_t * restrict in,
+                                     data_t * restrict out,
+                                     const int *dims, int ndims, int radius,
+                                     const median_filter_opts_t *opts )
+{
+    assert(ndims == 2);
+    const int width = dims[DX];
+    const int height = dims[DY];
+    const int nchan = opts->channels;
+    const int dil = opts->dilation;
+    const int nsamp = radius / dil;
+    const int wlen = 2*nsamp + 1;
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const int out_height = (height + stride - 1) / stride;
+    const int nsamples = sample_count(opts->max_error, wlen * wlen);
+    const int exact = (nsamples == wlen * wlen);
+    int row_first, row_last;
+    median_filter_rows(opts, out_height, &row_first, &row_last);
+    const size_t pitch = median_filter_in_pitch(dims, opts);
+    const size_t out_pitch = median_filter_out_pitch(dims, opts);
+    data_t nodata_value;
+    const data_t *nodata = median_filter_nodata(opts, &nodata_value);
+
+#pragma omp parallel default(none) shared(width, height, pitch, out_pitch, in, out, nsamp, dil, wlen, stride, out_width, row_first, row_last, nsamples, exact, nchan, nodata, dims, opts)
+    {
+        size_t *offset = (size_t*)median_filter_alloc(opts, nsamples * sizeof(*offset));
+        data_t *buf = (data_t*)median_filter_alloc(opts, nsamples * sizeof(*buf));
+        assert(offset != NULL);
+        assert(buf != NULL);
+#pragma omp for
+        for (int oi=row_first; oi<row_last; oi++) {
+            const int i = oi * stride;
+            for (int oj=0; oj<out_width; oj++) {
+                const int j = oj * stride;
+                /* The same pixels are used for all channels */
+                uint32_t state = sample_seed(opts->row_origin + i, opts->col_origin + j);
+                for (int k=0; k<nsamples; k++) {
+                    const int r = (exact ? k : (int)(xorshift32(&state) % (uint32_t)(wlen * wlen)));
+                    const int ii = clamp(i + (r / wlen - nsamp) * dil, 0, height-1);
+                    const int jj = clamp(j + (r % wlen - nsamp) * dil, 0, width-1);
+                    offset[k] = (size_t)ii * pitch + (size_t)jj * nchan;
+                }
+                for (int ch=0; ch<nchan; ch++) {
+                    int nvalid = 0;
+                    for (int k=0; k<nsamples; k++) {
+                        const data_t v = in[offset[k] + ch];
+                        if (nodata == NULL || v != *nodata)
+                            buf[nvalid++] = v;
+                    }
+                    out[(size_t)oi * out_pitch + (size_t)oj * nchan + ch] =
+                        (nvalid > 0 ? quickselect(buf, nvalid, nvalid / 2) : *nodata);
+                }
+            }
+            postop_row(in, out, dims, oi, 0, nchan, opts);
+        }
+        median_filter_free(opts, offset);
+        median_filter_free(opts, buf);
+    }
+}
+
+void median_filter_2D_approx_sample_bound( int radius, const median_filter_opts_t *opts,
+                                           char *buf, size_t len )
+{
+    const int wlen = 2*(radius / opts->dilation) + 1;
+    const int nsamples = sample_count(opts->max_error, wlen * wlen);
+    if (nsamples == wlen * wlen) {
+        snprintf(buf, len, "exact");
+    } else {
+        snprintf(buf, len, "rank +/- %d%% of the window with probability %g (%d samples)",
+                 opts->max_error, 1.0 - SAMPLE_FAILURE_PROB, nsamples);
+    }
+}
+
+/****************************************************************************
+ * Separable median
+ ****************************************************************************/
+
+/**
+ ** Approximate median filter that computes the median of each row of
+ ** the window, and then the median of these values; the first pass is
+ ** stored in a temporary image with the same height as the input and
+ ** the width of the output, whose rows are padded so that the columns
+ ** read by the second pass do not map to the same cache sets.
+ **
+ ** Execution time: O(width * height * C * R / P)
+ **
+ ** Additional memory: O(width * height * C / S)
+ **/
+void median_filter_2D_approx_separable( const data_t * restrict in,
+                                        data_t * restrict out,
+                                        const int *dims, int ndims, int radius,
+                                        const median_filter_opts_t *opts )
+{
+    assert(ndims == 2);
+    const int width = dims[DX];
+    const int height = dims[DY];
+    const int nchan = opts->channels;
+    const int dil = opts->dilation;
+    const int nsamp = radius / dil;
+    const int wlen = 2*nsamp + 1;
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const int out_height = (height + stride - 1) / stride;
+    int row_first, row_last;
+    median_filter_rows(opts, out_height, &row_first, &row_last);
+    data_t nodata_value;
+    const data_t *nodata = median_filter_nodata(opts, &nodata_value);
+
+    const size_t pitch = median_filter_in_pitch(dims, opts);
+    const size_t out_pitch = median_filter_out_pitch(dims, opts);
+    const size_t tmp_pitch = median_filter_padded_pitch((size_t)out_width * nchan, DATA_SIZE);
+    data_t *tmp = (data_t*)median_filter_alloc(opts, (size_t)height * tmp_pitch * DATA_SIZE);
+    assert(tmp != NULL);
+    /* With stride > 1, or a subset of the output rows, the first pass
+       skips the rows that are not used by the second one */
+    char *needed = (char*)median_filter_calloc(opts, height, 1);
+    assert(needed != NULL);
+    for (int oi=row_first; oi<row_last; oi++) {
+        for (int k=-nsamp; k<=nsamp; k++) {
+            needed[clamp(oi*stride + k*dil, 0, height-1)] = 1;
+        }
+    }
+
+#pragma omp parallel default(none) shared(width, height, pitch, out_pitch, tmp_pitch, in, out, tmp, needed, nsamp, dil, wlen, stride, out_width, row_first, row_last, nchan, nodata, dims, opts)
+    {
+        data_t *buf = (data_t*)median_filter_alloc(opts, wlen * sizeof(*buf));
+        assert(buf != NULL);
+        /* Horizontal pass */
+#pragma omp for
+        for (int i=0; i<height; i++) {
+            if (!needed[i])
+                continue;
+            const data_t *row = in + (size_t)i * pitch;
+            for (int oj=0; oj<out_width; oj++) {
+                for (int ch=0; ch<nchan; ch++) {
+                    int nvalid = 0;
+                    for (int k=0; k<wlen; k++) {
+                        const data_t v = row[(size_t)clamp(oj*stride + (k-nsamp)*dil, 0, width-1) * nchan + ch];
+                        if (nodata == NULL || v != *nodata)
+                            buf[nvalid++] = v;
+                    }
+                    tmp[(size_t)i * tmp_pitch + (size_t)oj * nchan + ch] =
+                        (nvalid > 0 ? quickselect(buf, nvalid, nvalid/2) : *nodata);
+                }
+            }
+        }
+        /* Vertical pass */
+#pragma omp for
+        for (int oi=row_first; oi<row_last; oi++) {
+            for (int oj=0; oj<out_width; oj++) {
+                for (int ch=0; ch<nchan; ch++) {
+                    /* rows without valid samples are ignored */
+                    int nvalid = 0;
+                    for (int k=0; k<wlen; k++) {
+                        const int ii = clamp(oi*stride + (k-nsamp)*dil, 0, height-1);
+                        const data_t v = tmp[(size_t)ii * tmp_pitch + (size_t)oj * nchan + ch];
+                        if (nodata == NULL || v != *nodata)
+                            buf[nvalid++] = v;
+                    }
+                    out[(size_t)oi * out_pitch + (size_t)oj * nchan + ch] =
+                        (nvalid > 0 ? quickselect(buf, nvalid, nvalid/2) : *nodata);
+                }
+            }
+            postop_row(in, out, dims, oi, 0, nchan, opts);
+        }
+        median_filter_free(opts, buf);
+    }
+    median_filter_free(opts, needed);
+    median_filter_free(opts, tmp);
+}
+
+void median_filter_2D_approx_separable_bound( int radius, const median_filter_opts_t *opts,
+                                              char *buf, size_t len )
+{
+    const int nsamp = radius / opts->dilation;
+    const int wlen = 2*nsamp + 1;
+    const int n = wlen * wlen;
+    const int lo = (nsamp + 1) * (nsamp + 1);
+    snprintf(buf, len, "rank in [%d, %d] of %d (percentiles %.1f-%.1f)",
+             lo, n - lo + 1, n, 100.0 * lo / n, 100.0 * (n - lo + 1) / n);
+}
@@ -28,10 +28,14 @@
 #include <omp.h>
 #include "common.h"
 #include "hist.h"
+#include "postop.h"
 
 #define REPLICATE
 
-static int IDX(int i, int j, int height, int width)
+/* Return the position of the first value of pixel (i, j), whose rows
+   are `pitch` values apart; pixels outside the image are replaced by
+   the nearest one (REPLICATE) or wrap around */
+static size_t IDX(int i, int j, int height, int width, size_t pitch, int nchan)
 {
 #ifdef REPLICATE
     i = (i<0 ? 0 : (i>=height ? height-1 : i));
@@ -40,41 +44,61 @@ static int IDX(int i, int j, int height, int width)
     i = (i + height) % height;
     j = (j + width) % width;
 #endif
-    return (i*width + j);
+    return ((size_t)i*pitch + (size_t)j*nchan);
 }
 
 /**
- * Compute the histogram of the values located within a window of
- * radius `radius` centered at (i,j).
+ * Compute the histograms of the values located within a window
+ * centered at (i,j), for channels `c0` to `c1-1` of an image with
+ * `nchan` interleaved channels. `hist[c]` is the histogram of channel
+ * `c0 + c`. The window contains the pixels at offsets (di*dil, dj*dil)
+ * from the center, with -nsamp <= di, dj <= nsamp. If `nodata` is not
+ * NULL, values equal to `*nodata` are skipped.
  */
-static void fill_histogram(Hist * restrict hist,
+static void fill_histogram(Hist **hist,
                            const data_t * restrict in,
-                           int i, int j, int radius,
-                           int width, int height)
+                           int i, int j, int nsamp, int dil,
+                           int width, int height, size_t pitch,
+                           int nchan, int c0, int c1,
+                           const data_t *nodata)
 {
-    for (int di=-radius; di<=radius; di++) {
-        for (int dj=-radius; dj<=radius; dj++) {
-            const data_t val = in[IDX(i+di, j+dj, height, width)];
-            hist_insert(hist, val, 1);
+    for (int di=-nsamp; di<=nsamp; di++) {
+        for (int dj=-nsamp; dj<=nsamp; dj++) {
+            const data_t *px = in + IDX(i+di*dil, j+dj*dil, height, width, pitch, nchan);
+            for (int c=c0; c<c1; c++) {
+                if (nodata == NULL || px[c] != *nodata)
+                    hist_insert(hist[c-c0], px[c], 1);
+            }
         }
     }
 }
 
 /**
- * Given an histogram for a window of radius `radius`` centered at (i,
- * j), update the histogram by shifting the window one position to the
- * right.
+ * Given the histograms for a window centered at (i, j), update the
+ * histograms by shifting the window `ncols*dil` positions to the
+ * right, i.e., by removing the `ncols` leftmost sampled columns and
+ * adding `ncols` new ones on the right. `ncols` must not exceed the
+ * window width `2*nsamp+1`. All channels slide together, so that each
+ * input pixel is fetched once for all of them.
  */
-static void shift_histogram(Hist * restrict hist,
+static void shift_histogram(Hist **hist,
                             const data_t * restrict in,
-                            int i, int j, int radius,
-                            int width, int height)
+                            int i, int j, int nsamp, int dil, int ncols,
+                            int width, int height, size_t pitch,
+                            int nchan, int c0, int c1,
+                            const data_t *nodata)
 {
-    for (int di=-radius; di<=radius; di++) {
-        const data_t val_left = in[IDX(i+di, j-radius, height, width)];
-        hist_delete(hist, val_left, 1);
-        const data_t val_right = in[IDX(i+di, j+radius+1, height, width)];
-        hist_insert(hist, val_right, 1);
+    for (int di=-nsamp; di<=nsamp; di++) {
+        for (int t=0; t<ncols; t++) {
+            const data_t *px_left = in + IDX(i+di*dil, j+(t-nsamp)*dil, height, width, pitch, nchan);
+            const data_t *px_right = in + IDX(i+di*dil, j+(nsamp+1+t)*dil, height, width, pitch, nchan);
+            for (int c=c0; c<c1; c++) {
+                if (nodata == NULL || px_left[c] != *nodata)
+                    hist_delete(hist[c-c0], px_left[c], 1);
+                if (nodata == NULL || px_right[c] != *nodata)
+                    hist_insert(hist[c-c0], px_right[c], 1);
+            }
+        }
     }
 }
 
@@ -83,38 +107,126 @@ static void shift_histogram(Hist * restrict hist,
  ** scratch for each pixel; instead, when the window is shifted, the
  ** old histogram is updated.
  **
- ** Execution time: O(width * height * R * log(R) / P)
+ ** Images with C > 1 interleaved channels are filtered in a single
+ ** pass, using one histogram per channel; the histograms slide
+ ** together. When the image has too few rows to keep all threads
+ ** busy, each channel is handled as a separate work item.
+ **
+ ** With a dilation factor D > 1 the window only contains every D-th
+ ** row and column within distance R of the center. Each row is then
+ ** processed as D interleaved sequences of columns j, j+D, j+2D, ...
+ ** and the histogram is shifted D positions at a time, so that the
+ ** cost depends on the number of samples R/D rather than on R.
+ **
+ ** With an output stride S > 1 only the medians centered at (i*S,
+ ** j*S) are computed, and the output image is S times smaller in each
+ ** direction. Rows that do not contribute to the output are skipped,
+ ** and the histogram is shifted S positions at a time (or, more
+ ** precisely, lcm(S, D) positions, so that consecutive windows share
+ ** the same sampled columns).
+ **
+ ** Samples equal to the no-data value, if any, are never inserted in
+ ** the histograms, and the median is computed over the valid samples
+ ** only; a window without valid samples produces the no-data value.
  **
- ** Additional memory: O(P * R)
+ ** The post-operations, if any, are applied to each row as soon as it
+ ** has been computed.
+ **
+ ** The rows of the input and output are opts->in_pitch and
+ ** opts->out_pitch values apart; with a pitch that is not a multiple
+ ** of a large power of two, the 2R+1 rows of a window do not compete
+ ** for the same cache sets.
+ **
+ ** Execution time: O(width * height * C * (R/D) * log(R/D) / (P * S))
+ **
+ ** Additional memory: O(P * C * R)
  **
  ** where P is the number of OpenMP threads and B is the color depth in pixels.
  **/
 void median_filter_2D_sparse_byrow( const data_t * restrict in,
                                     data_t * restrict out,
-                                    const int *dims, int ndims, int radius )
+                                    const int *dims, int ndims, int radius,
+                                    const median_filter_opts_t *opts )
 {
     assert(ndims == 2);
     const int width = dims[DX];
     const int height = dims[DY];
+    const int nchan = opts->channels;
+    const int dil = opts->dilation;
+    const int nsamp = radius / dil;
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const int out_height = (height + stride - 1) / stride;
+    int row_first, row_last;
+    median_filter_rows(opts, out_height, &row_first, &row_last);
+    const size_t pitch = median_filter_in_pitch(dims, opts);
+    const size_t out_pitch = median_filter_out_pitch(dims, opts);
+    /* Distance between two consecutive centers that are handled with
+       the same histogram, i.e., the least common multiple of `stride`
+       and `dil`; `nphases` interleaved sequences of output columns
+       are required to cover a whole row. */
+    int step = dil;
+    while (step % stride != 0) {
+        step += dil;
+    }
+    const int nphases = step / stride;
+    const int ncols = step / dil;
+    data_t nodata_value;
+    const data_t *nodata = median_filter_nodata(opts, &nodata_value);
+    /* Channels are split into `ngroups` groups of `gsize` channels;
+       each (row, group) pair is a work item. */
+    const int ngroups = (nchan > 1 && row_last - row_first < 4*omp_get_max_threads() ? nchan : 1);
+    const int gsize = nchan / ngroups;
 
-#pragma omp parallel default(none) shared(width, height, in, out, radius)
+#pragma omp parallel default(none) shared(width, height, pitch, out_pitch, in, out, nsamp, dil, stride, out_width, row_first, row_last, step, nphases, ncols, nchan, ngroups, gsize, nodata, dims, opts)
     {
-        Hist *hist = hist_create();
+        Hist **hist = (Hist**)median_filter_alloc(opts, gsize * sizeof(*hist));
         assert(hist != NULL);
-#pragma omp for
-        for (int i=0; i<height; i++) {
-            hist_clear(hist);
-            fill_histogram(hist, in, i, 0, radius, width, height);
-            // Note: the loop stops before the last column, so that we
-            // do not perform a shift_histogram() out-of-bound
-            int j;
-            for (j=0; j<width-1; j++) {
-                out[IDX(i, j, height, width)] = hist_median(hist);
-                shift_histogram(hist, in, i, j, radius, width, height);
+        for (int c=0; c<gsize; c++) {
+            hist[c] = hist_create(opts);
+            assert(hist[c] != NULL);
+        }
+#pragma omp for collapse(2)
+        for (int oi=row_first; oi<row_last; oi++) {
+            for (int g=0; g<ngroups; g++) {
+                const int i = oi * stride;
+                const int c0 = g * gsize, c1 = c0 + gsize;
+                for (int phase=0; phase<nphases && phase<out_width; phase++) {
+                    int oj = phase, j = phase * stride;
+                    for (int c=0; c<gsize; c++) {
+                        hist_clear(hist[c]);
+                    }
+                    fill_histogram(hist, in, i, j, nsamp, dil, width, height, pitch, nchan, c0, c1, nodata);
+                    while (1) {
+                        data_t *px = out + (size_t)oi * out_pitch + (size_t)oj * nchan;
+                        for (int c=c0; c<c1; c++) {
+                            px[c] = (hist_is_empty(hist[c-c0]) ? *nodata : hist_median(hist[c-c0]));
+                        }
+                        // Note: we stop after the last column of
+                        // this phase, so that we do not perform a
+                        // shift_histogram() out-of-bound
+                        if (oj + nphases >= out_width)
+                            break;
+                        if (2*ncols <= 2*nsamp + 1) {
+                            shift_histogram(hist, in, i, j, nsamp, dil, ncols, width, height, pitch, nchan, c0, c1, nodata);
+                        } else {
+                            // the windows overlap too little (if at
+                            // all): refilling the histograms is cheaper
+                            for (int c=0; c<gsize; c++) {
+                                hist_clear(hist[c]);
+                            }
+                            fill_histogram(hist, in, i, j + step, nsamp, dil, width, height, pitch, nchan, c0, c1, nodata);
+                        }
+                        oj += nphases;
+                        j += step;
+                    }
+                }
+                postop_row(in, out, dims, oi, c0, c1, opts);
             }
-            // Handle the last element of the current row
-            out[IDX(i, j, height, width)] = hist_median(hist);
         }
-        hist_destroy(hist);
+        for (int c=0; c<gsize; c++) {
+            hist_destroy(hist[c]);
+        }
+        median_filter_free(opts, hist);
     }
 }
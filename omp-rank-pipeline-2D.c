@@ -0,0 +1,255 @@
+/****************************************************************************
+ *
+ * omp-rank-pipeline-2D.c -- Fused pipelines of 2D rank filters
+ *
+ * Copyright 2025 Moreno Marzolla, Michele Ravaioli
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * A pipeline is a sequence of rank filters (minimum, maximum,
+ * percentile or median), each with its own radius, where the output
+ * of each stage is the input of the next one. Morphological opening
+ * (minimum, then maximum) and closing (maximum, then minimum), or a
+ * median followed by another median, are common examples.
+ *
+ * Intermediate images are never stored in full. Each stage writes its
+ * output rows into a ring buffer that holds only the rows needed by
+ * the next stage: if stage k+1 has radius R and rows are computed in
+ * bands of B rows, a band of stage k+1 requires B+2R consecutive rows
+ * of stage k. Stages are evaluated on demand: before computing a band,
+ * a stage asks the previous one to produce the rows it needs, so that
+ * each row is consumed shortly after being produced, while it is still
+ * in cache. The rows of each band are computed in parallel.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <omp.h>
+#include "common.h"
+#include "hist.h"
+#include "postop.h"
+
+typedef struct {
+    int percentile;     /* rank of the output (see rank_stage_t) */
+    int radius;
+    data_t *buf;        /* ring buffer of output rows */
+    int cap;            /* capacity of `buf`, in rows */
+    size_t pitch;       /* distance between rows of `buf`, in values */
+    int produced;       /* rows up to produced-1 have been computed */
+} Stage;
+
+/* Shared state of the pipeline */
+typedef struct {
+    const data_t *in;
+    data_t *out;
+    const int *dims;
+    int width, height;
+    int nchan;
+    int band;           /* rows computed at each step */
+    int nstages;
+    Stage *stage;       /* stage[0] is the input image */
+    Hist **hist;        /* hist[t*nchan + c] is used by thread t for channel c */
+    const median_filter_opts_t *opts;
+} Pipeline;
+
+static int clamp(int x, int lo, int hi)
+{
+    return (x < lo ? lo : (x > hi ? hi : x));
+}
+
+/* Return a pointer to row `y` of the output of stage `st`; row `y`
+   must still be in the ring buffer. */
+static data_t *stage_row(const Stage *st, int y)
+{
+    return st->buf + (size_t)(y % st->cap) * st->pitch;
+}
+
+/* Return the value of rank `percentile` among the `n` values of `h` */
+static data_t hist_rank(const Hist *h, int percentile)
+{
+    const int n = hist_count(h);
+    if (percentile == RANK_MEDIAN)
+        return hist_nth(h, n / 2);
+    else
+        return hist_nth(h, (int)((int64_t)(n - 1) * percentile / 100));
+}
+
+/* Compute one output row of a rank filter of radius `radius`;
+   `rows[k]` is the input row at vertical offset k-radius. */
+static void rank_filter_row(Hist **hist, const data_t **rows, data_t *out_row,
+                            int width, int radius, int nchan, int percentile,
+                            const data_t *nodata)
+{
+    for (int c=0; c<nchan; c++) {
+        hist_clear(hist[c]);
+    }
+    for (int k=0; k<=2*radius; k++) {
+        for (int dj=-radius; dj<=radius; dj++) {
+            const data_t *px = rows[k] + (size_t)clamp(dj, 0, width-1) * nchan;
+            for (int c=0; c<nchan; c++) {
+                if (nodata == NULL || px[c] != *nodata)
+                    hist_insert(hist[c], px[c], 1);
+            }
+        }
+    }
+    for (int j=0; j<width; j++) {
+        data_t *dst = out_row + (size_t)j * nchan;
+        for (int c=0; c<nchan; c++) {
+            dst[c] = (hist_is_empty(hist[c]) ? *nodata : hist_rank(hist[c], percentile));
+        }
+        if (j == width-1)
+            break;
+        const size_t left = (size_t)clamp(j - radius, 0, width-1) * nchan;
+        const size_t right = (size_t)clamp(j + radius + 1, 0, width-1) * nchan;
+        for (int k=0; k<=2*radius; k++) {
+            for (int c=0; c<nchan; c++) {
+                if (nodata == NULL || rows[k][left + c] != *nodata)
+                    hist_delete(hist[c], rows[k][left + c], 1);
+                if (nodata == NULL || rows[k][right + c] != *nodata)
+                    hist_insert(hist[c], rows[k][right + c], 1);
+            }
+        }
+    }
+}
+
+/* Compute rows `first` .. `last` of stage `s`; the rows of stage s-1
+   they depend on must be available. */
+static void stage_compute(Pipeline *p, int s, int first, int last)
+{
+    const Stage *src = &p->stage[s-1];
+    const Stage *dst = &p->stage[s];
+    data_t nodata_value;
+    const data_t *nodata = median_filter_nodata(p->opts, &nodata_value);
+    const int is_last = (s == p->nstages);
+
+#pragma omp parallel for default(none) shared(p, s, first, last, src, dst, nodata, is_last)
+    for (int y=first; y<=last; y++) {
+        const data_t *rows[2*dst->radius + 1];
+        for (int k=0; k<=2*dst->radius; k++) {
+            rows[k] = stage_row(src, clamp(y - dst->radius + k, 0, p->height-1));
+        }
+        rank_filter_row(p->hist + omp_get_thread_num() * p->nchan, rows,
+                        stage_row(dst, y),
+                        p->width, dst->radius, p->nchan, dst->percentile, nodata);
+        if (is_last)
+            postop_row(p->in, p->out, p->dims, y, 0, p->nchan, p->opts);
+    }
+}
+
+/* Make sure that stage `s` has computed all rows up to `upto`
+   (included) */
+static void stage_ensure(Pipeline *p, int s, int upto)
+{
+    Stage *st = &p->stage[s];
+    upto = clamp(upto, 0, p->height-1);
+    while (st->produced <= upto) {
+        const int first = st->produced;
+        const int last = (upto < first + p->band - 1 ? upto : first + p->band - 1);
+        stage_ensure(p, s-1, last + st->radius);
+        stage_compute(p, s, first, last);
+        st->produced = last + 1;
+    }
+}
+
+/**
+ ** Pipeline of rank filters; the stages are taken from
+ ** `opts->stages`. If no stages are given, the pipeline consists of a
+ ** single median filter of radius `radius`.
+ **
+ ** Execution time: O(width * height * C * sum(R_k * log(R_k)) / P)
+ **
+ ** Additional memory: O(width * C * sum(B + 2*R_k) + P * C * max(R_k))
+ **
+ ** where R_k is the radius of stage k and B = 2P is the band height.
+ ** The rows of the ring buffers are padded (see
+ ** median_filter_padded_pitch()), so that the 2R_k+1 rows read by a
+ ** stage do not evict each other from the caches.
+ **/
+void median_filter_2D_rank_pipeline( const data_t *in, data_t *out,
+                                     const int *dims, int ndims, int radius,
+                                     const median_filter_opts_t *opts )
+{
+    assert(ndims == 2);
+    const rank_stage_t single = {RANK_MEDIAN, radius};
+    const rank_stage_t *stages = (opts->nstages > 0 ? opts->stages : &single);
+    const int nstages = (opts->nstages > 0 ? opts->nstages : 1);
+    const int nthreads = omp_get_max_threads();
+    Pipeline p;
+
+    p.in = in;
+    p.out = out;
+    p.dims = dims;
+    p.width = dims[DX];
+    p.height = dims[DY];
+    p.nchan = opts->channels;
+    p.band = 2 * nthreads;
+    p.nstages = nstages;
+    p.opts = opts;
+
+    p.stage = (Stage*)median_filter_alloc(opts, (nstages + 1) * sizeof(Stage));
+    assert(p.stage != NULL);
+    /* the input image is a stage whose rows are all available */
+    p.stage[0].buf = (data_t*)in;
+    p.stage[0].cap = p.height;
+    p.stage[0].produced = p.height;
+    p.stage[0].pitch = median_filter_in_pitch(dims, opts);
+    p.stage[0].radius = 0;
+    /* Only output rows row_first .. row_last-1 are computed; each stage
+       starts from the first row that the later stages read */
+    int row_first, row_last;
+    median_filter_rows(opts, p.height, &row_first, &row_last);
+    int reach = 0;
+    for (int s=0; s<nstages; s++) {
+        reach += stages[s].radius;
+    }
+    for (int s=1; s<=nstages; s++) {
+        Stage *st = &p.stage[s];
+        st->percentile = stages[s-1].percentile;
+        st->radius = stages[s-1].radius;
+        reach -= st->radius;
+        st->produced = (row_first - reach > 0 ? row_first - reach : 0);
+        if (s == nstages) {
+            st->buf = out;
+            st->cap = p.height;
+            st->pitch = median_filter_out_pitch(dims, opts);
+        } else {
+            st->cap = p.band + 2*stages[s].radius;
+            st->pitch = median_filter_padded_pitch((size_t)p.width * p.nchan, DATA_SIZE);
+            st->buf = (data_t*)median_filter_alloc(opts, (size_t)st->cap * st->pitch * DATA_SIZE);
+            assert(st->buf != NULL);
+        }
+    }
+
+    p.hist = (Hist**)median_filter_alloc(opts, nthreads * p.nchan * sizeof(Hist*));
+    assert(p.hist != NULL);
+    for (int i=0; i<nthreads * p.nchan; i++) {
+        p.hist[i] = hist_create(opts);
+    }
+
+    if (row_first < row_last)
+        stage_ensure(&p, nstages, row_last-1);
+
+    for (int i=0; i<nthreads * p.nchan; i++) {
+        hist_destroy(p.hist[i]);
+    }
+    median_filter_free(opts, p.hist);
+    for (int s=1; s<nstages; s++) {
+        median_filter_free(opts, p.stage[s].buf);
+    }
+    median_filter_free(opts, p.stage);
+}
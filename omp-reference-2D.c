@@ -0,0 +1,260 @@
+/****************************************************************************
+ *
+ * omp-reference-2D.c -- Brute-force reference median filter
+ *
+ * Copyright 2025 Moreno Marzolla, Michele Ravaioli
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * This is the slowest, and hopefully the most obviously correct,
+ * implementation: the samples of each window are copied into a buffer
+ * and the median is selected with quickselect(). It supports every
+ * option of the other algorithms (channels, dilation, stride, no-data
+ * values, post operations and rank filter pipelines), and is meant to
+ * be used as the ground truth by `check.sh`. The vector medians are
+ * likewise computed by brute force, from the sums of the distances of
+ * each pixel of the window to all the others, as defined in
+ * vector-median.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include "common.h"
+#include "quickselect.h"
+#include "postop.h"
+#include "vector-median.h"
+
+static int clamp(int x, int lo, int hi)
+{
+    return (x < lo ? lo : (x > hi ? hi : x));
+}
+
+/* Return the position of rank `percentile` (see rank_stage_t) among
+   `n` sorted values */
+static int rank_index(int n, int percentile)
+{
+    if (percentile == RANK_MEDIAN)
+        return n / 2;
+    else
+        return (int)((int64_t)(n - 1) * percentile / 100);
+}
+
+/* Apply a rank filter of radius `radius` to `in`, whose rows are
+   `pitch` values apart; the result has the dimensions of the output
+   image, given the stride and dilation in `opts`, and its rows are
+   `out_pitch` values apart. */
+static void rank_filter( const data_t *in, data_t *out, int width, int height,
+                         size_t pitch, size_t out_pitch,
+                         int radius, int percentile, const median_filter_opts_t *opts )
+{
+    const int nchan = opts->channels;
+    const int dil = opts->dilation;
+    const int nsamp = radius / dil;
+    const int wlen = 2*nsamp + 1;
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const int out_height = (height + stride - 1) / stride;
+    int row_first, row_last;
+    median_filter_rows(opts, out_height, &row_first, &row_last);
+    data_t nodata_value;
+    const data_t *nodata = median_filter_nodata(opts, &nodata_value);
+
+#pragma omp parallel default(none) shared(in, out, width, height, pitch, out_pitch, nchan, dil, nsamp, wlen, stride, out_width, row_first, row_last, percentile, nodata, opts)
+    {
+        data_t *buf = (data_t*)median_filter_alloc(opts, (size_t)wlen * wlen * sizeof(*buf));
+        assert(buf != NULL);
+#pragma omp for
+        for (int oi=row_first; oi<row_last; oi++) {
+            for (int oj=0; oj<out_width; oj++) {
+                for (int c=0; c<nchan; c++) {
+                    int n = 0;
+                    for (int di=-nsamp; di<=nsamp; di++) {
+                        const int ii = clamp(oi*stride + di*dil, 0, height-1);
+                        for (int dj=-nsamp; dj<=nsamp; dj++) {
+                            const int jj = clamp(oj*stride + dj*dil, 0, width-1);
+                            const data_t v = in[(size_t)ii * pitch + (size_t)jj * nchan + c];
+                            if (nodata == NULL || v != *nodata)
+                                buf[n++] = v;
+                        }
+                    }
+                    out[(size_t)oi * out_pitch + (size_t)oj * nchan + c] =
+                        (n > 0 ? quickselect(buf, n, rank_index(n, percentile)) : *nodata);
+                }
+            }
+        }
+        median_filter_free(opts, buf);
+    }
+}
+
+/**
+ ** Reference median filter, or pipeline of rank filters if
+ ** `opts->stages` is given; each window is copied and its median is
+ ** selected with quickselect. Stride and dilation are not supported
+ ** with pipelines.
+ **
+ ** Execution time: O(width * height * C * R^2 / P) on average
+ **
+ ** Additional memory: O(P * R^2), plus two temporary images for
+ ** pipelines
+ **/
+void median_filter_2D_reference( const data_t *in, data_t *out,
+                                 const int *dims, int ndims, int radius,
+                                 const median_filter_opts_t *opts )
+{
+    assert(ndims == 2);
+    const int width = dims[DX];
+    const int height = dims[DY];
+    const int out_height = (height + opts->stride - 1) / opts->stride;
+    int row_first, row_last;
+    median_filter_rows(opts, out_height, &row_first, &row_last);
+    const size_t pitch = median_filter_in_pitch(dims, opts);
+    const size_t out_pitch = median_filter_out_pitch(dims, opts);
+
+    if (opts->nstages == 0) {
+        rank_filter(in, out, width, height, pitch, out_pitch, radius, RANK_MEDIAN, opts);
+    } else {
+        assert(opts->stride == 1 && opts->dilation == 1);
+        const size_t size = (size_t)width * height * opts->channels * DATA_SIZE;
+        data_t *tmp[2] = {(data_t*)median_filter_alloc(opts, size), (data_t*)median_filter_alloc(opts, size)};
+        assert(tmp[0] != NULL && tmp[1] != NULL);
+        /* the temporary images are contiguous */
+        const size_t tmp_pitch = (size_t)width * opts->channels;
+        const data_t *src = in;
+        /* the later stages read the rows within `reach` rows of those
+           they compute */
+        int reach = 0;
+        for (int s=0; s<opts->nstages; s++) {
+            reach += opts->stages[s].radius;
+        }
+        for (int s=0; s<opts->nstages; s++) {
+            const int last = (s == opts->nstages-1);
+            data_t *dst = (last ? out : tmp[s % 2]);
+            median_filter_opts_t stage_opts = *opts;
+            reach -= opts->stages[s].radius;
+            stage_opts.rows_first = row_first - reach;
+            stage_opts.rows_last = row_last + reach;
+            rank_filter(src, dst, width, height,
+                        (s == 0 ? pitch : tmp_pitch), (last ? out_pitch : tmp_pitch),
+                        opts->stages[s].radius, opts->stages[s].percentile, &stage_opts);
+            src = dst;
+        }
+        median_filter_free(opts, tmp[0]);
+        median_filter_free(opts, tmp[1]);
+    }
+
+#pragma omp parallel for
+    for (int oi=row_first; oi<row_last; oi++) {
+        postop_row(in, out, dims, oi, 0, opts->channels, opts);
+    }
+}
+
+static void vector_reference( const data_t *in, data_t *out,
+                              const int *dims, int ndims, int radius,
+                              const median_filter_opts_t *opts, int metric )
+{
+    assert(ndims == 2);
+    const int width = dims[DX];
+    const int height = dims[DY];
+    const int nchan = opts->channels;
+    const int dil = opts->dilation;
+    const int nsamp = radius / dil;
+    const int wlen = 2*nsamp + 1;
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const int out_height = (height + stride - 1) / stride;
+    const size_t pitch = median_filter_in_pitch(dims, opts);
+    const size_t out_pitch = median_filter_out_pitch(dims, opts);
+    int row_first, row_last;
+    median_filter_rows(opts, out_height, &row_first, &row_last);
+    data_t nodata_value;
+    const data_t *nodata = median_filter_nodata(opts, &nodata_value);
+
+#pragma omp parallel default(none) shared(in, out, width, height, pitch, out_pitch, nchan, dil, nsamp, wlen, stride, out_width, row_first, row_last, metric, nodata, dims, opts)
+    {
+        /* the values and the addresses of the valid pixels of the
+           window, row by row */
+        double *val = (double*)median_filter_alloc(opts, (size_t)wlen * wlen * nchan * sizeof(*val));
+        const data_t **px = (const data_t**)median_filter_alloc(opts, (size_t)wlen * wlen * sizeof(*px));
+        assert(val != NULL);
+        assert(px != NULL);
+#pragma omp for
+        for (int oi=row_first; oi<row_last; oi++) {
+            for (int oj=0; oj<out_width; oj++) {
+                int n = 0;
+                for (int di=-nsamp; di<=nsamp; di++) {
+                    const int ii = clamp(oi*stride + di*dil, 0, height-1);
+                    for (int dj=-nsamp; dj<=nsamp; dj++) {
+                        const int jj = clamp(oj*stride + dj*dil, 0, width-1);
+                        const data_t *p = in + (size_t)ii * pitch + (size_t)jj * nchan;
+                        int valid = 1;
+                        for (int c=0; c<nchan; c++) {
+                            val[(size_t)n * nchan + c] = key_value(p[c], opts->float_keys);
+                            valid = valid && (nodata == NULL || p[c] != *nodata);
+                        }
+                        px[n] = p;
+                        n += valid;
+                    }
+                }
+                int best = -1;
+                double best_sum = 0.0;
+                for (int a=0; a<n; a++) {
+                    double sum = 0.0;
+                    for (int b=0; b<n; b++) {
+                        sum += vector_distance(val + (size_t)a * nchan, val + (size_t)b * nchan, nchan, metric);
+                    }
+                    if (best < 0 || sum < best_sum) {
+                        best = a;
+                        best_sum = sum;
+                    }
+                }
+                for (int c=0; c<nchan; c++) {
+                    out[(size_t)oi * out_pitch + (size_t)oj * nchan + c] = (best < 0 ? *nodata : px[best][c]);
+                }
+            }
+            postop_row(in, out, dims, oi, 0, nchan, opts);
+        }
+        median_filter_free(opts, val);
+        median_filter_free(opts, px);
+    }
+}
+
+/**
+ ** Reference vector median filter with L1 metric; the distances of
+ ** each pixel of the window to all the others are summed.
+ **
+ ** Execution time: O(width * height * C * R^4 / P)
+ **
+ ** Additional memory: O(P * C * R^2)
+ **/
+void median_filter_2D_vector_reference_l1( const data_t *in, data_t *out,
+                                           const int *dims, int ndims, int radius,
+                                           const median_filter_opts_t *opts )
+{
+    vector_reference(in, out, dims, ndims, radius, opts, 1);
+}
+
+/**
+ ** Reference vector median filter with L2 metric; same cost as the L1
+ ** version.
+ **/
+void median_filter_2D_vector_reference_l2( const data_t *in, data_t *out,
+                                           const int *dims, int ndims, int radius,
+                                           const median_filter_opts_t *opts )
+{
+    vector_reference(in, out, dims, ndims, radius, opts, 2);
+}
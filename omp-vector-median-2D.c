@@ -0,0 +1,423 @@
+/****************************************************************************
+ *
+ * omp-vector-median-2D.c -- 2D vector median filter for color images
+ *
+ * Copyright 2025 Moreno Marzolla, Michele Ravaioli
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * The vector median of a window is the pixel of the window that
+ * minimizes the sum of the distances to all other pixels of the same
+ * window; each pixel is a vector of C channels. Unlike filtering each
+ * channel independently, the vector median never produces colors
+ * that are not present in the input.
+ *
+ * For each pixel `p` of the current window we keep the sum S[p] of the
+ * distances from `p` to all pixels of the window. When the window is
+ * shifted one position to the right, the contribution of the column
+ * that leaves the window is subtracted from S[], and the contribution
+ * of the column that enters the window is added; only the sums of the
+ * pixels of the new column are computed from scratch. Each shift
+ * therefore costs O(R^3) distance computations instead of the O(R^4)
+ * required to recompute all sums.
+ *
+ * With a dilation factor D > 1 the window contains every D-th row and
+ * column within distance R of the center; each row is processed as D
+ * interleaved sequences of columns j, j+D, j+2D, ... so that the
+ * window slides by D columns and the incremental update still applies.
+ * With an output stride S > 1 only the centers (i*S, j*S) are
+ * computed, and the window slides by lcm(S, D) columns.
+ *
+ * If a no-data value is defined, pixels with at least one channel
+ * equal to it are neither candidates nor contribute to the sums of
+ * the other pixels; windows without valid pixels produce a pixel whose
+ * channels are all equal to the no-data value.
+ *
+ * Values are stored as doubles, one array per channel, so that the
+ * distances between a pixel and a whole column can be computed with
+ * SIMD instructions. With the L1 metric all sums are exact, since
+ * they fit the 53-bit mantissa of a double. The keys of floating point
+ * values (see keys.h) preserve the order, but not the distances, and
+ * are decoded to the values first. Since the other sums are computed
+ * incrementally, in an order that depends on the position of the
+ * window, the sums of the pixels that are within the rounding error
+ * of the minimum are recomputed in the order of vector-median.h, and
+ * ties are broken on the position of the pixels in the window.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <stdint.h>
+#include <omp.h>
+#include "common.h"
+#include "postop.h"
+#include "vector-median.h"
+
+static int clamp(int x, int lo, int hi)
+{
+    return (x < lo ? lo : (x > hi ? hi : x));
+}
+
+/* Sliding window of a single thread. The window is a ring buffer of
+   `wlen` columns of `wlen` pixels each, sampled every `dil` pixels;
+   the values of channel `c` of pixel `k` of the column stored in slot
+   `s` are found in `val[c][s*wlen + k]`. */
+typedef struct {
+    int wlen;
+    int dil;
+    int nchan;
+    const data_t *nodata;
+    double **val;
+    double *valid;      /* valid[s*wlen + k] is 1.0 if pixel k of slot s
+                           is valid, 0.0 otherwise */
+    double *sum;        /* sum[s*wlen + k] is the sum of the distances from
+                           pixel k of slot s to all pixels of the window */
+    double drift;       /* sum of the largest terms added to, or subtracted
+                           from, the sums since the window was loaded */
+    const data_t **px;  /* px[s*wlen + k] points to the original pixel */
+    const median_filter_opts_t *opts; /* the memory is allocated with these options */
+} VWindow;
+
+static VWindow *vwindow_create(int nsamp, int dil, int nchan, const data_t *nodata,
+                               const median_filter_opts_t *opts)
+{
+    VWindow *w = (VWindow*)median_filter_alloc(opts, sizeof(*w));
+    assert(w != NULL);
+    w->opts = opts;
+    w->wlen = 2*nsamp + 1;
+    w->dil = dil;
+    w->nchan = nchan;
+    w->nodata = nodata;
+    const size_t n = (size_t)w->wlen * w->wlen;
+    w->val = (double**)median_filter_alloc(opts, nchan * sizeof(*(w->val)));
+    assert(w->val != NULL);
+    for (int c=0; c<nchan; c++) {
+        w->val[c] = (double*)median_filter_alloc(opts, n * sizeof(double));
+        assert(w->val[c] != NULL);
+    }
+    w->valid = (double*)median_filter_alloc(opts, n * sizeof(double));
+    assert(w->valid != NULL);
+    w->sum = (double*)median_filter_alloc(opts, n * sizeof(double));
+    assert(w->sum != NULL);
+    w->px = (const data_t**)median_filter_alloc(opts, n * sizeof(*(w->px)));
+    assert(w->px != NULL);
+    return w;
+}
+
+static void vwindow_destroy(VWindow *w)
+{
+    const median_filter_opts_t *opts = w->opts;
+    for (int c=0; c<w->nchan; c++) {
+        median_filter_free(opts, w->val[c]);
+    }
+    median_filter_free(opts, w->val);
+    median_filter_free(opts, w->valid);
+    median_filter_free(opts, w->sum);
+    median_filter_free(opts, w->px);
+    median_filter_free(opts, w);
+}
+
+/* Copy into slot `s` of the window the column `j` of the image, whose
+   rows are `pitch` values apart, for rows i-nsamp*dil,
+   i-(nsamp-1)*dil, ... i+nsamp*dil */
+static void vwindow_load_column(VWindow *w, int s,
+                                const data_t *in, int i, int j,
+                                int width, int height, size_t pitch)
+{
+    const int nsamp = w->wlen / 2;
+    const int jj = clamp(j, 0, width-1);
+    for (int k=0; k<w->wlen; k++) {
+        const int ii = clamp(i + (k - nsamp) * w->dil, 0, height-1);
+        const data_t *px = in + (size_t)ii * pitch + (size_t)jj * w->nchan;
+        w->px[s*w->wlen + k] = px;
+        double valid = 1.0;
+        for (int c=0; c<w->nchan; c++) {
+            w->val[c][s*w->wlen + k] = key_value(px[c], w->opts->float_keys);
+            if (w->nodata != NULL && px[c] == *(w->nodata))
+                valid = 0.0;
+        }
+        w->valid[s*w->wlen + k] = valid;
+    }
+}
+
+/* Return the sum of the distances between pixel `a` (an array of
+   `nchan` values) and all valid pixels of slot `s`; the distances to
+   the other pixels are selected away rather than multiplied by zero,
+   since their values may be NaN or infinite */
+static double column_distance(const VWindow *w, const double *a, int s, int metric)
+{
+    const int wlen = w->wlen;
+    const int base = s*wlen;
+    const double *valid = w->valid + base;
+    double result = 0.0;
+
+    if (metric == 1) {
+        for (int c=0; c<w->nchan; c++) {
+            const double *v = w->val[c] + base;
+            const double ac = a[c];
+#pragma omp simd reduction(+:result)
+            for (int k=0; k<wlen; k++) {
+                result += (valid[k] != 0.0 ? fabs(v[k] - ac) : 0.0);
+            }
+        }
+    } else {
+        double d2[wlen];
+        for (int k=0; k<wlen; k++) {
+            d2[k] = 0.0;
+        }
+        for (int c=0; c<w->nchan; c++) {
+            const double *v = w->val[c] + base;
+            const double ac = a[c];
+#pragma omp simd
+            for (int k=0; k<wlen; k++) {
+                const double d = v[k] - ac;
+                d2[k] += d*d;
+            }
+        }
+#pragma omp simd reduction(+:result)
+        for (int k=0; k<wlen; k++) {
+            result += (valid[k] != 0.0 ? sqrt(d2[k]) : 0.0);
+        }
+    }
+    return result;
+}
+
+/* Fetch the channels of pixel k of slot s into `a` */
+static void vwindow_get(const VWindow *w, int s, int k, double *a)
+{
+    for (int c=0; c<w->nchan; c++) {
+        a[c] = w->val[c][s*w->wlen + k];
+    }
+}
+
+/* Compute from scratch the sums of the pixels of slot `s` */
+static void vwindow_init_sums(VWindow *w, int s, int metric)
+{
+    double a[w->nchan];
+    for (int k=0; k<w->wlen; k++) {
+        vwindow_get(w, s, k, a);
+        double sum = 0.0;
+        for (int t=0; t<w->wlen; t++) {
+            sum += column_distance(w, a, t, metric);
+        }
+        w->sum[s*w->wlen + k] = sum;
+    }
+}
+
+/* Add (sign = 1) or subtract (sign = -1) the contribution of slot `s`
+   to the sums of all pixels that are not in slot `s` */
+static void vwindow_update_sums(VWindow *w, int s, int sign, int metric)
+{
+    double a[w->nchan];
+    double largest = 0.0;
+    for (int t=0; t<w->wlen; t++) {
+        if (t == s)
+            continue;
+        for (int k=0; k<w->wlen; k++) {
+            vwindow_get(w, t, k, a);
+            const double d = column_distance(w, a, s, metric);
+            w->sum[t*w->wlen + k] += sign * d;
+            largest = (d > largest ? d : largest);
+        }
+    }
+    w->drift += largest;
+}
+
+/* Return the sum of the distances from pixel k of slot s to all valid
+   pixels of the window, whose leftmost column is in slot `first`, in
+   the order of vector-median.h */
+static double vwindow_ordered_sum(const VWindow *w, int s, int k, int first, int metric)
+{
+    double a[w->nchan], b[w->nchan];
+    vwindow_get(w, s, k, a);
+    double sum = 0.0;
+    for (int r=0; r<w->wlen; r++) {
+        for (int t=0; t<w->wlen; t++) {
+            const int u = (first + t) % w->wlen;
+            if (w->valid[u*w->wlen + r] != 0.0) {
+                vwindow_get(w, u, r, b);
+                sum += vector_distance(a, b, w->nchan, metric);
+            }
+        }
+    }
+    return sum;
+}
+
+/* Return a pointer to the valid pixel with minimum sum of distances,
+   the topmost and then leftmost one in case of ties, or NULL if there
+   are no valid pixels; the leftmost column of the window is in slot
+   `first` */
+static const data_t *vwindow_median(const VWindow *w, int first, int metric)
+{
+    const int wlen = w->wlen;
+    const int n = wlen * wlen;
+    int nvalid = 0;
+    double min = INFINITY;
+    for (int p=0; p<n; p++) {
+        if (w->valid[p] != 0.0) {
+            nvalid++;
+            min = (w->sum[p] < min ? w->sum[p] : min);
+        }
+    }
+    if (nvalid == 0)
+        return NULL;
+    /* The incremental sums are exact with the L1 metric on integers;
+       otherwise, their rounding errors are far smaller than the
+       terms they are made of. If the minimum is not finite, all
+       pixels are candidates, and so are those whose sums have become
+       NaN, e.g., when an infinite value has left the window. */
+    const int exact = (metric == 1 && !w->opts->float_keys);
+    const double bound = (exact ? min : min + 1e-9 * (fabs(min) + w->drift));
+    const int all = !isfinite(bound);
+    int best = -1;
+    double best_sum = 0.0;
+    for (int r=0; r<wlen; r++) {
+        for (int t=0; t<wlen; t++) {
+            const int p = ((first + t) % wlen) * wlen + r;
+            if (w->valid[p] == 0.0 || (!all && w->sum[p] > bound))
+                continue;
+            if (exact)
+                return w->px[p];
+            /* a pixel equal to the best one has the same sum */
+            if (best >= 0 && memcmp(w->px[p], w->px[best], w->nchan * sizeof(data_t)) == 0)
+                continue;
+            const double sum = vwindow_ordered_sum(w, p / wlen, r, first, metric);
+            if (best < 0 || sum < best_sum) {
+                best = p;
+                best_sum = sum;
+            }
+        }
+    }
+    return w->px[best];
+}
+
+/* Load the whole window centered at (i, j); the column
+   j+(t-nsamp)*dil is stored in slot t */
+static void vwindow_load(VWindow *w, const data_t *in, int i, int j,
+                         int width, int height, size_t pitch, int metric)
+{
+    const int nsamp = w->wlen / 2;
+    for (int t=0; t<w->wlen; t++) {
+        vwindow_load_column(w, t, in, i, j + (t - nsamp)*w->dil, width, height, pitch);
+    }
+    for (int t=0; t<w->wlen; t++) {
+        vwindow_init_sums(w, t, metric);
+    }
+    w->drift = 0.0;
+}
+
+static void vector_median_2D( const data_t * restrict in,
+                              data_t * restrict out,
+                              const int *dims, int ndims, int radius,
+                              const median_filter_opts_t *opts,
+                              int metric )
+{
+    assert(ndims == 2);
+    const int width = dims[DX];
+    const int height = dims[DY];
+    const int nchan = opts->channels;
+    const int dil = opts->dilation;
+    const int nsamp = radius / dil;
+    const int wlen = 2*nsamp + 1;
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const int out_height = (height + stride - 1) / stride;
+    int row_first, row_last;
+    median_filter_rows(opts, out_height, &row_first, &row_last);
+    const size_t pitch = median_filter_in_pitch(dims, opts);
+    const size_t out_pitch = median_filter_out_pitch(dims, opts);
+    /* Consecutive centers handled by the same window are `step`
+       columns apart, i.e., `ncols` sampled columns; see
+       median_filter_2D_sparse_byrow() */
+    int step = dil;
+    while (step % stride != 0) {
+        step += dil;
+    }
+    const int nphases = step / stride;
+    const int ncols = step / dil;
+    data_t nodata_value;
+    const data_t *nodata = median_filter_nodata(opts, &nodata_value);
+
+#pragma omp parallel default(none) shared(width, height, pitch, out_pitch, in, out, nsamp, dil, nchan, wlen, metric, stride, out_width, row_first, row_last, step, nphases, ncols, nodata, dims, opts)
+    {
+        VWindow *w = vwindow_create(nsamp, dil, nchan, nodata, opts);
+#pragma omp for
+        for (int oi=row_first; oi<row_last; oi++) {
+            const int i = oi * stride;
+            for (int phase=0; phase<nphases && phase<out_width; phase++) {
+                /* slot of the leftmost column of the window */
+                int first = 0;
+                vwindow_load(w, in, i, phase * stride, width, height, pitch, metric);
+                for (int oj=phase, j=phase*stride; oj<out_width; oj+=nphases, j+=step) {
+                    const data_t *best = vwindow_median(w, first, metric);
+                    data_t *px = out + (size_t)oi * out_pitch + (size_t)oj * nchan;
+                    for (int c=0; c<nchan; c++) {
+                        px[c] = (best != NULL ? best[c] : *nodata);
+                    }
+                    if (oj + nphases >= out_width)
+                        break;
+                    if (ncols < wlen) {
+                        /* shift the window `step` positions to the
+                           right, one sampled column at a time: the
+                           leftmost column is replaced by column
+                           j+(nsamp+1+t)*dil */
+                        for (int t=0; t<ncols; t++) {
+                            const int s = first;
+                            vwindow_update_sums(w, s, -1, metric);
+                            vwindow_load_column(w, s, in, i, j + (nsamp + 1 + t)*dil, width, height, pitch);
+                            vwindow_update_sums(w, s, 1, metric);
+                            vwindow_init_sums(w, s, metric);
+                            first = (first + 1) % wlen;
+                        }
+                    } else {
+                        vwindow_load(w, in, i, j + step, width, height, pitch, metric);
+                        first = 0;
+                    }
+                }
+            }
+            postop_row(in, out, dims, oi, 0, nchan, opts);
+        }
+        vwindow_destroy(w);
+    }
+}
+
+/**
+ ** Vector median filter with L1 (sum of absolute differences) metric.
+ **
+ ** Execution time: O(width * height * C * R^3 / P)
+ **
+ ** Additional memory: O(P * C * R^2)
+ **/
+void median_filter_2D_vector_l1( const data_t *in, data_t *out,
+                                 const int *dims, int ndims, int radius,
+                                 const median_filter_opts_t *opts )
+{
+    vector_median_2D(in, out, dims, ndims, radius, opts, 1);
+}
+
+/**
+ ** Vector median filter with L2 (euclidean) metric; same cost as the
+ ** L1 version.
+ **/
+void median_filter_2D_vector_l2( const data_t *in, data_t *out,
+                                 const int *dims, int ndims, int radius,
+                                 const median_filter_opts_t *opts )
+{
+    vector_median_2D(in, out, dims, ndims, radius, opts, 2);
+}
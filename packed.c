@@ -0,0 +1,86 @@
+/****************************************************************************
+ *
+ * packed.c -- Readers of packed 10, 12 and 14 bit images
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#include <string.h>
+#include <assert.h>
+#include "packed.h"
+
+static const packed_layout_t packed_layouts[] = { {"mipi10", 10, 4, 5, 1},
+                                                  {"mipi12", 12, 2, 3, 1},
+                                                  {"mipi14", 14, 4, 7, 1},
+                                                  {"lsb10", 10, 4, 5, 0},
+                                                  {"lsb12", 12, 2, 3, 0},
+                                                  {"lsb14", 14, 4, 7, 0},
+                                                  {NULL, 0, 0, 0, 0} };
+
+const packed_layout_t *packed_layout_find( const char *name )
+{
+    for (int i=0; packed_layouts[i].name; i++) {
+        if (strcmp(name, packed_layouts[i].name) == 0)
+            return &packed_layouts[i];
+    }
+    return NULL;
+}
+
+/* Unpack `ngroups` groups of P values of B bits each, stored in G
+   bytes. The groups are independent, and the loop is vectorized; the
+   function is inlined with constant parameters, so that the inner
+   loops are fully unrolled. */
+static inline void unpack_groups( const uint8_t *src, uint16_t *dst, size_t ngroups,
+                                  const int B, const int P, const int G, const int mipi )
+{
+#pragma omp simd
+    for (size_t g=0; g<ngroups; g++) {
+        const uint8_t *s = src + g*G;
+        uint16_t *d = dst + g*P;
+        if (mipi) {
+            /* the low-order bits of all values, as a bit stream */
+            uint32_t low = 0;
+            for (int k=P; k<G; k++)
+                low |= (uint32_t)s[k] << (8*(k-P));
+            for (int k=0; k<P; k++)
+                d[k] = (uint16_t)((s[k] << (B-8)) | ((low >> ((B-8)*k)) & ((1u << (B-8)) - 1)));
+        } else {
+            uint64_t stream = 0;
+            for (int k=0; k<G; k++)
+                stream |= (uint64_t)s[k] << (8*k);
+            for (int k=0; k<P; k++)
+                d[k] = (uint16_t)((stream >> (B*k)) & ((1u << B) - 1));
+        }
+    }
+}
+
+void packed_unpack( const packed_layout_t *layout, const uint8_t *src, uint16_t *dst, size_t n )
+{
+    assert(n % layout->group_values == 0);
+    const size_t ngroups = n / layout->group_values;
+
+    /* one specialized loop for each layout */
+    switch (layout->bits * (layout->mipi ? 1 : -1)) {
+    case 10: unpack_groups(src, dst, ngroups, 10, 4, 5, 1); break;
+    case 12: unpack_groups(src, dst, ngroups, 12, 2, 3, 1); break;
+    case 14: unpack_groups(src, dst, ngroups, 14, 4, 7, 1); break;
+    case -10: unpack_groups(src, dst, ngroups, 10, 4, 5, 0); break;
+    case -12: unpack_groups(src, dst, ngroups, 12, 2, 3, 0); break;
+    case -14: unpack_groups(src, dst, ngroups, 14, 4, 7, 0); break;
+    default: assert(0);
+    }
+}
@@ -0,0 +1,59 @@
+/****************************************************************************
+ *
+ * packed.h -- Readers of packed 10, 12 and 14 bit images
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Cameras often store values of 10, 12 or 14 bits without padding, so
+ * that groups of P values occupy G bytes. Two layouts are supported:
+ *
+ * - mipi10, mipi12, mipi14 (MIPI CSI-2 RAW10/12/14): the first P bytes
+ *   of each group contain the 8 most significant bits of each value;
+ *   the remaining bytes contain the least significant bits, starting
+ *   from the first value and from the least significant bit.
+ *
+ * - lsb10, lsb12, lsb14 (e.g., GenICam Mono10p/12p/14p): the values
+ *   are concatenated into a little-endian bit stream.
+ *
+ * In both cases, P = 4 and G = 5 for 10 bits, P = 2 and G = 3 for 12
+ * bits, P = 4 and G = 7 for 14 bits. The values are unpacked into
+ * 16-bit words.
+ */
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    const char *name;
+    int bits;           /* bits per value */
+    int group_values;   /* values per group (P) */
+    int group_bytes;    /* bytes per group (G) */
+    int mipi;           /* nonzero for the MIPI layout, 0 for the bit stream */
+} packed_layout_t;
+
+/* Return the layout called `name`, or NULL if there is none */
+const packed_layout_t *packed_layout_find( const char *name );
+
+/* Unpack `n` values, that must be a multiple of the group size, from
+   `src` into `dst` */
+void packed_unpack( const packed_layout_t *layout, const uint8_t *src, uint16_t *dst, size_t n );
+
+#endif
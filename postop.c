@@ -0,0 +1,64 @@
+/****************************************************************************
+ *
+ * postop.c -- Per-pixel operations fused with the median filter
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#include <stdint.h>
+#include "postop.h"
+
+void postop_row( const data_t *in, data_t *out, const int *dims,
+                 int oi, int c0, int c1, const median_filter_opts_t *opts )
+{
+    if (!postop_enabled(opts))
+        return;
+
+    const int width = dims[DX];
+    const int nchan = opts->channels;
+    const int stride = opts->stride;
+    const int out_width = (width + stride - 1) / stride;
+    const data_t *in_row = in + (size_t)oi * stride * median_filter_in_pitch(dims, opts);
+    data_t *out_row = out + (size_t)oi * median_filter_out_pitch(dims, opts);
+    const int count = (opts->stats != NULL && oi >= opts->stats_first && oi < opts->stats_last);
+    uint64_t outliers = 0;
+    double abs_residual = 0.0;
+
+    for (int oj=0; oj<out_width; oj++) {
+        const data_t *src = in_row + (size_t)oj * stride * nchan;
+        data_t *dst = out_row + (size_t)oj * nchan;
+        for (int c=c0; c<c1; c++) {
+            const data_t med = dst[c];
+            /* missing samples are left untouched */
+            if (opts->has_nodata && (src[c] == opts->nodata || med == opts->nodata))
+                continue;
+            if (count) {
+                const data_t r = postop_abs_diff(src[c], med);
+                outliers += (r > opts->threshold);
+                abs_residual += r;
+            }
+            dst[c] = postop_apply(opts, src[c], med);
+        }
+    }
+
+    if (count) {
+#pragma omp atomic
+        opts->stats->outliers += outliers;
+#pragma omp atomic
+        opts->stats->abs_residual += abs_residual;
+    }
+}
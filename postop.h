@@ -0,0 +1,87 @@
+/****************************************************************************
+ *
+ * postop.h -- Per-pixel operations fused with the median filter
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Most uses of the median filter do something with the median right
+ * away: subtract it from the input (background removal), threshold
+ * the residual, clamp, or count the outliers. Instead of making
+ * further passes over the whole image, the algorithms apply these
+ * operations to each output row as soon as it has been computed,
+ * while it is still in cache. The per-pixel operation is shared by
+ * the CPU and GPU code.
+ */
+#ifndef POSTOP_H
+#define POSTOP_H
+
+#include "common.h"
+
+#ifdef __CUDACC__
+#define POSTOP_FN static inline __host__ __device__
+#else
+#define POSTOP_FN static inline
+#endif
+
+POSTOP_FN data_t postop_abs_diff( data_t a, data_t b )
+{
+    return (a > b ? a - b : b - a);
+}
+
+/* Return the output value for a pixel whose input value is `in` and
+   whose median is `med` */
+POSTOP_FN data_t postop_apply( const median_filter_opts_t *opts, data_t in, data_t med )
+{
+    data_t result;
+
+    switch (opts->postop) {
+    case POSTOP_RESIDUAL:
+        result = (in > med ? in - med : 0);
+        break;
+    case POSTOP_ABS_RESIDUAL:
+        result = postop_abs_diff(in, med);
+        break;
+    case POSTOP_MASK:
+        result = (postop_abs_diff(in, med) > opts->threshold);
+        break;
+    default:
+        result = med;
+    }
+    if (opts->has_clamp) {
+        result = (result < opts->clamp_lo ? (data_t)opts->clamp_lo :
+                  (result > opts->clamp_hi ? (data_t)opts->clamp_hi : result));
+    }
+    return result;
+}
+
+/* Return nonzero if any post-operation or reduction is requested */
+static inline int postop_enabled( const median_filter_opts_t *opts )
+{
+    return (opts->postop != POSTOP_NONE || opts->has_clamp || opts->stats != NULL);
+}
+
+#define postop_row TYPED(postop_row)
+
+/* Apply the post-operations to channels c0 .. c1-1 of output row `oi`,
+   whose medians have just been computed, and accumulate the
+   reductions. `dims` are the dimensions of the input image `in`. */
+void postop_row( const data_t *in, data_t *out, const int *dims,
+                 int oi, int c0, int c1, const median_filter_opts_t *opts );
+
+#endif
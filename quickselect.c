@@ -0,0 +1,70 @@
+/****************************************************************************
+ *
+ * quickselect.c -- Selection of the k-th smallest element of an array
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Hoare's selection algorithm with median-of-three pivot choice. The
+ * iterative formulation narrows the interval [lo, hi] that contains
+ * the k-th element until it has at most one element.
+ */
+#include <assert.h>
+#include "quickselect.h"
+
+static void swap(data_t *v, int i, int j)
+{
+    const data_t tmp = v[i];
+    v[i] = v[j];
+    v[j] = tmp;
+}
+
+data_t quickselect(data_t *v, int n, int k)
+{
+    int lo = 0, hi = n-1;
+
+    assert(0 <= k && k < n);
+
+    while (lo < hi) {
+        /* median of three: after this, v[lo] <= v[mid] <= v[hi] */
+        const int mid = lo + (hi - lo)/2;
+        if (v[mid] < v[lo]) swap(v, mid, lo);
+        if (v[hi] < v[lo]) swap(v, hi, lo);
+        if (v[hi] < v[mid]) swap(v, hi, mid);
+        const data_t pivot = v[mid];
+
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (v[i] < pivot) i++;
+            while (v[j] > pivot) j--;
+            if (i <= j) {
+                swap(v, i, j);
+                i++;
+                j--;
+            }
+        }
+        /* now v[lo..j] <= pivot <= v[i..hi], and v[j+1..i-1] == pivot */
+        if (k <= j)
+            hi = j;
+        else if (k >= i)
+            lo = i;
+        else
+            break;
+    }
+    return v[k];
+}
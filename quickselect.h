@@ -0,0 +1,36 @@
+/****************************************************************************
+ *
+ * quickselect.h -- Selection of the k-th smallest element of an array
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#ifndef QUICKSELECT_H
+#define QUICKSELECT_H
+
+#include "common.h"
+
+#define quickselect TYPED(quickselect)
+
+/* Return the k-th smallest element (0 <= k < n) of array `v` of
+   length `n`. The content of `v` is permuted so that v[k] is the
+   returned value, all elements before it are less than or equal to
+   v[k] and all elements after it are greater than or equal to v[k].
+   Average execution time O(n). */
+data_t quickselect(data_t *v, int n, int k);
+
+#endif
@@ -20,23 +20,45 @@
  * --------------------------------------------------------------------------
  *
  * Generate a random image with user-specified width and height,
- * suitable for `median-filter-cuda`. The image is a raw streams of $X
- * \times Y \times Z$ random values of type `data_t` as defined in
- * `common.h`.
+ * suitable for `median-filter`. The image is a raw streams of $X
+ * \times Y \times Z$ random unsigned integers of 8, 16 or 32 bits.
  *
  * The syntax is:
  *
- *      ./random-image [-X xsize] [-Y ysize] [-Z zsize] [outfile]
+ *      ./random-image [-X xsize] [-Y ysize] [-Z zsize] [-b bits] [-B sigbits] [-v values] [-s seed] [-F] [-P layout] [outfile]
  *
  * where _xsize_, _ysize_ and _zsize_ are the image sizes (default 1);
  * indeed, the program can generate a 3D image that is stored in the
  * output file as a sequence of XY matrices. The output file is just a
- * sequence of xsize * ysize * zsize random words of type `data_t`.
+ * sequence of xsize * ysize * zsize random words of _bits_ bits (8,
+ * 16 or 32; default 32), of which only the _sigbits_ least
+ * significant ones are used (default: all). If _outfile_ is `-`, the
+ * image is written to the standard output.
+ *
+ * _values_ is the distribution of the values: `uniform` (default)
+ * over the whole range of the data type, `few` (only 4 distinct
+ * values, so that windows contain many duplicates), `extreme` (only
+ * the minimum and maximum value) or `constant` (all zeros). _seed_
+ * initializes the random number generator (default: current time),
+ * so that the same image can be generated again.
+ *
+ * With -F, each value $v$ is written as the 32-bit floating point
+ * number $v - 2^{sigbits-1}$ instead, so that the image has negative
+ * and positive values; -F requires 32 bits, and at most 24 significant
+ * bits, so that all values are exact.
+ *
+ * With -P, the values are packed with _layout_ (mipi10, mipi12,
+ * mipi14, lsb10, lsb12 or lsb14, see packed.h), as read by the option
+ * --packed of `median-filter`; -P requires 16 bits, and the number of
+ * values must be a multiple of the values of a group. The significant
+ * bits are those of the layout, so that the values are those of the
+ * image generated with the same seed, -b 16 and -B 10, 12 or 14.
  *
  ****************************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdint.h>
 #include <time.h>
@@ -44,13 +66,86 @@
 #include <getopt.h>
 #include "common.h"
 
+static const char *value_names[] = {"uniform", "few", "extreme", "constant", NULL};
+enum { VAL_UNIFORM, VAL_FEW, VAL_EXTREME, VAL_CONSTANT };
+
+/* Packed layouts: groups of P values of B bits are stored in G bytes */
+static const struct {
+    const char *name;
+    int B, P, G, mipi;
+} layouts[] = { {"mipi10", 10, 4, 5, 1}, {"mipi12", 12, 2, 3, 1}, {"mipi14", 14, 4, 7, 1},
+                {"lsb10", 10, 4, 5, 0}, {"lsb12", 12, 2, 3, 0}, {"lsb14", 14, 4, 7, 0},
+                {NULL, 0, 0, 0, 0} };
+
+/* Return 32 random bits; rand() may return as few as 15 random bits,
+   so several calls are combined */
+static uint32_t random_bits( void )
+{
+    uint32_t v = 0;
+    for (int i=0; i<3; i++) {
+        v = (v << 15) ^ (uint32_t)rand();
+    }
+    return v;
+}
+
+/* Pack the `n` values of `src` into `dst` with layout `l`. With the
+   MIPI layout, the first P bytes of a group are the 8 most significant
+   bits of each value, and the others are the remaining bits of the
+   values, as a little-endian bit stream; otherwise, the whole group is
+   a little-endian bit stream. */
+static void pack_values( uint8_t *dst, const uint32_t *src, size_t n, int l )
+{
+    const int B = layouts[l].B, P = layouts[l].P, G = layouts[l].G;
+    for (size_t g=0; g<n/P; g++) {
+        const uint32_t *v = src + g*P;
+        uint8_t *d = dst + g*G;
+        uint64_t stream = 0;
+        if (layouts[l].mipi) {
+            for (int k=0; k<P; k++) {
+                d[k] = (uint8_t)(v[k] >> (B-8));
+                stream |= (uint64_t)(v[k] & ((1u << (B-8)) - 1)) << ((B-8)*k);
+            }
+            for (int k=P; k<G; k++)
+                d[k] = (uint8_t)(stream >> (8*(k-P)));
+        } else {
+            for (int k=0; k<P; k++)
+                stream |= (uint64_t)v[k] << (B*k);
+            for (int k=0; k<G; k++)
+                d[k] = (uint8_t)(stream >> (8*k));
+        }
+    }
+}
+
+/* Store the `n` values of `src` into `dst` as words of `bpp` bits */
+static void store_values( void *dst, const uint32_t *src, size_t n, int bpp )
+{
+    switch (bpp) {
+    case 8:
+        for (size_t i=0; i<n; i++)
+            ((uint8_t*)dst)[i] = (uint8_t)src[i];
+        break;
+    case 16:
+        for (size_t i=0; i<n; i++)
+            ((uint16_t*)dst)[i] = (uint16_t)src[i];
+        break;
+    default:
+        memcpy(dst, src, n * sizeof(*src));
+    }
+}
+
 int main(int argc, char** argv)
 {
     const char *outfile = "image.raw";
     int dims[3] = {1024, 768, 1};
+    int values = VAL_UNIFORM;
+    int bpp = 32;
+    int sigbits = 0;
+    unsigned seed = (unsigned)time(NULL);
+    int floats = 0;
+    int layout = -1;
     int opt;
 
-    while ((opt = getopt(argc, argv, "X:Y:Z:")) != -1) {
+    while ((opt = getopt(argc, argv, "X:Y:Z:b:B:v:s:FP:")) != -1) {
         switch (opt) {
         case 'X':
             dims[DX] = atoi(optarg);
@@ -61,6 +156,42 @@ int main(int argc, char** argv)
         case 'Z':
             dims[DZ] = atoi(optarg);
             break;
+        case 'b':
+            bpp = atoi(optarg);
+            if (bpp != 8 && bpp != 16 && bpp != 32) {
+                fprintf(stderr, "FATAL: the number of bits must be 8, 16 or 32\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'B':
+            sigbits = atoi(optarg);
+            break;
+        case 'v':
+            values = 0;
+            while (value_names[values] && strcmp(optarg, value_names[values])) {
+                values++;
+            }
+            if (value_names[values] == NULL) {
+                fprintf(stderr, "FATAL: invalid value distribution %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            seed = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'F':
+            floats = 1;
+            break;
+        case 'P':
+            layout = 0;
+            while (layouts[layout].name && strcmp(optarg, layouts[layout].name)) {
+                layout++;
+            }
+            if (layouts[layout].name == NULL) {
+                fprintf(stderr, "FATAL: invalid packed layout %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         default:
             fprintf(stderr, "FATAL: unrecognized option %c\n", opt);
             return EXIT_FAILURE;
@@ -71,27 +202,72 @@ int main(int argc, char** argv)
         outfile = argv[optind];
     }
 
-    const size_t N_PIXELS = dims[0] * dims[1] * dims[2];
-    data_t *img = (data_t*)malloc(N_PIXELS * sizeof(data_t));
+    const size_t N_PIXELS = (size_t)dims[0] * dims[1] * dims[2];
+    if (sigbits <= 0 || sigbits > bpp) {
+        sigbits = bpp;
+    }
+    if (floats && (bpp != 32 || sigbits > 24)) {
+        fprintf(stderr, "FATAL: -F requires 32 bits, of which at most 24 are significant\n");
+        return EXIT_FAILURE;
+    }
+    if (layout >= 0) {
+        if (bpp != 16 || N_PIXELS % layouts[layout].P != 0) {
+            fprintf(stderr, "FATAL: -P requires 16 bits, and a multiple of %d values\n", layouts[layout].P);
+            return EXIT_FAILURE;
+        }
+        sigbits = layouts[layout].B;
+    }
+    const uint32_t max_value = (uint32_t)(((uint64_t)1 << sigbits) - 1);
+    uint32_t *val = (uint32_t*)malloc(N_PIXELS * sizeof(*val));
+    void *img = malloc(N_PIXELS * (bpp / 8));
+    assert(val != NULL);
     assert(img != NULL);
 
-    FILE* fileout = fopen(outfile, "w");
+    FILE* fileout = (strcmp(outfile, "-") == 0 ? stdout : fopen(outfile, "w"));
     if (fileout == NULL) {
-        fprintf(stderr, "FATAL: can not create output file \"%s\"\n", argv[3]);
+        fprintf(stderr, "FATAL: can not create output file \"%s\"\n", outfile);
         return EXIT_FAILURE;
     }
 
-    srand(time(NULL));
+    srand(seed);
     for (size_t i=0; i<N_PIXELS; i++) {
-        img[i] = (data_t)rand();
+        switch (values) {
+        case VAL_FEW:
+            val[i] = rand() % 4;
+            break;
+        case VAL_EXTREME:
+            val[i] = (rand() % 2 ? max_value : 0);
+            break;
+        case VAL_CONSTANT:
+            val[i] = 0;
+            break;
+        default:
+            val[i] = random_bits() & max_value;
+        }
+    }
+    if (floats) {
+        const int32_t offset = (int32_t)(1u << (sigbits - 1));
+        for (size_t i=0; i<N_PIXELS; i++) {
+            const float f = (float)((int32_t)val[i] - offset);
+            memcpy(&val[i], &f, sizeof(f));
+        }
+    }
+    size_t nbytes = N_PIXELS * (bpp / 8);
+    if (layout >= 0) {
+        nbytes = N_PIXELS / layouts[layout].P * layouts[layout].G;
+        pack_values((uint8_t*)img, val, N_PIXELS, layout);
+    } else {
+        store_values(img, val, N_PIXELS, bpp);
     }
 
-    const size_t nwritten = fwrite(img, sizeof(data_t), N_PIXELS, fileout);
+    const size_t nwritten = fwrite(img, 1, nbytes, fileout);
     (void)nwritten; /* avoid warning */
-    assert(nwritten == N_PIXELS);
-    fclose(fileout);
+    assert(nwritten == nbytes);
+    if (fileout != stdout)
+        fclose(fileout);
     // printf("Created image X=%d Y=%d Z=%d (%ld pixels)\n", dims[DX], dims[DY], dims[DZ], (unsigned long)N_PIXELS);
 
+    free(val);
     free(img);
 
     return EXIT_SUCCESS;
@@ -0,0 +1,329 @@
+/****************************************************************************
+ *
+ * result-cache.c -- On-disk cache of the results of the filter
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/* futimens() is part of POSIX.1-2008; flock() is a BSD extension */
+#if _XOPEN_SOURCE < 700
+#define _XOPEN_SOURCE 700
+#endif
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#include "result-cache.h"
+
+/* Files are hashed and copied in blocks of COPY_BLOCK bytes */
+#define COPY_BLOCK ((size_t)1 << 20)
+
+/* Temporary files older than this (in seconds) have been left by
+   processes that did not complete, and are removed by the eviction */
+#define STALE_TMP (24*3600)
+
+/*
+ * The hash processes the data in blocks of 32 bytes, one 64-bit word
+ * in each of four independent lanes, with a multiply and rotate per
+ * word; the lanes are combined into 128 bits at the end.
+ */
+#define PRIME1 0x9e3779b97f4a7c15ull
+#define PRIME2 0xbf58476d1ce4e5b9ull
+#define PRIME3 0x94d049bb133111ebull
+
+typedef struct {
+    uint64_t lane[4];
+    uint64_t len;
+    unsigned char buf[32];
+    size_t nbuf;
+} hash_t;
+
+static uint64_t rotl64( uint64_t x, int r )
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64( uint64_t h )
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static void hash_init( hash_t *h )
+{
+    h->lane[0] = PRIME1;
+    h->lane[1] = PRIME2;
+    h->lane[2] = PRIME3;
+    h->lane[3] = PRIME1 ^ PRIME2;
+    h->len = 0;
+    h->nbuf = 0;
+}
+
+static void hash_block( hash_t *h, const unsigned char *p )
+{
+    uint64_t v[4];
+    memcpy(v, p, sizeof(v));
+    for (int i=0; i<4; i++) {
+        h->lane[i] = rotl64(h->lane[i] + v[i] * PRIME2, 31) * PRIME1;
+    }
+}
+
+static void hash_update( hash_t *h, const void *data, size_t n )
+{
+    const unsigned char *p = (const unsigned char*)data;
+    h->len += n;
+    if (h->nbuf > 0) {
+        const size_t k = (n < 32 - h->nbuf ? n : 32 - h->nbuf);
+        memcpy(h->buf + h->nbuf, p, k);
+        h->nbuf += k;
+        p += k;
+        n -= k;
+        if (h->nbuf < 32)
+            return;
+        hash_block(h, h->buf);
+        h->nbuf = 0;
+    }
+    for (; n >= 32; p += 32, n -= 32) {
+        hash_block(h, p);
+    }
+    memcpy(h->buf, p, n);
+    h->nbuf = n;
+}
+
+static void hash_final( hash_t *h, uint64_t *hi, uint64_t *lo )
+{
+    if (h->nbuf > 0) {
+        memset(h->buf + h->nbuf, 0, 32 - h->nbuf);
+        hash_block(h, h->buf);
+    }
+    const uint64_t *l = h->lane;
+    *hi = fmix64(l[0] + rotl64(l[1], 17) + rotl64(l[2], 31) + rotl64(l[3], 47) + h->len);
+    *lo = fmix64(l[3] ^ rotl64(l[2], 13) ^ rotl64(l[1], 29) ^ rotl64(l[0], 43) ^ (h->len * PRIME3));
+}
+
+int result_cache_key( const char *infile, const char *params, char *key )
+{
+    hash_t h;
+    uint64_t hi, lo;
+    ssize_t nread;
+
+    const int fd = open(infile, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    char *buf = (char*)malloc(COPY_BLOCK);
+    if (buf == NULL) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    hash_init(&h);
+    /* the terminator separates the parameters from the data */
+    hash_update(&h, params, strlen(params) + 1);
+    while ((nread = read(fd, buf, COPY_BLOCK)) > 0) {
+        hash_update(&h, buf, nread);
+    }
+    const int saved = errno;
+    free(buf);
+    close(fd);
+    if (nread < 0) {
+        errno = saved;
+        return -1;
+    }
+    hash_final(&h, &hi, &lo);
+    snprintf(key, RESULT_CACHE_KEY_LEN + 1, "%016llx%016llx", (unsigned long long)hi, (unsigned long long)lo);
+    return 0;
+}
+
+/* Copy the contents of file `in` to file `out`, which is empty; return
+   0 on success, -1 on error */
+static int copy_fd( int in, int out )
+{
+#ifdef FICLONE
+    /* share the blocks of the file, on file systems that support it */
+    if (ioctl(out, FICLONE, in) == 0)
+        return 0;
+#endif
+    char *buf = (char*)malloc(COPY_BLOCK);
+    ssize_t nread;
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    while ((nread = read(in, buf, COPY_BLOCK)) > 0) {
+        for (ssize_t done = 0; done < nread; ) {
+            const ssize_t n = write(out, buf + done, nread - done);
+            if (n < 0) {
+                free(buf);
+                return -1;
+            }
+            done += n;
+        }
+    }
+    free(buf);
+    return (nread < 0 ? -1 : 0);
+}
+
+int result_cache_fetch( const char *dir, const char *key, const char *outfile )
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, key);
+    const int in = open(path, O_RDONLY);
+    if (in < 0)
+        return (errno == ENOENT ? 0 : -1);
+    const int out = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0 || copy_fd(in, out) != 0) {
+        const int saved = errno;
+        if (out >= 0)
+            close(out);
+        close(in);
+        errno = saved;
+        return -1;
+    }
+    /* the entry has been used now; the owner of the cache may not be
+       the owner of the entry, so this may fail */
+    futimens(in, NULL);
+    close(in);
+    return (close(out) == 0 ? 1 : -1);
+}
+
+typedef struct {
+    char name[RESULT_CACHE_KEY_LEN + 1];
+    off_t size;
+    time_t mtime;
+} entry_t;
+
+static int older( const void *p1, const void *p2 )
+{
+    const entry_t *e1 = (const entry_t*)p1, *e2 = (const entry_t*)p2;
+    if (e1->mtime != e2->mtime)
+        return (e1->mtime < e2->mtime ? -1 : 1);
+    return strcmp(e1->name, e2->name);
+}
+
+static int is_key( const char *name )
+{
+    return (strlen(name) == RESULT_CACHE_KEY_LEN &&
+            strspn(name, "0123456789abcdef") == RESULT_CACHE_KEY_LEN);
+}
+
+/* Remove the least recently used entries of cache `dir`, until the
+   total size is at most `limit`; only one process at a time evicts */
+static int evict( const char *dir, size_t limit )
+{
+    char path[4096];
+    entry_t *entries = NULL;
+    size_t n = 0, capacity = 0;
+    unsigned long long total = 0;
+    struct dirent *d;
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/lock", dir);
+    const int lock = open(path, O_RDWR | O_CREAT, 0666);
+    if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+        if (lock >= 0)
+            close(lock);
+        return -1;
+    }
+    DIR *dp = opendir(dir);
+    if (dp == NULL) {
+        close(lock);
+        return -1;
+    }
+    const time_t now = time(NULL);
+    while ((d = readdir(dp)) != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+        if (strncmp(d->d_name, "tmp.", 4) == 0) {
+            if (stat(path, &st) == 0 && now - st.st_mtime > STALE_TMP)
+                unlink(path);
+            continue;
+        }
+        if (!is_key(d->d_name) || stat(path, &st) != 0)
+            continue;
+        if (n == capacity) {
+            capacity = (capacity > 0 ? 2 * capacity : 256);
+            entry_t *e = (entry_t*)realloc(entries, capacity * sizeof(*e));
+            if (e == NULL)
+                break;
+            entries = e;
+        }
+        snprintf(entries[n].name, sizeof(entries[n].name), "%s", d->d_name);
+        entries[n].size = st.st_size;
+        entries[n].mtime = st.st_mtime;
+        total += st.st_size;
+        n++;
+    }
+    closedir(dp);
+    if (total > limit) {
+        qsort(entries, n, sizeof(*entries), older);
+        for (size_t i=0; i<n && total > limit; i++) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+            if (unlink(path) == 0)
+                total -= entries[i].size;
+        }
+    }
+    free(entries);
+    close(lock);
+    return 0;
+}
+
+int result_cache_store( const char *dir, const char *key, const char *outfile, size_t limit )
+{
+    char tmp[4096], path[4096];
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        return -1;
+    snprintf(tmp, sizeof(tmp), "%s/tmp.%ld.%s", dir, (long)getpid(), key);
+    snprintf(path, sizeof(path), "%s/%s", dir, key);
+    const int in = open(outfile, O_RDONLY);
+    if (in < 0)
+        return -1;
+    const int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int status = (out < 0 ? -1 : copy_fd(in, out));
+    int saved = errno;
+    close(in);
+    if (out >= 0 && close(out) != 0 && status == 0) {
+        status = -1;
+        saved = errno;
+    }
+    /* the entry appears complete, or not at all */
+    if (status == 0 && rename(tmp, path) != 0) {
+        status = -1;
+        saved = errno;
+    }
+    if (status != 0) {
+        unlink(tmp);
+        errno = saved;
+        return -1;
+    }
+    return evict(dir, limit);
+}
@@ -0,0 +1,62 @@
+/****************************************************************************
+ *
+ * result-cache.h -- On-disk cache of the results of the filter
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * A result cache is a directory that holds output files, each named
+ * after the key of the job that produced it. The key is a 128-bit hash
+ * of the bytes of the input file and of a string that describes all
+ * the parameters that affect the output; the hash is fast, but not
+ * cryptographic, so the cache must not be shared with untrusted users.
+ *
+ * An output is stored by writing it to a temporary file in the cache,
+ * which is then renamed to its key, so that other processes never see
+ * a partial entry. A hit copies the entry to the output file (with a
+ * reflink, if the file system supports them), and updates its
+ * modification time, so that the entries can be evicted in least
+ * recently used order when the total size exceeds the limit. Eviction
+ * is serialized by an exclusive flock() on the file "lock" of the
+ * cache; an entry that is evicted while another process copies it
+ * remains readable through the open descriptor.
+ */
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stddef.h>
+
+#define RESULT_CACHE_KEY_LEN 32 /* hexadecimal digits of a key */
+
+/* Compute into `key` (RESULT_CACHE_KEY_LEN + 1 chars) the key of the
+   contents of file `infile` and of the parameters `params`; return 0
+   on success, -1 if the file can not be read, with errno set */
+int result_cache_key( const char *infile, const char *params, char *key );
+
+/* Copy the entry `key` of the cache `dir` to the file `outfile`; return
+   1 if the entry has been copied, 0 if it is not in the cache, -1 on
+   error, with errno set */
+int result_cache_fetch( const char *dir, const char *key, const char *outfile );
+
+/* Store a copy of `outfile` as the entry `key` of the cache `dir`, which
+   is created if needed, then evict the least recently used entries
+   until the total size is at most `limit` bytes; return 0 on success,
+   -1 on error, with errno set */
+int result_cache_store( const char *dir, const char *key, const char *outfile, size_t limit );
+
+#endif
@@ -0,0 +1,167 @@
+/****************************************************************************
+ *
+ * test-daemon.c -- submit invalid jobs to a median filter daemon
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Submit to the daemon listening on _socket_ (see daemon.h) jobs whose
+ * images do not lie within the shared memory, because of offsets or
+ * sizes that wrap around when they are added or multiplied. The
+ * daemon must reject all of them with EINVAL, and keep serving; this
+ * is checked by check.sh, that submits a valid job afterwards.
+ *
+ * Then a client submits 1x1 jobs without ever reading the replies.
+ * The daemon must disconnect it once its replies no longer fit in its
+ * socket, rather than wait for it, and serve the job of another
+ * client.
+ *
+ * The syntax is:
+ *
+ *      ./test-daemon socket pixel_size
+ *
+ * where _pixel_size_ is the bytes per pixel of the images of the
+ * daemon. The exit status is 0 if all the jobs are rejected as
+ * expected.
+ *
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "daemon.h"
+
+#define MEM_SIZE (64 * 1024)
+
+/* Seconds after which a daemon that is blocked by a client is
+   considered hung; the test is then killed by SIGALRM */
+#define HANG_TIMEOUT 20
+
+/* Submit 1x1 jobs of pixels of `ps` bytes, in the memory `fd`, to
+   the daemon listening on `path`, without reading the replies; return
+   0 once the daemon has disconnected the client */
+static int flood( const char *path, int fd, uint64_t ps )
+{
+    const int sock = daemon_connect(path);
+    if (sock < 0 || fcntl(sock, F_SETFL, O_NONBLOCK) != 0)
+        return -1;
+    daemon_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.magic = DAEMON_MAGIC;
+    job.width = job.height = 1;
+    job.in_offset = 0;
+    job.out_offset = ps;
+    for (;;) {
+        job.id++;
+        if (daemon_submit(sock, &job, fd) != 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* the daemon has not read the previous jobs yet */
+                struct pollfd p = {sock, POLLOUT, 0};
+                job.id--;
+                poll(&p, 1, 100);
+            } else {
+                break;
+            }
+        }
+    }
+    const int err = errno;
+    close(sock);
+    return (err == EPIPE || err == ECONNRESET ? 0 : -1);
+}
+
+int main( int argc, char *argv[] )
+{
+    if (argc != 3 || atoi(argv[2]) < 1) {
+        fprintf(stderr, "Usage: %s socket pixel_size\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const uint64_t ps = (uint64_t)atoi(argv[2]);
+    /* the largest offset aligned to the pixels */
+    const uint64_t top = UINT64_MAX / ps * ps;
+    const struct {
+        int32_t width, height;
+        uint64_t in_offset, out_offset;
+        const char *what;
+    } jobs[] = {
+        {4, 4, top - ps, 0, "input offset that wraps around"},
+        {4, 4, 0, top - ps, "output offset that wraps around"},
+        {4, 4, MEM_SIZE / ps * ps, 0, "input past the end of the memory"},
+        {4, 4, 0, MEM_SIZE / ps * ps, "output past the end of the memory"},
+        {INT32_MAX, INT32_MAX, 0, 16 * ps, "size that wraps around"},
+        {INT32_MAX, INT32_MAX, top - ps, 0, "size and offset that wrap around"},
+        {-1, 4, 0, 16 * ps, "negative width"}
+    };
+    const int fd = daemon_memory(MEM_SIZE);
+    const int sock = daemon_connect(argv[1]);
+    if (fd < 0 || sock < 0) {
+        fprintf(stderr, "%s: can not connect to \"%s\": %s\n", argv[0], argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    int nfail = 0;
+    for (size_t k=0; k<sizeof(jobs)/sizeof(jobs[0]); k++) {
+        daemon_job_t job;
+        daemon_reply_t reply;
+        memset(&job, 0, sizeof(job));
+        job.magic = DAEMON_MAGIC;
+        job.id = (uint32_t)k + 1;
+        job.width = jobs[k].width;
+        job.height = jobs[k].height;
+        job.in_offset = jobs[k].in_offset;
+        job.out_offset = jobs[k].out_offset;
+        if (daemon_submit(sock, &job, fd) != 0 || daemon_wait(sock, &reply) != 0) {
+            fprintf(stderr, "%s: the daemon did not reply to a job with %s\n", argv[0], jobs[k].what);
+            return EXIT_FAILURE;
+        }
+        if (reply.id != job.id || reply.status != EINVAL) {
+            fprintf(stderr, "%s: a job with %s got status %d instead of EINVAL\n",
+                    argv[0], jobs[k].what, reply.status);
+            nfail++;
+        }
+    }
+    close(sock);
+
+    alarm(HANG_TIMEOUT);
+    if (flood(argv[1], fd, ps) != 0) {
+        fprintf(stderr, "%s: a client that does not read its replies is not disconnected: %s\n",
+                argv[0], strerror(errno));
+        nfail++;
+    }
+    daemon_job_t job;
+    daemon_reply_t reply;
+    memset(&job, 0, sizeof(job));
+    job.magic = DAEMON_MAGIC;
+    job.id = 1;
+    job.width = job.height = 1;
+    job.out_offset = ps;
+    const int other = daemon_connect(argv[1]);
+    if (other < 0 || daemon_submit(other, &job, fd) != 0 || daemon_wait(other, &reply) != 0 ||
+        reply.id != job.id || reply.status != 0) {
+        fprintf(stderr, "%s: the daemon does not serve the other clients after a flood\n", argv[0]);
+        nfail++;
+    }
+    alarm(0);
+    if (other >= 0)
+        close(other);
+    close(fd);
+    return (nfail == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -16,9 +16,10 @@ BPP="16 32"
 NREP=5
 EXE=./median-filter
 
+make || exit -1
+
 # Test different image depths
 for B in $BPP ; do
-    make clean && CFLAGS=-DBPP=$B NVCFLAGS=-DBPP=$B make || exit -1
     echo
     echo "algorithm"
     echo "|                     img size"
@@ -37,8 +38,8 @@ for B in $BPP ; do
                 printf "%20s %4d %2d %3d " ${A} ${X} ${B} ${R}
                 TT=0
                 for rep in `seq $NREP`; do
-                    ./random-image -X $X -Y $X $IMG_NAME
-                    EXEC_TIME="$( $EXE -X $X -Y $X -r $R -a $A -o /dev/null $IMG_NAME 2>&1 | grep "Execution time" | sed 's/Execution time\.\. //' )"
+                    ./random-image -b $B -X $X -Y $X $IMG_NAME
+                    EXEC_TIME="$( $EXE -b $B -X $X -Y $X -r $R -a $A -o /dev/null $IMG_NAME 2>&1 | grep "Execution time" | sed 's/Execution time\.\. //' )"
                     TT=$( echo "$TT + $EXEC_TIME" | bc )
                     echo -n " $EXEC_TIME"
                 done
@@ -0,0 +1,185 @@
+/****************************************************************************
+ *
+ * test-plan.c -- check that median_filter_execute() does not allocate memory
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Create a plan (see median-plan.h) for each algorithm of the library
+ * that runs on the CPU, and each data type of `types` below, and filter
+ * a few random images with it. The program is linked with
+ * `-Wl,--wrap=malloc` etc. (see the Makefile), so that the allocations
+ * of the library go through the wrappers below, that count those made
+ * while median_filter_execute() runs; there must be none. The outputs
+ * of an image filtered twice must be the same.
+ *
+ * The syntax is:
+ *
+ *      ./test-plan [algo ...]
+ *
+ * where the algorithms to check are all those of the library if none
+ * is given. The exit status is 0 if all the checks pass.
+ *
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "median-plan.h"
+
+#define WIDTH 61
+#define HEIGHT 47
+#define RADIUS 3
+#define NRUNS 4
+
+void *__real_malloc( size_t size );
+void *__real_calloc( size_t n, size_t size );
+void *__real_realloc( void *ptr, size_t size );
+int __real_posix_memalign( void **ptr, size_t alignment, size_t size );
+
+static int counting = 0;
+static long nalloc = 0;
+
+static void count( void )
+{
+    if (counting) {
+#pragma omp atomic
+        nalloc++;
+    }
+}
+
+void *__wrap_malloc( size_t size )
+{
+    count();
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc( size_t n, size_t size )
+{
+    count();
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc( void *ptr, size_t size )
+{
+    count();
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign( void **ptr, size_t alignment, size_t size )
+{
+    count();
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+/* Fill `img` with `n` random values of type `t`; floating point values
+   are drawn from [-1000, 1000) */
+static void fill( void *img, size_t n, const value_type_t *t )
+{
+    for (size_t i=0; i<n; i++) {
+        const uint32_t r = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        if (t->kind == VALUE_FLOAT) {
+            const float v = (float)(r % 2000000) / 1000.0f - 1000.0f;
+            memcpy((char*)img + i * 4, &v, 4);
+        } else if (t->bits == 8) {
+            ((uint8_t*)img)[i] = (uint8_t)r;
+        } else if (t->bits == 16) {
+            ((uint16_t*)img)[i] = (uint16_t)r;
+        } else {
+            ((uint32_t*)img)[i] = r;
+        }
+    }
+}
+
+/* Filter random images with algorithm `algo` on values of `type`;
+   return the number of failed checks */
+static int check( const char *algo, const char *type )
+{
+    const value_type_t *t = value_type_find(type);
+    const size_t size = t->bits / 8;
+    const size_t n = (size_t)WIDTH * HEIGHT;
+    median_filter_opts_t opts;
+    char err[256];
+    int nfail = 0;
+
+    median_filter_opts_init(&opts);
+    median_filter_plan_t *plan = median_filter_plan_create(algo, type, WIDTH, HEIGHT, RADIUS,
+                                                           &opts, err, sizeof(err));
+    if (plan == NULL) {
+        printf("%-24s %-4s skipped (%s)\n", algo, type, err);
+        return 0;
+    }
+    void *in = malloc(n * size);
+    void *out = malloc(n * size);
+    void *again = malloc(n * size);
+    if (in == NULL || out == NULL || again == NULL) {
+        fprintf(stderr, "FATAL: not enough memory\n");
+        exit(EXIT_FAILURE);
+    }
+    nalloc = 0;
+    for (int run=0; run<NRUNS; run++) {
+        fill(in, n, t);
+        counting = 1;
+        const int status = median_filter_execute(plan, in, out) | median_filter_execute(plan, in, again);
+        counting = 0;
+        if (status != 0 || memcmp(out, again, n * size) != 0) {
+            printf("FAIL %s %s: the outputs of an image filtered twice differ\n", algo, type);
+            nfail++;
+            break;
+        }
+    }
+    if (nalloc > 0) {
+        printf("FAIL %s %s: %ld allocations in %d executions\n", algo, type, nalloc, 2 * NRUNS);
+        nfail++;
+    } else if (nfail == 0) {
+        printf("%-24s %-4s passed\n", algo, type);
+    }
+    free(in);
+    free(out);
+    free(again);
+    median_filter_plan_destroy(plan);
+    return nfail;
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *types[] = {"u8", "u16", "i16", "u32", "f32"};
+    int nfail = 0;
+
+    srand(42);
+    if (argc > 1) {
+        for (int a=1; a<argc; a++) {
+            if (median_filter_algo_find(argv[a]) == NULL) {
+                fprintf(stderr, "%s: unknown algorithm \"%s\"\n", argv[0], argv[a]);
+                return EXIT_FAILURE;
+            }
+            for (size_t k=0; k<sizeof(types)/sizeof(types[0]); k++)
+                nfail += check(argv[a], types[k]);
+        }
+    } else {
+        for (const median_filter_algo_info_t *a = median_filter_algos; a->name != NULL; a++) {
+            if (strncmp(a->name, "cuda-", 5) == 0)
+                continue;
+            for (size_t k=0; k<sizeof(types)/sizeof(types[0]); k++)
+                nfail += check(a->name, types[k]);
+        }
+    }
+    if (nfail > 0)
+        printf("%d FAILURES\n", nfail);
+    return (nfail == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,89 @@
+/****************************************************************************
+ *
+ * vector-median.h -- Distances between the pixels of the vector medians
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * The vector median of a window is the valid pixel p with the least
+ * sum S(p) of the distances to all valid pixels of the window; ties
+ * are broken in favor of the pixel that comes first in the window,
+ * i.e., in the topmost row and then in the leftmost column, so that
+ * the result does not depend on how the window has been computed.
+ *
+ * S(p) is defined as the sum of vector_distance() from p to the valid
+ * pixels of the window, taken row by row from the top left corner,
+ * starting from 0.0. Rounding makes the sums depend on the order of
+ * the terms; the fast algorithm (omp-vector-median-2D.c) computes them
+ * incrementally, in any order, and recomputes in this order the sums
+ * of the pixels that may be the minimum, so that its result is that of
+ * the brute-force reference (omp-reference-2D.c), bit for bit.
+ */
+#ifndef VECTOR_MEDIAN_H
+#define VECTOR_MEDIAN_H
+
+#include <string.h>
+#include <math.h>
+#include "common.h"
+
+/* Return the value of key `k`, that is the key of a floating point
+   value if `float_keys` is nonzero */
+static inline double key_value(data_t k, int float_keys)
+{
+#if BPP == 32
+    if (float_keys) {
+        const uint32_t bits = (k & 0x80000000u) ? (k & 0x7fffffffu) : ~k;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+#elif BPP == 16
+    if (float_keys) {
+        const uint16_t bits = (k & 0x8000u) ? (k & 0x7fffu) : (uint16_t)~k;
+        const int e = (bits >> 10) & 0x1f;
+        const int m = bits & 0x3ff;
+        const double v = (e == 0 ? ldexp(m, -24) :
+                          e == 0x1f ? INFINITY : ldexp(m | 0x400, e - 25));
+        return (bits & 0x8000u) ? -v : v;
+    }
+#else
+    (void)float_keys;
+#endif
+    return k;
+}
+
+/* Return the L1 (`metric` == 1) or L2 distance between the pixels `a`
+   and `b` of `nchan` values */
+static inline double vector_distance(const double *a, const double *b, int nchan, int metric)
+{
+    double d = 0.0;
+    if (metric == 1) {
+        for (int c=0; c<nchan; c++) {
+            d += fabs(a[c] - b[c]);
+        }
+        return d;
+    } else {
+        for (int c=0; c<nchan; c++) {
+            const double diff = a[c] - b[c];
+            d += diff * diff;
+        }
+        return sqrt(d);
+    }
+}
+
+#endif
@@ -0,0 +1,170 @@
+/****************************************************************************
+ *
+ * workspace.c -- Temporary memory of the algorithms kept across calls
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/* posix_memalign() is not part of C99 */
+#if _XOPEN_SOURCE < 600
+#define _XOPEN_SOURCE 600
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+#include "common.h"
+#include "workspace.h"
+
+/* The allocations from the arenas are aligned to (and are a multiple
+   of) a cache line, so that the memory of different threads never
+   shares a line */
+#define ALIGN MEDIAN_FILTER_CACHE_LINE
+
+/* An allocation that did not fit in the arena; the memory follows the
+   header */
+typedef struct block {
+    struct block *next;
+} block_t;
+#define HEADER ((sizeof(block_t) + ALIGN - 1) / ALIGN * ALIGN)
+
+typedef struct {
+    char *base;
+    size_t size;        /* bytes of `base` */
+    size_t used;        /* bytes of `base` allocated since the last reset */
+    size_t requested;   /* bytes allocated since the last reset, also
+                           outside the arena */
+    block_t *overflow;  /* allocations that did not fit */
+    size_t noverflow;
+    char pad[ALIGN];    /* the arenas of two threads are in different lines */
+} arena_t;
+
+struct median_filter_workspace {
+    int nthreads;
+    arena_t *arena;
+};
+
+median_filter_workspace_t *workspace_create( int nthreads )
+{
+    assert(nthreads > 0);
+    median_filter_workspace_t *ws = (median_filter_workspace_t*)malloc(sizeof(*ws));
+    if (ws == NULL)
+        return NULL;
+    ws->nthreads = nthreads;
+    ws->arena = (arena_t*)calloc(nthreads, sizeof(arena_t));
+    if (ws->arena == NULL) {
+        free(ws);
+        return NULL;
+    }
+    return ws;
+}
+
+void workspace_reset( median_filter_workspace_t *ws )
+{
+    for (int t=0; t<ws->nthreads; t++) {
+        arena_t *a = &ws->arena[t];
+        while (a->overflow != NULL) {
+            block_t *b = a->overflow;
+            a->overflow = b->next;
+            free(b);
+        }
+        if (a->requested > a->size) {
+            void *base;
+            free(a->base);
+            a->base = NULL;
+            a->size = 0;
+            if (posix_memalign(&base, ALIGN, a->requested) == 0) {
+                a->base = (char*)base;
+                a->size = a->requested;
+            }
+        }
+        a->used = a->requested = 0;
+        a->noverflow = 0;
+    }
+}
+
+size_t workspace_bytes( const median_filter_workspace_t *ws )
+{
+    size_t bytes = 0;
+    for (int t=0; t<ws->nthreads; t++) {
+        bytes += ws->arena[t].size;
+    }
+    return bytes;
+}
+
+size_t workspace_overflows( const median_filter_workspace_t *ws )
+{
+    size_t n = 0;
+    for (int t=0; t<ws->nthreads; t++) {
+        n += ws->arena[t].noverflow;
+    }
+    return n;
+}
+
+void workspace_destroy( median_filter_workspace_t *ws )
+{
+    if (ws == NULL)
+        return;
+    workspace_reset(ws);
+    for (int t=0; t<ws->nthreads; t++) {
+        free(ws->arena[t].base);
+    }
+    free(ws->arena);
+    free(ws);
+}
+
+void *median_filter_alloc( const median_filter_opts_t *opts, size_t size )
+{
+    median_filter_workspace_t *ws = opts->workspace;
+    if (ws == NULL)
+        return malloc(size);
+    /* the arenas are not shared by nested teams */
+    const int t = omp_get_thread_num();
+    assert(t < ws->nthreads && omp_get_level() <= 1);
+    arena_t *a = &ws->arena[t];
+    size = (size + ALIGN - 1) / ALIGN * ALIGN;
+    a->requested += size;
+    if (a->used + size <= a->size) {
+        void *p = a->base + a->used;
+        a->used += size;
+        return p;
+    }
+    block_t *b = (block_t*)malloc(HEADER + size);
+    if (b == NULL)
+        return NULL;
+    b->next = a->overflow;
+    a->overflow = b;
+    a->noverflow++;
+    return (char*)b + HEADER;
+}
+
+void *median_filter_calloc( const median_filter_opts_t *opts, size_t n, size_t size )
+{
+    if (opts->workspace == NULL)
+        return calloc(n, size);
+    void *p = median_filter_alloc(opts, n * size);
+    if (p != NULL)
+        memset(p, 0, n * size);
+    return p;
+}
+
+void median_filter_free( const median_filter_opts_t *opts, void *p )
+{
+    /* the memory of the workspace is released by workspace_reset() */
+    if (opts->workspace == NULL)
+        free(p);
+}
@@ -0,0 +1,60 @@
+/****************************************************************************
+ *
+ * workspace.h -- Temporary memory of the algorithms kept across calls
+ *
+ * Copyright (C) 2025 Moreno Marzolla
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * The algorithms allocate their temporary memory (histograms, windows,
+ * line buffers, ...) with median_filter_alloc() and release it with
+ * median_filter_free() (see common.h). If `opts->workspace` is NULL,
+ * these are malloc() and free(). Otherwise, the memory is taken from
+ * the arena of the calling OpenMP thread in the workspace, with a
+ * pointer increment, and released all at once by workspace_reset().
+ *
+ * An allocation that does not fit in the arena is served by malloc(),
+ * and the arena is enlarged by the next workspace_reset(), so that it
+ * can hold all the allocations of a call. Once the algorithm has been
+ * called on an image of the same geometry and similar content, the
+ * following calls allocate nothing.
+ */
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <stddef.h>
+
+typedef struct median_filter_workspace median_filter_workspace_t;
+
+/* Create a workspace for teams of up to `nthreads` threads; return
+   NULL if there is not enough memory */
+median_filter_workspace_t *workspace_create( int nthreads );
+
+/* Release all the memory allocated from `ws`, and enlarge the arenas
+   that have been too small since the last reset */
+void workspace_reset( median_filter_workspace_t *ws );
+
+/* Return the size in bytes of the arenas of `ws` */
+size_t workspace_bytes( const median_filter_workspace_t *ws );
+
+/* Return the number of allocations that did not fit in the arenas of
+   `ws` since the last reset */
+size_t workspace_overflows( const median_filter_workspace_t *ws );
+
+void workspace_destroy( median_filter_workspace_t *ws );
+
+#endif